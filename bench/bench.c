@@ -0,0 +1,421 @@
+#include "valuescan.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#	include <x86intrin.h>
+#	define HAVE_RDTSC
+#endif
+
+#ifdef _MSC_VER
+#	define PRIuSZ "Iu"
+#else
+#	define PRIuSZ "zu"
+#endif
+
+#define PLANT_DISTANCE 4096
+
+enum bench_format {
+	FORMAT_TEXT,
+	FORMAT_JSON,
+	FORMAT_CSV,
+};
+
+enum haystack_kind {
+	HAYSTACK_RANDOM,
+	HAYSTACK_LOW_ENTROPY,
+	HAYSTACK_ZEROS,
+	HAYSTACK_NEAR_MATCH,
+};
+
+static const char *haystack_names[] = {
+	"random",
+	"lowentropy",
+	"zeros",
+	"nearmatch",
+};
+
+static const size_t needle_counts[] = { 1, 10, 1000, 100000 };
+
+struct bench_case {
+	const uint8_t *haystack;
+	size_t haystack_size;
+	const struct vs_needle *needles;
+	size_t needle_count;
+	const struct vs_trie *trie;
+	const struct vs_plan *plan;
+};
+
+struct bench_engine {
+	const char *name;
+	size_t max_needles; // skip needle sets where this engine would take ages
+	int (*run)(const struct bench_case *bench, size_t *matches);
+};
+
+// xorshift64*, deterministic so results are comparable between runs
+static uint64_t rng_state = UINT64_C(0x9E3779B97F4A7C15);
+
+static uint64_t rng_next(void) {
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+static int count_offset(void *ctx, const struct vs_needle *needle, size_t offset) {
+	(void)needle;
+	(void)offset;
+	++ *(size_t*)ctx;
+	return 0;
+}
+
+static int count_match(void *ctx, const struct vs_match *match) {
+	(void)match;
+	++ *(size_t*)ctx;
+	return 0;
+}
+
+static int run_search(const struct bench_case *bench, size_t *matches) {
+	return vs_search(bench->haystack, bench->haystack_size, bench->needles, bench->needle_count, matches, count_offset);
+}
+
+static int run_trie(const struct bench_case *bench, size_t *matches) {
+	return vs_trie_search(bench->trie, bench->haystack, bench->haystack_size, matches, count_offset);
+}
+
+static int run_plan(const struct bench_case *bench, size_t *matches) {
+	return vs_plan_search(bench->plan, bench->haystack, bench->haystack_size, matches, count_offset);
+}
+
+static int run_approx(const struct bench_case *bench, size_t *matches) {
+	return vs_search_approx(bench->haystack, bench->haystack_size, bench->needles, bench->needle_count, 1, matches, count_match);
+}
+
+static int run_bits(const struct bench_case *bench, size_t *matches) {
+	return vs_search_bits(bench->haystack, bench->haystack_size, bench->needles, bench->needle_count,
+	                      VS_MSB_FIRST | VS_LSB_FIRST, matches, count_match);
+}
+
+static const struct bench_engine engines[] = {
+	{ "search",    10,     run_search },
+	{ "trie",      100000, run_trie   },
+	{ "plan",      100000, run_plan   },
+	{ "approx-k1", 10,     run_approx },
+	{ "bits",      10,     run_bits   },
+};
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t cycles(void) {
+#ifdef HAVE_RDTSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// Needles of mixed widths (2, 4 and 8 bytes). For the low entropy haystack
+// they are drawn from the same small alphabet so that they actually occur.
+static struct vs_needle *make_needles(size_t count, enum haystack_kind kind, uint8_t *storage) {
+	static const size_t widths[] = { 4, 2, 8 };
+	struct vs_needle *needles = calloc(count, sizeof(struct vs_needle));
+	if (!needles) {
+		return NULL;
+	}
+
+	uint8_t *ptr = storage;
+	for (size_t i = 0; i < count; ++ i) {
+		const size_t size = widths[i % 3];
+		for (size_t j = 0; j < size; ++ j) {
+			ptr[j] = kind == HAYSTACK_LOW_ENTROPY ? "ACGT"[rng_next() % 4] : (uint8_t)rng_next();
+		}
+		needles[i].size = size;
+		needles[i].data = ptr;
+		ptr += size;
+	}
+
+	return needles;
+}
+
+static void fill_haystack(uint8_t *haystack, size_t size, enum haystack_kind kind,
+                          const struct vs_needle *needles, size_t needle_count) {
+	switch (kind) {
+		case HAYSTACK_RANDOM:
+			for (size_t i = 0; i < size; ++ i) {
+				haystack[i] = (uint8_t)rng_next();
+			}
+			break;
+
+		case HAYSTACK_LOW_ENTROPY:
+			for (size_t i = 0; i < size; ++ i) {
+				haystack[i] = "ACGT"[rng_next() % 4];
+			}
+			break;
+
+		case HAYSTACK_ZEROS:
+			memset(haystack, 0, size);
+			for (size_t i = 0; i < size / 64; ++ i) {
+				haystack[rng_next() % size] = (uint8_t)rng_next();
+			}
+			break;
+
+		case HAYSTACK_NEAR_MATCH:
+		{
+			// copies of the first needle with the last byte changed
+			const struct vs_needle *needle = needles;
+			for (size_t i = 0; i + needle->size <= size; i += needle->size) {
+				memcpy(haystack + i, needle->data, needle->size);
+				haystack[i + needle->size - 1] ^= 0x01;
+			}
+			return;
+		}
+	}
+
+	// plant real matches
+	for (size_t i = 0; i + PLANT_DISTANCE <= size; i += PLANT_DISTANCE) {
+		const struct vs_needle *needle = needles + rng_next() % needle_count;
+		memcpy(haystack + i, needle->data, needle->size);
+	}
+}
+
+static void print_result(enum bench_format format, const char *engine, const char *haystack, size_t needle_count,
+                         size_t haystack_size, double prepare, double seconds, uint64_t cycle_count, size_t matches) {
+	const double gbps = (double)haystack_size / seconds / 1e9;
+	const double matches_per_second = (double)matches / seconds;
+	const double cycles_per_byte = (double)cycle_count / (double)haystack_size;
+
+	switch (format) {
+		case FORMAT_JSON:
+			printf("{\"engine\":\"%s\",\"haystack\":\"%s\",\"needles\":%" PRIuSZ ",\"bytes\":%" PRIuSZ
+			       ",\"prepare_s\":%.6f,\"scan_s\":%.6f,\"gb_per_s\":%.4f,\"matches\":%" PRIuSZ
+			       ",\"matches_per_s\":%.1f,",
+			       engine, haystack, needle_count, haystack_size, prepare, seconds, gbps, matches, matches_per_second);
+			if (cycle_count) {
+				printf("\"cycles_per_byte\":%.3f}\n", cycles_per_byte);
+			}
+			else {
+				printf("\"cycles_per_byte\":null}\n");
+			}
+			break;
+
+		case FORMAT_CSV:
+			printf("%s,%s,%" PRIuSZ ",%" PRIuSZ ",%.6f,%.6f,%.4f,%" PRIuSZ ",%.1f,",
+			       engine, haystack, needle_count, haystack_size, prepare, seconds, gbps, matches, matches_per_second);
+			if (cycle_count) {
+				printf("%.3f\n", cycles_per_byte);
+			}
+			else {
+				printf("\n");
+			}
+			break;
+
+		case FORMAT_TEXT:
+			printf("%-10s %-10s %7" PRIuSZ " %9.4f %12" PRIuSZ " %14.1f ",
+			       engine, haystack, needle_count, gbps, matches, matches_per_second);
+			if (cycle_count) {
+				printf("%10.3f\n", cycles_per_byte);
+			}
+			else {
+				printf("%10s\n", "-");
+			}
+			break;
+	}
+	fflush(stdout);
+}
+
+static void usage(int argc, char *argv[]) {
+	const char *binary = argc > 0 ? argv[0] : "vsbench";
+	printf(
+		"Usage: %s [options]\n"
+		"\n"
+		"Benchmarks the search engines of valuescan on synthetic data.\n"
+		"\n"
+		"OPTIONS:\n"
+		"\t-h, --help               print this help message\n"
+		"\t-s, --size=MIB           haystack size in MiB (default: 16)\n"
+		"\t-r, --repeat=N           best of N runs per case (default: 3)\n"
+		"\t-f, --format=FORMAT      text, json (one object per line) or csv\n"
+		"\t-e, --engine=ENGINE      only run ENGINE (search, trie, plan,\n"
+		"\t                         approx-k1, bits)\n",
+		binary);
+}
+
+static const char *option_value(int argc, char *argv[], int *argind, const char *shortopt, const char *longopt) {
+	const char *arg = argv[*argind];
+	const size_t longlen = strlen(longopt);
+
+	if (strcmp(arg, shortopt) == 0 || strcmp(arg, longopt) == 0) {
+		if (++ *argind == argc) {
+			fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+			exit(1);
+		}
+		return argv[*argind];
+	}
+	else if (strncmp(arg, longopt, longlen) == 0 && arg[longlen] == '=') {
+		return arg + longlen + 1;
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	size_t haystack_size = 16 << 20;
+	unsigned long repeat = 3;
+	enum bench_format format = FORMAT_TEXT;
+	const char *only_engine = NULL;
+
+	for (int argind = 1; argind < argc; ++ argind) {
+		const char *value;
+		if (strcmp(argv[argind], "-h") == 0 || strcmp(argv[argind], "--help") == 0) {
+			usage(argc, argv);
+			return 0;
+		}
+		else if ((value = option_value(argc, argv, &argind, "-s", "--size"))) {
+			haystack_size = (size_t)strtoul(value, NULL, 10) << 20;
+		}
+		else if ((value = option_value(argc, argv, &argind, "-r", "--repeat"))) {
+			repeat = strtoul(value, NULL, 10);
+		}
+		else if ((value = option_value(argc, argv, &argind, "-f", "--format"))) {
+			if (strcasecmp(value, "json") == 0) {
+				format = FORMAT_JSON;
+			}
+			else if (strcasecmp(value, "csv") == 0) {
+				format = FORMAT_CSV;
+			}
+			else if (strcasecmp(value, "text") == 0) {
+				format = FORMAT_TEXT;
+			}
+			else {
+				fprintf(stderr, "*** error: unknown format %s\n", value);
+				return 1;
+			}
+		}
+		else if ((value = option_value(argc, argv, &argind, "-e", "--engine"))) {
+			only_engine = value;
+		}
+		else {
+			fprintf(stderr, "*** error: unknown option %s\n", argv[argind]);
+			return 1;
+		}
+	}
+
+	if (haystack_size == 0 || repeat == 0) {
+		fprintf(stderr, "*** error: size and repeat must not be 0\n");
+		return 1;
+	}
+
+	const size_t max_needles = needle_counts[sizeof(needle_counts) / sizeof(needle_counts[0]) - 1];
+	uint8_t *haystack = malloc(haystack_size);
+	uint8_t *storage  = malloc(max_needles * 8);
+	if (!haystack || !storage) {
+		perror("allocating benchmark data");
+		return 1;
+	}
+
+	if (format == FORMAT_CSV) {
+		printf("engine,haystack,needles,bytes,prepare_s,scan_s,gb_per_s,matches,matches_per_s,cycles_per_byte\n");
+	}
+	else if (format == FORMAT_TEXT) {
+		printf("%-10s %-10s %7s %9s %12s %14s %10s\n",
+		       "engine", "haystack", "needles", "GB/s", "matches", "matches/s", "cycles/B");
+	}
+
+	int status = 0;
+	for (size_t kind = 0; kind < sizeof(haystack_names) / sizeof(haystack_names[0]); ++ kind) {
+		for (size_t count_index = 0; count_index < sizeof(needle_counts) / sizeof(needle_counts[0]); ++ count_index) {
+			const size_t needle_count = needle_counts[count_index];
+			struct vs_needle *needles = make_needles(needle_count, (enum haystack_kind)kind, storage);
+			if (!needles) {
+				perror("allocating needles");
+				status = 1;
+				goto end;
+			}
+
+			fill_haystack(haystack, haystack_size, (enum haystack_kind)kind, needles, needle_count);
+
+			for (size_t engine_index = 0; engine_index < sizeof(engines) / sizeof(engines[0]); ++ engine_index) {
+				const struct bench_engine *engine = engines + engine_index;
+				if ((only_engine && strcmp(only_engine, engine->name) != 0) || needle_count > engine->max_needles) {
+					continue;
+				}
+
+				struct bench_case bench = {
+					.haystack      = haystack,
+					.haystack_size = haystack_size,
+					.needles       = needles,
+					.needle_count  = needle_count,
+					.trie          = NULL,
+					.plan          = NULL,
+				};
+
+				double prepare = now();
+				struct vs_trie *trie = NULL;
+				if (engine->run == run_trie) {
+					trie = vs_trie_create(needles, needle_count);
+					if (!trie) {
+						perror("compiling needles");
+						status = 1;
+						free(needles);
+						goto end;
+					}
+					bench.trie = trie;
+				}
+				struct vs_plan *plan = NULL;
+				if (engine->run == run_plan) {
+					plan = vs_plan_create(needles, needle_count, NULL, 0);
+					if (!plan) {
+						perror("planning search");
+						status = 1;
+						free(needles);
+						goto end;
+					}
+					bench.plan = plan;
+				}
+				prepare = now() - prepare;
+
+				double best_seconds = 0;
+				uint64_t best_cycles = 0;
+				size_t matches = 0;
+				for (unsigned long run = 0; run < repeat; ++ run) {
+					matches = 0;
+					const double start = now();
+					const uint64_t start_cycles = cycles();
+					if (engine->run(&bench, &matches) != 0) {
+						perror(engine->name);
+						status = 1;
+					}
+					const uint64_t cycle_count = cycles() - start_cycles;
+					const double seconds = now() - start;
+					if (run == 0 || seconds < best_seconds) {
+						best_seconds = seconds;
+						best_cycles  = cycle_count;
+					}
+				}
+
+				vs_trie_free(trie);
+				vs_plan_free(plan);
+				print_result(format, engine->name, haystack_names[kind], needle_count, haystack_size,
+				             prepare, best_seconds, best_cycles, matches);
+			}
+
+			free(needles);
+		}
+	}
+
+end:
+	free(storage);
+	free(haystack);
+
+	return status;
+}
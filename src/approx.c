@@ -0,0 +1,235 @@
+#include "valuescan.h"
+#include "hits.h"
+#include "counters.h"
+
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+
+#define VS_APPROX_CHUNK_SIZE (64 * 1024)
+#define VS_APPROX_WORD_BITS  64
+
+void *memmem(const void *l, size_t l_len, const void *s, size_t s_len);
+
+struct approx_needle {
+	uint64_t masks[256];
+};
+
+// Counts differing bytes 8 at a time. Stops early once limit is exceeded.
+static size_t count_mismatches(const uint8_t *lhs, const uint8_t *rhs, size_t size, size_t limit) {
+	size_t count = 0;
+	size_t index = 0;
+
+	for (; index + 8 <= size; index += 8) {
+		uint64_t x, y;
+		memcpy(&x, lhs + index, 8);
+		memcpy(&y, rhs + index, 8);
+		x ^= y;
+		// set the high bit of every non-zero byte
+		x |= (x & UINT64_C(0x7F7F7F7F7F7F7F7F)) + UINT64_C(0x7F7F7F7F7F7F7F7F);
+		count += (size_t)__builtin_popcountll(x & UINT64_C(0x8080808080808080));
+		if (count > limit) {
+			return count;
+		}
+	}
+
+	for (; index < size; ++ index) {
+		count += lhs[index] != rhs[index];
+	}
+
+	return count;
+}
+
+static void prepare_shift_or(struct approx_needle *prepared, const struct vs_needle *needle) {
+	for (size_t ch = 0; ch < 256; ++ ch) {
+		prepared->masks[ch] = ~(uint64_t)0;
+	}
+
+	for (size_t index = 0; index < needle->size; ++ index) {
+		prepared->masks[needle->data[index]] &= ~((uint64_t)1 << index);
+	}
+}
+
+// Shift-Or with one state word per allowed mismatch count: a zero bit i in
+// levels[j] means needle[0..i] matches the text ending at the current
+// position with at most j mismatches.
+static int search_shift_or(const uint8_t haystack[], size_t haystack_size, size_t start, size_t end,
+                           const struct vs_needle *needle, const struct approx_needle *prepared,
+                           uint64_t levels[], size_t level_count, struct vs_hits *hits) {
+	const size_t   size = needle->size;
+	const uint64_t hit  = (uint64_t)1 << (size - 1);
+	size_t text_end = end + size - 1;
+
+	if (text_end > haystack_size) {
+		text_end = haystack_size;
+	}
+
+	for (size_t level = 0; level < level_count; ++ level) {
+		levels[level] = ~(uint64_t)0;
+	}
+
+	for (size_t pos = start; pos < text_end; ++ pos) {
+		const uint64_t mask = prepared->masks[haystack[pos]];
+		uint64_t prev = levels[0];
+
+		levels[0] = (levels[0] << 1) | mask;
+		for (size_t level = 1; level < level_count; ++ level) {
+			const uint64_t old = levels[level];
+			levels[level] = ((old << 1) | mask) & (prev << 1);
+			prev = old;
+		}
+
+		if (!(levels[level_count - 1] & hit)) {
+			size_t mismatches = 0;
+			while (levels[mismatches] & hit) {
+				++ mismatches;
+			}
+			const struct vs_match match = {
+				.needle     = needle,
+				.offset     = pos + 1 - size,
+				.size       = size,
+				.mismatches = mismatches,
+			};
+			if (vs_hits_push(hits, &match) != 0) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+// Any match with at most k mismatches contains at least one of k+1 needle
+// pieces unchanged. Find those exactly and verify the whole needle around them.
+static int search_seeds(const uint8_t haystack[], size_t haystack_size, size_t start, size_t end,
+                        const struct vs_needle *needle, size_t max_mismatches, struct vs_hits *hits) {
+	const size_t size = needle->size;
+
+	if (max_mismatches >= size) {
+		// everything matches
+		for (size_t offset = start; offset < end && offset + size <= haystack_size; ++ offset) {
+			const struct vs_match match = {
+				.needle     = needle,
+				.offset     = offset,
+				.size       = size,
+				.mismatches = count_mismatches(needle->data, haystack + offset, size, size),
+			};
+			if (vs_hits_push(hits, &match) != 0) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	const size_t piece_count = max_mismatches + 1;
+	const size_t piece_size  = size / piece_count;
+
+	for (size_t piece = 0; piece < piece_count; ++ piece) {
+		const size_t piece_offset = piece * piece_size;
+		const size_t piece_len    = piece + 1 == piece_count ? size - piece_offset : piece_size;
+		const uint8_t *ptr = haystack + start + piece_offset;
+		const uint8_t *lim = haystack + end + piece_offset + piece_len - 1;
+
+		if (lim > haystack + haystack_size) {
+			lim = haystack + haystack_size;
+		}
+
+		while (ptr + piece_len <= lim) {
+			const uint8_t *found = memmem(ptr, (size_t)(lim - ptr), needle->data + piece_offset, piece_len);
+			if (!found) {
+				break;
+			}
+			ptr = found + 1;
+
+			const size_t offset = (size_t)(found - haystack) - piece_offset;
+			if (offset + size > haystack_size) {
+				break;
+			}
+
+			// an earlier piece that also matches exactly already produced this candidate
+			bool seen = false;
+			for (size_t other = 0; other < piece; ++ other) {
+				if (memcmp(needle->data + other * piece_size, haystack + offset + other * piece_size, piece_size) == 0) {
+					seen = true;
+					break;
+				}
+			}
+			if (seen) {
+				continue;
+			}
+
+			VS_COUNT_CANDIDATE();
+			const size_t mismatches = count_mismatches(needle->data, haystack + offset, size, max_mismatches);
+			if (mismatches <= max_mismatches) {
+				VS_COUNT_VERIFIED();
+				const struct vs_match match = {
+					.needle     = needle,
+					.offset     = offset,
+					.size       = size,
+					.mismatches = mismatches,
+				};
+				if (vs_hits_push(hits, &match) != 0) {
+					return -1;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+int vs_search_approx(const uint8_t haystack[], size_t haystack_size, const struct vs_needle needles[], size_t needle_count,
+                     size_t max_mismatches, void *ctx, vs_match_callback callback) {
+	struct approx_needle *prepared = calloc(needle_count ? needle_count : 1, sizeof(struct approx_needle));
+	uint64_t *levels = calloc(VS_APPROX_WORD_BITS + 1, sizeof(uint64_t));
+	struct vs_hits hits = { NULL, 0, 0 };
+	int status = 0;
+
+	if (!prepared || !levels) {
+		errno = ENOMEM;
+		status = -1;
+		goto end;
+	}
+
+	for (size_t index = 0; index < needle_count; ++ index) {
+		if (needles[index].size > 0 && needles[index].size <= VS_APPROX_WORD_BITS) {
+			prepare_shift_or(prepared + index, needles + index);
+		}
+	}
+
+	for (size_t start = 0; start < haystack_size; start += VS_APPROX_CHUNK_SIZE) {
+		const size_t end = haystack_size - start > VS_APPROX_CHUNK_SIZE ? start + VS_APPROX_CHUNK_SIZE : haystack_size;
+
+		for (size_t index = 0; index < needle_count; ++ index) {
+			const struct vs_needle *needle = needles + index;
+
+			if (needle->size == 0 || needle->size > haystack_size - start) {
+				continue;
+			}
+
+			if (needle->size <= VS_APPROX_WORD_BITS) {
+				const size_t level_count = (max_mismatches < needle->size ? max_mismatches : needle->size) + 1;
+				status = search_shift_or(haystack, haystack_size, start, end, needle, prepared + index, levels, level_count, &hits);
+			}
+			else {
+				status = search_seeds(haystack, haystack_size, start, end, needle, max_mismatches, &hits);
+			}
+
+			if (status != 0) {
+				goto end;
+			}
+		}
+
+		status = vs_hits_flush(&hits, ctx, callback);
+		if (status != 0) {
+			goto end;
+		}
+	}
+
+end:
+	vs_hits_destroy(&hits);
+	free(levels);
+	free(prepared);
+
+	return status;
+}
@@ -0,0 +1,454 @@
+#include "archive.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define TAR_BLOCK_SIZE 512
+
+#define ZIP_LOCAL_HEADER_SIZE    30
+#define ZIP_CENTRAL_HEADER_SIZE  46
+#define ZIP_END_SIZE             22
+#define ZIP64_END_LOCATOR_SIZE   20
+#define ZIP64_END_SIZE           56
+#define ZIP_MAX_COMMENT_SIZE     0xFFFF
+
+static inline uint16_t get_u16(const uint8_t *ptr) {
+	return (uint16_t)(ptr[0] | (ptr[1] << 8));
+}
+
+static inline uint32_t get_u32(const uint8_t *ptr) {
+	return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+static inline uint64_t get_u64(const uint8_t *ptr) {
+	return (uint64_t)get_u32(ptr) | ((uint64_t)get_u32(ptr + 4) << 32);
+}
+
+enum vs_archive_type vs_detect_archive(const uint8_t data[], size_t size) {
+	// "ustar\0" (POSIX) or "ustar " (GNU)
+	if (size >= TAR_BLOCK_SIZE && memcmp(data + 257, "ustar", 5) == 0) {
+		return VS_TAR;
+	}
+	if (size >= 4 && (memcmp(data, "PK\3\4", 4) == 0 || memcmp(data, "PK\5\6", 4) == 0)) {
+		return VS_ZIP;
+	}
+	return VS_NOT_ARCHIVE;
+}
+
+// ---- tar ----
+
+static int tar_number(const uint8_t *field, size_t size, uint64_t *valueptr) {
+	uint64_t value = 0;
+
+	if (field[0] & 0x80) {
+		// GNU base-256 for values that don't fit the octal field
+		value = field[0] & 0x7F;
+		for (size_t index = 1; index < size; ++ index) {
+			if (value > (UINT64_MAX >> 8)) {
+				return -1;
+			}
+			value = (value << 8) | field[index];
+		}
+		*valueptr = value;
+		return 0;
+	}
+
+	size_t index = 0;
+	while (index < size && field[index] == ' ') {
+		++ index;
+	}
+	for (; index < size && field[index] >= '0' && field[index] <= '7'; ++ index) {
+		if (value > (UINT64_MAX >> 3)) {
+			return -1;
+		}
+		value = (value << 3) | (uint64_t)(field[index] - '0');
+	}
+	if (index < size && field[index] != ' ' && field[index] != '\0') {
+		return -1;
+	}
+	*valueptr = value;
+	return 0;
+}
+
+static bool tar_checksum_ok(const uint8_t *header) {
+	uint64_t expected = 0;
+	if (tar_number(header + 148, 8, &expected) != 0) {
+		return false;
+	}
+
+	uint64_t sum = 0;
+	for (size_t index = 0; index < TAR_BLOCK_SIZE; ++ index) {
+		// the checksum field itself counts as spaces
+		sum += index >= 148 && index < 156 ? ' ' : header[index];
+	}
+	return sum == expected;
+}
+
+static char *copy_name(const uint8_t *name, size_t size) {
+	const uint8_t *end = memchr(name, '\0', size);
+	if (end) {
+		size = (size_t)(end - name);
+	}
+	char *copy = malloc(size + 1);
+	if (copy) {
+		memcpy(copy, name, size);
+		copy[size] = '\0';
+	}
+	return copy;
+}
+
+// Picks path= and size= out of pax extended header records ("LEN key=value\n").
+static int tar_pax(const uint8_t *data, size_t size, char **pathptr, uint64_t *sizeptr, bool *has_sizeptr) {
+	size_t pos = 0;
+	while (pos < size) {
+		size_t len = 0;
+		size_t index = pos;
+		while (index < size && data[index] >= '0' && data[index] <= '9') {
+			len = len * 10 + (size_t)(data[index] - '0');
+			++ index;
+		}
+		if (index >= size || data[index] != ' ' || len == 0 || len > size - pos || data[pos + len - 1] != '\n') {
+			return -1;
+		}
+		const uint8_t *key = data + index + 1;
+		const uint8_t *end = data + pos + len - 1;
+		const uint8_t *eq  = memchr(key, '=', (size_t)(end - key));
+		if (!eq) {
+			return -1;
+		}
+		const size_t key_size = (size_t)(eq - key);
+		const uint8_t *value = eq + 1;
+		const size_t value_size = (size_t)(end - value);
+
+		if (key_size == 4 && memcmp(key, "path", 4) == 0) {
+			char *path = malloc(value_size + 1);
+			if (!path) {
+				return -1;
+			}
+			memcpy(path, value, value_size);
+			path[value_size] = '\0';
+			free(*pathptr);
+			*pathptr = path;
+		}
+		else if (key_size == 4 && memcmp(key, "size", 4) == 0) {
+			uint64_t number = 0;
+			for (size_t digit = 0; digit < value_size; ++ digit) {
+				if (value[digit] < '0' || value[digit] > '9' || number > UINT64_MAX / 10) {
+					return -1;
+				}
+				number = number * 10 + (uint64_t)(value[digit] - '0');
+			}
+			*sizeptr = number;
+			*has_sizeptr = true;
+		}
+
+		pos += len;
+	}
+	return 0;
+}
+
+static int walk_tar(const uint8_t data[], size_t size, void *ctx, vs_member_callback callback) {
+	char    *long_name = NULL; // from a GNU 'L' or pax header, applies to the next member
+	uint64_t pax_size  = 0;
+	bool     has_pax_size = false;
+	int      status = 0;
+	size_t   pos = 0;
+
+	while (size - pos >= TAR_BLOCK_SIZE) {
+		const uint8_t *header = data + pos;
+
+		bool zero = true;
+		for (size_t index = 0; index < TAR_BLOCK_SIZE; ++ index) {
+			if (header[index]) {
+				zero = false;
+				break;
+			}
+		}
+		if (zero) {
+			// end of archive
+			break;
+		}
+
+		uint64_t member_size = 0;
+		if (!tar_checksum_ok(header) || tar_number(header + 124, 12, &member_size) != 0) {
+			errno = EINVAL;
+			status = -1;
+			break;
+		}
+		if (has_pax_size) {
+			member_size  = pax_size;
+			has_pax_size = false;
+		}
+
+		const size_t data_pos = pos + TAR_BLOCK_SIZE;
+		if (member_size > size - data_pos) {
+			// truncated
+			errno = EINVAL;
+			status = -1;
+			break;
+		}
+
+		const uint8_t *member = data + data_pos;
+		const char type = (char)header[156];
+
+		if (type == 'L') {
+			free(long_name);
+			long_name = copy_name(member, (size_t)member_size);
+			if (!long_name) {
+				status = -1;
+				break;
+			}
+		}
+		else if (type == 'x') {
+			if (tar_pax(member, (size_t)member_size, &long_name, &pax_size, &has_pax_size) != 0) {
+				if (errno != ENOMEM) {
+					errno = EINVAL;
+				}
+				status = -1;
+				break;
+			}
+		}
+		else {
+			if (type == '0' || type == '\0' || type == '7') {
+				char *name = long_name;
+				if (!name) {
+					char buf[155 + 1 + 100 + 1];
+					size_t len = 0;
+					if (memcmp(header + 257, "ustar\0", 6) == 0 && header[345]) {
+						const uint8_t *end = memchr(header + 345, '\0', 155);
+						len = end ? (size_t)(end - (header + 345)) : 155;
+						memcpy(buf, header + 345, len);
+						buf[len ++] = '/';
+					}
+					const uint8_t *end = memchr(header, '\0', 100);
+					const size_t name_len = end ? (size_t)(end - header) : 100;
+					memcpy(buf + len, header, name_len);
+					buf[len + name_len] = '\0';
+					name = copy_name((const uint8_t*)buf, len + name_len + 1);
+					if (!name) {
+						status = -1;
+						break;
+					}
+				}
+
+				const struct vs_archive_member info = {
+					.name        = name,
+					.data        = member,
+					.size        = (size_t)member_size,
+					.offset      = data_pos,
+					.compression = VS_UNCOMPRESSED,
+					.unsupported = NULL,
+				};
+				status = callback(ctx, &info);
+
+				if (name != long_name) {
+					free(name);
+				}
+				if (status != 0) {
+					break;
+				}
+			}
+			// 'g' (global pax) and everything that isn't a regular file is skipped
+			if (type != 'g') {
+				free(long_name);
+				long_name = NULL;
+			}
+		}
+
+		const uint64_t padded = (member_size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+		if (padded > size - data_pos) {
+			// last member without padding
+			break;
+		}
+		pos = data_pos + (size_t)padded;
+	}
+
+	free(long_name);
+	return status;
+}
+
+// ---- zip ----
+
+static int find_zip_directory(const uint8_t data[], size_t size, uint64_t *offsetptr, uint64_t *countptr, uint64_t *sizeptr) {
+	if (size < ZIP_END_SIZE) {
+		return -1;
+	}
+
+	// the end of central directory record is followed by a comment of up to 64K
+	const size_t lowest = size - ZIP_END_SIZE > ZIP_MAX_COMMENT_SIZE ? size - ZIP_END_SIZE - ZIP_MAX_COMMENT_SIZE : 0;
+	size_t pos = size - ZIP_END_SIZE;
+	for (;;) {
+		if (get_u32(data + pos) == 0x06054B50 && pos + ZIP_END_SIZE + get_u16(data + pos + 20) <= size) {
+			break;
+		}
+		if (pos == lowest) {
+			return -1;
+		}
+		-- pos;
+	}
+
+	const uint8_t *end = data + pos;
+	uint64_t count  = get_u16(end + 10);
+	uint64_t dir_size   = get_u32(end + 12);
+	uint64_t dir_offset = get_u32(end + 16);
+
+	if (pos >= ZIP64_END_LOCATOR_SIZE && get_u32(end - ZIP64_END_LOCATOR_SIZE) == 0x07064B50) {
+		// the zip64 end record has to end before the locator
+		const uint64_t end64_offset = get_u64(end - ZIP64_END_LOCATOR_SIZE + 8);
+		const size_t   locator_pos  = pos - ZIP64_END_LOCATOR_SIZE;
+		if (end64_offset > locator_pos || locator_pos - end64_offset < ZIP64_END_SIZE ||
+		    get_u32(data + end64_offset) != 0x06064B50) {
+			return -1;
+		}
+		const uint8_t *end64 = data + end64_offset;
+		count      = get_u64(end64 + 32);
+		dir_size   = get_u64(end64 + 40);
+		dir_offset = get_u64(end64 + 48);
+	}
+
+	if (dir_offset > size || dir_size > size - dir_offset) {
+		return -1;
+	}
+
+	*offsetptr = dir_offset;
+	*countptr  = count;
+	*sizeptr   = dir_size;
+	return 0;
+}
+
+static int walk_zip(const uint8_t data[], size_t size, void *ctx, vs_member_callback callback) {
+	uint64_t dir_offset = 0;
+	uint64_t count = 0;
+	uint64_t dir_size = 0;
+
+	if (find_zip_directory(data, size, &dir_offset, &count, &dir_size) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	const uint8_t *dir_end = data + dir_offset + dir_size;
+	const uint8_t *entry   = data + dir_offset;
+
+	for (uint64_t index = 0; index < count; ++ index) {
+		if ((size_t)(dir_end - entry) < ZIP_CENTRAL_HEADER_SIZE || get_u32(entry) != 0x02014B50) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		const uint16_t flags        = get_u16(entry + 8);
+		const uint16_t method       = get_u16(entry + 10);
+		uint64_t compressed_size    = get_u32(entry + 20);
+		uint64_t uncompressed_size  = get_u32(entry + 24);
+		const size_t name_size      = get_u16(entry + 28);
+		const size_t extra_size     = get_u16(entry + 30);
+		const size_t comment_size   = get_u16(entry + 32);
+		uint64_t local_offset       = get_u32(entry + 42);
+		const size_t entry_size     = ZIP_CENTRAL_HEADER_SIZE + name_size + extra_size + comment_size;
+
+		if ((size_t)(dir_end - entry) < entry_size) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		// zip64 extended information: only the fields that overflowed, in this order
+		const uint8_t *extra     = entry + ZIP_CENTRAL_HEADER_SIZE + name_size;
+		const uint8_t *extra_end = extra + extra_size;
+		while (extra_end - extra >= 4) {
+			const uint16_t id = get_u16(extra);
+			const size_t field_size = get_u16(extra + 2);
+			const uint8_t *field = extra + 4;
+			if ((size_t)(extra_end - field) < field_size) {
+				break;
+			}
+			if (id == 0x0001) {
+				const uint8_t *field_end = field + field_size;
+				if (uncompressed_size == 0xFFFFFFFF && field_end - field >= 8) {
+					uncompressed_size = get_u64(field);
+					field += 8;
+				}
+				if (compressed_size == 0xFFFFFFFF && field_end - field >= 8) {
+					compressed_size = get_u64(field);
+					field += 8;
+				}
+				if (local_offset == 0xFFFFFFFF && field_end - field >= 8) {
+					local_offset = get_u64(field);
+				}
+				break;
+			}
+			extra = field + field_size;
+		}
+
+		const uint8_t *name = entry + ZIP_CENTRAL_HEADER_SIZE;
+		entry += entry_size;
+
+		if (name_size > 0 && name[name_size - 1] == '/') {
+			// directory
+			continue;
+		}
+
+		if (size < ZIP_LOCAL_HEADER_SIZE || local_offset > size - ZIP_LOCAL_HEADER_SIZE ||
+		    get_u32(data + local_offset) != 0x04034B50) {
+			errno = EINVAL;
+			return -1;
+		}
+		const uint8_t *local = data + local_offset;
+		const uint64_t data_offset = local_offset + ZIP_LOCAL_HEADER_SIZE + get_u16(local + 26) + get_u16(local + 28);
+		if (data_offset > size || compressed_size > size - data_offset) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		char reason[64];
+		const char *unsupported = NULL;
+		enum vs_compression compression = VS_UNCOMPRESSED;
+		if (flags & 1) {
+			unsupported = "encrypted";
+		}
+		else if (method == 8) {
+			compression = VS_DEFLATE;
+		}
+		else if (method != 0) {
+			snprintf(reason, sizeof(reason), "compression method %u not supported", method);
+			unsupported = reason;
+		}
+		(void)uncompressed_size;
+
+		char *member_name = copy_name(name, name_size);
+		if (!member_name) {
+			return -1;
+		}
+
+		const struct vs_archive_member info = {
+			.name        = member_name,
+			.data        = data + data_offset,
+			.size        = (size_t)compressed_size,
+			.offset      = data_offset,
+			.compression = compression,
+			.unsupported = unsupported,
+		};
+		const int status = callback(ctx, &info);
+		free(member_name);
+
+		if (status != 0) {
+			return status;
+		}
+	}
+
+	return 0;
+}
+
+int vs_archive_walk(enum vs_archive_type type, const uint8_t data[], size_t size, void *ctx, vs_member_callback callback) {
+	switch (type) {
+	case VS_TAR:
+		return walk_tar(data, size, ctx, callback);
+
+	case VS_ZIP:
+		return walk_zip(data, size, ctx, callback);
+
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
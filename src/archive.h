@@ -0,0 +1,41 @@
+#ifndef VS_ARCHIVE_H
+#define VS_ARCHIVE_H
+#pragma once
+
+#include "decompress.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum vs_archive_type {
+	VS_NOT_ARCHIVE,
+	VS_TAR,
+	VS_ZIP,
+};
+
+// A regular file inside an archive. data points into the archive (as
+// stored, i.e. possibly compressed) and offset is its offset in the archive.
+// compression is VS_UNCOMPRESSED or VS_DEFLATE; members that can't be
+// scanned (encrypted, other zip methods) have unsupported set to the reason.
+struct vs_archive_member {
+	const char    *name;
+	const uint8_t *data;
+	size_t   size;
+	uint64_t offset;
+	enum vs_compression compression;
+	const char    *unsupported;
+};
+
+typedef int (*vs_member_callback)(void *ctx, const struct vs_archive_member *member);
+
+enum vs_archive_type vs_detect_archive(const uint8_t data[], size_t size);
+// Walks tar headers or the zip central directory and calls callback for
+// every regular file. Returns -1 with errno EINVAL for malformed archives.
+int vs_archive_walk(enum vs_archive_type type, const uint8_t data[], size_t size, void *ctx, vs_member_callback callback);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,158 @@
+#include "valuescan.h"
+#include "fields.h"
+
+#include <string.h>
+#include <errno.h>
+
+struct run {
+	size_t start;
+	size_t count;
+};
+
+struct arrays {
+	struct vs_array *arrays;
+	size_t count;
+	size_t capacity;
+};
+
+static int push_array(struct arrays *arrays, size_t offset, size_t count, size_t stride) {
+	if (arrays->count == arrays->capacity) {
+		const size_t capacity = arrays->capacity ? arrays->capacity * 2 : 64;
+		struct vs_array *buf = realloc(arrays->arrays, sizeof(struct vs_array) * capacity);
+		if (!buf) {
+			errno = ENOMEM;
+			return -1;
+		}
+		arrays->arrays   = buf;
+		arrays->capacity = capacity;
+	}
+	struct vs_array *array = arrays->arrays + arrays->count ++;
+	array->offset = offset;
+	array->count  = count;
+	array->stride = stride;
+	return 0;
+}
+
+static int array_cmp(const void *lhs, const void *rhs) {
+	const struct vs_array *larray = lhs;
+	const struct vs_array *rarray = rhs;
+	return larray->offset < rarray->offset ? -1 : larray->offset > rarray->offset ? 1 :
+	       larray->count  > rarray->count  ? -1 : larray->count  < rarray->count  ? 1 : 0;
+}
+
+int vs_search_arrays(const uint8_t haystack[], size_t haystack_size, const struct vs_array_schema *schema,
+                     void *ctx, vs_array_callback callback) {
+	const size_t stride = schema->stride;
+	const size_t min_count = schema->min_count > 0 ? schema->min_count : 1;
+
+	if (stride == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (haystack_size < stride) {
+		return 0;
+	}
+
+	struct run *runs = calloc(stride, sizeof(struct run));
+	if (!runs) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	// range checks first, they are cheaper and don't need the previous record
+	size_t range_count = 0;
+	struct vs_array_field *fields = malloc(sizeof(struct vs_array_field) * (schema->field_count ? schema->field_count : 1));
+	if (!fields) {
+		free(runs);
+		errno = ENOMEM;
+		return -1;
+	}
+	for (size_t index = 0; index < schema->field_count; ++ index) {
+		if (schema->fields[index].predicate == VS_ARRAY_RANGE) {
+			fields[range_count ++] = schema->fields[index];
+		}
+	}
+	size_t order_count = 0;
+	for (size_t index = 0; index < schema->field_count; ++ index) {
+		if (schema->fields[index].predicate != VS_ARRAY_RANGE) {
+			fields[range_count + order_count ++] = schema->fields[index];
+		}
+	}
+
+	struct arrays arrays = { NULL, 0, 0 };
+	int status = 0;
+	const size_t end = haystack_size - stride + 1;
+	size_t phase = 0;
+
+	for (size_t offset = 0; offset < end; ++ offset) {
+		const uint8_t *record = haystack + offset;
+		struct run *run = runs + phase;
+
+		bool matches = true;
+		for (size_t index = 0; index < range_count && matches; ++ index) {
+			matches = vs_field_in_range(fields + index, record);
+		}
+
+		bool extends = matches && run->count > 0;
+		for (size_t index = range_count; index < range_count + order_count && extends; ++ index) {
+			extends = vs_field_in_order(fields + index, record - stride, record);
+		}
+
+		if (extends) {
+			++ run->count;
+		}
+		else {
+			if (run->count >= min_count && push_array(&arrays, run->start, run->count, stride) != 0) {
+				status = -1;
+				goto end;
+			}
+			run->start = offset;
+			run->count = matches ? 1 : 0;
+		}
+
+		if (++ phase == stride) {
+			phase = 0;
+		}
+	}
+
+	for (size_t index = 0; index < stride; ++ index) {
+		if (runs[index].count >= min_count && push_array(&arrays, runs[index].start, runs[index].count, stride) != 0) {
+			status = -1;
+			goto end;
+		}
+	}
+
+	if (arrays.count > 1) {
+		qsort(arrays.arrays, arrays.count, sizeof(struct vs_array), array_cmp);
+	}
+
+	// of overlapping arrays (at different phases) only the longest is reported
+	for (size_t index = 0; index < arrays.count;) {
+		const struct vs_array *longest = arrays.arrays + index;
+		size_t cluster_end = longest->offset + longest->count * stride;
+
+		for (++ index; index < arrays.count && arrays.arrays[index].offset < cluster_end; ++ index) {
+			const struct vs_array *array = arrays.arrays + index;
+			const size_t array_end = array->offset + array->count * stride;
+			if (array->count > longest->count) {
+				longest = array;
+			}
+			if (array_end > cluster_end) {
+				cluster_end = array_end;
+			}
+		}
+
+		status = callback(ctx, longest);
+		if (status != 0) {
+			goto end;
+		}
+	}
+
+end:
+	free(arrays.arrays);
+	free(fields);
+	free(runs);
+
+	return status;
+}
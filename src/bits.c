@@ -0,0 +1,261 @@
+#include "valuescan.h"
+#include "hits.h"
+#include "counters.h"
+
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif
+
+#define VS_BITS_CHUNK_SIZE (64 * 1024)
+#define VS_BITS_MAX_PATTERNS 15
+
+// A needle shifted by bit bits in the given bit order. It spans size bytes
+// (one more than the needle unless bit is 0) and only the bits set in mask
+// are compared. data and mask are zero padded to a multiple of 8 bytes.
+struct bit_pattern {
+	unsigned int bit;
+	enum vs_bit_order bit_order;
+	size_t size;
+	size_t padded;
+	uint8_t *data;
+	uint8_t *mask;
+};
+
+struct bit_needle {
+	struct bit_pattern patterns[VS_BITS_MAX_PATTERNS];
+	size_t pattern_count;
+	uint8_t *buffer;
+};
+
+static int prepare_bit_needle(struct bit_needle *prepared, const struct vs_needle *needle, unsigned int bit_orders) {
+	const size_t size    = needle->size;
+	const size_t padded  = (size + 1 + 7) & ~(size_t)7;
+	const uint8_t *data  = needle->data;
+
+	prepared->buffer = calloc(VS_BITS_MAX_PATTERNS * 2, padded);
+	if (!prepared->buffer) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	uint8_t *buffer = prepared->buffer;
+	struct bit_pattern *pattern = prepared->patterns;
+
+	pattern->bit       = 0;
+	pattern->bit_order = VS_BYTE_ALIGNED;
+	pattern->size      = size;
+	pattern->padded    = padded;
+	pattern->data      = buffer;
+	pattern->mask      = buffer + padded;
+	memcpy(pattern->data, data, size);
+	memset(pattern->mask, 0xFF, size);
+	buffer += 2 * padded;
+	++ pattern;
+
+	for (unsigned int bit = 1; bit < 8; ++ bit) {
+		for (unsigned int bit_order = VS_MSB_FIRST; bit_order <= VS_LSB_FIRST; bit_order <<= 1) {
+			if (!(bit_orders & bit_order)) {
+				continue;
+			}
+
+			pattern->bit       = bit;
+			pattern->bit_order = (enum vs_bit_order)bit_order;
+			pattern->size      = size + 1;
+			pattern->padded    = padded;
+			pattern->data      = buffer;
+			pattern->mask      = buffer + padded;
+
+			if (bit_order == VS_MSB_FIRST) {
+				pattern->data[0] = data[0] >> bit;
+				pattern->mask[0] = 0xFF >> bit;
+				for (size_t index = 1; index < size; ++ index) {
+					pattern->data[index] = (uint8_t)((data[index - 1] << (8 - bit)) | (data[index] >> bit));
+					pattern->mask[index] = 0xFF;
+				}
+				pattern->data[size] = (uint8_t)(data[size - 1] << (8 - bit));
+				pattern->mask[size] = (uint8_t)(0xFF << (8 - bit));
+			}
+			else {
+				pattern->data[0] = (uint8_t)(data[0] << bit);
+				pattern->mask[0] = (uint8_t)(0xFF << bit);
+				for (size_t index = 1; index < size; ++ index) {
+					pattern->data[index] = (uint8_t)((data[index] << bit) | (data[index - 1] >> (8 - bit)));
+					pattern->mask[index] = 0xFF;
+				}
+				pattern->data[size] = data[size - 1] >> (8 - bit);
+				pattern->mask[size] = 0xFF >> (8 - bit);
+			}
+
+			buffer += 2 * padded;
+			++ pattern;
+		}
+	}
+
+	prepared->pattern_count = (size_t)(pattern - prepared->patterns);
+	return 0;
+}
+
+static bool match_pattern(const uint8_t *ptr, size_t avail, const struct bit_pattern *pattern) {
+	if (avail >= pattern->padded) {
+		for (size_t index = 0; index < pattern->padded; index += 8) {
+			uint64_t word, data, mask;
+			memcpy(&word, ptr + index, 8);
+			memcpy(&data, pattern->data + index, 8);
+			memcpy(&mask, pattern->mask + index, 8);
+			if ((word & mask) != data) {
+				return false;
+			}
+		}
+	}
+	else {
+		for (size_t index = 0; index < pattern->size; ++ index) {
+			if ((ptr[index] & pattern->mask[index]) != pattern->data[index]) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static int verify_at(const uint8_t haystack[], size_t haystack_size, size_t offset,
+                     const struct vs_needle *needle, const struct bit_needle *prepared, struct vs_hits *hits) {
+	const size_t avail = haystack_size - offset;
+
+	for (size_t index = 0; index < prepared->pattern_count; ++ index) {
+		const struct bit_pattern *pattern = prepared->patterns + index;
+		if (pattern->size <= avail && match_pattern(haystack + offset, avail, pattern)) {
+			VS_COUNT_VERIFIED();
+			const struct vs_match match = {
+				.needle     = needle,
+				.offset     = offset,
+				.size       = needle->size,
+				.bit        = pattern->bit,
+				.bit_order  = pattern->bit_order,
+			};
+			if (vs_hits_push(hits, &match) != 0) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+#ifdef __SSE2__
+// Funnel shift two overlapping loads so that lane i holds the bit stream byte
+// starting at bit `bit` of haystack byte i and compare all of them with the
+// first needle byte. Yields candidate offsets for all bit phases at once.
+static uint32_t find_candidates(const uint8_t *ptr, uint8_t first, unsigned int bit_orders) {
+	const __m128i lo   = _mm_loadu_si128((const __m128i*)ptr);
+	const __m128i hi   = _mm_loadu_si128((const __m128i*)(ptr + 1));
+	const __m128i want = _mm_set1_epi8((char)first);
+	__m128i found = _mm_cmpeq_epi8(lo, want);
+
+	for (int bit = 1; bit < 8; ++ bit) {
+		const __m128i left  = _mm_cvtsi32_si128(bit);
+		const __m128i right = _mm_cvtsi32_si128(8 - bit);
+
+		if (bit_orders & VS_MSB_FIRST) {
+			const __m128i shifted = _mm_or_si128(
+				_mm_and_si128(_mm_sll_epi16(lo, left),  _mm_set1_epi8((char)(0xFF << bit))),
+				_mm_and_si128(_mm_srl_epi16(hi, right), _mm_set1_epi8((char)(0xFF >> (8 - bit)))));
+			found = _mm_or_si128(found, _mm_cmpeq_epi8(shifted, want));
+		}
+
+		if (bit_orders & VS_LSB_FIRST) {
+			const __m128i shifted = _mm_or_si128(
+				_mm_and_si128(_mm_srl_epi16(lo, left),  _mm_set1_epi8((char)(0xFF >> bit))),
+				_mm_and_si128(_mm_sll_epi16(hi, right), _mm_set1_epi8((char)(0xFF << (8 - bit)))));
+			found = _mm_or_si128(found, _mm_cmpeq_epi8(shifted, want));
+		}
+	}
+
+	return (uint32_t)_mm_movemask_epi8(found);
+}
+#endif
+
+static int search_needle(const uint8_t haystack[], size_t haystack_size, size_t start, size_t end,
+                         const struct vs_needle *needle, const struct bit_needle *prepared,
+                         unsigned int bit_orders, struct vs_hits *hits) {
+	size_t offset = start;
+
+#ifdef __SSE2__
+	for (; offset + 16 <= end && offset + 17 <= haystack_size; offset += 16) {
+		uint32_t candidates = find_candidates(haystack + offset, needle->data[0], bit_orders);
+		while (candidates) {
+			const size_t index = (size_t)__builtin_ctz(candidates);
+			candidates &= candidates - 1;
+			VS_COUNT_CANDIDATE();
+			if (verify_at(haystack, haystack_size, offset + index, needle, prepared, hits) != 0) {
+				return -1;
+			}
+		}
+	}
+#else
+	(void)bit_orders;
+#endif
+
+	for (; offset < end; ++ offset) {
+		if (verify_at(haystack, haystack_size, offset, needle, prepared, hits) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int vs_search_bits(const uint8_t haystack[], size_t haystack_size, const struct vs_needle needles[], size_t needle_count,
+                   unsigned int bit_orders, void *ctx, vs_match_callback callback) {
+	struct bit_needle *prepared = calloc(needle_count ? needle_count : 1, sizeof(struct bit_needle));
+	struct vs_hits hits = { NULL, 0, 0 };
+	int status = 0;
+
+	if (!prepared) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	bit_orders &= VS_MSB_FIRST | VS_LSB_FIRST;
+
+	for (size_t index = 0; index < needle_count; ++ index) {
+		if (needles[index].size > 0 && prepare_bit_needle(prepared + index, needles + index, bit_orders) != 0) {
+			status = -1;
+			goto end;
+		}
+	}
+
+	for (size_t start = 0; start < haystack_size; start += VS_BITS_CHUNK_SIZE) {
+		const size_t end = haystack_size - start > VS_BITS_CHUNK_SIZE ? start + VS_BITS_CHUNK_SIZE : haystack_size;
+
+		for (size_t index = 0; index < needle_count; ++ index) {
+			const struct vs_needle *needle = needles + index;
+
+			if (needle->size == 0 || needle->size > haystack_size - start) {
+				continue;
+			}
+
+			status = search_needle(haystack, haystack_size, start, end, needle, prepared + index, bit_orders, &hits);
+			if (status != 0) {
+				goto end;
+			}
+		}
+
+		status = vs_hits_flush(&hits, ctx, callback);
+		if (status != 0) {
+			goto end;
+		}
+	}
+
+end:
+	for (size_t index = 0; index < needle_count; ++ index) {
+		free(prepared[index].buffer);
+	}
+	vs_hits_destroy(&hits);
+	free(prepared);
+
+	return status;
+}
@@ -0,0 +1,164 @@
+#include "valuescan.h"
+#include "hash.h"
+#include "counters.h"
+
+#include <string.h>
+#include <errno.h>
+
+#define VS_BLOCK_FILTER_BITS 16
+
+struct block_entry {
+	uint64_t hash;
+	const struct vs_needle *needle;
+	size_t needle_offset;
+};
+
+static int block_entry_cmp(const void *lhs, const void *rhs) {
+	const struct block_entry *e1 = lhs;
+	const struct block_entry *e2 = rhs;
+	if (e1->hash != e2->hash) {
+		return e1->hash < e2->hash ? -1 : 1;
+	}
+	if (e1->needle != e2->needle) {
+		return e1->needle < e2->needle ? -1 : 1;
+	}
+	if (e1->needle_offset != e2->needle_offset) {
+		return e1->needle_offset < e2->needle_offset ? -1 : 1;
+	}
+	return 0;
+}
+
+static const struct block_entry *find_block(const struct block_entry entries[], size_t entry_count, uint64_t hash) {
+	size_t lo = 0;
+	size_t hi = entry_count;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (entries[mid].hash < hash) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo < entry_count && entries[lo].hash == hash ? entries + lo : NULL;
+}
+
+int vs_search_blocks(const uint8_t haystack[], size_t haystack_size, const struct vs_needle needles[], size_t needle_count,
+                     size_t block_size, void *ctx, vs_match_callback callback) {
+	if (block_size == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (block_size > haystack_size) {
+		return 0;
+	}
+
+	size_t entry_count = 0;
+	for (size_t i = 0; i < needle_count; ++ i) {
+		entry_count += needles[i].size / block_size;
+	}
+
+	if (entry_count == 0) {
+		return 0;
+	}
+
+	struct block_entry *entries = calloc(entry_count, sizeof(struct block_entry));
+	uint8_t *filter = calloc((1 << VS_BLOCK_FILTER_BITS) / 8, 1);
+	int status = 0;
+
+	if (!entries || !filter) {
+		errno = ENOMEM;
+		status = -1;
+		goto end;
+	}
+
+	size_t entry_index = 0;
+	for (size_t i = 0; i < needle_count; ++ i) {
+		const struct vs_needle *needle = needles + i;
+		for (size_t offset = 0; offset + block_size <= needle->size; offset += block_size) {
+			struct block_entry *entry = entries + entry_index ++;
+			entry->hash          = vs_hash(needle->data + offset, block_size);
+			entry->needle        = needle;
+			entry->needle_offset = offset;
+
+			const size_t bit = entry->hash >> (64 - VS_BLOCK_FILTER_BITS);
+			filter[bit / 8] |= 1 << (bit % 8);
+		}
+	}
+
+	qsort(entries, entry_count, sizeof(struct block_entry), block_entry_cmp);
+
+	const uint64_t pow = vs_hash_pow(block_size - 1);
+	uint64_t hash = vs_hash(haystack, block_size);
+	size_t covered = 0;
+	size_t pos = 0;
+
+	while (pos + block_size <= haystack_size) {
+		const size_t bit = hash >> (64 - VS_BLOCK_FILTER_BITS);
+		const struct block_entry *entry = NULL;
+
+		if (filter[bit / 8] & (1 << (bit % 8))) {
+			entry = find_block(entries, entry_count, hash);
+			if (entry) {
+				VS_COUNT_CANDIDATE();
+			}
+			while (entry && entry < entries + entry_count && entry->hash == hash &&
+			       memcmp(entry->needle->data + entry->needle_offset, haystack + pos, block_size) != 0) {
+				++ entry;
+			}
+			if (entry == entries + entry_count || (entry && entry->hash != hash)) {
+				entry = NULL;
+			}
+		}
+
+		if (entry) {
+			VS_COUNT_VERIFIED();
+			const uint8_t *data = entry->needle->data;
+			size_t start = pos;
+			size_t needle_start = entry->needle_offset;
+			size_t end = pos + block_size;
+			size_t needle_end = entry->needle_offset + block_size;
+
+			while (start > covered && needle_start > 0 && haystack[start - 1] == data[needle_start - 1]) {
+				-- start;
+				-- needle_start;
+			}
+
+			while (end < haystack_size && needle_end < entry->needle->size && haystack[end] == data[needle_end]) {
+				++ end;
+				++ needle_end;
+			}
+
+			const struct vs_match match = {
+				.needle        = entry->needle,
+				.offset        = start,
+				.size          = end - start,
+				.needle_offset = needle_start,
+				.mismatches    = 0,
+			};
+
+			status = callback(ctx, &match);
+			if (status != 0) {
+				goto end;
+			}
+
+			covered = pos = end;
+			if (pos + block_size <= haystack_size) {
+				hash = vs_hash(haystack + pos, block_size);
+			}
+		}
+		else {
+			if (pos + block_size < haystack_size) {
+				hash = vs_hash_roll(hash, pow, haystack[pos], haystack[pos + block_size]);
+			}
+			++ pos;
+		}
+	}
+
+end:
+	free(filter);
+	free(entries);
+
+	return status;
+}
@@ -0,0 +1,415 @@
+#include "cache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define CACHE_KEY_SIZE 68
+
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME  0x100000001B3ULL
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+	const uint8_t *bytes = data;
+	for (size_t index = 0; index < size; ++ index) {
+		hash = (hash ^ bytes[index]) * FNV_PRIME;
+	}
+	return hash;
+}
+
+static uint64_t fnv1a_u64(uint64_t hash, uint64_t value) {
+	uint8_t bytes[8];
+	for (size_t index = 0; index < 8; ++ index) {
+		bytes[index] = (uint8_t)(value >> (index * 8));
+	}
+	return fnv1a(hash, bytes, sizeof(bytes));
+}
+
+struct ranked_needle {
+	const struct vs_needle *needle;
+	uint32_t index;
+};
+
+static int canonical_cmp(const void *lhs, const void *rhs) {
+	const struct vs_needle *left  = ((const struct ranked_needle*)lhs)->needle;
+	const struct vs_needle *right = ((const struct ranked_needle*)rhs)->needle;
+
+	if (left->size != right->size) {
+		return left->size > right->size ? -1 : 1;
+	}
+	const unsigned int left_flags  = left->flags  & ~VS_NEEDLE_MAPPED;
+	const unsigned int right_flags = right->flags & ~VS_NEEDLE_MAPPED;
+	if (left_flags != right_flags) {
+		return left_flags < right_flags ? -1 : 1;
+	}
+	if (left->unit_size != right->unit_size) {
+		return left->unit_size < right->unit_size ? -1 : 1;
+	}
+	int cmp = memcmp(left->data, right->data, left->size);
+	if (cmp != 0) {
+		return cmp;
+	}
+	if (!left->fold || !right->fold) {
+		return (left->fold != NULL) - (right->fold != NULL);
+	}
+	return memcmp(left->fold, right->fold, left->size);
+}
+
+int vs_cache_hash_needles(const struct vs_needle needles[], size_t needle_count,
+                          const uint64_t params[], size_t param_count, uint64_t *hashptr, uint32_t ranks[]) {
+	struct ranked_needle *sorted = malloc(sizeof(struct ranked_needle) * (needle_count ? needle_count : 1));
+	if (!sorted) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (size_t index = 0; index < needle_count; ++ index) {
+		sorted[index].needle = needles + index;
+		sorted[index].index  = (uint32_t)index;
+	}
+	qsort(sorted, needle_count, sizeof(struct ranked_needle), canonical_cmp);
+
+	uint64_t hash = fnv1a_u64(FNV_OFFSET, needle_count);
+	for (size_t index = 0; index < param_count; ++ index) {
+		hash = fnv1a_u64(hash, params[index]);
+	}
+	for (size_t rank = 0; rank < needle_count; ++ rank) {
+		const struct vs_needle *needle = sorted[rank].needle;
+		hash = fnv1a_u64(hash, needle->size);
+		hash = fnv1a(hash, needle->data, needle->size);
+		hash = fnv1a_u64(hash, needle->fold != NULL);
+		hash = fnv1a_u64(hash, (needle->flags & ~VS_NEEDLE_MAPPED) | needle->unit_size << 8);
+		if (needle->fold) {
+			hash = fnv1a(hash, needle->fold, needle->size);
+		}
+		ranks[sorted[rank].index] = (uint32_t)rank;
+	}
+
+	free(sorted);
+	*hashptr = hash;
+	return 0;
+}
+
+static void put_u32(uint8_t *ptr, uint32_t value) {
+	for (size_t index = 0; index < 4; ++ index) {
+		ptr[index] = (uint8_t)(value >> (index * 8));
+	}
+}
+
+static void put_u64(uint8_t *ptr, uint64_t value) {
+	for (size_t index = 0; index < 8; ++ index) {
+		ptr[index] = (uint8_t)(value >> (index * 8));
+	}
+}
+
+static uint32_t get_u32(const uint8_t *ptr) {
+	return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+static uint64_t get_u64(const uint8_t *ptr) {
+	return (uint64_t)get_u32(ptr) | ((uint64_t)get_u32(ptr + 4) << 32);
+}
+
+static void encode_key(const struct vs_cache_key *key, uint8_t buf[CACHE_KEY_SIZE]) {
+	put_u64(buf,      key->dev);
+	put_u64(buf +  8, key->ino);
+	put_u64(buf + 16, key->size);
+	put_u64(buf + 24, (uint64_t)key->mtime_sec);
+	put_u64(buf + 32, (uint64_t)key->mtime_nsec);
+	put_u32(buf + 40, key->range_flags);
+	put_u64(buf + 44, (uint64_t)key->range_start);
+	put_u64(buf + 52, (uint64_t)key->range_end);
+	put_u64(buf + 60, key->needles_hash);
+}
+
+// Everything but size and mtime, so a changed file maps to the same entry.
+static int entry_path(const char *dir, const struct vs_cache_key *key, char path[], size_t path_size) {
+	uint64_t hash = FNV_OFFSET;
+	hash = fnv1a_u64(hash, key->dev);
+	hash = fnv1a_u64(hash, key->ino);
+	hash = fnv1a_u64(hash, key->range_flags);
+	hash = fnv1a_u64(hash, (uint64_t)key->range_start);
+	hash = fnv1a_u64(hash, (uint64_t)key->range_end);
+	hash = fnv1a_u64(hash, key->needles_hash);
+
+	const int len = snprintf(path, path_size, "%s/%016" PRIx64 ".vsc", dir, hash);
+	if (len < 0 || (size_t)len >= path_size) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return 0;
+}
+
+static size_t put_varint(uint8_t *ptr, uint64_t value) {
+	size_t size = 0;
+	while (value >= 0x80) {
+		ptr[size ++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	ptr[size ++] = (uint8_t)value;
+	return size;
+}
+
+static int get_varint(const uint8_t **ptrptr, const uint8_t *end, uint64_t *valueptr) {
+	const uint8_t *ptr = *ptrptr;
+	uint64_t value = 0;
+	for (unsigned int shift = 0; shift < 64; shift += 7) {
+		if (ptr == end) {
+			return -1;
+		}
+		const uint8_t byte = *ptr ++;
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			*ptrptr   = ptr;
+			*valueptr = value;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int vs_cache_load(const char *dir, const struct vs_cache_key *key, struct vs_cache_entry *entry) {
+	char path[PATH_MAX];
+	if (entry_path(dir, key, path, sizeof(path)) != 0) {
+		return -1;
+	}
+
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return errno == ENOENT ? 0 : -1;
+	}
+
+	struct stat st;
+	uint8_t *data = NULL;
+	int status = -1;
+
+	if (fstat(fd, &st) != 0) {
+		goto end;
+	}
+
+	const size_t header_size = VS_CACHE_MAGIC_SIZE + 4 + CACHE_KEY_SIZE + 1 + 8;
+	if ((uint64_t)st.st_size < header_size || (uint64_t)st.st_size > SIZE_MAX) {
+		// not an entry, treat as a miss
+		status = 0;
+		goto end;
+	}
+
+	const size_t size = (size_t)st.st_size;
+	data = malloc(size);
+	if (!data) {
+		errno = ENOMEM;
+		goto end;
+	}
+
+	size_t got = 0;
+	while (got < size) {
+		const ssize_t count = read(fd, data + got, size - got);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			goto end;
+		}
+		if (count == 0) {
+			break;
+		}
+		got += (size_t)count;
+	}
+
+	uint8_t encoded_key[CACHE_KEY_SIZE];
+	encode_key(key, encoded_key);
+
+	status = 0;
+	if (got != size ||
+	    memcmp(data, VS_CACHE_MAGIC, VS_CACHE_MAGIC_SIZE) != 0 ||
+	    get_u32(data + VS_CACHE_MAGIC_SIZE) != CACHE_KEY_SIZE ||
+	    memcmp(data + VS_CACHE_MAGIC_SIZE + 4, encoded_key, CACHE_KEY_SIZE) != 0) {
+		// stale entry (file changed) or something else
+		goto end;
+	}
+
+	const uint8_t *ptr = data + VS_CACHE_MAGIC_SIZE + 4 + CACHE_KEY_SIZE;
+	const uint8_t *end = data + size;
+	const bool extended = *ptr ++ != 0;
+	const uint64_t count = get_u64(ptr);
+	ptr += 8;
+
+	vs_cache_clear(entry);
+	entry->extended = extended;
+
+	uint64_t offset = 0;
+	for (uint64_t index = 0; index < count; ++ index) {
+		struct vs_cache_match match = { 0, 0, 0, 0, 0, 0, 0 };
+		uint64_t delta = 0;
+		uint64_t needle = 0;
+		if (get_varint(&ptr, end, &delta) != 0 || get_varint(&ptr, end, &needle) != 0 || needle > UINT32_MAX) {
+			goto corrupt;
+		}
+		// zigzag: offsets of some engines aren't strictly ascending
+		offset += (delta >> 1) ^ (uint64_t)-(int64_t)(delta & 1);
+		match.offset = offset;
+		match.needle = (uint32_t)needle;
+
+		if (extended) {
+			uint64_t match_size = 0, needle_offset = 0, mismatches = 0, bit = 0;
+			if (get_varint(&ptr, end, &match_size)    != 0 ||
+			    get_varint(&ptr, end, &needle_offset) != 0 ||
+			    get_varint(&ptr, end, &mismatches)    != 0 ||
+			    get_varint(&ptr, end, &bit)           != 0) {
+				goto corrupt;
+			}
+			match.size          = (size_t)match_size;
+			match.needle_offset = (size_t)needle_offset;
+			match.mismatches    = (size_t)mismatches;
+			match.bit           = (uint32_t)(bit & 7);
+			match.bit_order     = (uint32_t)(bit >> 3);
+		}
+
+		if (vs_cache_push(entry, &match) != 0) {
+			status = -1;
+			goto end;
+		}
+	}
+
+	status = ptr == end ? 1 : 0;
+	if (status == 0) {
+		vs_cache_clear(entry);
+	}
+	goto end;
+
+corrupt:
+	vs_cache_clear(entry);
+	status = 0;
+
+end:
+	{
+		const int errnum = errno;
+		free(data);
+		close(fd);
+		errno = errnum;
+	}
+	return status;
+}
+
+int vs_cache_push(struct vs_cache_entry *entry, const struct vs_cache_match *match) {
+	if (entry->count == entry->capacity) {
+		const size_t capacity = entry->capacity ? entry->capacity * 2 : 256;
+		struct vs_cache_match *matches = realloc(entry->matches, sizeof(struct vs_cache_match) * capacity);
+		if (!matches) {
+			errno = ENOMEM;
+			return -1;
+		}
+		entry->matches  = matches;
+		entry->capacity = capacity;
+	}
+	entry->matches[entry->count ++] = *match;
+	return 0;
+}
+
+int vs_cache_store(const char *dir, const struct vs_cache_key *key, const struct vs_cache_entry *entry) {
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX];
+	if (entry_path(dir, key, path, sizeof(path)) != 0) {
+		return -1;
+	}
+	const int len = snprintf(tmp_path, sizeof(tmp_path), "%s/.tmp-XXXXXX", dir);
+	if (len < 0 || (size_t)len >= sizeof(tmp_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	// 10 bytes per varint at most
+	const size_t max_match_size = entry->extended ? 6 * 10 : 2 * 10;
+	const size_t header_size = VS_CACHE_MAGIC_SIZE + 4 + CACHE_KEY_SIZE + 1 + 8;
+	if (entry->count > (SIZE_MAX - header_size) / max_match_size) {
+		errno = ENOMEM;
+		return -1;
+	}
+	uint8_t *buf = malloc(header_size + entry->count * max_match_size);
+	if (!buf) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	memcpy(buf, VS_CACHE_MAGIC, VS_CACHE_MAGIC_SIZE);
+	put_u32(buf + VS_CACHE_MAGIC_SIZE, CACHE_KEY_SIZE);
+	encode_key(key, buf + VS_CACHE_MAGIC_SIZE + 4);
+	buf[VS_CACHE_MAGIC_SIZE + 4 + CACHE_KEY_SIZE] = entry->extended;
+	put_u64(buf + VS_CACHE_MAGIC_SIZE + 4 + CACHE_KEY_SIZE + 1, entry->count);
+
+	size_t size = header_size;
+	uint64_t offset = 0;
+	for (size_t index = 0; index < entry->count; ++ index) {
+		const struct vs_cache_match *match = entry->matches + index;
+		const int64_t delta = (int64_t)(match->offset - offset);
+		size += put_varint(buf + size, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+		size += put_varint(buf + size, match->needle);
+		if (entry->extended) {
+			size += put_varint(buf + size, match->size);
+			size += put_varint(buf + size, match->needle_offset);
+			size += put_varint(buf + size, match->mismatches);
+			size += put_varint(buf + size, match->bit | (match->bit_order << 3));
+		}
+		offset = match->offset;
+	}
+
+	const int fd = mkstemp(tmp_path);
+	if (fd == -1) {
+		const int errnum = errno;
+		free(buf);
+		errno = errnum;
+		return -1;
+	}
+
+	size_t written = 0;
+	while (written < size) {
+		const ssize_t count = write(fd, buf + written, size - written);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			goto error;
+		}
+		written += (size_t)count;
+	}
+
+	if (close(fd) != 0) {
+		const int errnum = errno;
+		unlink(tmp_path);
+		free(buf);
+		errno = errnum;
+		return -1;
+	}
+
+	free(buf);
+
+	if (rename(tmp_path, path) != 0) {
+		const int errnum = errno;
+		unlink(tmp_path);
+		errno = errnum;
+		return -1;
+	}
+	return 0;
+
+error:
+	{
+		const int errnum = errno;
+		close(fd);
+		unlink(tmp_path);
+		free(buf);
+		errno = errnum;
+	}
+	return -1;
+}
+
+void vs_cache_clear(struct vs_cache_entry *entry) {
+	free(entry->matches);
+	entry->matches  = NULL;
+	entry->count    = 0;
+	entry->capacity = 0;
+}
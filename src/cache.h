@@ -0,0 +1,71 @@
+#ifndef VS_CACHE_H
+#define VS_CACHE_H
+#pragma once
+
+#include "valuescan.h"
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Result cache entry (all integers little endian):
+//
+//   header:  "VSCACHE\1", u32 key size, key, u8 extended, u64 match count
+//   matches: varints: zigzag offset delta, canonical needle index and, if
+//            extended, size, needle offset, mismatches, bit | bit order << 3
+//
+// An entry's file name is derived from the file's device and inode, the
+// scanned range and the needle hash, so when the file's size or mtime
+// changes the next run misses and replaces the entry.
+#define VS_CACHE_MAGIC      "VSCACHE\1"
+#define VS_CACHE_MAGIC_SIZE 8
+
+struct vs_cache_key {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t  mtime_sec;
+	int64_t  mtime_nsec;
+	uint32_t range_flags;
+	int64_t  range_start;
+	int64_t  range_end;
+	uint64_t needles_hash;
+};
+
+struct vs_cache_match {
+	uint64_t offset;
+	uint32_t needle; // canonical needle index
+	uint32_t bit;
+	uint32_t bit_order;
+	size_t   size;
+	size_t   needle_offset;
+	size_t   mismatches;
+};
+
+struct vs_cache_entry {
+	struct vs_cache_match *matches;
+	size_t count;
+	size_t capacity;
+	bool   extended; // the search reports more than needle and offset
+};
+
+// Hashes the needles independently of their order together with params
+// (search options that change the result). ranks[i] is set to the canonical
+// index of needles[i]. Returns -1 if out of memory.
+int  vs_cache_hash_needles(const struct vs_needle needles[], size_t needle_count,
+                           const uint64_t params[], size_t param_count, uint64_t *hashptr, uint32_t ranks[]);
+
+// Returns 1 on a hit (entry filled), 0 on a miss and -1 on error.
+int  vs_cache_load(const char *dir, const struct vs_cache_key *key, struct vs_cache_entry *entry);
+int  vs_cache_push(struct vs_cache_entry *entry, const struct vs_cache_match *match);
+// Written to a temporary file and renamed into place.
+int  vs_cache_store(const char *dir, const struct vs_cache_key *key, const struct vs_cache_entry *entry);
+void vs_cache_clear(struct vs_cache_entry *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,329 @@
+#include "carve.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#	include <sys/syscall.h>
+#	include <sys/sendfile.h>
+#endif
+
+#define VS_CARVE_MAX_THREADS 8
+
+// tries FILE-OFFSET.bin, FILE-OFFSET.1.bin, ... before giving up
+#define VS_CARVE_MAX_SUFFIX 10000
+
+int vs_parse_carve_field(const char *str, struct vs_carve_options *options) {
+	static const struct {
+		const char *name;
+		size_t size;
+		bool big_endian;
+	} formats[] = {
+		{ "u8",    1, false },
+		{ "u16le", 2, false },
+		{ "u16be", 2, true  },
+		{ "u32le", 4, false },
+		{ "u32be", 4, true  },
+		{ "u64le", 8, false },
+		{ "u64be", 8, true  },
+	};
+
+	const char *at = strchr(str, '@');
+	if (!at) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	size_t index = 0;
+	const size_t name_len = (size_t)(at - str);
+	for (; index < sizeof(formats) / sizeof(formats[0]); ++ index) {
+		if (strlen(formats[index].name) == name_len && strncasecmp(formats[index].name, str, name_len) == 0) {
+			break;
+		}
+	}
+	if (index == sizeof(formats) / sizeof(formats[0])) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	char *endptr = NULL;
+	errno = 0;
+	long long offset = strtoll(at + 1, &endptr, 10);
+	if (!at[1] || *endptr) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (errno != 0) {
+		return -1;
+	}
+
+	options->has_field        = true;
+	options->field_size       = formats[index].size;
+	options->field_big_endian = formats[index].big_endian;
+	options->field_offset     = offset;
+
+	return 0;
+}
+
+int vs_carve_prepare_dir(const char *dir) {
+	struct stat st;
+	if (mkdir(dir, 0755) == 0) {
+		return 0;
+	}
+	if (errno != EEXIST) {
+		return -1;
+	}
+	if (stat(dir, &st) != 0) {
+		return -1;
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		errno = ENOTDIR;
+		return -1;
+	}
+	return 0;
+}
+
+int vs_carve_push(struct vs_carver *carver, const uint8_t haystack[], size_t haystack_size,
+                  uint64_t haystack_offset, const struct vs_match *match) {
+	const struct vs_carve_options *options = carver->options;
+	uint64_t length = options->length;
+
+	if (options->has_field) {
+		const long long field_pos = (long long)match->offset + options->field_offset;
+		if (field_pos < 0 || (unsigned long long)field_pos + options->field_size > haystack_size) {
+			// length field is outside of the scanned range
+			return 0;
+		}
+
+		const uint8_t *field = haystack + field_pos;
+		uint64_t value = 0;
+		for (size_t index = 0; index < options->field_size; ++ index) {
+			const size_t shift = options->field_big_endian ? options->field_size - 1 - index : index;
+			value |= (uint64_t)field[index] << (shift * 8);
+		}
+
+		const uint64_t field_end = (uint64_t)field_pos + options->field_size;
+		if (value > UINT64_MAX - field_end || field_end + value <= match->offset) {
+			return 0;
+		}
+		length = field_end + value - match->offset;
+	}
+
+	if (length == 0) {
+		return 0;
+	}
+
+	if (carver->count == carver->capacity) {
+		size_t capacity = carver->capacity ? carver->capacity * 2 : 256;
+		struct vs_carve_job *jobs = realloc(carver->jobs, sizeof(struct vs_carve_job) * capacity);
+		if (!jobs) {
+			errno = ENOMEM;
+			return -1;
+		}
+		carver->jobs     = jobs;
+		carver->capacity = capacity;
+	}
+
+	carver->jobs[carver->count ++] = (struct vs_carve_job){
+		.offset = haystack_offset + match->offset,
+		.length = length,
+		.bit    = match->bit,
+	};
+
+	return 0;
+}
+
+// Copies in the kernel where possible: copy_file_range(), then sendfile(),
+// then plain pread()/write() for file systems that support neither.
+static int copy_range(int in_fd, int out_fd, uint64_t offset, uint64_t length) {
+	off_t in_offset = (off_t)offset;
+
+#ifdef __linux__
+	bool kernel_copy = true;
+	while (length > 0 && kernel_copy) {
+		const size_t chunk = length > (1 << 30) ? (1 << 30) : (size_t)length;
+		loff_t off = in_offset;
+		ssize_t count = syscall(SYS_copy_file_range, in_fd, &off, out_fd, NULL, chunk, 0);
+		if (count < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+			count = sendfile(out_fd, in_fd, &off, chunk);
+			if (count < 0 && (errno == ENOSYS || errno == EINVAL)) {
+				kernel_copy = false;
+				break;
+			}
+		}
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (count == 0) {
+			return 0; // end of file
+		}
+		in_offset += count;
+		length    -= (uint64_t)count;
+	}
+#endif
+
+	uint8_t buffer[64 * 1024];
+	while (length > 0) {
+		const size_t chunk = length > sizeof(buffer) ? sizeof(buffer) : (size_t)length;
+		ssize_t count = pread(in_fd, buffer, chunk, in_offset);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (count == 0) {
+			break;
+		}
+		for (ssize_t written = 0; written < count;) {
+			ssize_t wcount = write(out_fd, buffer + written, (size_t)(count - written));
+			if (wcount < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return -1;
+			}
+			written += wcount;
+		}
+		in_offset += count;
+		length    -= (uint64_t)count;
+	}
+
+	return 0;
+}
+
+// Creates a file for the job that doesn't exist yet. Files with the same name
+// and offset (e.g. under -r or from an earlier run) and matches at several bit
+// offsets of one byte would otherwise overwrite each other.
+static int open_carve_file(const char *dir, const char *basename, const struct vs_carve_job *job,
+                           char path[PATH_MAX]) {
+	char bit[16] = "";
+	if (job->bit != 0) {
+		snprintf(bit, sizeof(bit), "-bit%u", job->bit);
+	}
+
+	for (unsigned int suffix = 0; suffix < VS_CARVE_MAX_SUFFIX; ++ suffix) {
+		char counter[16] = "";
+		if (suffix != 0) {
+			snprintf(counter, sizeof(counter), ".%u", suffix);
+		}
+
+		const int len = snprintf(path, PATH_MAX, "%s/%s-%" PRIu64 "%s%s.bin", dir, basename, job->offset, bit, counter);
+		if (len < 0 || len >= PATH_MAX) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+
+		const int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (fd != -1 || errno != EEXIST) {
+			return fd;
+		}
+	}
+
+	errno = EEXIST;
+	return -1;
+}
+
+struct carve_worker {
+	const struct vs_carver *carver;
+	int fd;
+	const char *basename;
+	size_t next;
+	int status;
+};
+
+static void *carve_thread(void *arg) {
+	struct carve_worker *worker = arg;
+	const struct vs_carver *carver = worker->carver;
+	char path[PATH_MAX];
+
+	for (;;) {
+		const size_t index = __atomic_fetch_add(&worker->next, 1, __ATOMIC_RELAXED);
+		if (index >= carver->count) {
+			break;
+		}
+
+		const struct vs_carve_job *job = carver->jobs + index;
+		int out_fd = open_carve_file(carver->options->dir, worker->basename, job, path);
+		if (out_fd == -1 || copy_range(worker->fd, out_fd, job->offset, job->length) != 0) {
+			perror(path);
+			__atomic_store_n(&worker->status, -1, __ATOMIC_RELAXED);
+		}
+		if (out_fd != -1) {
+			close(out_fd);
+		}
+	}
+
+	return NULL;
+}
+
+int vs_carve_run(struct vs_carver *carver, int fd, const char *filename) {
+	if (carver->count == 0) {
+		return 0;
+	}
+
+	const char *basename = "stdin";
+	if (filename) {
+		const char *slash = strrchr(filename, '/');
+		basename = slash ? slash + 1 : filename;
+	}
+
+	struct carve_worker worker = {
+		.carver   = carver,
+		.fd       = fd,
+		.basename = basename,
+		.next     = 0,
+		.status   = 0,
+	};
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t thread_count = cpus > 0 ? (size_t)cpus : 1;
+	if (thread_count > VS_CARVE_MAX_THREADS) {
+		thread_count = VS_CARVE_MAX_THREADS;
+	}
+	if (thread_count > carver->count) {
+		thread_count = carver->count;
+	}
+
+	pthread_t threads[VS_CARVE_MAX_THREADS];
+	size_t started = 0;
+	for (; started + 1 < thread_count; ++ started) {
+		if (pthread_create(threads + started, NULL, carve_thread, &worker) != 0) {
+			break;
+		}
+	}
+
+	// the calling thread helps out
+	carve_thread(&worker);
+
+	for (size_t index = 0; index < started; ++ index) {
+		pthread_join(threads[index], NULL);
+	}
+
+	carver->count = 0;
+
+	if (worker.status != 0) {
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+void vs_carve_destroy(struct vs_carver *carver) {
+	free(carver->jobs);
+	carver->jobs     = NULL;
+	carver->count    = 0;
+	carver->capacity = 0;
+}
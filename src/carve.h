@@ -0,0 +1,53 @@
+#ifndef VS_CARVE_H
+#define VS_CARVE_H
+#pragma once
+
+#include "valuescan.h"
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// --carve=LEN copies LEN bytes starting at each match into its own file in
+// --carve-dir. With --carve-length-field=FORMAT@[+-]OFFSET the length is read
+// from an unsigned integer at OFFSET relative to the match instead and the
+// carved region spans from the match to the end of the data that follows the
+// length field.
+struct vs_carve_options {
+	const char *dir;
+	size_t length;
+	bool   has_field;
+	size_t field_size;
+	bool   field_big_endian;
+	long long field_offset;
+};
+
+struct vs_carve_job {
+	uint64_t offset;
+	uint64_t length;
+	unsigned int bit; // --bit-offsets: bit within the byte at offset
+};
+
+// Carves are collected while a file is searched and then written by a few
+// threads with copy_file_range() straight from the source file descriptor.
+struct vs_carver {
+	const struct vs_carve_options *options;
+	struct vs_carve_job *jobs;
+	size_t count;
+	size_t capacity;
+};
+
+int  vs_parse_carve_field(const char *str, struct vs_carve_options *options);
+int  vs_carve_prepare_dir(const char *dir);
+int  vs_carve_push(struct vs_carver *carver, const uint8_t haystack[], size_t haystack_size,
+                   uint64_t haystack_offset, const struct vs_match *match);
+int  vs_carve_run(struct vs_carver *carver, int fd, const char *filename);
+void vs_carve_destroy(struct vs_carver *carver);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef VS_COUNTERS_H
+#define VS_COUNTERS_H
+#pragma once
+
+#include "valuescan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern _Thread_local struct vs_counters vs_thread_counters;
+
+#define VS_COUNT_CANDIDATE() (++ vs_thread_counters.candidates)
+#define VS_COUNT_VERIFIED()  (++ vs_thread_counters.verified)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,440 @@
+#include "decompress.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+
+#ifdef VS_WITH_ZLIB
+#	include <zlib.h>
+#endif
+
+#ifdef VS_WITH_LZMA
+#	include <lzma.h>
+#endif
+
+#ifdef VS_WITH_ZSTD
+#	include <zstd.h>
+#endif
+
+#define VS_INFLATE_BLOCK_SIZE  (4 * 1024 * 1024)
+#define VS_INFLATE_BLOCK_COUNT 4
+
+enum vs_compression vs_detect_compression(const uint8_t magic[], size_t size) {
+	if (size >= 2 && magic[0] == 0x1F && magic[1] == 0x8B) {
+		return VS_GZIP;
+	}
+	if (size >= 4 && memcmp(magic, "\x28\xB5\x2F\xFD", 4) == 0) {
+		return VS_ZSTD;
+	}
+	if (size >= 6 && memcmp(magic, "\xFD" "7zXZ\0", 6) == 0) {
+		return VS_XZ;
+	}
+	return VS_UNCOMPRESSED;
+}
+
+bool vs_can_decompress(enum vs_compression compression) {
+	switch (compression) {
+#ifdef VS_WITH_ZLIB
+	case VS_GZIP:
+	case VS_DEFLATE:
+		return true;
+#endif
+#ifdef VS_WITH_ZSTD
+	case VS_ZSTD:
+		return true;
+#endif
+#ifdef VS_WITH_LZMA
+	case VS_XZ:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+struct inflate_block {
+	uint8_t *data; // overlap bytes of room for the tail, then the block
+	size_t   size;
+	bool     last;
+};
+
+struct vs_inflater {
+	enum vs_compression compression;
+	const uint8_t *input;
+	size_t input_size;
+	size_t input_pos;
+	size_t overlap;
+
+#ifdef VS_WITH_ZLIB
+	z_stream zstream;
+#endif
+#ifdef VS_WITH_LZMA
+	lzma_stream lzstream;
+#endif
+#ifdef VS_WITH_ZSTD
+	ZSTD_DStream *zstd;
+	size_t zstd_status; // last ZSTD_decompressStream() result
+#endif
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+
+	struct inflate_block blocks[VS_INFLATE_BLOCK_COUNT];
+	size_t ready;     // blocks filled by the decompress thread
+	size_t read_pos;  // next block to search
+	size_t write_pos; // next block to fill
+	bool   holding;   // the caller is searching blocks[read_pos - 1]
+	bool   finished;
+	bool   stop;
+	int    error;
+
+	uint8_t *tail;
+	size_t   tail_size;
+	uint64_t stream_pos;
+};
+
+// Fills out with up to cap bytes. Returns 1 at the end of the stream,
+// 0 if there is more and -1 (with errno set) on error.
+static int decode(struct vs_inflater *inflater, uint8_t *out, size_t cap, size_t *produced) {
+	*produced = 0;
+
+	switch (inflater->compression) {
+#ifdef VS_WITH_ZLIB
+	case VS_GZIP:
+	case VS_DEFLATE:
+	{
+		z_stream *stream = &inflater->zstream;
+		stream->next_out  = out;
+		stream->avail_out = (uInt)cap;
+
+		while (stream->avail_out > 0) {
+			if (stream->avail_in == 0) {
+				const size_t rem = inflater->input_size - inflater->input_pos;
+				stream->next_in  = (Bytef*)(inflater->input + inflater->input_pos);
+				stream->avail_in = rem > UINT_MAX ? UINT_MAX : (uInt)rem;
+				inflater->input_pos += stream->avail_in;
+			}
+
+			int status = inflate(stream, Z_NO_FLUSH);
+			if (status == Z_STREAM_END) {
+				// concatenated members; anything else (e.g. zero padding) ends the stream
+				const size_t rem = stream->avail_in + (inflater->input_size - inflater->input_pos);
+				if (inflater->compression == VS_GZIP &&
+				    vs_detect_compression(inflater->input + inflater->input_pos - stream->avail_in, rem) == VS_GZIP) {
+					inflateReset(stream);
+					continue;
+				}
+				*produced = cap - stream->avail_out;
+				return 1;
+			}
+			if (status != Z_OK) {
+				errno = status == Z_MEM_ERROR ? ENOMEM : EIO;
+				return -1;
+			}
+			if (stream->avail_in == 0 && inflater->input_pos == inflater->input_size && stream->avail_out > 0) {
+				// truncated input
+				errno = EIO;
+				return -1;
+			}
+		}
+
+		*produced = cap - stream->avail_out;
+		return 0;
+	}
+#endif
+#ifdef VS_WITH_LZMA
+	case VS_XZ:
+	{
+		lzma_stream *stream = &inflater->lzstream;
+		stream->next_out  = out;
+		stream->avail_out = cap;
+
+		while (stream->avail_out > 0) {
+			lzma_ret status = lzma_code(stream, stream->avail_in == 0 ? LZMA_FINISH : LZMA_RUN);
+			if (status == LZMA_STREAM_END) {
+				*produced = cap - stream->avail_out;
+				return 1;
+			}
+			if (status != LZMA_OK) {
+				errno = status == LZMA_MEM_ERROR ? ENOMEM : EIO;
+				return -1;
+			}
+		}
+
+		*produced = cap - stream->avail_out;
+		return 0;
+	}
+#endif
+#ifdef VS_WITH_ZSTD
+	case VS_ZSTD:
+	{
+		ZSTD_inBuffer  in_buf  = { inflater->input, inflater->input_size, inflater->input_pos };
+		ZSTD_outBuffer out_buf = { out, cap, 0 };
+		int result = 0;
+
+		while (out_buf.pos < out_buf.size) {
+			const size_t before = out_buf.pos;
+			const size_t status = ZSTD_decompressStream(inflater->zstd, &out_buf, &in_buf);
+			if (ZSTD_isError(status)) {
+				errno = EIO;
+				return -1;
+			}
+			if (in_buf.pos == in_buf.size && out_buf.pos == before) {
+				// a status of 0 means the last frame was completely decoded
+				if (inflater->zstd_status != 0) {
+					// truncated input
+					errno = EIO;
+					return -1;
+				}
+				result = 1;
+				break;
+			}
+			inflater->zstd_status = status;
+		}
+
+		inflater->input_pos = in_buf.pos;
+		*produced = out_buf.pos;
+		return result;
+	}
+#endif
+	default:
+		(void)out;
+		(void)cap;
+		errno = ENOTSUP;
+		return -1;
+	}
+}
+
+static void *inflate_thread(void *arg) {
+	struct vs_inflater *inflater = arg;
+
+	for (;;) {
+		pthread_mutex_lock(&inflater->lock);
+		// the block the caller is searching isn't free either
+		while (!inflater->stop && inflater->ready + inflater->holding == VS_INFLATE_BLOCK_COUNT) {
+			pthread_cond_wait(&inflater->cond, &inflater->lock);
+		}
+		if (inflater->stop) {
+			pthread_mutex_unlock(&inflater->lock);
+			break;
+		}
+		struct inflate_block *block = inflater->blocks + inflater->write_pos;
+		pthread_mutex_unlock(&inflater->lock);
+
+		size_t produced = 0;
+		const int status = decode(inflater, block->data + inflater->overlap, VS_INFLATE_BLOCK_SIZE, &produced);
+		const int errnum = errno;
+
+		pthread_mutex_lock(&inflater->lock);
+		block->size = produced;
+		block->last = status != 0;
+		inflater->write_pos = (inflater->write_pos + 1) % VS_INFLATE_BLOCK_COUNT;
+		++ inflater->ready;
+		if (status != 0) {
+			inflater->finished = true;
+			inflater->error    = status < 0 ? errnum : 0;
+		}
+		pthread_cond_broadcast(&inflater->cond);
+		pthread_mutex_unlock(&inflater->lock);
+
+		if (status != 0) {
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int init_decoder(struct vs_inflater *inflater) {
+	switch (inflater->compression) {
+#ifdef VS_WITH_ZLIB
+	case VS_GZIP:
+		// 15 + 16: gzip header, maximum window size
+		if (inflateInit2(&inflater->zstream, 15 + 16) != Z_OK) {
+			errno = ENOMEM;
+			return -1;
+		}
+		return 0;
+	case VS_DEFLATE:
+		// negative: raw deflate without header or trailer
+		if (inflateInit2(&inflater->zstream, -15) != Z_OK) {
+			errno = ENOMEM;
+			return -1;
+		}
+		return 0;
+#endif
+#ifdef VS_WITH_LZMA
+	case VS_XZ:
+	{
+		const lzma_stream init = LZMA_STREAM_INIT;
+		inflater->lzstream = init;
+		if (lzma_stream_decoder(&inflater->lzstream, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+			errno = ENOMEM;
+			return -1;
+		}
+		inflater->lzstream.next_in  = inflater->input;
+		inflater->lzstream.avail_in = inflater->input_size;
+		return 0;
+	}
+#endif
+#ifdef VS_WITH_ZSTD
+	case VS_ZSTD:
+		inflater->zstd_status = 1;
+		inflater->zstd = ZSTD_createDStream();
+		if (!inflater->zstd || ZSTD_isError(ZSTD_initDStream(inflater->zstd))) {
+			errno = ENOMEM;
+			return -1;
+		}
+		return 0;
+#endif
+	default:
+		errno = ENOTSUP;
+		return -1;
+	}
+}
+
+static void free_decoder(struct vs_inflater *inflater) {
+	switch (inflater->compression) {
+#ifdef VS_WITH_ZLIB
+	case VS_GZIP:
+	case VS_DEFLATE:
+		inflateEnd(&inflater->zstream);
+		break;
+#endif
+#ifdef VS_WITH_LZMA
+	case VS_XZ:
+		lzma_end(&inflater->lzstream);
+		break;
+#endif
+#ifdef VS_WITH_ZSTD
+	case VS_ZSTD:
+		ZSTD_freeDStream(inflater->zstd);
+		break;
+#endif
+	default:
+		break;
+	}
+}
+
+struct vs_inflater *vs_inflate_start(enum vs_compression compression, const uint8_t input[], size_t input_size, size_t overlap) {
+	struct vs_inflater *inflater = calloc(1, sizeof(struct vs_inflater));
+	if (!inflater) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	inflater->compression = compression;
+	inflater->input       = input;
+	inflater->input_size  = input_size;
+	inflater->overlap     = overlap;
+
+	for (size_t index = 0; index < VS_INFLATE_BLOCK_COUNT; ++ index) {
+		inflater->blocks[index].data = malloc(overlap + VS_INFLATE_BLOCK_SIZE);
+		if (!inflater->blocks[index].data) {
+			goto error;
+		}
+	}
+	inflater->tail = malloc(overlap ? overlap : 1);
+	if (!inflater->tail) {
+		goto error;
+	}
+
+	if (init_decoder(inflater) != 0) {
+		const int errnum = errno;
+		for (size_t index = 0; index < VS_INFLATE_BLOCK_COUNT; ++ index) {
+			free(inflater->blocks[index].data);
+		}
+		free(inflater->tail);
+		free(inflater);
+		errno = errnum;
+		return NULL;
+	}
+
+	pthread_mutex_init(&inflater->lock, NULL);
+	pthread_cond_init(&inflater->cond, NULL);
+
+	if (pthread_create(&inflater->thread, NULL, inflate_thread, inflater) != 0) {
+		pthread_cond_destroy(&inflater->cond);
+		pthread_mutex_destroy(&inflater->lock);
+		free_decoder(inflater);
+		goto error;
+	}
+
+	return inflater;
+
+error:
+	for (size_t index = 0; index < VS_INFLATE_BLOCK_COUNT; ++ index) {
+		free(inflater->blocks[index].data);
+	}
+	free(inflater->tail);
+	free(inflater);
+	errno = ENOMEM;
+	return NULL;
+}
+
+const uint8_t *vs_inflate_next(struct vs_inflater *inflater, size_t *sizeptr, size_t *tail_sizeptr, uint64_t *offsetptr, bool *lastptr) {
+	pthread_mutex_lock(&inflater->lock);
+	if (inflater->holding) {
+		inflater->holding = false;
+		pthread_cond_broadcast(&inflater->cond);
+	}
+	while (inflater->ready == 0 && !inflater->finished) {
+		pthread_cond_wait(&inflater->cond, &inflater->lock);
+	}
+	if (inflater->ready == 0) {
+		pthread_mutex_unlock(&inflater->lock);
+		return NULL;
+	}
+	struct inflate_block *block = inflater->blocks + inflater->read_pos;
+	inflater->read_pos = (inflater->read_pos + 1) % VS_INFLATE_BLOCK_COUNT;
+	-- inflater->ready;
+	inflater->holding = true;
+	pthread_mutex_unlock(&inflater->lock);
+
+	const size_t tail_size = inflater->tail_size;
+	uint8_t *window = block->data + inflater->overlap - tail_size;
+	const size_t size = tail_size + block->size;
+
+	memcpy(window, inflater->tail, tail_size);
+
+	inflater->tail_size = size < inflater->overlap ? size : inflater->overlap;
+	memcpy(inflater->tail, window + size - inflater->tail_size, inflater->tail_size);
+
+	*sizeptr      = size;
+	*tail_sizeptr = tail_size;
+	*offsetptr    = inflater->stream_pos - tail_size;
+	*lastptr      = block->last;
+
+	inflater->stream_pos += block->size;
+
+	return window;
+}
+
+int vs_inflate_finish(struct vs_inflater *inflater) {
+	pthread_mutex_lock(&inflater->lock);
+	inflater->stop = true;
+	pthread_cond_broadcast(&inflater->cond);
+	pthread_mutex_unlock(&inflater->lock);
+
+	pthread_join(inflater->thread, NULL);
+
+	const int error = inflater->error;
+
+	free_decoder(inflater);
+	pthread_cond_destroy(&inflater->cond);
+	pthread_mutex_destroy(&inflater->lock);
+	for (size_t index = 0; index < VS_INFLATE_BLOCK_COUNT; ++ index) {
+		free(inflater->blocks[index].data);
+	}
+	free(inflater->tail);
+	free(inflater);
+
+	if (error) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef VS_DECOMPRESS_H
+#define VS_DECOMPRESS_H
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum vs_compression {
+	VS_UNCOMPRESSED,
+	VS_GZIP,
+	VS_ZSTD,
+	VS_XZ,
+	VS_DEFLATE, // raw deflate (zip members), never detected from magic
+};
+
+#define VS_COMPRESSION_MAGIC_SIZE 6
+
+enum vs_compression vs_detect_compression(const uint8_t magic[], size_t size);
+// Only formats whose library was available at build time can be decompressed.
+bool vs_can_decompress(enum vs_compression compression);
+
+// A decompress thread fills a ring of blocks while the caller searches them.
+// Each window returned by vs_inflate_next() starts with the last overlap
+// bytes of the previous window (tail_size of them), so matches that cross a
+// block boundary are found. *lastptr is set for the final window.
+struct vs_inflater;
+
+struct vs_inflater *vs_inflate_start(enum vs_compression compression, const uint8_t input[], size_t input_size, size_t overlap);
+// Returns NULL once the stream ended or decompression failed.
+const uint8_t *vs_inflate_next(struct vs_inflater *inflater, size_t *sizeptr, size_t *tail_sizeptr, uint64_t *offsetptr, bool *lastptr);
+// Returns -1 and sets errno if decompression failed.
+int vs_inflate_finish(struct vs_inflater *inflater);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
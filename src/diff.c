@@ -0,0 +1,88 @@
+#include "valuescan.h"
+#include "fields.h"
+
+#include <string.h>
+
+// bytes compared per step of the lockstep walk, the XOR of a block vectorizes
+#define DIFF_BLOCK 64
+
+// Offset of the first byte from pos on that differs, size if there is none.
+static size_t next_difference(const uint8_t before[], const uint8_t after[], size_t pos, size_t size) {
+	while (size - pos >= DIFF_BLOCK) {
+		uint64_t bits = 0;
+		for (size_t index = 0; index < DIFF_BLOCK; index += sizeof(uint64_t)) {
+			uint64_t lhs, rhs;
+			memcpy(&lhs, before + pos + index, sizeof(lhs));
+			memcpy(&rhs, after  + pos + index, sizeof(rhs));
+			bits |= lhs ^ rhs;
+		}
+		if (bits != 0) {
+			break;
+		}
+		pos += DIFF_BLOCK;
+	}
+	while (pos < size && before[pos] == after[pos]) {
+		++ pos;
+	}
+	return pos;
+}
+
+static inline bool differs(const struct vs_diff *diff, const struct vs_array_field *field,
+                           const uint8_t *before, const uint8_t *after) {
+	switch (diff->kind) {
+	case VS_DIFF_NEEDLES:
+		return memcmp(before, diff->before->data, diff->before->size) == 0 &&
+		       memcmp(after,  diff->after->data,  diff->after->size)  == 0;
+
+	case VS_DIFF_CHANGED:
+		return memcmp(before, after, field->size) != 0;
+
+	default:
+		return vs_field_in_order(field, before, after);
+	}
+}
+
+int vs_search_diff(const uint8_t before[], const uint8_t after[], size_t size, const struct vs_diff *diff,
+                   void *ctx, vs_diff_callback callback) {
+	const size_t align = diff->align ? diff->align : 1;
+	struct vs_array_field field = diff->field;
+	field.offset    = 0;
+	field.predicate = diff->kind == VS_DIFF_DECREASED ? VS_ARRAY_DECREASING : VS_ARRAY_INCREASING;
+	size_t width;
+	size_t match_size;
+
+	if (diff->kind == VS_DIFF_NEEDLES) {
+		match_size = diff->after->size;
+		width = diff->before->size > match_size ? diff->before->size : match_size;
+	}
+	else {
+		match_size = width = diff->field.size;
+	}
+
+	if (width == 0 || size < width) {
+		return 0;
+	}
+
+	// values covering a differing byte, each offset is tested once
+	size_t next = 0;
+	for (size_t pos = next_difference(before, after, 0, size); pos < size;
+	     pos = next_difference(before, after, pos + 1, size)) {
+		size_t offset = pos >= width - 1 ? pos - (width - 1) : 0;
+		if (offset < next) {
+			offset = next;
+		}
+		offset += (align - offset % align) % align;
+
+		for (; offset <= pos && offset <= size - width; offset += align) {
+			if (differs(diff, &field, before + offset, after + offset)) {
+				const int status = callback(ctx, offset, match_size);
+				if (status != 0) {
+					return status;
+				}
+			}
+		}
+		next = pos + 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,101 @@
+#include "entropy.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+// counts up to this get their count * log2(count) from a table
+#define NLOGN_TABLE_SIZE 65536
+
+int vs_parse_entropy_skip(const char *str, struct vs_entropy_skip *skip) {
+	char *endptr = NULL;
+	errno = 0;
+	const double threshold = strtod(str, &endptr);
+	if (endptr == str || (*endptr && *endptr != ',') || !(threshold >= 0 && threshold <= 8)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	size_t block_size = VS_ENTROPY_DEFAULT_BLOCK;
+	if (*endptr == ',') {
+		const char *value = endptr + 1;
+		const unsigned long long number = strtoull(value, &endptr, 10);
+		if (endptr == value || *endptr || *value == '-') {
+			errno = EINVAL;
+			return -1;
+		}
+		if (errno != 0 || number < VS_ENTROPY_MIN_BLOCK || number > VS_ENTROPY_MAX_BLOCK) {
+			errno = ERANGE;
+			return -1;
+		}
+		block_size = (size_t)number;
+	}
+
+	skip->threshold  = threshold;
+	skip->block_size = block_size;
+	skip->skipped    = 0;
+
+	return 0;
+}
+
+int vs_block_entropy(const uint8_t data[], size_t size, size_t block_size, float entropies[]) {
+	if (block_size == 0 || block_size > UINT32_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	const size_t table_size = block_size < NLOGN_TABLE_SIZE ? block_size + 1 : NLOGN_TABLE_SIZE;
+	double *nlogn = malloc(sizeof(double) * table_size);
+	if (!nlogn) {
+		return -1;
+	}
+	nlogn[0] = 0;
+	for (size_t count = 1; count < table_size; ++ count) {
+		nlogn[count] = (double)count * log2((double)count);
+	}
+
+	// Four histograms, so that runs of the same byte don't stall on
+	// incrementing one counter. Merging them vectorizes.
+	uint32_t counts[4][256];
+	size_t index = 0;
+	for (size_t block = 0; block < size; block += block_size, ++ index) {
+		const size_t   count = size - block < block_size ? size - block : block_size;
+		const uint8_t *ptr   = data + block;
+
+		memset(counts, 0, sizeof(counts));
+
+		size_t pos = 0;
+		for (; pos + 8 <= count; pos += 8) {
+			uint64_t word;
+			memcpy(&word, ptr + pos, sizeof(word));
+			++ counts[0][ word        & 0xff];
+			++ counts[1][(word >>  8) & 0xff];
+			++ counts[2][(word >> 16) & 0xff];
+			++ counts[3][(word >> 24) & 0xff];
+			++ counts[0][(word >> 32) & 0xff];
+			++ counts[1][(word >> 40) & 0xff];
+			++ counts[2][(word >> 48) & 0xff];
+			++ counts[3][ word >> 56        ];
+		}
+		for (; pos < count; ++ pos) {
+			++ counts[0][ptr[pos]];
+		}
+
+		for (size_t byte = 0; byte < 256; ++ byte) {
+			counts[0][byte] += counts[1][byte] + counts[2][byte] + counts[3][byte];
+		}
+
+		// H = log2(n) - sum(c * log2(c)) / n
+		double sum = 0;
+		for (size_t byte = 0; byte < 256; ++ byte) {
+			const uint32_t value = counts[0][byte];
+			sum += value < table_size ? nlogn[value] : (double)value * log2((double)value);
+		}
+		entropies[index] = (float)(log2((double)count) - sum / (double)count);
+	}
+
+	free(nlogn);
+
+	return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef VS_ENTROPY_H
+#define VS_ENTROPY_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Block sizes accepted by --skip-entropy.
+#define VS_ENTROPY_MIN_BLOCK     16
+#define VS_ENTROPY_MAX_BLOCK     (1024 * 1024)
+#define VS_ENTROPY_DEFAULT_BLOCK 4096
+
+// --skip-entropy=THRESHOLD[,BLOCK]: blocks of encrypted or compressed data
+// (more than THRESHOLD bits of entropy per byte) aren't searched.
+struct vs_entropy_skip {
+	double   threshold;
+	size_t   block_size;
+	uint64_t skipped; // bytes in skipped blocks
+};
+
+// Shannon entropy in bits per byte of each block_size bytes of data. The last
+// block may be shorter. entropies needs room for one value per block.
+int vs_block_entropy(const uint8_t data[], size_t size, size_t block_size, float entropies[]);
+
+int vs_parse_entropy_skip(const char *str, struct vs_entropy_skip *skip);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef VS_FIELDS_H
+#define VS_FIELDS_H
+#pragma once
+
+#include "valuescan.h"
+
+#include <endian.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Reading and comparing number fields (--records, --diff).
+static inline uint64_t vs_load_field(const struct vs_array_field *field, const uint8_t *ptr) {
+	switch (field->size) {
+	case 1:
+		return ptr[0];
+
+	case 2:
+	{
+		uint16_t value;
+		memcpy(&value, ptr, sizeof(value));
+		return field->big_endian ? be16toh(value) : le16toh(value);
+	}
+	case 4:
+	{
+		uint32_t value;
+		memcpy(&value, ptr, sizeof(value));
+		return field->big_endian ? be32toh(value) : le32toh(value);
+	}
+	default:
+	{
+		uint64_t value;
+		memcpy(&value, ptr, sizeof(value));
+		return field->big_endian ? be64toh(value) : le64toh(value);
+	}
+	}
+}
+
+static inline int64_t vs_field_signed(const struct vs_array_field *field, uint64_t value) {
+	const unsigned shift = (unsigned)(64 - field->size * 8);
+	return (int64_t)(value << shift) >> shift;
+}
+
+static inline double vs_field_float(const struct vs_array_field *field, uint64_t value) {
+	if (field->size == 4) {
+		const uint32_t bits = (uint32_t)value;
+		float fvalue;
+		memcpy(&fvalue, &bits, sizeof(fvalue));
+		return fvalue;
+	}
+	double dvalue;
+	memcpy(&dvalue, &value, sizeof(dvalue));
+	return dvalue;
+}
+
+static inline bool vs_field_in_range(const struct vs_array_field *field, const uint8_t *record) {
+	const uint64_t value = vs_load_field(field, record + field->offset);
+	switch (field->value) {
+	case VS_ARRAY_SIGNED:
+	{
+		const int64_t ivalue = vs_field_signed(field, value);
+		return ivalue >= field->min.i && ivalue <= field->max.i;
+	}
+	case VS_ARRAY_FLOAT:
+	{
+		// false for NaN
+		const double fvalue = vs_field_float(field, value);
+		return fvalue >= field->min.f && fvalue <= field->max.f;
+	}
+	default:
+		return value >= field->min.u && value <= field->max.u;
+	}
+}
+
+// Whether the field increases (or decreases) from prev to record.
+static inline bool vs_field_in_order(const struct vs_array_field *field, const uint8_t *prev, const uint8_t *record) {
+	const uint64_t lhs = vs_load_field(field, prev   + field->offset);
+	const uint64_t rhs = vs_load_field(field, record + field->offset);
+	const bool increasing = field->predicate == VS_ARRAY_INCREASING;
+	switch (field->value) {
+	case VS_ARRAY_SIGNED:
+	{
+		const int64_t ilhs = vs_field_signed(field, lhs);
+		const int64_t irhs = vs_field_signed(field, rhs);
+		return increasing ? ilhs < irhs : ilhs > irhs;
+	}
+	case VS_ARRAY_FLOAT:
+	{
+		const double flhs = vs_field_float(field, lhs);
+		const double frhs = vs_field_float(field, rhs);
+		return increasing ? flhs < frhs : flhs > frhs;
+	}
+	default:
+		return increasing ? lhs < rhs : lhs > rhs;
+	}
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef VS_HASH_H
+#define VS_HASH_H
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Polynomial rolling hash modulo 2^64. Equal hashes still need to be verified.
+#define VS_HASH_BASE UINT64_C(0x100000001B3)
+
+static inline uint64_t vs_hash_pow(size_t exponent) {
+	uint64_t result = 1;
+	uint64_t base   = VS_HASH_BASE;
+	while (exponent) {
+		if (exponent & 1) {
+			result *= base;
+		}
+		base *= base;
+		exponent >>= 1;
+	}
+	return result;
+}
+
+static inline uint64_t vs_hash(const uint8_t data[], size_t size) {
+	uint64_t hash = 0;
+	for (size_t index = 0; index < size; ++ index) {
+		hash = hash * VS_HASH_BASE + data[index];
+	}
+	return hash;
+}
+
+// Remove `out` from the front of a window whose first byte has weight pow and
+// append `in` at its end.
+static inline uint64_t vs_hash_roll(uint64_t hash, uint64_t pow, uint8_t out, uint8_t in) {
+	return (hash - out * pow) * VS_HASH_BASE + in;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
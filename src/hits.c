@@ -0,0 +1,69 @@
+#include "hits.h"
+
+#include <string.h>
+#include <errno.h>
+
+int vs_hits_push(struct vs_hits *hits, const struct vs_match *match) {
+	if (hits->count == hits->capacity) {
+		size_t capacity = hits->capacity ? hits->capacity * 2 : 1024;
+		struct vs_match *buf = realloc(hits->matches, sizeof(struct vs_match) * capacity);
+		if (!buf) {
+			errno = ENOMEM;
+			return -1;
+		}
+		hits->matches  = buf;
+		hits->capacity = capacity;
+	}
+	hits->matches[hits->count ++] = *match;
+	return 0;
+}
+
+static int match_cmp(const void *lhs, const void *rhs) {
+	const struct vs_match *m1 = lhs;
+	const struct vs_match *m2 = rhs;
+	if (m1->offset != m2->offset) {
+		return m1->offset < m2->offset ? -1 : 1;
+	}
+	if (m1->bit != m2->bit) {
+		return m1->bit < m2->bit ? -1 : 1;
+	}
+	if (m1->bit_order != m2->bit_order) {
+		return m1->bit_order < m2->bit_order ? -1 : 1;
+	}
+	if (m1->needle != m2->needle) {
+		return m1->needle < m2->needle ? -1 : 1;
+	}
+	return 0;
+}
+
+int vs_hits_flush(struct vs_hits *hits, void *ctx, vs_match_callback callback) {
+	const size_t count = hits->count;
+	hits->count = 0;
+
+	if (count == 0) {
+		return 0;
+	}
+
+	qsort(hits->matches, count, sizeof(struct vs_match), match_cmp);
+
+	for (size_t i = 0; i < count; ++ i) {
+		const struct vs_match *match = hits->matches + i;
+		if (i > 0 && match->offset == hits->matches[i - 1].offset &&
+		    match->bit == hits->matches[i - 1].bit && match->bit_order == hits->matches[i - 1].bit_order) {
+			continue;
+		}
+		int status = callback(ctx, match);
+		if (status != 0) {
+			return status;
+		}
+	}
+
+	return 0;
+}
+
+void vs_hits_destroy(struct vs_hits *hits) {
+	free(hits->matches);
+	hits->matches  = NULL;
+	hits->count    = 0;
+	hits->capacity = 0;
+}
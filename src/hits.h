@@ -0,0 +1,29 @@
+#ifndef VS_HITS_H
+#define VS_HITS_H
+#pragma once
+
+#include "valuescan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Engines that don't produce matches in offset order (e.g. one pass per
+// needle) collect them per chunk into a hit buffer. Flushing sorts the hits
+// by offset and reports only the first needle (in needle array order) per
+// offset (and bit), which is the same thing vs_search() does.
+struct vs_hits {
+	struct vs_match *matches;
+	size_t count;
+	size_t capacity;
+};
+
+int  vs_hits_push(struct vs_hits *hits, const struct vs_match *match);
+int  vs_hits_flush(struct vs_hits *hits, void *ctx, vs_match_callback callback);
+void vs_hits_destroy(struct vs_hits *hits);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,5 +1,16 @@
 #include "valuescan.h"
 #include "parse_needle.h"
+#include "stats.h"
+#include "output.h"
+#include "carve.h"
+#include "walk.h"
+#include "decompress.h"
+#include "archive.h"
+#include "serve.h"
+#include "cache.h"
+#include "entropy.h"
+#include "prefetch.h"
+#include "throttle.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -19,6 +30,9 @@
 #define START_SET 1
 #define END_SET   2
 
+// bytes read from the first file to estimate byte frequencies
+#define VS_PLAN_SAMPLE_SIZE (64 * 1024)
+
 #define OFF_MAX ((off_t)~((uintmax_t)1 << (sizeof(off_t) * CHAR_BIT - 1)))
 #define OFF_MIN ((off_t) ((uintmax_t)1 << (sizeof(off_t) * CHAR_BIT - 1)))
 
@@ -29,25 +43,90 @@
 
 #ifdef _MSC_VER
 #	define PRIuSZ "Iu"
+#	define PRIxSZ "Ix"
 #else
 #	define PRIuSZ "zu"
+#	define PRIxSZ "zx"
 #endif
 
 // printfmt:
 // %% -> %
 // %f -> filename
+// %m -> filename, or archive!member for members of archives
 // %o -> offset
 // %s -> size of matched value
 // %t -> format:value tuple as provided by user
 // %v -> value as provided by user
 // %x -> value as hex (lower case)
 // %X -> value as hex (upper case)
+// %p -> offset the pointer points at (--pointers)
+// %d -> number of mismatching bytes
+// %n -> offset of the matched part within the needle
+// %b -> bit within the byte where the match starts
+// %B -> bit order of the match (msb first, lsb first or aligned)
+// --cache: needles are identified by their canonical index in cache entries.
+struct result_cache {
+	const char *dir;
+	uint64_t needles_hash;
+	uint32_t *ranks;                  // canonical index of each needle
+	const struct vs_needle **by_rank; // needle of each canonical index
+};
+
+// --histogram=SIZE[,K]: hits are counted per needle and bucket of SIZE bytes
+// instead of being printed, only every Kth bucket is searched.
+struct histogram {
+	size_t    bucket_size;
+	size_t    sample;
+	size_t    needle_count;
+	uint64_t  first;        // bucket of counts[0]
+	size_t    bucket_count;
+	size_t    capacity;     // in buckets
+	uint32_t *counts;       // hits of needle n in bucket first + b at b * needle_count + n
+	bool      active;       // set while valuescan_histogram() scans a file
+};
+
 struct vs_options {
 	const char *printfmt;
 	const char *filename;
-	off_t start;
-	off_t end;
-	char  eol;
+	const char *member; // name of the archive member being scanned
+	uint32_t    file_id;
+	enum vs_output_format output;
+	struct vs_records *records;
+	const struct vs_needle *needles;
+	FILE  *out;
+	FILE  *err; // warnings about single files or archive members
+	off_t  start;
+	off_t  end;
+	char   eol;
+	size_t max_mismatches;
+	size_t block_size;
+	unsigned int bit_orders;
+	const struct vs_plan *plan;
+	const struct vs_array_schema *array_schema; // --records
+	const struct vs_pointer_format *pointers;   // --pointers
+	bool   pointers_anywhere; // --pointers without needles: every offset is a target
+	struct vs_entropy_skip *skip_entropy; // --skip-entropy
+	struct histogram *histogram;          // --histogram
+	const struct vs_diff *diff;           // --diff
+	size_t prefetch;  // --prefetch: read ahead distance, 0 if off
+	bool   hugepages; // --hugepages
+	bool   populate;  // --populate
+	bool   nice_io;   // --nice-io
+	struct vs_throttle *throttle; // --max-read-rate, --max-cpu
+	struct vs_stats *stats;
+	struct vs_carver *carver;
+	const uint8_t *haystack;
+	size_t haystack_size;
+	size_t context_before;
+	size_t context_after;
+	size_t context_end; // haystack offset up to which context was printed
+	size_t report_from; // only matches starting in [report_from, report_to) are
+	size_t report_to;   // reported, for overlapping windows of a stream
+	size_t report_past; // and only if they end past report_past (--skip-entropy)
+	bool   decompress;
+	bool   archives;
+	const struct result_cache *cache;
+	struct vs_cache_entry *cache_entry; // matches of the current file are recorded here
 };
 
 static bool startswith(const char *str, const char *prefix) {
@@ -62,20 +141,64 @@ static bool startswith(const char *str, const char *prefix) {
 static int needle_size_cmp(const void *lhs, const void *rhs) {
 	const struct vs_needle *n1 = lhs;
 	const struct vs_needle *n2 = rhs;
-	return n2->size - n1->size;
+	return n1->size == n2->size ? 0 : n1->size < n2->size ? 1 : -1;
+}
+
+static bool has_needle_flag(const struct vs_needle needles[], size_t needle_count, unsigned int flag) {
+	for (size_t i = 0; i < needle_count; ++ i) {
+		if (needles[i].flags & flag) {
+			return true;
+		}
+	}
+	return false;
 }
 
 static void usage(int argc, char *argv[]) {
 	const char *binary = argc > 0 ? argv[0] : "valuescan";
 	printf(
 		"Usage: %s [options] format:value[,format:value...]... [--] [file...]\n"
+		"       %s --records=SCHEMA [options] [--] [file...]\n"
+		"       %s --pointers=FORMAT[,...] [options] [format:value...] [--] [file...]\n"
+		"       %s --diff[=KIND:FORMAT[,align:N]] [options] [format:value format:value] [--] A B\n"
+		"       %s serve [--max-mappings=N] SOCKET\n"
 		"\n"
 		"BLOB FORAMTS:\n"
 		"\n"
 		"\ttext .... either simple string [-+\\._:/\\\\%%a-zA-Z0-9]* or C-like quoted string\n"
+		"\ttext16le, text16be, text32le, text32be\n"
+		"\t          text as UTF-16 or UTF-32 (input is read as UTF-8)\n"
 		"\thex ..... hex encoded binary\n"
 		"\tfile .... read needle from given file (filename is encoded like text)\n"
 		"\n"
+		"\tAppend /i to a text format (e.g. text16le/i:hello) to match ASCII letters\n"
+		"\tcase-insensitively.\n"
+		"\n"
+		"VALUE GROUPS:\n"
+		"\n"
+		"\tany ....... every integer and float encoding of the given number\n"
+		"\tanyint .... every integer encoding (width, sign, byte order)\n"
+		"\tanyfloat .. every float encoding (f32 only if exact)\n"
+		"\n"
+		"\tA value group can't be combined with other values via comma. %%t reports\n"
+		"\tthe encoding that matched.\n"
+		"\n"
+		"DELTA SEQUENCES:\n"
+		"\n"
+		"\tdelta:FORMAT:VALUE,VALUE,... matches consecutive integers of FORMAT that\n"
+		"\tdiffer from each other like the given values do, whatever the first one\n"
+		"\tis. E.g. delta:u32le:0,+1,+5 finds x, x+1, x+5 for every x and\n"
+		"\tdelta:u16be:0,0x40,0x80 finds offsets spaced 0x40 apart.\n"
+		"\n"
+		"VARINTS AND BCD:\n"
+		"\n"
+		"\tvarint .... unsigned LEB128 (protobuf, DWARF), also uleb128\n"
+		"\tsleb128 ... signed LEB128 (DWARF)\n"
+		"\tzigzag .... zigzag encoded LEB128 (protobuf sint32/sint64)\n"
+		"\tbcd ....... packed BCD, every given digit is encoded (bcd:0042 is 00 42)\n"
+		"\n"
+		"\tVarints also match padded encodings of the value (e.g. varint:1 finds\n"
+		"\t01 and 81 80 00) and can't be combined with other values via comma.\n"
+		"\n"
 		"NUMBER FORMATS:\n"
 		"\n"
 		"\tFormat | Type    | Bits |   Sign   |  Byte Order\n"
@@ -84,19 +207,27 @@ static void usage(int argc, char *argv[]) {
 		"\tu8     | integer |    8 | unsigned |     ----\n"
 		"\ti16le  | integer |   16 | signed   | little endian\n"
 		"\tu16le  | integer |   16 | unsigned | little endian\n"
+		"\ti24le  | integer |   24 | signed   | little endian\n"
+		"\tu24le  | integer |   24 | unsigned | little endian\n"
 		"\ti32le  | integer |   32 | signed   | little endian\n"
 		"\tu32le  | integer |   32 | unsigned | little endian\n"
 		"\ti64le  | integer |   64 | signed   | little endian\n"
 		"\tu64le  | integer |   64 | unsigned | little endian\n"
 		"\ti16be  | integer |   16 | signed   | big endian\n"
 		"\tu16be  | integer |   16 | unsigned | big endian\n"
+		"\ti24be  | integer |   24 | signed   | big endian\n"
+		"\tu24be  | integer |   24 | unsigned | big endian\n"
 		"\ti32be  | integer |   32 | signed   | big endian\n"
 		"\tu32be  | integer |   32 | unsigned | big endian\n"
 		"\ti64be  | integer |   64 | signed   | big endian\n"
 		"\tu64be  | integer |   64 | unsigned | big endian\n"
 #ifdef __STDC_IEC_559__
+		"\tf16le  | float   |   16 | signed   | little endian\n"
+		"\tbf16le | bfloat  |   16 | signed   | little endian\n"
 		"\tf32le  | float   |   32 | signed   | little endian\n"
 		"\tf64le  | float   |   64 | signed   | little endian\n"
+		"\tf16be  | float   |   16 | signed   | big endian\n"
+		"\tbf16be | bfloat  |   16 | signed   | big endian\n"
 		"\tf32be  | float   |   32 | signed   | big endian\n"
 		"\tf64be  | float   |   64 | signed   | big endian\n"
 #endif
@@ -108,13 +239,82 @@ static void usage(int argc, char *argv[]) {
 		"\t-p, --print-format=FORMAT    use FORMAT for messages\n"
 		"\t          %%%% ... %%\n"
 		"\t          %%f ... filename\n"
+		"\t          %%m ... filename, or archive!member inside of archives\n"
 		"\t          %%o ... offset\n"
 		"\t          %%s ... size of matched value\n"
 		"\t          %%t ... format:value tuple as provided by user\n"
 		"\t          %%v ... value as provided by user\n"
 		"\t          %%x ... value as hex (lower case)\n"
 		"\t          %%X ... value as hex (upper case)\n"
+		"\t          %%c ... number of records (--records) or hits (--histogram)\n"
+		"\t          %%p ... offset the pointer points at (--pointers)\n"
+		"\t          %%d ... number of mismatching bytes\n"
+		"\t          %%n ... offset of the matched part within the needle\n"
+		"\t          %%b ... bit within the byte where the match starts\n"
+		"\t          %%B ... bit order of the match (msb first, lsb first or aligned)\n"
 		"\t-0, --print0                 separate lines with null bytes\n"
+		"\t-A, --after-context=N        print N bytes after each match as hexdump\n"
+		"\t-B, --before-context=N       print N bytes before each match as hexdump\n"
+		"\t-C, --context=N              print N bytes around each match as hexdump\n"
+		"\t-k, --max-mismatches=K       allow up to K differing bytes per match\n"
+		"\t    --block-hash=SIZE        find partial or shifted copies of needles\n"
+		"\t                             by hashing SIZE byte blocks of them\n"
+		"\t    --bit-offsets[=ORDER]    also match at non-byte-aligned bit offsets\n"
+		"\t                             ORDER is msb, lsb or both (default)\n"
+		"\t    --records=SCHEMA         find arrays of records instead of needles\n"
+		"\t                             (see RECORD ARRAYS)\n"
+		"\t    --pointers=FORMAT[,...]  find values pointing at needle matches or, without\n"
+		"\t                             needles, anywhere into the file (see POINTERS)\n"
+		"\t    --diff[=KIND:FORMAT]     compare two snapshots of the same file\n"
+		"\t                             (see SNAPSHOT DIFFS)\n"
+		"\t    --output=FORMAT          text (default, see --print-format), ndjson\n"
+		"\t                             (one JSON object per match) or binary\n"
+		"\t                             (needle table and 16 byte match records)\n"
+		"\t-r, --recursive              scan all files in the given directories (or\n"
+		"\t                             the current directory) and below\n"
+		"\t    --include=GLOB           only scan files whose name matches GLOB\n"
+		"\t                             (or relative path, if GLOB contains a /)\n"
+		"\t    --exclude=GLOB           skip files and directories matching GLOB\n"
+		"\t    --min-size=SIZE          skip files smaller than SIZE bytes\n"
+		"\t    --max-size=SIZE          skip files bigger than SIZE bytes\n"
+		"\t    --one-file-system        don't descend into other file systems\n"
+		"\t    --carve=LEN              copy LEN bytes starting at each match into\n"
+		"\t                             a new file named FILE-OFFSET.bin (or\n"
+		"\t                             FILE-OFFSET.N.bin if that exists)\n"
+		"\t    --carve-length-field=FORMAT@OFFSET\n"
+		"\t                             carve from the match to the end of the data\n"
+		"\t                             following a length field of FORMAT (u8,\n"
+		"\t                             u16le, ..., u64be) at OFFSET relative to the\n"
+		"\t                             match, e.g. u32le@+4\n"
+		"\t    --carve-dir=DIR          write carved files to DIR (default: .)\n"
+		"\t    --no-decompress          scan gzip, zstd and xz files as they are\n"
+		"\t                             instead of their decompressed contents\n"
+		"\t    --archives               scan the members of tar and zip files\n"
+		"\t                             (offsets are offsets in the member)\n"
+		"\t    --histogram=SIZE[,K]     count the hits of each needle per SIZE bytes\n"
+		"\t                             instead of printing them, if given only in\n"
+		"\t                             every Kth block (%%o is the block offset)\n"
+		"\t    --prefetch[=DISTANCE]    read files DISTANCE bytes (default: 64 MiB) ahead\n"
+		"\t                             of the search in a helper thread and drop what\n"
+		"\t                             was searched from memory\n"
+		"\t    --hugepages              ask for huge pages for mapped files\n"
+		"\t    --populate               read mapped files completely before searching\n"
+		"\t    --max-read-rate=RATE     read no more than RATE MiB per second\n"
+		"\t    --max-cpu=PCT            use no more than PCT percent of a CPU\n"
+		"\t    --nice-io                read with idle I/O priority and drop what was\n"
+		"\t                             read from the page cache, unless it was cached\n"
+		"\t                             before\n"
+		"\t    --skip-entropy=T[,BLOCK] don't search BLOCK byte blocks (default: 4096)\n"
+		"\t                             with more than T bits of entropy per byte,\n"
+		"\t                             like compressed or encrypted data (e.g. 7.5)\n"
+		"\t    --cache=DIR              keep the matches of each file in DIR and\n"
+		"\t                             replay them while the file is unchanged\n"
+		"\t    --explain                print which matcher is used for which\n"
+		"\t                             needles and exit without scanning\n"
+		"\t    --stats[=FORMAT]         print bytes scanned, time per phase, page\n"
+		"\t                             faults, max RSS, prefilter and per needle hit\n"
+		"\t                             counts to stderr. FORMAT is text (default) or\n"
+		"\t                             json\n"
 		"\n"
 		"EXAMPLES:\n"
 		"\n"
@@ -122,8 +322,93 @@ static void usage(int argc, char *argv[]) {
 		"\n"
 		"\t\t%s u32le:1024,u32le:1024 u32le:2048,u32le:2048 -- file.bin\n"
 		"\n"
+		"\tFind the number 1337 in whatever encoding it is stored:\n"
+		"\n"
+		"\t\t%s any:1337 -- file.bin\n"
+		"\n"
+		"RECORD ARRAYS:\n"
+		"\n"
+		"\t--records=stride:N[,min:N],FIELD,... finds at least min (default: 16)\n"
+		"\tconsecutive records of N bytes where every FIELD holds. A FIELD is\n"
+		"\tFORMAT@OFFSET=VALUE, FORMAT@OFFSET=MIN..MAX (either bound may be left\n"
+		"\tout), FORMAT@OFFSET=inc or FORMAT@OFFSET=dec (bigger or smaller than in\n"
+		"\tthe previous record) with FORMAT being a number format and OFFSET the\n"
+		"\toffset within the record. Of overlapping arrays only the longest is\n"
+		"\treported. E.g. 32 or more vertices with increasing ids:\n"
+		"\n"
+		"\t\t%s --records=stride:16,min:32,u32le@0=inc,f32le@4=-1e4..1e4 file.bin\n"
+		"\n"
+		"POINTERS:\n"
+		"\n"
+		"\t--pointers=FORMAT[,base:N][,align:N][,density:R] reads an unsigned integer\n"
+		"\tof FORMAT (u16le, ..., u64be) at every multiple of align (default: its\n"
+		"\tsize) and reports it if it minus base (default: 0) is a file offset where\n"
+		"\tone of the needles matched. Without needles every offset within the file\n"
+		"\tcounts, but only windows of 64 values of which at least density (default:\n"
+		"\t0.5, with needles: 0) are pointers are reported. Zero values never count.\n"
+		"\tE.g. offsets of PNG images embedded in a container:\n"
+		"\n"
+		"\t\t%s --pointers=u32le hex:89504e470d0a1a0a -- archive.dat\n"
+		"\n"
+		"SNAPSHOT DIFFS:\n"
+		"\n"
+		"\t--diff with two needles reports the offsets where file A holds the first\n"
+		"\tand file B the second needle. --diff=KIND:FORMAT reports the offsets where\n"
+		"\tthe value of FORMAT (a number format) changed, increased or decreased\n"
+		"\t(KIND) from A to B, at every multiple of align (default: its size). Only\n"
+		"\toffsets where the files differ are tested. Compressed snapshots are\n"
+		"\tdecompressed into memory first (unless --no-decompress). E.g. a counter\n"
+		"\tthat went from 100 to 95:\n"
+		"\n"
+		"\t\t%s --diff u32le:100 u32le:95 -- before.sav after.sav\n"
+		"\n"
+		"SERVE MODE:\n"
+		"\n"
+		"\tserve listens on the Unix socket SOCKET and keeps the scanned files mapped\n"
+		"\t(up to --max-mappings, default 256) and compiled needles cached between\n"
+		"\trequests. A request is one line of tab separated arguments: --name=value\n"
+		"\toptions, needles, -- and files. The response is the output of the scan\n"
+		"\t(including error messages) followed by an empty line.\n"
+		"\n"
 		"Report bugs to: https://github.com/panzi/valuescan/issues\n",
-		binary, binary);
+		binary, binary, binary, binary, binary, binary, binary, binary, binary, binary);
+}
+
+static const char *default_printfmt(const struct vs_options *options, bool with_filename) {
+	if (options->histogram) {
+		return !with_filename ? "%o: %c %t" : "%f:%o: %c %t";
+	}
+	if (options->array_schema) {
+		return
+			!with_filename ? "%o: %c records (%s bytes)" :
+			options->archives ? "%m:%o: %c records (%s bytes)" :
+			"%f:%o: %c records (%s bytes)";
+	}
+	if (options->pointers) {
+		return
+			!with_filename ? "%o: -> %p (%t)" :
+			options->archives ? "%m:%o: -> %p (%t)" :
+			"%f:%o: -> %p (%t)";
+	}
+	if (!with_filename) {
+		return
+			options->bit_orders ? "%o.%b: %t (%B)" :
+			options->block_size > 0 ? "%o: %t+%n (%s bytes)" :
+			options->max_mismatches > 0 ? "%o: %t (%d mismatches)" :
+			"%o: %t";
+	}
+	if (options->archives) {
+		return
+			options->bit_orders ? "%m:%o.%b: %t (%B)" :
+			options->block_size > 0 ? "%m:%o: %t+%n (%s bytes)" :
+			options->max_mismatches > 0 ? "%m:%o: %t (%d mismatches)" :
+			"%m:%o: %t";
+	}
+	return
+		options->bit_orders ? "%f:%o.%b: %t (%B)" :
+		options->block_size > 0 ? "%f:%o: %t+%n (%s bytes)" :
+		options->max_mismatches > 0 ? "%f:%o: %t (%d mismatches)" :
+		"%f:%o: %t";
 }
 
 static bool is_needle(const char *str) {
@@ -135,8 +420,100 @@ static bool is_needle(const char *str) {
 		strchr(str, ':') != NULL;
 }
 
-static int print_offset(void *ctx, const struct vs_needle *needle, size_t offset) {
-	const struct vs_options *options = (const struct vs_options *)ctx;
+static void print_ndjson(const struct vs_options *options, const struct vs_match *match) {
+	FILE *out = options->out;
+	fputs("{\"file\":", out);
+	if (options->filename) {
+		vs_print_json_string(options->filename, out);
+	}
+	else {
+		fputs("null", out);
+	}
+	if (options->member) {
+		fputs(",\"member\":", out);
+		vs_print_json_string(options->member, out);
+	}
+	fprintf(out, ",\"offset\":%" PRIuSZ ",\"needle_id\":%" PRIuSZ ",\"needle\":",
+		(size_t)options->start + match->offset, (size_t)(match->needle - options->needles));
+	vs_print_json_string((const char*)match->needle->ctx, out);
+	fprintf(out, ",\"size\":%" PRIuSZ, match->size);
+	if (options->max_mismatches > 0) {
+		fprintf(out, ",\"mismatches\":%" PRIuSZ, match->mismatches);
+	}
+	if (options->block_size > 0) {
+		fprintf(out, ",\"needle_offset\":%" PRIuSZ, match->needle_offset);
+	}
+	if (options->array_schema) {
+		fprintf(out, ",\"records\":%" PRIuSZ ",\"stride\":%" PRIuSZ,
+			match->size / options->array_schema->stride, options->array_schema->stride);
+	}
+	if (options->pointers) {
+		fprintf(out, ",\"target\":%" PRIuSZ, (size_t)options->start + match->target);
+	}
+	if (options->histogram) {
+		fprintf(out, ",\"hits\":%" PRIuSZ, match->hits);
+	}
+	if (options->bit_orders) {
+		fprintf(out, ",\"bit\":%u,\"bit_order\":\"%s\"", match->bit,
+			match->bit_order == VS_MSB_FIRST ? "msb" :
+			match->bit_order == VS_LSB_FIRST ? "lsb" : "aligned");
+	}
+	fputs("}\n", out);
+}
+
+// Hexdump rows are aligned to 16 bytes of the file. Rows that were already
+// printed for a previous match are skipped, so overlapping contexts merge.
+static void print_context(struct vs_options *options, const struct vs_match *match) {
+	FILE *out = options->out;
+	const size_t size  = options->haystack_size;
+	const size_t start = (size_t)options->start;
+	size_t from = match->offset > options->context_before ? match->offset - options->context_before : 0;
+	size_t to   = match->offset + match->size;
+
+	to = size - to > options->context_after ? to + options->context_after : size;
+	if (from < options->context_end) {
+		from = options->context_end;
+	}
+	if (from >= to) {
+		return;
+	}
+
+	size_t row = (start + from) & ~(size_t)15;
+	for (; row < start + to; row += 16) {
+		fprintf(out, "\t%08" PRIxSZ " ", row);
+		for (size_t index = 0; index < 16; ++ index) {
+			const size_t pos = row + index;
+			if (index == 8) {
+				fputc(' ', out);
+			}
+			if (pos >= start && pos - start < size) {
+				fprintf(out, " %02x", options->haystack[pos - start]);
+			}
+			else {
+				fputs("   ", out);
+			}
+		}
+		fputs("  |", out);
+		for (size_t index = 0; index < 16; ++ index) {
+			const size_t pos = row + index;
+			if (pos >= start && pos - start < size) {
+				const uint8_t byte = options->haystack[pos - start];
+				fputc(byte >= 0x20 && byte < 0x7F ? byte : '.', out);
+			}
+			else {
+				fputc(' ', out);
+			}
+		}
+		fputs("|\n", out);
+	}
+
+	options->context_end = row - start;
+}
+
+static void print_formatted(const struct vs_options *options, const struct vs_match *match) {
+	FILE *out = options->out;
+	const struct vs_needle *needle = match->needle;
+	const size_t offset = match->offset;
 	const char *fmt = options->printfmt;
 	const char *last = fmt;
 
@@ -145,60 +522,111 @@ static int print_offset(void *ctx, const struct vs_needle *needle, size_t offset
 
 		if (!ch) {
 			if (last != fmt) {
-				fwrite(last, fmt - last, 1, stdout);
+				fwrite(last, fmt - last, 1, out);
 			}
 			break;
 		}
 		else if (ch == '%') {
 			if (last != fmt) {
-				fwrite(last, fmt - last, 1, stdout);
+				fwrite(last, fmt - last, 1, out);
 			}
 			++ fmt;
 			ch = *fmt;
 			switch (ch) {
 			case 'f':
 				if (options->filename) {
-					fputs(options->filename, stdout);
+					fputs(options->filename, out);
+				}
+				++ fmt;
+				break;
+
+			case 'm':
+				if (options->filename) {
+					fputs(options->filename, out);
+					if (options->member) {
+						fputc('!', out);
+					}
+				}
+				if (options->member) {
+					fputs(options->member, out);
 				}
 				++ fmt;
 				break;
 
 			case 'o':
-				printf("%" PRIuSZ, options->start + offset);
+				fprintf(out, "%" PRIuSZ, options->start + offset);
 				++ fmt;
 				break;
 
 			case 's':
-				printf("%" PRIuSZ, needle->size);
+				fprintf(out, "%" PRIuSZ, match->size);
 				++ fmt;
 				break;
 
 			case 't':
-				fputs((const char*)needle->ctx, stdout);
+				fputs((const char*)needle->ctx, out);
 				++ fmt;
 				break;
 
 			case 'v':
-				fputs(strchr((const char*)needle->ctx, ':')+1, stdout);
+			{
+				// pseudo needles (--pointers=u32le) may have no value
+				const char *value = strchr((const char*)needle->ctx, ':');
+				fputs(value ? value + 1 : (const char*)needle->ctx, out);
 				++ fmt;
 				break;
+			}
 
 			case 'x':
 				for (size_t i = 0; i < needle->size; ++ i) {
-					printf("%02x", needle->data[i]);
+					fprintf(out, "%02x", needle->data[i]);
 				}
 				++ fmt;
 				break;
 
 			case 'X':
 				for (size_t i = 0; i < needle->size; ++ i) {
-					printf("%02X", needle->data[i]);
+					fprintf(out, "%02X", needle->data[i]);
 				}
 				++ fmt;
 				break;
 
+			case 'c':
+				fprintf(out, "%" PRIuSZ,
+					options->array_schema ? match->size / options->array_schema->stride :
+					options->histogram ? match->hits : 1);
+				++ fmt;
+				break;
+
+			case 'p':
+				fprintf(out, "%" PRIuSZ, options->start + match->target);
+				++ fmt;
+				break;
+
+			case 'd':
+				fprintf(out, "%" PRIuSZ, match->mismatches);
+				++ fmt;
+				break;
+
+			case 'n':
+				fprintf(out, "%" PRIuSZ, match->needle_offset);
+				++ fmt;
+				break;
+
+			case 'b':
+				fprintf(out, "%u", match->bit);
+				++ fmt;
+				break;
+
+			case 'B':
+				fputs(match->bit_order == VS_MSB_FIRST ? "msb first" :
+				      match->bit_order == VS_LSB_FIRST ? "lsb first" :
+				      "aligned", out);
+				++ fmt;
+				break;
+
 			default:
-				fputc('%', stdout);
+				fputc('%', out);
 			}
 			last = fmt;
 		}
@@ -207,7 +635,289 @@ static int print_offset(void *ctx, const struct vs_needle *needle, size_t offset
 		}
 	}
 
-	fputc(options->eol, stdout);
+	fputc(options->eol, out);
+}
+
+static int print_match(void *ctx, const struct vs_match *match) {
+	struct vs_options *options = (struct vs_options *)ctx;
+	int status = 0;
+
+	if (match->offset < options->report_from || match->offset >= options->report_to ||
+	    match->offset + match->size <= options->report_past) {
+		return 0;
+	}
+
+	if (options->cache_entry) {
+		const struct vs_cache_match cached = {
+			.offset        = (uint64_t)options->start + match->offset,
+			.needle        = options->cache->ranks[match->needle - options->needles],
+			.bit           = match->bit,
+			.bit_order     = match->bit_order,
+			.size          = match->size,
+			.needle_offset = match->needle_offset,
+			.mismatches    = match->mismatches,
+		};
+		if (vs_cache_push(options->cache_entry, &cached) != 0) {
+			return -1;
+		}
+	}
+
+	if (options->stats) {
+		vs_stats_begin(options->stats, VS_PHASE_OUTPUT);
+		vs_stats_hit(options->stats, match->needle);
+	}
+
+	if (options->carver && vs_carve_push(options->carver, options->haystack, options->haystack_size,
+	                                     (uint64_t)options->start, match) != 0) {
+		status = -1;
+	}
+
+	switch (options->output) {
+	case VS_OUTPUT_NDJSON:
+		print_ndjson(options, match);
+		break;
+
+	case VS_OUTPUT_BINARY:
+		status |= vs_records_push(options->records, options->file_id,
+			(uint32_t)(match->needle - options->needles), (uint64_t)options->start + match->offset);
+		break;
+
+	default:
+		print_formatted(options, match);
+		if (options->context_before || options->context_after) {
+			print_context(options, match);
+		}
+	}
+
+	if (options->stats) {
+		vs_stats_end(options->stats, VS_PHASE_OUTPUT);
+	}
+
+	return status;
+}
+
+static int print_offset(void *ctx, const struct vs_needle *needle, size_t offset) {
+	const struct vs_options *options = (const struct vs_options *)ctx;
+	uint64_t value;
+	const struct vs_match match = {
+		.needle        = needle,
+		.offset        = offset,
+		// padded varints are longer than the needle
+		.size          = needle->flags & VS_NEEDLE_VARINT ?
+			vs_decode_leb128(options->haystack + offset, options->haystack_size - offset,
+			                 (needle->flags & VS_NEEDLE_SIGNED) != 0, &value) :
+			needle->size,
+		.needle_offset = 0,
+		.mismatches    = 0,
+	};
+	return print_match(ctx, &match);
+}
+
+static int print_array(void *ctx, const struct vs_array *array) {
+	struct vs_options *options = (struct vs_options *)ctx;
+	const struct vs_match match = {
+		.needle        = options->needles,
+		.offset        = array->offset,
+		.size          = array->count * array->stride,
+		.needle_offset = 0,
+		.mismatches    = 0,
+	};
+	return print_match(ctx, &match);
+}
+
+// --pointers: needle matches that pointers may point at
+struct pointer_target {
+	size_t offset;
+	const struct vs_needle *needle;
+};
+
+struct pointer_search {
+	struct vs_options *options;
+	struct pointer_target *targets;
+	size_t count;
+	size_t capacity;
+};
+
+static int collect_target(void *ctx, const struct vs_needle *needle, size_t offset) {
+	struct pointer_search *search = ctx;
+	if (search->count == search->capacity) {
+		const size_t capacity = search->capacity ? search->capacity * 2 : 256;
+		struct pointer_target *targets = realloc(search->targets, sizeof(struct pointer_target) * capacity);
+		if (!targets) {
+			errno = ENOMEM;
+			return -1;
+		}
+		search->targets  = targets;
+		search->capacity = capacity;
+	}
+	search->targets[search->count].offset = offset;
+	search->targets[search->count].needle = needle;
+	++ search->count;
+	return 0;
+}
+
+static int pointer_target_cmp(const void *lhs, const void *rhs) {
+	const struct pointer_target *ltarget = lhs;
+	const struct pointer_target *rtarget = rhs;
+	return ltarget->offset < rtarget->offset ? -1 : ltarget->offset > rtarget->offset ? 1 :
+	       ltarget->needle < rtarget->needle ? -1 : ltarget->needle > rtarget->needle ? 1 : 0;
+}
+
+static int print_pointer(void *ctx, const struct vs_pointer *pointer) {
+	const struct pointer_search *search = ctx;
+	const struct vs_match match = {
+		.needle        = pointer->target_index == SIZE_MAX ? search->options->needles : search->targets[pointer->target_index].needle,
+		.offset        = pointer->offset,
+		.size          = search->options->pointers->size,
+		.needle_offset = 0,
+		.mismatches    = 0,
+		.target        = pointer->target,
+	};
+	return print_match(search->options, &match);
+}
+
+// Makes room for bucket in the histogram.
+static int histogram_grow(struct histogram *hist, uint64_t bucket) {
+	const size_t needle_count = hist->needle_count;
+	const uint64_t first = hist->bucket_count == 0 || bucket < hist->first ? bucket : hist->first;
+	const uint64_t last  = hist->bucket_count == 0 || bucket > hist->first + hist->bucket_count - 1 ?
+		bucket : hist->first + hist->bucket_count - 1;
+
+	if (last - first >= SIZE_MAX / sizeof(uint32_t) / needle_count) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	const size_t bucket_count = (size_t)(last - first) + 1;
+	if (bucket_count > hist->capacity) {
+		size_t capacity = hist->capacity ? hist->capacity : 64;
+		while (capacity < bucket_count) {
+			capacity = capacity > SIZE_MAX / 2 / sizeof(uint32_t) / needle_count ? bucket_count : capacity * 2;
+		}
+		uint32_t *counts = realloc(hist->counts, capacity * needle_count * sizeof(uint32_t));
+		if (!counts) {
+			return -1;
+		}
+		hist->counts   = counts;
+		hist->capacity = capacity;
+	}
+
+	// hits are mostly in offset order, but not all matchers guarantee it
+	const size_t shift = hist->bucket_count == 0 ? 0 : (size_t)(hist->first - first);
+	if (shift > 0) {
+		memmove(hist->counts + shift * needle_count, hist->counts, hist->bucket_count * needle_count * sizeof(uint32_t));
+		memset(hist->counts, 0, shift * needle_count * sizeof(uint32_t));
+	}
+	memset(hist->counts + (hist->bucket_count + shift) * needle_count, 0,
+		(bucket_count - hist->bucket_count - shift) * needle_count * sizeof(uint32_t));
+
+	hist->first        = first;
+	hist->bucket_count = bucket_count;
+
+	return 0;
+}
+
+static int count_hit(struct vs_options *options, const struct vs_needle *needle, size_t offset, size_t size) {
+	struct histogram *hist = options->histogram;
+
+	if (offset < options->report_from || offset >= options->report_to || offset + size <= options->report_past) {
+		return 0;
+	}
+
+	const uint64_t bucket = ((uint64_t)options->start + offset) / hist->bucket_size;
+	if (bucket % hist->sample != 0) {
+		// a match crossing into a sampled bucket
+		return 0;
+	}
+
+	if (bucket - hist->first >= hist->bucket_count && histogram_grow(hist, bucket) != 0) {
+		return -1;
+	}
+
+	++ hist->counts[(size_t)(bucket - hist->first) * hist->needle_count + (size_t)(needle - options->needles)];
+
+	if (options->stats) {
+		vs_stats_hit(options->stats, needle);
+	}
+
+	return 0;
+}
+
+static int count_offset(void *ctx, const struct vs_needle *needle, size_t offset) {
+	return count_hit((struct vs_options *)ctx, needle, offset, needle->size);
+}
+
+static int count_match(void *ctx, const struct vs_match *match) {
+	return count_hit((struct vs_options *)ctx, match->needle, match->offset, match->size);
+}
+
+// One line per bucket and needle with hits.
+static void print_histogram(struct vs_options *options) {
+	const struct histogram *hist = options->histogram;
+
+	if (options->stats) {
+		vs_stats_begin(options->stats, VS_PHASE_OUTPUT);
+	}
+
+	options->start = 0;
+	for (size_t bucket = 0; bucket < hist->bucket_count; ++ bucket) {
+		const uint32_t *counts = hist->counts + bucket * hist->needle_count;
+		for (size_t index = 0; index < hist->needle_count; ++ index) {
+			if (counts[index] == 0) {
+				continue;
+			}
+			const struct vs_match match = {
+				.needle = options->needles + index,
+				.offset = (size_t)((hist->first + bucket) * hist->bucket_size),
+				.size   = hist->bucket_size,
+				.hits   = counts[index],
+			};
+			if (options->output == VS_OUTPUT_NDJSON) {
+				print_ndjson(options, &match);
+			}
+			else {
+				print_formatted(options, &match);
+			}
+		}
+	}
+
+	if (options->stats) {
+		vs_stats_end(options->stats, VS_PHASE_OUTPUT);
+	}
+}
+
+static int parse_histogram(const char *str, struct histogram *hist) {
+	if (!*str || *str == '-') {
+		errno = EINVAL;
+		return -1;
+	}
+	char *endptr = NULL;
+	errno = 0;
+	const unsigned long long bucket_size = strtoull(str, &endptr, 10);
+	if (endptr == str || (*endptr && *endptr != ',') || bucket_size == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (errno != 0) return -1;
+
+	unsigned long long sample = 1;
+	if (*endptr == ',') {
+		const char *value = endptr + 1;
+		sample = strtoull(value, &endptr, 10);
+		if (endptr == value || *endptr || *value == '-' || sample == 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (errno != 0) return -1;
+	}
+
+	if (bucket_size > SIZE_MAX || sample > SIZE_MAX) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	hist->bucket_size = (size_t)bucket_size;
+	hist->sample      = (size_t)sample;
 
 	return 0;
 }
@@ -228,84 +938,1787 @@ static int parse_offset(const char *str, off_t *valueptr) {
 	return 0;
 }
 
-static int valuescan(const char *filename, int fd, int flags, off_t offset_start, off_t offset_end,
-                     const char *printfmt, char eol, const struct vs_needle *needles, size_t needle_count) {
-	struct stat st;
-
-	if (fstat(fd, &st) != 0) {
+static int parse_size(const char *str, size_t *valueptr) {
+	if (!*str || *str == '-') {
+		errno = EINVAL;
 		return -1;
 	}
-
-	if (S_ISDIR(st.st_mode)) {
-		errno = EISDIR;
+	char *endptr = NULL;
+	errno = 0;
+	unsigned long long int value = strtoull(str, &endptr, 10);
+	if (*endptr) {
+		errno = EINVAL;
 		return -1;
 	}
+	if (errno != 0) return -1;
+	if (value > SIZE_MAX) {
+		errno = ERANGE;
+		return -1;
+	}
+	if (valueptr) *valueptr = (size_t)value;
+	return 0;
+}
 
-	struct vs_options options = {
-		.printfmt = printfmt,
-		.filename = filename,
-		.start    = 0,
-		.end      = st.st_size,
-		.eol      = eol
-	};
-
-	if (flags & START_SET) {
-		if (offset_start < 0) {
-			if (-offset_start > st.st_size) {
-				errno = ERANGE;
-				return -1;
-			}
-			options.start = st.st_size - offset_start;
-		}
-		else {
-			options.start = offset_start;
+static int append_glob(const char ***globs, size_t *count, const char *glob) {
+	if (*count % 16 == 0) {
+		const char **buf = realloc(*globs, sizeof(char*) * (*count + 16));
+		if (!buf) {
+			errno = ENOMEM;
+			return -1;
 		}
+		*globs = buf;
 	}
+	(*globs)[(*count) ++] = glob;
+	return 0;
+}
 
-	if (flags & END_SET) {
-		if (offset_end < 0) {
-			if (-offset_end > st.st_size) {
-				errno = ERANGE;
-				return -1;
+static int add_needle(const char *arg, struct vs_needle **needlesptr, size_t *countptr, size_t *capacityptr) {
+	struct vs_needle group[VS_NEEDLE_GROUP_MAX];
+	size_t group_size = 1;
+	group[0] = (struct vs_needle){ 0, .ctx = (void*)arg };
+	if (vs_is_needle_group(arg) ?
+	    vs_parse_needle_group(arg, group, &group_size) != 0 :
+	    vs_parse_needle(arg, group) != 0) {
+		return -1;
+	}
+	if (*capacityptr - *countptr < group_size) {
+		const size_t capacity = *capacityptr + 32;
+		struct vs_needle *buf = realloc(*needlesptr, sizeof(struct vs_needle) * capacity);
+		if (!buf) {
+			for (size_t i = 0; i < group_size; ++ i) {
+				vs_free_needle(group + i);
 			}
-			options.end = st.st_size - offset_end;
-		}
-		else {
-			options.end = offset_end;
+			errno = ENOMEM;
+			return -1;
 		}
+		memset(buf + *countptr, 0, (capacity - *countptr) * sizeof(struct vs_needle));
+		*needlesptr  = buf;
+		*capacityptr = capacity;
 	}
+	memcpy(*needlesptr + *countptr, group, sizeof(struct vs_needle) * group_size);
+	*countptr += group_size;
+	return 0;
+}
 
-	if (sizeof(off_t) > sizeof(size_t) && (options.end - options.start) > (off_t)SIZE_MAX) {
-		errno = ERANGE;
+// Sorts needles biggest first and checks them against the search options.
+// Errors are printed to err.
+static int prepare_needles(const struct vs_options *options, struct vs_needle needles[], size_t needle_count,
+                           const uint8_t sample[], size_t sample_size, struct vs_plan **planptr, FILE *err) {
+	*planptr = NULL;
+
+	if ((options->block_size > 0) + (options->max_mismatches > 0) + (options->bit_orders != 0) > 1) {
+		fprintf(err, "*** error: only one of --block-hash, --max-mismatches and --bit-offsets can be used\n");
 		return -1;
 	}
 
-	long pagesize = sysconf(_SC_PAGE_SIZE);
-	if (pagesize < 0) {
-		return -1;
+	// biggest match first
+	qsort(needles, needle_count, sizeof(struct vs_needle), needle_size_cmp);
+
+	bool folded = false;
+	for (size_t i = 0; i < needle_count; ++ i) {
+		if (needles[i].fold) {
+			folded = true;
+			break;
+		}
 	}
 
-	const size_t haystack_size = (size_t)(options.end - options.start);
-	const size_t map_delta     = options.start % pagesize;
-	const off_t  map_offset    = options.start - map_delta;
-	const size_t map_size      = haystack_size + map_delta;
-	void *map_data = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, map_offset);
+	const bool delta  = has_needle_flag(needles, needle_count, VS_NEEDLE_DELTA);
+	const bool varint = has_needle_flag(needles, needle_count, VS_NEEDLE_VARINT);
 
-	if (map_data == MAP_FAILED) {
+	if (folded && (options->block_size > 0 || options->max_mismatches > 0 || options->bit_orders != 0)) {
+		fprintf(err, "*** error: case-insensitive needles can't be used with --block-hash, --max-mismatches or --bit-offsets\n");
 		return -1;
 	}
 
-	const uint8_t *haystack = ((const uint8_t *)map_data) + map_delta;
-	int status = vs_search(haystack, haystack_size, needles, needle_count, &options, &print_offset);
+	if ((delta || varint) && (options->block_size > 0 || options->max_mismatches > 0 || options->bit_orders != 0)) {
+		fprintf(err, "*** error: delta and varint needles can't be used with --block-hash, --max-mismatches or --bit-offsets\n");
+		return -1;
+	}
 
-	munmap(map_data, map_size);
+	// pick matchers for exact searches
+	if (!options->array_schema && !options->pointers_anywhere &&
+	    !options->bit_orders && !options->block_size && !options->max_mismatches) {
+		*planptr = vs_plan_create(needles, needle_count, sample, sample_size);
+		if (!*planptr) {
+			fprintf(err, "*** error: compiling needles: %s\n", strerror(errno));
+			return -1;
+		}
+	}
 
-	return status;
+	return 0;
+}
+
+// Reads the start of a regular, uncompressed file. Returns -1 if there is
+// nothing to sample.
+static ssize_t read_sample(const char *filename, bool decompress, uint8_t buf[], size_t size) {
+	struct stat st;
+	const int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		return -1;
+	}
+
+	ssize_t count = -1;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		count = pread(fd, buf, size, 0);
+		if (decompress && count > 0 && vs_detect_compression(buf, (size_t)count) != VS_UNCOMPRESSED) {
+			count = -1;
+		}
+	}
+	close(fd);
+
+	return count;
+}
+
+static void print_plan(const struct vs_options *options, const struct vs_plan *plan, const char *sample, size_t sample_size) {
+	if (options->array_schema) {
+		printf("engine: record arrays, stride %" PRIuSZ ", at least %" PRIuSZ " records, %" PRIuSZ " field%s\n",
+			options->array_schema->stride, options->array_schema->min_count, options->array_schema->field_count,
+			options->array_schema->field_count == 1 ? "" : "s");
+		return;
+	}
+
+	if (options->pointers) {
+		const struct vs_pointer_format *format = options->pointers;
+		printf("engine: pointers, %zu byte %s endian values every %zu bytes, base 0x%" PRIx64 ", density %g\n",
+			format->size, format->big_endian ? "big" : "little", format->align, format->base, format->min_density);
+		if (options->pointers_anywhere) {
+			printf("targets: every offset in the file\n");
+			return;
+		}
+		printf("targets:\n");
+	}
+
+	if (!plan) {
+		printf("engine: %s\n",
+			options->bit_orders ? "bit offsets" :
+			options->block_size > 0 ? "block hash" :
+			"approximate (shift-or and seeds)");
+		return;
+	}
+
+	if (sample) {
+		printf("byte frequencies: first %zu bytes of %s\n", sample_size, sample);
+	}
+	else {
+		printf("byte frequencies: static table\n");
+	}
+
+	const size_t group_count = vs_plan_group_count(plan);
+	for (size_t i = 0; i < group_count; ++ i) {
+		struct vs_plan_info info;
+		vs_plan_group_info(plan, i, &info);
+
+		printf("group %zu: %s, %zu needle%s, ", i + 1, vs_plan_engine_name(info.engine),
+			info.needle_count, info.needle_count == 1 ? "" : "s");
+		if (info.min_size == info.max_size) {
+			printf("%zu byte%s", info.min_size, info.min_size == 1 ? "" : "s");
+		}
+		else {
+			printf("%zu-%zu bytes", info.min_size, info.max_size);
+		}
+		printf(", %zu distinct first byte%s", info.first_bytes, info.first_bytes == 1 ? "" : "s");
+		if (info.engine == VS_ENGINE_ANCHOR) {
+			printf(", anchor at offset %zu (~%.3g matches per MiB)", info.anchor, info.anchor_frequency * 1024 * 1024);
+		}
+		putchar('\n');
+	}
+}
+
+// Two passes: the offsets of all needle matches are collected first, then
+// the values that point at one of them are looked up in batches.
+static int search_pointers(struct vs_options *options, const uint8_t haystack[], size_t haystack_size,
+                           const struct vs_needle *needles, size_t needle_count) {
+	struct pointer_search search = { options, NULL, 0, 0 };
+	size_t *offsets = NULL;
+	int status = 0;
+
+	if (!options->pointers_anywhere) {
+		status = options->plan ?
+			vs_plan_search(options->plan, haystack, haystack_size, &search, &collect_target) :
+			vs_search(haystack, haystack_size, needles, needle_count, &search, &collect_target);
+		if (status != 0 || search.count == 0) {
+			goto end;
+		}
+
+		bool sorted = true;
+		for (size_t index = 1; index < search.count && sorted; ++ index) {
+			sorted = search.targets[index - 1].offset <= search.targets[index].offset;
+		}
+		if (!sorted) {
+			qsort(search.targets, search.count, sizeof(struct pointer_target), pointer_target_cmp);
+		}
+
+		offsets = malloc(sizeof(size_t) * search.count);
+		if (!offsets) {
+			errno = ENOMEM;
+			status = -1;
+			goto end;
+		}
+
+		// of several needles matching at the same offset the first one is kept
+		size_t count = 0;
+		for (size_t index = 0; index < search.count; ++ index) {
+			if (count == 0 || offsets[count - 1] != search.targets[index].offset) {
+				offsets[count] = search.targets[index].offset;
+				search.targets[count] = search.targets[index];
+				++ count;
+			}
+		}
+		search.count = count;
+	}
+
+	// pointers are file offsets, values are aligned in the file
+	const size_t start = (size_t)options->start;
+	const size_t align = options->pointers->align ? options->pointers->align : options->pointers->size;
+	struct vs_pointer_format format = *options->pointers;
+	format.phase = (align - start % align) % align;
+	format.base += start;
+
+	status = vs_search_pointers(haystack, haystack_size, &format,
+		offsets, search.count, &search, &print_pointer);
+
+end:
+	free(offsets);
+	free(search.targets);
+
+	return status;
+}
+
+// Size of the longest possible match (needles are sorted biggest first).
+static size_t longest_match(const struct vs_needle needles[], size_t needle_count) {
+	// padded varints are longer than their needle
+	return has_needle_flag(needles, needle_count, VS_NEEDLE_VARINT) && needles[0].size < VS_LEB128_MAX_SIZE ?
+		VS_LEB128_MAX_SIZE : needles[0].size;
+}
+
+static int search_haystack(struct vs_options *options, const uint8_t haystack[], size_t haystack_size,
+                           const struct vs_needle *needles, size_t needle_count) {
+	// histograms count hits instead of printing them
+	const vs_match_callback on_match  = options->histogram ? &count_match  : &print_match;
+	const vs_callback       on_offset = options->histogram ? &count_offset : &print_offset;
+
+	return options->pointers ?
+		search_pointers(options, haystack, haystack_size, needles, needle_count) :
+		options->array_schema ?
+		vs_search_arrays(haystack, haystack_size, options->array_schema, options, &print_array) :
+		options->bit_orders ?
+		vs_search_bits(haystack, haystack_size, needles, needle_count, options->bit_orders, options, on_match) :
+		options->block_size > 0 ?
+		vs_search_blocks(haystack, haystack_size, needles, needle_count, options->block_size, options, on_match) :
+		options->max_mismatches > 0 ?
+		vs_search_approx(haystack, haystack_size, needles, needle_count, options->max_mismatches, options, on_match) :
+		options->plan ?
+		vs_plan_search(options->plan, haystack, haystack_size, options, on_offset) :
+		vs_search(haystack, haystack_size, needles, needle_count, options, on_offset);
+}
+
+typedef int (*search_function)(struct vs_options *options, const uint8_t haystack[], size_t haystack_size,
+                               const struct vs_needle *needles, size_t needle_count);
+
+// Searches [from, to) of the haystack with searcher, extended by lead_before
+// and lead_after bytes so that matches crossing into the neighbouring blocks
+// are found. Only matches that overlap [from, to) are reported.
+static int search_run(struct vs_options *options, const uint8_t haystack[], size_t haystack_size, size_t from, size_t to,
+                      size_t lead_before, size_t lead_after, const struct vs_needle *needles, size_t needle_count,
+                      search_function searcher) {
+	const size_t lead_from   = from > lead_before ? from - lead_before : 0;
+	const size_t report_from = lead_from > options->report_from ? lead_from : options->report_from;
+	const size_t report_to   = to < options->report_to ? to : options->report_to;
+
+	if (report_from >= report_to) {
+		return 0;
+	}
+
+	// room for the whole match and its context
+	const bool   context = options->context_before || options->context_after;
+	const size_t before  = context ? options->context_before + 16 : 0;
+	const size_t after   = lead_after + (context ? options->context_after + 16 : 0);
+	const size_t begin   = report_from > before ? report_from - before : 0;
+	const size_t end     = haystack_size - report_to > after ? report_to + after : haystack_size;
+
+	const off_t  start       = options->start;
+	size_t       context_end = options->context_end;
+	const size_t saved_from  = options->report_from;
+	const size_t saved_to    = options->report_to;
+	const size_t saved_past  = options->report_past;
+	const size_t report_past = from > saved_past ? from : saved_past;
+
+	options->start         = start + (off_t)begin;
+	options->haystack      = haystack + begin;
+	options->haystack_size = end - begin;
+	options->report_from   = report_from - begin;
+	options->report_to     = report_to - begin;
+	options->report_past   = report_past > begin ? report_past - begin : 0;
+	options->context_end   = context_end > begin ? context_end - begin : 0;
+
+	const int status = searcher(options, haystack + begin, end - begin, needles, needle_count);
+
+	if (options->context_end > 0 && begin + options->context_end > context_end) {
+		context_end = begin + options->context_end;
+	}
+	options->context_end   = context_end;
+	options->start         = start;
+	options->haystack      = haystack;
+	options->haystack_size = haystack_size;
+	options->report_from   = saved_from;
+	options->report_to     = saved_to;
+	options->report_past   = saved_past;
+
+	return status;
+}
+
+// Byte histograms of whole batches of blocks are computed ahead of the
+// search, runs of blocks that aren't above the entropy threshold are searched.
+#define ENTROPY_BATCH 1024
+
+static int search_low_entropy(struct vs_options *options, const uint8_t haystack[], size_t haystack_size,
+                              const struct vs_needle *needles, size_t needle_count) {
+	struct vs_entropy_skip *skip = options->skip_entropy;
+	const size_t block_size = skip->block_size;
+	const size_t lead = longest_match(needles, needle_count) + (options->bit_orders ? 1 : 0);
+
+	float entropies[ENTROPY_BATCH];
+	size_t run_start = SIZE_MAX;
+	size_t run_end   = 0; // of the last run searched
+	int status = 0;
+	for (size_t batch = 0; batch < haystack_size && status == 0; batch += ENTROPY_BATCH * block_size) {
+		const size_t batch_size = haystack_size - batch < ENTROPY_BATCH * block_size ?
+			haystack_size - batch : ENTROPY_BATCH * block_size;
+
+		if (vs_block_entropy(haystack + batch, batch_size, block_size, entropies) != 0) {
+			return -1;
+		}
+
+		for (size_t offset = batch, index = 0; offset < batch + batch_size && status == 0; offset += block_size, ++ index) {
+			if (entropies[index] <= skip->threshold) {
+				if (run_start == SIZE_MAX) {
+					run_start = offset;
+				}
+				continue;
+			}
+
+			if (run_start != SIZE_MAX) {
+				// matches starting before the end of the last run were reported by it
+				const size_t lead_before = run_start - run_end < lead ? run_start - run_end : lead;
+				status = search_run(options, haystack, haystack_size, run_start, offset, lead_before, lead,
+				                    needles, needle_count, &search_haystack);
+				run_start = SIZE_MAX;
+				run_end   = offset;
+			}
+
+			// only count what this window reports, stream windows overlap
+			const size_t block_end = haystack_size - offset < block_size ? haystack_size : offset + block_size;
+			const size_t from = offset > options->report_from ? offset : options->report_from;
+			const size_t to   = block_end < options->report_to ? block_end : options->report_to;
+			if (from < to) {
+				skip->skipped += to - from;
+			}
+		}
+	}
+
+	if (run_start != SIZE_MAX && status == 0) {
+		const size_t lead_before = run_start - run_end < lead ? run_start - run_end : lead;
+		status = search_run(options, haystack, haystack_size, run_start, haystack_size, lead_before, lead,
+		                    needles, needle_count, &search_haystack);
+	}
+
+	return status;
+}
+
+// Searches every sample-th histogram bucket. Buckets are aligned to file
+// offsets, so windows of a stream sample the same buckets.
+static int search_sampled(struct vs_options *options, const uint8_t haystack[], size_t haystack_size,
+                          const struct vs_needle *needles, size_t needle_count) {
+	const struct histogram *hist = options->histogram;
+	const uint64_t bucket_size = hist->bucket_size;
+	const uint64_t start = (uint64_t)options->start;
+	const uint64_t end   = start + haystack_size;
+	const size_t   lead  = longest_match(needles, needle_count) + (options->bit_orders ? 1 : 0);
+
+	uint64_t bucket = start / bucket_size;
+	bucket += (hist->sample - bucket % hist->sample) % hist->sample;
+
+	uint64_t last_to = start; // end of the last bucket searched
+	int status = 0;
+	for (; bucket * bucket_size < end && status == 0; bucket += hist->sample) {
+		const uint64_t from = bucket * bucket_size > start ? bucket * bucket_size : start;
+		const uint64_t to   = end - bucket * bucket_size > bucket_size ? (bucket + 1) * bucket_size : end;
+		// matches starting before the end of the last bucket were counted there
+		const size_t lead_before = from - last_to < lead ? (size_t)(from - last_to) : lead;
+		status = search_run(options, haystack, haystack_size, (size_t)(from - start), (size_t)(to - start), lead_before, lead,
+		                    needles, needle_count, &search_haystack);
+		last_to = to;
+	}
+
+	return status;
+}
+
+static int search(struct vs_options *options, const uint8_t haystack[], size_t haystack_size,
+                  const struct vs_needle *needles, size_t needle_count) {
+	return options->histogram && options->histogram->sample > 1 ?
+		search_sampled(options, haystack, haystack_size, needles, needle_count) :
+		options->skip_entropy ?
+		search_low_entropy(options, haystack, haystack_size, needles, needle_count) :
+		search_haystack(options, haystack, haystack_size, needles, needle_count);
+}
+
+// Searches the mapped haystack chunk by chunk. Before each chunk the cursor of
+// the prefetcher is moved, pages that weren't cached before are dropped and
+// the throttle is waited for (each of them optional). Chunks are aligned in
+// the mapping, which starts map_delta bytes before the haystack. If the
+// haystack was already read into memory (and throttled while it was read) only
+// the CPU share is enforced.
+static int search_paced(struct vs_options *options, struct vs_prefetcher *prefetcher, struct vs_page_dropper *dropper,
+                        size_t map_delta, bool in_memory, const uint8_t haystack[], size_t haystack_size,
+                        const struct vs_needle *needles, size_t needle_count) {
+	const size_t lead   = longest_match(needles, needle_count) + (options->bit_orders ? 1 : 0);
+	const size_t behind = options->context_before + 16;
+
+	int status = 0;
+	size_t from = 0;
+	while (from < haystack_size && status == 0) {
+		const size_t end = ((map_delta + from) / VS_PREFETCH_CHUNK + 1) * VS_PREFETCH_CHUNK - map_delta;
+		const size_t to  = end < haystack_size ? end : haystack_size;
+
+		if (prefetcher) {
+			vs_prefetch_advance(prefetcher, map_delta + (from > behind ? from - behind : 0));
+		}
+		if (dropper && vs_page_dropper_next(dropper) != 0) {
+			return -1;
+		}
+		if (options->throttle && vs_throttle_wait(options->throttle, in_memory ? 0 : to - from) != 0) {
+			return -1;
+		}
+
+		status = search_run(options, haystack, haystack_size, from, to, 0, lead, needles, needle_count, &search);
+		from = to;
+	}
+
+	return status;
+}
+
+// Searches the decompressed stream window by window. Offsets are offsets
+// in the decompressed stream.
+static int search_stream(struct vs_options *options, enum vs_compression compression, const uint8_t input[], size_t input_size,
+                         const struct vs_needle *needles, size_t needle_count) {
+	struct vs_stats *stats = options->stats;
+
+	if (options->array_schema || options->pointers) {
+		// arrays would be cut at window boundaries, pointers can point anywhere
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	// Matches starting in the last hold bytes of a window are left to the next
+	// window, where the whole match (needles are sorted biggest first, plus one
+	// byte for bit offsets) and its context is available.
+	const bool   context = options->context_before || options->context_after;
+	const size_t hold    = longest_match(needles, needle_count) + 1 + options->context_after + (context ? 16 : 0);
+	const size_t overlap = hold + options->context_before + (context ? 16 : 0);
+
+	struct vs_inflater *inflater = vs_inflate_start(compression, input, input_size, overlap);
+	if (!inflater) {
+		return -1;
+	}
+
+	if (stats) {
+		vs_stats_begin(stats, VS_PHASE_SEARCH);
+	}
+
+	options->start       = 0;
+	options->context_end = 0;
+
+	const uint8_t *window;
+	size_t window_size = 0;
+	size_t tail_size   = 0;
+	uint64_t offset    = 0;
+	bool last = false;
+	int status = 0;
+	while ((window = vs_inflate_next(inflater, &window_size, &tail_size, &offset, &last))) {
+		const uint64_t context_end = (uint64_t)options->start + options->context_end;
+
+		options->start         = (off_t)offset;
+		options->end           = (off_t)(offset + window_size);
+		options->haystack      = window;
+		options->haystack_size = window_size;
+		options->report_from   = tail_size > hold ? tail_size - hold : 0;
+		options->report_to     = last ? window_size : window_size > hold ? window_size - hold : 0;
+		options->context_end   = context_end > offset ? (size_t)(context_end - offset) : 0;
+
+		if (stats) {
+			stats->bytes += window_size - tail_size;
+		}
+
+		if (options->throttle && vs_throttle_wait(options->throttle, window_size - tail_size) != 0) {
+			status = -1;
+			break;
+		}
+
+		status = search(options, window, window_size, needles, needle_count);
+		if (status != 0) {
+			break;
+		}
+	}
+
+	const int errnum = errno;
+	if (vs_inflate_finish(inflater) != 0) {
+		status = -1;
+	}
+	else if (status != 0) {
+		errno = errnum;
+	}
+
+	options->report_from = 0;
+	options->report_to   = SIZE_MAX;
+
+	if (stats) {
+		vs_stats_end(stats, VS_PHASE_SEARCH);
+	}
+
+	return status;
+}
+
+static int valuescan_compressed(int fd, enum vs_compression compression, const struct stat *st,
+                                struct vs_options *options, const struct vs_needle *needles, size_t needle_count) {
+	if (options->carver) {
+		fprintf(stderr, "*** warning: %s: can't carve from compressed input\n",
+			options->filename ? options->filename : "stdin");
+		options->carver = NULL;
+	}
+
+	if (sizeof(off_t) > sizeof(size_t) && st->st_size > (off_t)SIZE_MAX) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	const size_t input_size = (size_t)st->st_size;
+	void *input = mmap(NULL, input_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (input == MAP_FAILED) {
+		return -1;
+	}
+	madvise(input, input_size, MADV_SEQUENTIAL);
+
+	if (options->stats) {
+		++ options->stats->files;
+	}
+
+	const int status = search_stream(options, compression, input, input_size, needles, needle_count);
+
+	const int errnum = errno;
+	munmap(input, input_size);
+	errno = errnum;
+
+	return status;
+}
+
+struct archive_scan {
+	struct vs_options *options;
+	const struct vs_needle *needles;
+	size_t needle_count;
+	bool   failed;
+};
+
+static int scan_member(void *ctx, const struct vs_archive_member *member) {
+	struct archive_scan *scan = ctx;
+	struct vs_options *options = scan->options;
+	struct vs_stats *stats = options->stats;
+	const char *filename = options->filename ? options->filename : "stdin";
+
+	if (member->unsupported) {
+		fprintf(options->err, "*** warning: %s!%s: %s, skipped\n", filename, member->name, member->unsupported);
+		return 0;
+	}
+
+	if (member->compression != VS_UNCOMPRESSED && !vs_can_decompress(member->compression)) {
+		fprintf(options->err, "*** warning: %s!%s: built without zlib, skipped\n", filename, member->name);
+		return 0;
+	}
+
+	options->member = member->name;
+
+	int status = 0;
+	if (member->compression != VS_UNCOMPRESSED) {
+		status = search_stream(options, member->compression, member->data, member->size, scan->needles, scan->needle_count);
+	}
+	else if (member->size > 0) {
+		if (stats) {
+			stats->bytes += member->size;
+			vs_stats_begin(stats, VS_PHASE_SEARCH);
+		}
+
+		options->start         = 0;
+		options->end           = (off_t)member->size;
+		options->haystack      = member->data;
+		options->haystack_size = member->size;
+		options->context_end   = 0;
+
+		status = options->throttle ?
+			search_paced(options, NULL, NULL, 0, false, member->data, member->size, scan->needles, scan->needle_count) :
+			search(options, member->data, member->size, scan->needles, scan->needle_count);
+
+		if (stats) {
+			vs_stats_end(stats, VS_PHASE_SEARCH);
+		}
+	}
+
+	options->member = NULL;
+
+	if (status != 0) {
+		fprintf(options->err, "*** error: %s!%s: %s\n", filename, member->name, strerror(errno));
+		if (errno != EIO) {
+			return -1;
+		}
+		// a broken member doesn't stop the rest of the archive
+		scan->failed = true;
+	}
+
+	return 0;
+}
+
+// Offsets of archive members are offsets in the (decompressed) member.
+static int search_archive(struct vs_options *options, enum vs_archive_type type, const uint8_t data[], size_t size,
+                          const struct vs_needle *needles, size_t needle_count) {
+	struct archive_scan scan = {
+		.options      = options,
+		.needles      = needles,
+		.needle_count = needle_count,
+		.failed       = false,
+	};
+	int status = vs_archive_walk(type, data, size, &scan, &scan_member);
+	if (status == 0 && scan.failed) {
+		errno  = EIO;
+		status = -1;
+	}
+	return status;
+}
+
+static int valuescan_archive(int fd, enum vs_archive_type type, const struct stat *st,
+                             struct vs_options *options, const struct vs_needle *needles, size_t needle_count) {
+	if (options->carver) {
+		fprintf(stderr, "*** warning: %s: can't carve from archive members\n",
+			options->filename ? options->filename : "stdin");
+		options->carver = NULL;
+	}
+
+	if (sizeof(off_t) > sizeof(size_t) && st->st_size > (off_t)SIZE_MAX) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	const size_t size = (size_t)st->st_size;
+	void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		return -1;
+	}
+
+	if (options->stats) {
+		++ options->stats->files;
+	}
+
+	const int status = search_archive(options, type, data, size, needles, needle_count);
+
+	const int errnum = errno;
+	munmap(data, size);
+	errno = errnum;
+
+	return status;
+}
+
+// Sets options->start and options->end from -s/-e (negative offsets count
+// from the end of the file).
+static int resolve_range(int flags, off_t offset_start, off_t offset_end, off_t file_size, struct vs_options *options) {
+	options->start = 0;
+	options->end   = file_size;
+
+	if (flags & START_SET) {
+		if (offset_start < 0) {
+			if (-offset_start > file_size) {
+				errno = ERANGE;
+				return -1;
+			}
+			options->start = file_size + offset_start;
+		}
+		else {
+			options->start = offset_start;
+		}
+	}
+
+	if (flags & END_SET) {
+		if (offset_end < 0) {
+			if (-offset_end > file_size) {
+				errno = ERANGE;
+				return -1;
+			}
+			options->end = file_size + offset_end;
+		}
+		else {
+			options->end = offset_end;
+		}
+	}
+
+	if (sizeof(off_t) > sizeof(size_t) && (options->end - options->start) > (off_t)SIZE_MAX) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	return 0;
+}
+
+#define THROTTLED_READ_SIZE (64 * 1024)
+
+// Pipes, sockets and character devices can't be mapped, so they are read into
+// memory and searched from there.
+static int valuescan_unmappable(int fd, int flags, off_t offset_start, off_t offset_end,
+                                struct vs_options *options, const struct vs_needle *needles, size_t needle_count) {
+	struct vs_stats *stats = options->stats;
+
+	if (options->carver) {
+		fprintf(stderr, "*** warning: %s: can't carve from input that can't be read twice\n",
+			options->filename ? options->filename : "stdin");
+		options->carver = NULL;
+	}
+
+	if (stats) {
+		vs_stats_begin(stats, VS_PHASE_MAP);
+	}
+
+	uint8_t *data = NULL;
+	size_t size = 0;
+	size_t capacity = 0;
+	for (;;) {
+		if (size == capacity) {
+			const size_t new_capacity = capacity ? capacity * 2 : 1024 * 1024;
+			uint8_t *new_data = new_capacity > capacity ? realloc(data, new_capacity) : NULL;
+			if (!new_data) {
+				free(data);
+				errno = ENOMEM;
+				return -1;
+			}
+			data     = new_data;
+			capacity = new_capacity;
+		}
+
+		// throttled reads are kept small, so the wait after each of them is short
+		const size_t max_count = options->throttle && capacity - size > THROTTLED_READ_SIZE ? THROTTLED_READ_SIZE : capacity - size;
+		const ssize_t count = read(fd, data + size, max_count);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			const int errnum = errno;
+			free(data);
+			errno = errnum;
+			return -1;
+		}
+		if (count == 0) {
+			break;
+		}
+		size += (size_t)count;
+
+		if (options->throttle && vs_throttle_wait(options->throttle, (size_t)count) != 0) {
+			const int errnum = errno;
+			free(data);
+			errno = errnum;
+			return -1;
+		}
+	}
+
+	if (stats) {
+		vs_stats_end(stats, VS_PHASE_MAP);
+	}
+
+	int status = 0;
+	const enum vs_compression compression = options->decompress && size >= VS_COMPRESSION_MAGIC_SIZE ?
+		vs_detect_compression(data, VS_COMPRESSION_MAGIC_SIZE) : VS_UNCOMPRESSED;
+
+	if (compression != VS_UNCOMPRESSED && vs_can_decompress(compression)) {
+		if (flags & (START_SET | END_SET)) {
+			errno  = ENOTSUP;
+			status = -1;
+		}
+		else {
+			if (stats) {
+				++ stats->files;
+			}
+			status = search_stream(options, compression, data, size, needles, needle_count);
+		}
+	}
+	else if (resolve_range(flags, offset_start, offset_end, (off_t)size, options) != 0) {
+		status = -1;
+	}
+	else {
+		if (options->end > (off_t)size) {
+			options->end = (off_t)size;
+		}
+		if (options->start > options->end) {
+			options->start = options->end;
+		}
+		const size_t haystack_size = (size_t)(options->end - options->start);
+		const uint8_t *haystack = data + options->start;
+
+		if (stats) {
+			stats->bytes += haystack_size;
+			++ stats->files;
+			vs_stats_begin(stats, VS_PHASE_SEARCH);
+		}
+
+		options->haystack      = haystack;
+		options->haystack_size = haystack_size;
+		options->context_end   = 0;
+
+		status = options->throttle ?
+			search_paced(options, NULL, NULL, 0, true, haystack, haystack_size, needles, needle_count) :
+			search(options, haystack, haystack_size, needles, needle_count);
+
+		if (stats) {
+			vs_stats_end(stats, VS_PHASE_SEARCH);
+		}
+	}
+
+	const int errnum = errno;
+	free(data);
+	errno = errnum;
+
+	return status;
+}
+
+static int valuescan_cached(const char *filename, int fd, int flags, off_t offset_start, off_t offset_end, const struct stat *st,
+                            const struct vs_options *defaults, const struct vs_needle *needles, size_t needle_count);
+
+static int valuescan_histogram(const char *filename, int fd, int flags, off_t offset_start, off_t offset_end,
+                               const struct vs_options *defaults, const struct vs_needle *needles, size_t needle_count);
+
+static int valuescan(const char *filename, int fd, int flags, off_t offset_start, off_t offset_end,
+                     const struct vs_options *defaults, const struct vs_needle *needles, size_t needle_count) {
+	struct vs_stats *stats = defaults->stats;
+	struct stat st;
+
+	if (fstat(fd, &st) != 0) {
+		return -1;
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		errno = EISDIR;
+		return -1;
+	}
+
+	// (cache_entry is set when valuescan_cached() scans a file itself)
+	if (defaults->cache && !defaults->cache_entry && S_ISREG(st.st_mode)) {
+		return valuescan_cached(filename, fd, flags, offset_start, offset_end, &st, defaults, needles, needle_count);
+	}
+
+	if (defaults->histogram && !defaults->histogram->active) {
+		return valuescan_histogram(filename, fd, flags, offset_start, offset_end, defaults, needles, needle_count);
+	}
+
+	struct vs_options options = *defaults;
+	options.filename = filename;
+
+	if (!S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode)) {
+		return valuescan_unmappable(fd, flags, offset_start, offset_end, &options, needles, needle_count);
+	}
+
+	// st_size is 0 for block devices
+	const off_t file_size = S_ISBLK(st.st_mode) ? lseek(fd, 0, SEEK_END) : st.st_size;
+	if (file_size < 0) {
+		return -1;
+	}
+
+	if (options.archives && S_ISREG(st.st_mode) && st.st_size >= 4) {
+		uint8_t header[512];
+		const ssize_t header_size = pread(fd, header, sizeof(header), 0);
+		const enum vs_archive_type type = header_size > 0 ?
+			vs_detect_archive(header, (size_t)header_size) : VS_NOT_ARCHIVE;
+
+		if (type != VS_NOT_ARCHIVE) {
+			if (flags & (START_SET | END_SET)) {
+				errno = ENOTSUP;
+				return -1;
+			}
+			return valuescan_archive(fd, type, &st, &options, needles, needle_count);
+		}
+	}
+
+	if (options.decompress && S_ISREG(st.st_mode) && st.st_size >= VS_COMPRESSION_MAGIC_SIZE) {
+		uint8_t magic[VS_COMPRESSION_MAGIC_SIZE];
+		const enum vs_compression compression =
+			pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) ?
+			vs_detect_compression(magic, sizeof(magic)) : VS_UNCOMPRESSED;
+
+		if (compression != VS_UNCOMPRESSED && vs_can_decompress(compression)) {
+			if (flags & (START_SET | END_SET)) {
+				errno = ENOTSUP;
+				return -1;
+			}
+			return valuescan_compressed(fd, compression, &st, &options, needles, needle_count);
+		}
+	}
+
+	if (resolve_range(flags, offset_start, offset_end, file_size, &options) != 0) {
+		return -1;
+	}
+
+	long pagesize = sysconf(_SC_PAGE_SIZE);
+	if (pagesize < 0) {
+		return -1;
+	}
+
+	const size_t haystack_size = (size_t)(options.end - options.start);
+
+	if (haystack_size == 0) {
+		// empty file: nothing to scan and mmap() rejects empty mappings
+		return 0;
+	}
+
+	const size_t map_delta     = options.start % pagesize;
+	const off_t  map_offset    = options.start - map_delta;
+	const size_t map_size      = haystack_size + map_delta;
+
+	if (stats) {
+		vs_stats_begin(stats, VS_PHASE_MAP);
+	}
+
+	int map_flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+	if (options.populate) {
+		map_flags |= MAP_POPULATE;
+	}
+#endif
+	void *map_data = mmap(NULL, map_size, PROT_READ, map_flags, fd, map_offset);
+
+	if (stats) {
+		vs_stats_end(stats, VS_PHASE_MAP);
+	}
+
+	if (map_data == MAP_FAILED) {
+		return -1;
+	}
+
+#ifdef MADV_HUGEPAGE
+	if (options.hugepages) {
+		// only takes effect where the kernel supports huge pages of file data
+		madvise(map_data, map_size, MADV_HUGEPAGE);
+	}
+#endif
+
+	// small files are read ahead by the kernel anyway
+	struct vs_prefetcher prefetcher;
+	const bool prefetch = options.prefetch > 0 && haystack_size > VS_PREFETCH_CHUNK &&
+		vs_prefetch_start(&prefetcher, map_data, map_size, options.prefetch) == 0;
+
+	struct vs_page_dropper dropper;
+	const bool drop = options.nice_io && S_ISREG(st.st_mode) &&
+		vs_page_dropper_start(&dropper, fd, map_data, map_offset, map_size, VS_PREFETCH_CHUNK) == 0;
+
+	if (stats) {
+		stats->bytes += haystack_size;
+		++ stats->files;
+		vs_stats_begin(stats, VS_PHASE_SEARCH);
+	}
+
+	const uint8_t *haystack = ((const uint8_t *)map_data) + map_delta;
+	options.haystack      = haystack;
+	options.haystack_size = haystack_size;
+	options.context_end   = 0;
+
+	int status = prefetch || drop || options.throttle ?
+		search_paced(&options, prefetch ? &prefetcher : NULL, drop ? &dropper : NULL, map_delta, false,
+		             haystack, haystack_size, needles, needle_count) :
+		search(&options, haystack, haystack_size, needles, needle_count);
+
+	if (prefetch) {
+		vs_prefetch_stop(&prefetcher);
+	}
+
+	if (drop) {
+		vs_page_dropper_stop(&dropper);
+	}
+
+	if (stats) {
+		vs_stats_end(stats, VS_PHASE_SEARCH);
+		vs_stats_begin(stats, VS_PHASE_MAP);
+	}
+
+	munmap(map_data, map_size);
+
+	if (stats) {
+		vs_stats_end(stats, VS_PHASE_MAP);
+	}
+
+	// carve what was found even if the search stopped early
+	if (options.carver) {
+		const int errnum = errno;
+		if (vs_carve_run(options.carver, fd, filename) != 0) {
+			status = -1;
+		}
+		else if (status != 0) {
+			errno = errnum;
+		}
+	}
+
+	return status;
+}
+
+static int map_snapshot(const char *filename, const uint8_t **dataptr, size_t *sizeptr) {
+	int fd = open(filename, O_RDONLY, 0644);
+	if (fd == -1) {
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		goto error;
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		errno = EISDIR;
+		goto error;
+	}
+
+	if (sizeof(off_t) > sizeof(size_t) && st.st_size > (off_t)SIZE_MAX) {
+		errno = ERANGE;
+		goto error;
+	}
+
+	const size_t size = (size_t)st.st_size;
+	void *data = NULL;
+	if (size > 0) {
+		data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			goto error;
+		}
+		madvise(data, size, MADV_SEQUENTIAL);
+	}
+
+	close(fd);
+	*dataptr = data;
+	*sizeptr = size;
+	return 0;
+
+error:
+	{
+		const int errnum = errno;
+		close(fd);
+		errno = errnum;
+	}
+	return -1;
+}
+
+static int print_difference(void *ctx, size_t offset, size_t size) {
+	struct vs_options *options = (struct vs_options *)ctx;
+	const struct vs_match match = {
+		.needle        = options->diff->after ? options->diff->after : options->needles,
+		.offset        = offset,
+		.size          = size,
+		.needle_offset = 0,
+		.mismatches    = 0,
+	};
+	return print_match(ctx, &match);
+}
+
+// Replaces a mapped compressed snapshot by its decompressed contents (in
+// allocated memory). Snapshots are compared at the same offsets, which
+// can't be done window by window when the two decompress at different rates.
+static int inflate_snapshot(const uint8_t **dataptr, size_t *sizeptr, bool *inflatedptr) {
+	const uint8_t *input = *dataptr;
+	const size_t input_size = *sizeptr;
+
+	const enum vs_compression compression = input_size >= VS_COMPRESSION_MAGIC_SIZE ?
+		vs_detect_compression(input, VS_COMPRESSION_MAGIC_SIZE) : VS_UNCOMPRESSED;
+
+	if (compression == VS_UNCOMPRESSED) {
+		return 0;
+	}
+
+	if (!vs_can_decompress(compression)) {
+		// comparing compressed bytes would report meaningless offsets
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	struct vs_inflater *inflater = vs_inflate_start(compression, input, input_size, 0);
+	if (!inflater) {
+		return -1;
+	}
+
+	uint8_t *data = NULL;
+	size_t size = 0;
+	size_t capacity = 0;
+	const uint8_t *window;
+	size_t window_size = 0;
+	size_t tail_size   = 0;
+	uint64_t offset    = 0;
+	bool last = false;
+	while ((window = vs_inflate_next(inflater, &window_size, &tail_size, &offset, &last))) {
+		const size_t count = window_size - tail_size;
+		if (capacity - size < count) {
+			size_t new_capacity = capacity ? capacity : 1024 * 1024;
+			while (new_capacity - size < count && new_capacity <= SIZE_MAX / 2) {
+				new_capacity *= 2;
+			}
+			uint8_t *new_data = new_capacity - size >= count ? realloc(data, new_capacity) : NULL;
+			if (!new_data) {
+				vs_inflate_finish(inflater);
+				free(data);
+				errno = ENOMEM;
+				return -1;
+			}
+			data     = new_data;
+			capacity = new_capacity;
+		}
+		memcpy(data + size, window + tail_size, count);
+		size += count;
+	}
+
+	if (vs_inflate_finish(inflater) != 0) {
+		const int errnum = errno;
+		free(data);
+		errno = errnum;
+		return -1;
+	}
+
+	munmap((void*)input, input_size);
+	*dataptr    = data;
+	*sizeptr    = size;
+	*inflatedptr = true;
+
+	return 0;
+}
+
+// --diff: both snapshots are mapped and walked in lockstep. Matches are
+// reported as matches in the second one.
+static int diff_files(struct vs_options *options, const char *before_name, const char *after_name) {
+	struct vs_stats *stats = options->stats;
+	const uint8_t *before = NULL;
+	const uint8_t *after  = NULL;
+	size_t before_size = 0;
+	size_t after_size  = 0;
+	bool before_inflated = false;
+	bool after_inflated  = false;
+	int status = -1;
+
+	if (map_snapshot(before_name, &before, &before_size) != 0 ||
+	    (options->decompress && inflate_snapshot(&before, &before_size, &before_inflated) != 0)) {
+		perror(before_name);
+		goto end;
+	}
+
+	if (map_snapshot(after_name, &after, &after_size) != 0 ||
+	    (options->decompress && inflate_snapshot(&after, &after_size, &after_inflated) != 0)) {
+		perror(after_name);
+		goto end;
+	}
+
+	const size_t size = before_size < after_size ? before_size : after_size;
+	if (before_size != after_size) {
+		fprintf(stderr, "*** warning: %s and %s differ in size, comparing the first %" PRIuSZ " bytes\n",
+			before_name, after_name, size);
+	}
+
+	options->filename      = after_name;
+	options->file_id       = 1;
+	options->start         = 0;
+	options->end           = (off_t)size;
+	options->haystack      = after;
+	options->haystack_size = size;
+	options->context_end   = 0;
+
+	if (stats) {
+		stats->bytes += size;
+		stats->files += 2;
+		vs_stats_begin(stats, VS_PHASE_SEARCH);
+	}
+
+	status = vs_search_diff(before, after, size, options->diff, options, &print_difference);
+	if (status != 0) {
+		perror(after_name);
+	}
+
+	if (stats) {
+		vs_stats_end(stats, VS_PHASE_SEARCH);
+	}
+
+end:
+	if (before_inflated) {
+		free((void*)before);
+	}
+	else if (before_size > 0 && before) {
+		munmap((void*)before, before_size);
+	}
+	if (after_inflated) {
+		free((void*)after);
+	}
+	else if (after_size > 0 && after) {
+		munmap((void*)after, after_size);
+	}
+
+	return status;
+}
+
+// Counts the hits of a file and prints its histogram once the file is scanned
+// (also if the scan stopped early).
+static int valuescan_histogram(const char *filename, int fd, int flags, off_t offset_start, off_t offset_end,
+                               const struct vs_options *defaults, const struct vs_needle *needles, size_t needle_count) {
+	struct histogram *hist = defaults->histogram;
+	struct vs_options options = *defaults;
+
+	hist->bucket_count = 0;
+	hist->active       = true;
+
+	int status = valuescan(filename, fd, flags, offset_start, offset_end, &options, needles, needle_count);
+
+	hist->active = false;
+
+	const int errnum = errno;
+	options.filename = filename;
+	print_histogram(&options);
+	errno = errnum;
+
+	return status;
+}
+
+// Replays the matches of an unchanged file from the result cache without
+// reading it, or scans it and stores its matches.
+static int valuescan_cached(const char *filename, int fd, int flags, off_t offset_start, off_t offset_end, const struct stat *st,
+                            const struct vs_options *defaults, const struct vs_needle *needles, size_t needle_count) {
+	const struct result_cache *cache = defaults->cache;
+	struct vs_options options = *defaults;
+	struct vs_cache_entry entry = {
+		.matches  = NULL,
+		.count    = 0,
+		.capacity = 0,
+		// padded varints don't have the size of their needle
+		.extended = options.max_mismatches > 0 || options.block_size > 0 || options.bit_orders != 0 ||
+		            has_needle_flag(needles, needle_count, VS_NEEDLE_VARINT),
+	};
+	const struct vs_cache_key key = {
+		.dev          = (uint64_t)st->st_dev,
+		.ino          = (uint64_t)st->st_ino,
+		.size         = (uint64_t)st->st_size,
+		.mtime_sec    = (int64_t)st->st_mtim.tv_sec,
+		.mtime_nsec   = (int64_t)st->st_mtim.tv_nsec,
+		.range_flags  = (uint32_t)flags,
+		.range_start  = flags & START_SET ? (int64_t)offset_start : 0,
+		.range_end    = flags & END_SET   ? (int64_t)offset_end   : 0,
+		.needles_hash = cache->needles_hash,
+	};
+	const char *name = filename ? filename : "stdin";
+
+	int status = vs_cache_load(cache->dir, &key, &entry);
+	if (status < 0) {
+		fprintf(stderr, "*** warning: %s: reading result cache: %s\n", name, strerror(errno));
+	}
+	else if (status > 0) {
+		options.filename      = filename;
+		options.start         = 0;
+		options.end           = st->st_size;
+		options.haystack      = NULL;
+		options.haystack_size = 0;
+
+		if (options.stats) {
+			++ options.stats->files;
+		}
+
+		status = 0;
+		for (size_t index = 0; index < entry.count; ++ index) {
+			const struct vs_cache_match *cached = entry.matches + index;
+			if (cached->needle >= needle_count || cached->offset > SIZE_MAX) {
+				errno  = EINVAL;
+				status = -1;
+				break;
+			}
+			const struct vs_needle *needle = cache->by_rank[cached->needle];
+			const struct vs_match match = {
+				.needle        = needle,
+				.offset        = (size_t)cached->offset,
+				.size          = entry.extended ? cached->size : needle->size,
+				.needle_offset = cached->needle_offset,
+				.mismatches    = cached->mismatches,
+				.bit           = cached->bit,
+				.bit_order     = (enum vs_bit_order)cached->bit_order,
+			};
+			status = print_match(&options, &match);
+			if (status != 0) {
+				break;
+			}
+		}
+
+		vs_cache_clear(&entry);
+		return status;
+	}
+
+	options.cache_entry = &entry;
+	status = valuescan(filename, fd, flags, offset_start, offset_end, &options, needles, needle_count);
+
+	// only complete results are stored
+	if (status == 0 && vs_cache_store(cache->dir, &key, &entry) != 0) {
+		fprintf(stderr, "*** warning: %s: writing result cache: %s\n", name, strerror(errno));
+	}
+
+	vs_cache_clear(&entry);
+	return status;
+}
+
+// ---- serve mode ----
+
+#define SERVE_NEEDLE_SETS    32
+#define SERVE_DEFAULT_MAPPINGS 256
+
+// Identity of a file: needle when its set was built. Mapped needles must not
+// outlive their file's size and compiled plans must not outlive its contents.
+struct needle_file {
+	char    *path;
+	dev_t    dev;
+	ino_t    ino;
+	off_t    size;
+	struct timespec mtime;
+};
+
+// Needles parsed and compiled for one request, reused by later requests with
+// the same needles and search options as long as their files didn't change.
+struct needle_set {
+	char    *key;     // search options and needle arguments
+	char    *labels;  // copy of the needle arguments the needles' ctx point into
+	struct vs_needle *needles;
+	size_t   needle_count;
+	struct vs_plan *plan;
+	struct needle_file *files;
+	size_t   file_count;
+	uint64_t last_used;
+};
+
+struct server {
+	struct vs_map_cache maps;
+	struct needle_set   sets[SERVE_NEEDLE_SETS];
+	size_t   set_count;
+	uint64_t clock;
+};
+
+static void free_needle_set(struct needle_set *set) {
+	vs_plan_free(set->plan);
+	for (size_t i = 0; i < set->needle_count; ++ i) {
+		vs_free_needle(set->needles + i);
+	}
+	free(set->needles);
+	for (size_t i = 0; i < set->file_count; ++ i) {
+		free(set->files[i].path);
+	}
+	free(set->files);
+	free(set->labels);
+	free(set->key);
+}
+
+// Records the identity of a file: needle before its data is read, so a change
+// that happens while it's read is noticed by the next request.
+static int add_needle_file(const char *path, void *ctx) {
+	struct needle_set *set = ctx;
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return -1;
+	}
+
+	struct needle_file *files = realloc(set->files, sizeof(struct needle_file) * (set->file_count + 1));
+	if (!files) {
+		errno = ENOMEM;
+		return -1;
+	}
+	set->files = files;
+
+	char *copy = strdup(path);
+	if (!copy) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	set->files[set->file_count ++] = (struct needle_file){
+		.path  = copy,
+		.dev   = st.st_dev,
+		.ino   = st.st_ino,
+		.size  = st.st_size,
+		.mtime = st.st_mtim,
+	};
+	return 0;
+}
+
+static bool needle_files_unchanged(const struct needle_set *set) {
+	for (size_t i = 0; i < set->file_count; ++ i) {
+		const struct needle_file *file = set->files + i;
+		struct stat st;
+		if (stat(file->path, &st) != 0 ||
+		    st.st_dev != file->dev || st.st_ino != file->ino || st.st_size != file->size ||
+		    st.st_mtim.tv_sec != file->mtime.tv_sec || st.st_mtim.tv_nsec != file->mtime.tv_nsec) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static const struct needle_set *get_needle_set(struct server *server, const struct vs_options *options,
+                                               char *const args[], size_t arg_count, FILE *out) {
+	size_t labels_size = 0;
+	for (size_t i = 0; i < arg_count; ++ i) {
+		labels_size += strlen(args[i]) + 1;
+	}
+
+	char prefix[64];
+	const int prefix_size = snprintf(prefix, sizeof(prefix), "%" PRIuSZ ",%" PRIuSZ ",%u",
+		options->max_mismatches, options->block_size, options->bit_orders);
+
+	char *key = malloc((size_t)prefix_size + labels_size + 1);
+	if (!key) {
+		fprintf(out, "*** error: %s\n", strerror(ENOMEM));
+		return NULL;
+	}
+	char *ptr = key + prefix_size;
+	memcpy(key, prefix, (size_t)prefix_size);
+	for (size_t i = 0; i < arg_count; ++ i) {
+		const size_t size = strlen(args[i]);
+		*ptr ++ = '\t';
+		memcpy(ptr, args[i], size);
+		ptr += size;
+	}
+	*ptr = '\0';
+
+	for (size_t i = 0; i < server->set_count; ++ i) {
+		struct needle_set *found = server->sets + i;
+		if (strcmp(found->key, key) == 0) {
+			if (needle_files_unchanged(found)) {
+				free(key);
+				found->last_used = ++ server->clock;
+				return found;
+			}
+			// a needle file changed since the set was built
+			free_needle_set(found);
+			*found = server->sets[-- server->set_count];
+			break;
+		}
+	}
+
+	struct needle_set set = { key, NULL, NULL, 0, NULL, NULL, 0, 0 };
+	size_t capacity = 0;
+
+	set.labels = malloc(labels_size);
+	if (!set.labels) {
+		fprintf(out, "*** error: %s\n", strerror(ENOMEM));
+		goto error;
+	}
+	ptr = set.labels;
+	for (size_t i = 0; i < arg_count; ++ i) {
+		const size_t size = strlen(args[i]) + 1;
+		memcpy(ptr, args[i], size);
+		if (vs_needle_files(ptr, add_needle_file, &set) != 0 ||
+		    add_needle(ptr, &set.needles, &set.needle_count, &capacity) != 0) {
+			fprintf(out, "*** error: %s: %s\n", args[i], strerror(errno));
+			goto error;
+		}
+		ptr += size;
+	}
+
+	if (prepare_needles(options, set.needles, set.needle_count, NULL, 0, &set.plan, out) != 0) {
+		goto error;
+	}
+
+	if (server->set_count == SERVE_NEEDLE_SETS) {
+		struct needle_set *oldest = server->sets;
+		for (size_t i = 1; i < server->set_count; ++ i) {
+			if (server->sets[i].last_used < oldest->last_used) {
+				oldest = server->sets + i;
+			}
+		}
+		free_needle_set(oldest);
+		*oldest = server->sets[-- server->set_count];
+	}
+
+	set.last_used = ++ server->clock;
+	server->sets[server->set_count] = set;
+	return server->sets + server->set_count ++;
+
+error:
+	free_needle_set(&set);
+	return NULL;
+}
+
+static int serve_file(struct server *server, struct vs_options *options, const char *filename,
+                      int flags, off_t offset_start, off_t offset_end, const struct needle_set *set) {
+	const struct vs_mapping *mapping = vs_map_cache_get(&server->maps, filename);
+	if (!mapping) {
+		return -1;
+	}
+
+	const uint8_t *data = mapping->data;
+	const size_t   size = (size_t)mapping->size;
+
+	options->filename = filename;
+
+	if (size == 0) {
+		return 0;
+	}
+
+	if (options->archives) {
+		const enum vs_archive_type type = vs_detect_archive(data, size);
+		if (type != VS_NOT_ARCHIVE) {
+			if (flags & (START_SET | END_SET)) {
+				errno = ENOTSUP;
+				return -1;
+			}
+			return search_archive(options, type, data, size, set->needles, set->needle_count);
+		}
+	}
+
+	if (options->decompress) {
+		const enum vs_compression compression = vs_detect_compression(data, size);
+		if (compression != VS_UNCOMPRESSED && vs_can_decompress(compression)) {
+			if (flags & (START_SET | END_SET)) {
+				errno = ENOTSUP;
+				return -1;
+			}
+			return search_stream(options, compression, data, size, set->needles, set->needle_count);
+		}
+	}
+
+	if (resolve_range(flags, offset_start, offset_end, mapping->size, options) != 0) {
+		return -1;
+	}
+
+	options->haystack      = data + options->start;
+	options->haystack_size = (size_t)(options->end - options->start);
+	options->context_end   = 0;
+
+	return search(options, options->haystack, options->haystack_size, set->needles, set->needle_count);
+}
+
+// A request is one line of tab separated arguments: options, needles, -- and
+// files. Only the --name=value form of options is accepted.
+static int serve_request(void *ctx, int argc, char *argv[], FILE *out) {
+	struct server *server = ctx;
+	int flags = 0;
+	off_t start_offset = 0;
+	off_t end_offset   = 0;
+	struct vs_options options = {
+		.printfmt       = NULL,
+		.filename       = NULL,
+		.member         = NULL,
+		.file_id        = 0,
+		.output         = VS_OUTPUT_TEXT,
+		.records        = NULL,
+		.needles        = NULL,
+		.out            = out,
+		.err            = out,
+		.start          = 0,
+		.end            = 0,
+		.eol            = '\n',
+		.max_mismatches = 0,
+		.block_size     = 0,
+		.bit_orders     = 0,
+		.plan           = NULL,
+		.array_schema   = NULL,
+		.pointers       = NULL,
+		.pointers_anywhere = false,
+		.skip_entropy   = NULL,
+		.histogram      = NULL,
+		.diff           = NULL,
+		.prefetch       = 0,
+		.hugepages      = false,
+		.populate       = false,
+		.nice_io        = false,
+		.throttle       = NULL,
+		.stats          = NULL,
+		.carver         = NULL,
+		.haystack       = NULL,
+		.haystack_size  = 0,
+		.context_before = 0,
+		.context_after  = 0,
+		.context_end    = 0,
+		.report_from    = 0,
+		.report_to      = SIZE_MAX,
+		.report_past    = 0,
+		.decompress     = true,
+		.archives       = false,
+		.cache          = NULL,
+		.cache_entry    = NULL,
+	};
+
+	int argind = 0;
+	int needles_start = -1;
+	for (; argind < argc; ++ argind) {
+		const char *arg = argv[argind];
+
+		if (strcmp(arg, "--") == 0) {
+			break;
+		}
+		else if (is_needle(arg)) {
+			if (needles_start < 0) {
+				needles_start = argind;
+			}
+			continue;
+		}
+		else if (needles_start >= 0) {
+			fprintf(out, "*** error: options must come before needles: %s\n", arg);
+			return -1;
+		}
+
+		if (startswith(arg, "--start-offset=")) {
+			if (parse_offset(strchr(arg, '=') + 1, &start_offset) != 0) {
+				goto arg_error;
+			}
+			flags |= START_SET;
+		}
+		else if (startswith(arg, "--end-offset=")) {
+			if (parse_offset(strchr(arg, '=') + 1, &end_offset) != 0) {
+				goto arg_error;
+			}
+			flags |= END_SET;
+		}
+		else if (startswith(arg, "--print-format=")) {
+			options.printfmt = strchr(arg, '=') + 1;
+		}
+		else if (startswith(arg, "--max-mismatches=")) {
+			if (parse_size(strchr(arg, '=') + 1, &options.max_mismatches) != 0) {
+				goto arg_error;
+			}
+		}
+		else if (startswith(arg, "--block-hash=")) {
+			if (parse_size(strchr(arg, '=') + 1, &options.block_size) != 0 || options.block_size == 0) {
+				errno = errno ? errno : EINVAL;
+				goto arg_error;
+			}
+		}
+		else if (strcmp(arg, "--bit-offsets") == 0) {
+			options.bit_orders = VS_MSB_FIRST | VS_LSB_FIRST;
+		}
+		else if (startswith(arg, "--bit-offsets=")) {
+			const char *order = strchr(arg, '=') + 1;
+			options.bit_orders =
+				strcasecmp(order, "msb")  == 0 ? VS_MSB_FIRST :
+				strcasecmp(order, "lsb")  == 0 ? VS_LSB_FIRST :
+				strcasecmp(order, "both") == 0 ? VS_MSB_FIRST | VS_LSB_FIRST : 0;
+			if (!options.bit_orders) {
+				fprintf(out, "*** error: illegal bit order: %s\n", order);
+				return -1;
+			}
+		}
+		else if (startswith(arg, "--output=")) {
+			const char *format = strchr(arg, '=') + 1;
+			if (strcasecmp(format, "text") == 0) {
+				options.output = VS_OUTPUT_TEXT;
+			}
+			else if (strcasecmp(format, "ndjson") == 0) {
+				options.output = VS_OUTPUT_NDJSON;
+			}
+			else {
+				fprintf(out, "*** error: illegal output format: %s\n", format);
+				return -1;
+			}
+		}
+		else if (strcmp(arg, "--archives") == 0) {
+			options.archives = true;
+		}
+		else if (strcmp(arg, "--no-decompress") == 0) {
+			options.decompress = false;
+		}
+		else {
+			fprintf(out, "*** error: unknown option %s\n", arg);
+			return -1;
+		}
+		continue;
+
+	arg_error:
+		fprintf(out, "*** error: %s: %s\n", arg, strerror(errno));
+		return -1;
+	}
+
+	if (needles_start < 0) {
+		fprintf(out, "*** error: no needles given\n");
+		return -1;
+	}
+
+	if (argind + 1 >= argc) {
+		fprintf(out, "*** error: no files given\n");
+		return -1;
+	}
+
+	const struct needle_set *set = get_needle_set(server, &options,
+		argv + needles_start, (size_t)(argind - needles_start), out);
+	if (!set) {
+		return -1;
+	}
+
+	options.needles = set->needles;
+	options.plan    = set->plan;
+	if (!options.printfmt) {
+		options.printfmt = default_printfmt(&options, true);
+	}
+
+	int status = 0;
+	for (++ argind; argind < argc; ++ argind) {
+		const char *filename = argv[argind];
+		if (serve_file(server, &options, filename, flags, start_offset, end_offset, set) != 0) {
+			fprintf(out, "*** error: %s: %s\n", filename, strerror(errno));
+			status = -1;
+		}
+	}
+
+	return status;
+}
+
+static int serve_main(int argc, char *argv[]) {
+	struct server server;
+	size_t max_mappings = SERVE_DEFAULT_MAPPINGS;
+	const char *socket_path = NULL;
+
+	for (int argind = 2; argind < argc; ++ argind) {
+		const char *arg = argv[argind];
+
+		if (strcmp(arg, "--max-mappings") == 0) {
+			if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				return 1;
+			}
+			if (parse_size(argv[argind], &max_mappings) != 0) {
+				perror(argv[argind]);
+				return 1;
+			}
+		}
+		else if (startswith(arg, "--max-mappings=")) {
+			if (parse_size(strchr(arg, '=') + 1, &max_mappings) != 0) {
+				perror(arg);
+				return 1;
+			}
+		}
+		else if (startswith(arg, "-") || socket_path) {
+			fprintf(stderr, "*** error: illegal argument %s\n", arg);
+			return 1;
+		}
+		else {
+			socket_path = arg;
+		}
+	}
+
+	if (!socket_path) {
+		fprintf(stderr, "*** error: no socket path given\n");
+		return 1;
+	}
+
+	vs_map_cache_init(&server.maps, max_mappings);
+	server.set_count = 0;
+	server.clock     = 0;
+
+	int status = 0;
+	if (vs_serve(socket_path, &server, &serve_request) != 0) {
+		perror(socket_path);
+		status = 1;
+	}
+
+	for (size_t i = 0; i < server.set_count; ++ i) {
+		free_needle_set(server.sets + i);
+	}
+	vs_map_cache_destroy(&server.maps);
+
+	return status;
 }
 
 int main(int argc, char *argv[]) {
 	int flags = 0;
-	const char *printfmt = NULL;
 	off_t start_offset = 0;
 	off_t end_offset   = 0;
 	const char **filenames    = NULL;
@@ -315,7 +2728,86 @@ int main(int argc, char *argv[]) {
 	size_t filenames_capacity = 0;
 	size_t needles_capacity   = 0;
 	int status = 0;
-	char eol = '\n';
+	struct vs_plan *plan = NULL;
+	bool explain = false;
+	const char *records_spec = NULL;
+	struct vs_array_schema array_schema = { 0, 0, NULL, 0 };
+	const char *pointers_spec = NULL;
+	struct vs_pointer_format pointer_format;
+	struct vs_entropy_skip entropy_skip;
+	struct vs_throttle throttle = { 0, 0, 0, false, { 0, 0 }, { 0, 0 }, { 0, 0 }, 0 };
+	struct histogram histogram = {
+		.bucket_size  = 0,
+		.sample       = 1,
+		.needle_count = 0,
+		.first        = 0,
+		.bucket_count = 0,
+		.capacity     = 0,
+		.counts       = NULL,
+		.active       = false,
+	};
+	struct vs_stats stats;
+	struct vs_records records = { -1, 0, NULL };
+	struct vs_carve_options carve = { ".", 0, false, 0, false, 0 };
+	struct vs_carver carver = { &carve, NULL, 0, 0 };
+	bool recursive = false;
+	bool diffing   = false;
+	const char *diff_spec = NULL;
+	struct vs_diff diff;
+	const char **includes = NULL;
+	const char **excludes = NULL;
+	struct vs_walk_options walk = { NULL, 0, NULL, 0, 0, 0, false };
+	struct vs_walker *walker = NULL;
+	bool print_stats = false;
+	struct result_cache cache = { NULL, 0, NULL, NULL };
+	struct vs_options options = {
+		.printfmt       = NULL,
+		.filename       = NULL,
+		.file_id        = 0,
+		.output         = VS_OUTPUT_TEXT,
+		.records        = NULL,
+		.needles        = NULL,
+		.out            = stdout,
+		.err            = stderr,
+		.start          = 0,
+		.end            = 0,
+		.eol            = '\n',
+		.max_mismatches = 0,
+		.block_size     = 0,
+		.bit_orders     = 0,
+		.plan           = NULL,
+		.array_schema   = NULL,
+		.pointers       = NULL,
+		.pointers_anywhere = false,
+		.skip_entropy   = NULL,
+		.histogram      = NULL,
+		.diff           = NULL,
+		.prefetch       = 0,
+		.hugepages      = false,
+		.populate       = false,
+		.nice_io        = false,
+		.throttle       = NULL,
+		.stats          = NULL,
+		.carver         = NULL,
+		.haystack       = NULL,
+		.haystack_size  = 0,
+		.context_before = 0,
+		.context_after  = 0,
+		.context_end    = 0,
+		.report_from    = 0,
+		.report_to      = SIZE_MAX,
+		.report_past    = 0,
+		.decompress     = true,
+		.archives       = false,
+		.cache          = NULL,
+		.cache_entry    = NULL,
+	};
+
+	if (argc >= 2 && strcmp(argv[1], "serve") == 0) {
+		return serve_main(argc, argv);
+	}
+
+	vs_stats_init(&stats);
 
 	if (argc < 2) {
 		usage(argc, argv);
@@ -330,85 +2822,455 @@ int main(int argc, char *argv[]) {
 		if (opts_ended) {
 			goto filename_arg;
 		}
-		else if (strcmp(arg, "-s") == 0 || strcmp(arg, "--start-offset") == 0) {
+		else if (strcmp(arg, "-s") == 0 || strcmp(arg, "--start-offset") == 0) {
+			if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			if (parse_offset(argv[argind], &start_offset) != 0) {
+				perror(argv[argind]);
+				goto error;
+			}
+			flags |= START_SET;
+		}
+		else if (startswith(arg, "--start-offset=")) {
+			if (parse_offset(strchr(arg, '=')+1, &start_offset) != 0) {
+				perror(arg);
+				goto error;	
+			}
+			flags |= START_SET;
+		}
+		else if (strcmp(arg, "-e") == 0 || strcmp(arg, "--end-offset") == 0) {
+			if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			if (parse_offset(argv[argind], &end_offset) != 0) {
+				perror(argv[argind]);
+				goto error;	
+			}
+			flags |= END_SET;
+		}
+		else if (startswith(arg, "--end-offset=")) {
+			if (parse_offset(strchr(arg, '=')+1, &end_offset) != 0) {
+				perror(arg);
+				goto error;	
+			}
+			flags |= END_SET;
+		}
+		else if (strcmp(arg, "-p") == 0 || strcmp(arg, "--print-format") == 0) {
+			if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			options.printfmt = argv[argind];
+		}
+		else if (startswith(arg, "--print-format=")) {
+			options.printfmt = strchr(arg, '=') + 1;
+		}
+		else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+			usage(argc, argv);
+			goto end;
+		}
+		else if (strcmp(arg, "-0") == 0 || strcmp(arg, "--print0") == 0) {
+			options.eol = 0;
+		}
+		else if (strcmp(arg, "-k") == 0 || strcmp(arg, "--max-mismatches") == 0) {
+			if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			if (parse_size(argv[argind], &options.max_mismatches) != 0) {
+				perror(argv[argind]);
+				goto error;
+			}
+		}
+		else if (startswith(arg, "--max-mismatches=")) {
+			if (parse_size(strchr(arg, '=')+1, &options.max_mismatches) != 0) {
+				perror(arg);
+				goto error;
+			}
+		}
+		else if (strcmp(arg, "--bit-offsets") == 0) {
+			options.bit_orders = VS_MSB_FIRST | VS_LSB_FIRST;
+		}
+		else if (startswith(arg, "--bit-offsets=")) {
+			const char *order = strchr(arg, '=') + 1;
+			if (strcasecmp(order, "msb") == 0) {
+				options.bit_orders = VS_MSB_FIRST;
+			}
+			else if (strcasecmp(order, "lsb") == 0) {
+				options.bit_orders = VS_LSB_FIRST;
+			}
+			else if (strcasecmp(order, "both") == 0) {
+				options.bit_orders = VS_MSB_FIRST | VS_LSB_FIRST;
+			}
+			else {
+				fprintf(stderr, "*** error: illegal bit order: %s\n", order);
+				goto error;
+			}
+		}
+		else if (strcmp(arg, "--block-hash") == 0) {
+			if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			if (parse_size(argv[argind], &options.block_size) != 0 || options.block_size == 0) {
+				errno = errno ? errno : EINVAL;
+				perror(argv[argind]);
+				goto error;
+			}
+		}
+		else if (startswith(arg, "--block-hash=")) {
+			if (parse_size(strchr(arg, '=')+1, &options.block_size) != 0 || options.block_size == 0) {
+				errno = errno ? errno : EINVAL;
+				perror(arg);
+				goto error;
+			}
+		}
+		else if (strcmp(arg, "--output") == 0 || startswith(arg, "--output=")) {
+			const char *format = NULL;
+			if (arg[8] == '=') {
+				format = arg + 9;
+			}
+			else if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			else {
+				format = argv[argind];
+			}
+			if (strcasecmp(format, "text") == 0) {
+				options.output = VS_OUTPUT_TEXT;
+			}
+			else if (strcasecmp(format, "ndjson") == 0) {
+				options.output = VS_OUTPUT_NDJSON;
+			}
+			else if (strcasecmp(format, "binary") == 0) {
+				options.output = VS_OUTPUT_BINARY;
+			}
+			else {
+				fprintf(stderr, "*** error: illegal output format: %s\n", format);
+				goto error;
+			}
+		}
+		else if (strcmp(arg, "-A") == 0 || strcmp(arg, "-B") == 0 || strcmp(arg, "-C") == 0 ||
+		         strcmp(arg, "--after-context") == 0 || strcmp(arg, "--before-context") == 0 ||
+		         strcmp(arg, "--context") == 0) {
+			size_t context = 0;
+			if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			if (parse_size(argv[argind], &context) != 0) {
+				perror(argv[argind]);
+				goto error;
+			}
+			if (arg[1] != 'A' && strcmp(arg, "--after-context") != 0) {
+				options.context_before = context;
+			}
+			if (arg[1] != 'B' && strcmp(arg, "--before-context") != 0) {
+				options.context_after = context;
+			}
+		}
+		else if (startswith(arg, "--after-context=") || startswith(arg, "--before-context=") ||
+		         startswith(arg, "--context=")) {
+			size_t context = 0;
+			if (parse_size(strchr(arg, '=')+1, &context) != 0) {
+				perror(arg);
+				goto error;
+			}
+			if (!startswith(arg, "--after-")) {
+				options.context_before = context;
+			}
+			if (!startswith(arg, "--before-")) {
+				options.context_after = context;
+			}
+		}
+		else if (strcmp(arg, "--explain") == 0) {
+			explain = true;
+		}
+		else if (strcmp(arg, "--diff") == 0) {
+			diffing = true;
+			diff.kind = VS_DIFF_NEEDLES;
+			diff.align = 1;
+		}
+		else if (startswith(arg, "--diff=")) {
+			if (vs_parse_diff(strchr(arg, '=') + 1, &diff) != 0) {
+				perror(arg);
+				goto error;
+			}
+			diff_spec = strchr(arg, '=') + 1;
+			diffing = true;
+		}
+		else if (strcmp(arg, "--records") == 0) {
+			if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			records_spec = argv[argind];
+			vs_free_array_schema(&array_schema);
+			if (vs_parse_array_schema(records_spec, &array_schema) != 0) {
+				perror(records_spec);
+				goto error;
+			}
+		}
+		else if (startswith(arg, "--records=")) {
+			records_spec = strchr(arg, '=') + 1;
+			vs_free_array_schema(&array_schema);
+			if (vs_parse_array_schema(records_spec, &array_schema) != 0) {
+				perror(arg);
+				goto error;
+			}
+		}
+		else if (strcmp(arg, "--pointers") == 0) {
+			if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			pointers_spec = argv[argind];
+			if (vs_parse_pointer_format(pointers_spec, &pointer_format) != 0) {
+				perror(pointers_spec);
+				goto error;
+			}
+		}
+		else if (startswith(arg, "--pointers=")) {
+			pointers_spec = strchr(arg, '=') + 1;
+			if (vs_parse_pointer_format(pointers_spec, &pointer_format) != 0) {
+				perror(arg);
+				goto error;
+			}
+		}
+		else if (strcmp(arg, "--histogram") == 0) {
 			if (++ argind == argc) {
 				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
 				goto error;
 			}
-			if (parse_offset(argv[argind], &start_offset) != 0) {
+			if (parse_histogram(argv[argind], &histogram) != 0) {
 				perror(argv[argind]);
 				goto error;
 			}
-			flags |= START_SET;
+			options.histogram = &histogram;
 		}
-		else if (startswith(arg, "--start-offset=")) {
-			if (parse_offset(strchr(arg, '=')+1, &start_offset) != 0) {
+		else if (startswith(arg, "--histogram=")) {
+			if (parse_histogram(strchr(arg, '=') + 1, &histogram) != 0) {
 				perror(arg);
-				goto error;	
+				goto error;
 			}
-			flags |= START_SET;
+			options.histogram = &histogram;
 		}
-		else if (strcmp(arg, "-e") == 0 || strcmp(arg, "--end-offset") == 0) {
+		else if (strcmp(arg, "--prefetch") == 0) {
+			options.prefetch = VS_PREFETCH_DEFAULT_DISTANCE;
+		}
+		else if (startswith(arg, "--prefetch=")) {
+			if (parse_size(strchr(arg, '=') + 1, &options.prefetch) != 0 || options.prefetch == 0) {
+				errno = errno ? errno : EINVAL;
+				perror(arg);
+				goto error;
+			}
+		}
+		else if (strcmp(arg, "--hugepages") == 0) {
+			options.hugepages = true;
+		}
+		else if (strcmp(arg, "--populate") == 0) {
+			options.populate = true;
+		}
+		else if (strcmp(arg, "--max-read-rate") == 0) {
 			if (++ argind == argc) {
 				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
 				goto error;
 			}
-			if (parse_offset(argv[argind], &end_offset) != 0) {
+			if (vs_parse_read_rate(argv[argind], &throttle) != 0) {
 				perror(argv[argind]);
-				goto error;	
+				goto error;
 			}
-			flags |= END_SET;
+			options.throttle = &throttle;
 		}
-		else if (startswith(arg, "--end-offset=")) {
-			if (parse_offset(strchr(arg, '=')+1, &end_offset) != 0) {
+		else if (startswith(arg, "--max-read-rate=")) {
+			if (vs_parse_read_rate(strchr(arg, '=') + 1, &throttle) != 0) {
 				perror(arg);
-				goto error;	
+				goto error;
 			}
-			flags |= END_SET;
+			options.throttle = &throttle;
 		}
-		else if (strcmp(arg, "-p") == 0 || strcmp(arg, "--print-format") == 0) {
+		else if (strcmp(arg, "--max-cpu") == 0) {
 			if (++ argind == argc) {
 				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
 				goto error;
 			}
-			printfmt = argv[argind];
+			if (vs_parse_cpu_share(argv[argind], &throttle) != 0) {
+				perror(argv[argind]);
+				goto error;
+			}
+			options.throttle = &throttle;
 		}
-		else if (startswith(arg, "--print-format=")) {
-			printfmt = strchr(arg, '=') + 1;
+		else if (startswith(arg, "--max-cpu=")) {
+			if (vs_parse_cpu_share(strchr(arg, '=') + 1, &throttle) != 0) {
+				perror(arg);
+				goto error;
+			}
+			options.throttle = &throttle;
 		}
-		else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
-			usage(argc, argv);
-			goto end;
+		else if (strcmp(arg, "--nice-io") == 0) {
+			options.nice_io = true;
 		}
-		else if (strcmp(arg, "-0") == 0 || strcmp(arg, "--print0") == 0) {
-			eol = 0;
+		else if (strcmp(arg, "--skip-entropy") == 0) {
+			if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			if (vs_parse_entropy_skip(argv[argind], &entropy_skip) != 0) {
+				perror(argv[argind]);
+				goto error;
+			}
+			options.skip_entropy = &entropy_skip;
+		}
+		else if (startswith(arg, "--skip-entropy=")) {
+			if (vs_parse_entropy_skip(strchr(arg, '=') + 1, &entropy_skip) != 0) {
+				perror(arg);
+				goto error;
+			}
+			options.skip_entropy = &entropy_skip;
+		}
+		else if (strcmp(arg, "-r") == 0 || strcmp(arg, "--recursive") == 0) {
+			recursive = true;
+		}
+		else if (strcmp(arg, "--one-file-system") == 0) {
+			walk.one_file_system = true;
+		}
+		else if (strcmp(arg, "--include") == 0 || strcmp(arg, "--exclude") == 0 ||
+		         startswith(arg, "--include=") || startswith(arg, "--exclude=")) {
+			const char *glob = strchr(arg, '=');
+			if (glob) {
+				++ glob;
+			}
+			else if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			else {
+				glob = argv[argind];
+			}
+			if (arg[2] == 'i' ?
+			    append_glob(&includes, &walk.include_count, glob) != 0 :
+			    append_glob(&excludes, &walk.exclude_count, glob) != 0) {
+				perror("allocating glob buffer");
+				goto error;
+			}
+		}
+		else if (strcmp(arg, "--min-size") == 0 || strcmp(arg, "--max-size") == 0) {
+			size_t size = 0;
+			if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			if (parse_size(argv[argind], &size) != 0) {
+				perror(argv[argind]);
+				goto error;
+			}
+			*(arg[3] == 'i' ? &walk.min_size : &walk.max_size) = size;
+		}
+		else if (startswith(arg, "--min-size=") || startswith(arg, "--max-size=")) {
+			size_t size = 0;
+			if (parse_size(strchr(arg, '=')+1, &size) != 0) {
+				perror(arg);
+				goto error;
+			}
+			*(arg[3] == 'i' ? &walk.min_size : &walk.max_size) = size;
+		}
+		else if (strcmp(arg, "--carve") == 0) {
+			if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			if (parse_size(argv[argind], &carve.length) != 0 || carve.length == 0) {
+				errno = errno ? errno : EINVAL;
+				perror(argv[argind]);
+				goto error;
+			}
+			options.carver = &carver;
+		}
+		else if (startswith(arg, "--carve=")) {
+			if (parse_size(strchr(arg, '=')+1, &carve.length) != 0 || carve.length == 0) {
+				errno = errno ? errno : EINVAL;
+				perror(arg);
+				goto error;
+			}
+			options.carver = &carver;
+		}
+		else if (strcmp(arg, "--carve-length-field") == 0) {
+			if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			if (vs_parse_carve_field(argv[argind], &carve) != 0) {
+				perror(argv[argind]);
+				goto error;
+			}
+			options.carver = &carver;
+		}
+		else if (startswith(arg, "--carve-length-field=")) {
+			if (vs_parse_carve_field(strchr(arg, '=')+1, &carve) != 0) {
+				perror(arg);
+				goto error;
+			}
+			options.carver = &carver;
+		}
+		else if (strcmp(arg, "--carve-dir") == 0) {
+			if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			carve.dir = argv[argind];
+		}
+		else if (startswith(arg, "--carve-dir=")) {
+			carve.dir = strchr(arg, '=') + 1;
+		}
+		else if (strcmp(arg, "--no-decompress") == 0) {
+			options.decompress = false;
+		}
+		else if (strcmp(arg, "--archives") == 0) {
+			options.archives = true;
+		}
+		else if (strcmp(arg, "--cache") == 0) {
+			if (++ argind == argc) {
+				fprintf(stderr, "*** error: missing argument to option %s\n", arg);
+				goto error;
+			}
+			cache.dir = argv[argind];
+		}
+		else if (startswith(arg, "--cache=")) {
+			cache.dir = strchr(arg, '=') + 1;
+		}
+		else if (strcmp(arg, "--stats") == 0) {
+			print_stats = true;
+		}
+		else if (startswith(arg, "--stats=")) {
+			const char *format = strchr(arg, '=') + 1;
+			if (strcasecmp(format, "json") == 0) {
+				stats.json = true;
+			}
+			else if (strcasecmp(format, "text") == 0) {
+				stats.json = false;
+			}
+			else {
+				fprintf(stderr, "*** error: illegal stats format: %s\n", format);
+				goto error;
+			}
+			print_stats = true;
 		}
 		else if (strcmp(arg, "--") == 0) {
 			opts_ended = true;
-			++ argind;
-			break;
 		}
 		else if (startswith(arg, "-")) {
 			fprintf(stderr, "*** error: unknown option %s\n", arg);
 			goto error;
 		}
 		else if (is_needle(arg)) {
-			struct vs_needle needle = { 0, .ctx = (void*)arg };
-			if (vs_parse_needle(arg, &needle) != 0) {
+			if (add_needle(arg, &needles, &needle_count, &needles_capacity) != 0) {
 				perror(arg);
 				goto error;
 			}
-			if (needle_count == needles_capacity) {
-				needles_capacity += 32;
-				struct vs_needle *buf = realloc(needles, sizeof(struct vs_needle) * needles_capacity);
-				if (!buf) {
-					perror("allocating needle buffer");
-					goto error;
-				}
-				needles = buf;
-				memset(needles + needle_count, 0, (needles_capacity - needle_count) * sizeof(struct vs_needle));
-			}
-			needles[needle_count ++] = needle;
 		}
 		else {
 		filename_arg:
@@ -426,17 +3288,284 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+	if (records_spec) {
+		if (needle_count > 0) {
+			fprintf(stderr, "*** error: needles can't be used with --records\n");
+			goto error;
+		}
+		if (options.max_mismatches > 0 || options.block_size > 0 || options.bit_orders != 0 || cache.dir) {
+			fprintf(stderr, "*** error: --records can't be used with --max-mismatches, --block-hash, --bit-offsets or --cache\n");
+			goto error;
+		}
+
+		// arrays are reported as matches of a pseudo needle labeled with the schema
+		needles = calloc(1, sizeof(struct vs_needle));
+		if (!needles) {
+			perror("allocating needle buffer");
+			goto error;
+		}
+		needles[0].ctx = (void*)records_spec;
+		needle_count = 1;
+		options.array_schema = &array_schema;
+	}
+
+	if (pointers_spec) {
+		if (records_spec) {
+			fprintf(stderr, "*** error: --pointers can't be used with --records\n");
+			goto error;
+		}
+		if (options.max_mismatches > 0 || options.block_size > 0 || options.bit_orders != 0 || cache.dir) {
+			fprintf(stderr, "*** error: --pointers can't be used with --max-mismatches, --block-hash, --bit-offsets or --cache\n");
+			goto error;
+		}
+
+		if (needle_count == 0) {
+			// pointers into the file are reported as matches of a pseudo needle
+			// labeled with the format
+			needles = calloc(1, sizeof(struct vs_needle));
+			if (!needles) {
+				perror("allocating needle buffer");
+				goto error;
+			}
+			needles[0].ctx = (void*)pointers_spec;
+			needle_count = 1;
+			options.pointers_anywhere = true;
+			if (pointer_format.min_density < 0) {
+				pointer_format.min_density = VS_POINTER_DEFAULT_DENSITY;
+			}
+		}
+		else if (pointer_format.min_density < 0) {
+			pointer_format.min_density = 0;
+		}
+		if (options.skip_entropy) {
+			fprintf(stderr, "*** error: --pointers can't be used with --skip-entropy\n");
+			goto error;
+		}
+		options.pointers = &pointer_format;
+	}
+
+	if (options.prefetch > 0 && (records_spec || pointers_spec || options.block_size > 0 || options.skip_entropy)) {
+		// these need the whole haystack at once
+		fprintf(stderr, "*** error: --prefetch can't be used with --records, --pointers, --block-hash or --skip-entropy\n");
+		goto error;
+	}
+
+	if ((options.throttle || options.nice_io) &&
+	    (records_spec || pointers_spec || options.block_size > 0 || options.skip_entropy || diffing)) {
+		fprintf(stderr, "*** error: --max-read-rate, --max-cpu and --nice-io can't be used with --records, --pointers, "
+		                "--block-hash, --skip-entropy or --diff\n");
+		goto error;
+	}
+
+	if (options.nice_io && (options.prefetch > 0 || options.populate)) {
+		// pages read ahead would look like they were cached by someone else
+		fprintf(stderr, "*** error: --nice-io can't be used with --prefetch or --populate\n");
+		goto error;
+	}
+
+	if (options.histogram) {
+		if (records_spec || pointers_spec || cache.dir || options.carver || options.archives ||
+		    options.context_before || options.context_after || options.output == VS_OUTPUT_BINARY) {
+			fprintf(stderr, "*** error: --histogram can't be used with --records, --pointers, --cache, --carve, "
+			                "--archives, context or --output=binary\n");
+			goto error;
+		}
+		if (histogram.sample > 1 && options.skip_entropy) {
+			fprintf(stderr, "*** error: --histogram sampling can't be used with --skip-entropy\n");
+			goto error;
+		}
+	}
+
+	if (diffing) {
+		if (file_count != 2 || recursive) {
+			fprintf(stderr, "*** error: --diff needs exactly two files\n");
+			goto error;
+		}
+		if (records_spec || pointers_spec || options.histogram || options.max_mismatches > 0 || options.block_size > 0 ||
+		    options.bit_orders != 0 || cache.dir || options.archives || options.skip_entropy || options.carver ||
+		    (flags & (START_SET | END_SET))) {
+			fprintf(stderr, "*** error: --diff can't be used with --records, --pointers, --histogram, --max-mismatches, "
+			                "--block-hash, --bit-offsets, --cache, --archives, --skip-entropy, --carve or offsets\n");
+			goto error;
+		}
+
+		if (diff.kind == VS_DIFF_NEEDLES) {
+			if (needle_count != 2 || needles[0].flags != 0 || needles[1].flags != 0) {
+				fprintf(stderr, "*** error: --diff needs two plain needles, one for each file\n");
+				goto error;
+			}
+			diff.before = needles;
+			diff.after  = needles + 1;
+		}
+		else {
+			if (needle_count > 0) {
+				fprintf(stderr, "*** error: needles can't be used with --diff=%s\n",
+					diff.kind == VS_DIFF_CHANGED ? "changed" : diff.kind == VS_DIFF_INCREASED ? "increased" : "decreased");
+				goto error;
+			}
+
+			// differences are reported as matches of a pseudo needle labeled
+			// with the spec
+			needles = calloc(1, sizeof(struct vs_needle));
+			if (!needles) {
+				perror("allocating needle buffer");
+				goto error;
+			}
+			needles[0].ctx = (void*)diff_spec;
+			needle_count = 1;
+		}
+		options.diff = &diff;
+	}
+
 	if (needle_count == 0) {
 		fprintf(stderr, "*** error: no needles given\n");
 		goto error;
 	}
 
-	// biggest match first
-	qsort(needles, needle_count, sizeof(struct vs_needle), needle_size_cmp);
+	if (!diffing) {
+		// byte frequencies for the planner
+		uint8_t sample[VS_PLAN_SAMPLE_SIZE];
+		const ssize_t sample_size = recursive || file_count == 0 ? -1 :
+			read_sample(filenames[0], options.decompress, sample, sizeof(sample));
+
+		if (prepare_needles(&options, needles, needle_count, sample_size > 0 ? sample : NULL,
+		                    sample_size > 0 ? (size_t)sample_size : 0, &plan, stderr) != 0) {
+			goto error;
+		}
+		options.plan = plan;
+
+		if (explain) {
+			print_plan(&options, plan, sample_size > 0 ? filenames[0] : NULL, (size_t)(sample_size > 0 ? sample_size : 0));
+			goto end;
+		}
+	}
 
-	if (file_count > 0) {
-		if (!printfmt) {
-			printfmt = "%f:%o: %t";
+	if (print_stats) {
+		if (vs_stats_start(&stats, needles, needle_count) != 0) {
+			perror("initializing statistics");
+			goto error;
+		}
+		options.stats = &stats;
+	}
+	vs_stats_end(&stats, VS_PHASE_PARSE);
+
+	if (options.nice_io && vs_nice_io() != 0) {
+		fprintf(stderr, "*** warning: can't lower the I/O priority: %s\n", strerror(errno));
+	}
+
+	options.needles = needles;
+	histogram.needle_count = needle_count;
+
+	if (cache.dir) {
+		if (options.context_before || options.context_after || options.carver || options.archives) {
+			fprintf(stderr, "*** error: --cache can't be used with context, --carve or --archives\n");
+			goto error;
+		}
+
+		if (vs_carve_prepare_dir(cache.dir) != 0) {
+			perror(cache.dir);
+			goto error;
+		}
+
+		// everything that changes which matches are found
+		const uint64_t params[] = {
+			options.max_mismatches, options.block_size, options.bit_orders, options.decompress,
+			options.skip_entropy ? (uint64_t)(options.skip_entropy->threshold * 1000) : 0,
+			options.skip_entropy ? options.skip_entropy->block_size : 0,
+		};
+		cache.ranks   = malloc(sizeof(uint32_t) * needle_count);
+		cache.by_rank = malloc(sizeof(struct vs_needle*) * needle_count);
+		if (!cache.ranks || !cache.by_rank ||
+		    vs_cache_hash_needles(needles, needle_count, params, sizeof(params) / sizeof(params[0]),
+		                          &cache.needles_hash, cache.ranks) != 0) {
+			perror("preparing result cache");
+			goto error;
+		}
+		for (size_t i = 0; i < needle_count; ++ i) {
+			cache.by_rank[cache.ranks[i]] = needles + i;
+		}
+		options.cache = &cache;
+	}
+
+	if (options.context_before || options.context_after) {
+		if (options.output != VS_OUTPUT_TEXT) {
+			fprintf(stderr, "*** error: context can only be printed with --output=text\n");
+			goto error;
+		}
+		// lots of small writes per match
+		setvbuf(stdout, NULL, _IOFBF, 64 * 1024);
+	}
+
+	if (options.carver && vs_carve_prepare_dir(carve.dir) != 0) {
+		perror(carve.dir);
+		goto error;
+	}
+
+	if (options.output == VS_OUTPUT_BINARY && options.archives) {
+		fprintf(stderr, "*** error: --output=binary can't be used with --archives\n");
+		goto error;
+	}
+
+	if (options.output == VS_OUTPUT_BINARY) {
+		static const char *const stdin_filenames[] = { NULL };
+		if (vs_records_begin(&records, STDOUT_FILENO, file_count > 0 ? filenames : stdin_filenames,
+		                     file_count > 0 ? file_count : 1, needles, needle_count) != 0) {
+			perror("writing record header");
+			goto error;
+		}
+		options.records = &records;
+	}
+
+	if (diffing) {
+		if (!options.printfmt) {
+			options.printfmt = default_printfmt(&options, true);
+		}
+
+		if (diff_files(&options, filenames[0], filenames[1]) != 0) {
+			status = 1;
+		}
+	}
+	else if (recursive) {
+		static const char *const cwd[] = { "." };
+		walk.include = includes;
+		walk.exclude = excludes;
+
+		if (options.output == VS_OUTPUT_BINARY) {
+			fprintf(stderr, "*** error: --output=binary can't be used with --recursive\n");
+			goto error;
+		}
+
+		if (!options.printfmt) {
+			options.printfmt = default_printfmt(&options, true);
+		}
+
+		walker = file_count > 0 ?
+			vs_walk_start(filenames, file_count, &walk) :
+			vs_walk_start(cwd, 1, &walk);
+		if (!walker) {
+			perror("starting directory walk");
+			goto error;
+		}
+
+		struct vs_walk_file file;
+		while (vs_walk_next(walker, &file)) {
+			if (valuescan(file.path, file.fd, flags, start_offset, end_offset, &options, needles, needle_count) != 0) {
+				perror(file.path);
+				status = 1;
+			}
+			close(file.fd);
+			free(file.path);
+		}
+
+		const int walk_status = vs_walk_finish(walker);
+		walker = NULL;
+		if (walk_status != 0) {
+			status = 1;
+		}
+	}
+	else if (file_count > 0) {
+		if (!options.printfmt) {
+			options.printfmt = default_printfmt(&options, true);
 		}
 
 		for (size_t i = 0; i < file_count; ++ i) {
@@ -449,7 +3578,8 @@ int main(int argc, char *argv[]) {
 				continue;
 			}
 
-			if (valuescan(filename, fd, flags, start_offset, end_offset, printfmt, eol, needles, needle_count) != 0) {
+			options.file_id = (uint32_t)i;
+			if (valuescan(filename, fd, flags, start_offset, end_offset, &options, needles, needle_count) != 0) {
 				perror(filename);
 				status = 1;
 			}
@@ -457,23 +3587,62 @@ int main(int argc, char *argv[]) {
 			close(fd);
 		}
 	}
-	else if (valuescan(NULL, STDIN_FILENO, flags, start_offset, end_offset, printfmt ? printfmt : "%o: %t", eol, needles, needle_count) != 0) {
+	else {
+		if (!options.printfmt) {
+			options.printfmt = default_printfmt(&options, false);
+		}
+
+		if (valuescan(NULL, STDIN_FILENO, flags, start_offset, end_offset, &options, needles, needle_count) != 0) {
+			status = 1;
+		}
+	}
+
+	if (options.records && vs_records_flush(options.records) != 0) {
+		perror("writing records");
 		status = 1;
 	}
 
+	if (options.stats) {
+		fflush(stdout);
+		if (options.skip_entropy) {
+			options.stats->skipped_bytes = options.skip_entropy->skipped;
+		}
+		options.stats->throttled_ns = throttle.waited_ns;
+		vs_stats_print(options.stats, stderr);
+	}
+	else if (options.skip_entropy) {
+		fflush(stdout);
+		fprintf(stderr, "skipped %" PRIu64 " bytes of high entropy data\n", options.skip_entropy->skipped);
+	}
+
 	goto end;
 
 error:
 	status = 1;
 
 end:
+	vs_plan_free(plan);
+	vs_free_array_schema(&array_schema);
+	vs_stats_destroy(&stats);
+	vs_records_destroy(&records);
+	vs_carve_destroy(&carver);
+
+	if (walker) {
+		vs_walk_finish(walker);
+	}
+	free(includes);
+	free(excludes);
+	free(cache.ranks);
+	free(cache.by_rank);
+	free(histogram.counts);
+
 	if (filenames) {
 		free(filenames);
 	}
 
 	if (needles) {
 		for (size_t i = 0; i < needle_count; ++ i) {
-			free((void*)needles[i].data);
+			vs_free_needle(needles + i);
 		}
 		free(needles);
 	}
@@ -0,0 +1,135 @@
+#include "output.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+static uint8_t *put_u32le(uint8_t *ptr, uint32_t value) {
+	ptr[0] = (uint8_t) value;
+	ptr[1] = (uint8_t)(value >>  8);
+	ptr[2] = (uint8_t)(value >> 16);
+	ptr[3] = (uint8_t)(value >> 24);
+	return ptr + 4;
+}
+
+static uint8_t *put_u64le(uint8_t *ptr, uint64_t value) {
+	put_u32le(ptr, (uint32_t)value);
+	put_u32le(ptr + 4, (uint32_t)(value >> 32));
+	return ptr + 8;
+}
+
+static int write_all(int fd, const uint8_t *data, size_t size) {
+	while (size > 0) {
+		ssize_t count = write(fd, data, size);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data += count;
+		size -= (size_t)count;
+	}
+	return 0;
+}
+
+int vs_records_begin(struct vs_records *records, int fd, const char *const filenames[], size_t file_count,
+                     const struct vs_needle needles[], size_t needle_count) {
+	if (file_count > UINT32_MAX || needle_count > UINT32_MAX) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	records->fd     = fd;
+	records->count  = 0;
+	records->buffer = malloc(VS_RECORDS_BATCH * VS_RECORD_SIZE);
+	if (!records->buffer) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	size_t header_size = VS_RECORDS_MAGIC_SIZE + 4 + 4 + 8;
+	for (size_t index = 0; index < file_count; ++ index) {
+		header_size += 4 + (filenames[index] ? strlen(filenames[index]) : 0);
+	}
+	for (size_t index = 0; index < needle_count; ++ index) {
+		header_size += 4 + 4 + strlen((const char*)needles[index].ctx);
+	}
+	const size_t records_offset = (header_size + VS_RECORD_SIZE - 1) & ~(size_t)(VS_RECORD_SIZE - 1);
+
+	uint8_t *header = calloc(1, records_offset);
+	if (!header) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	uint8_t *ptr = header;
+	memcpy(ptr, VS_RECORDS_MAGIC, VS_RECORDS_MAGIC_SIZE);
+	ptr += VS_RECORDS_MAGIC_SIZE;
+	ptr = put_u32le(ptr, (uint32_t)file_count);
+	ptr = put_u32le(ptr, (uint32_t)needle_count);
+	ptr = put_u64le(ptr, records_offset);
+
+	for (size_t index = 0; index < file_count; ++ index) {
+		const size_t len = filenames[index] ? strlen(filenames[index]) : 0;
+		ptr = put_u32le(ptr, (uint32_t)len);
+		memcpy(ptr, filenames[index], len);
+		ptr += len;
+	}
+
+	for (size_t index = 0; index < needle_count; ++ index) {
+		const char *label = (const char*)needles[index].ctx;
+		const size_t len = strlen(label);
+		ptr = put_u32le(ptr, (uint32_t)needles[index].size);
+		ptr = put_u32le(ptr, (uint32_t)len);
+		memcpy(ptr, label, len);
+		ptr += len;
+	}
+
+	int status = write_all(fd, header, records_offset);
+	free(header);
+
+	return status;
+}
+
+int vs_records_push(struct vs_records *records, uint32_t file_id, uint32_t needle_id, uint64_t offset) {
+	uint8_t *ptr = records->buffer + records->count * VS_RECORD_SIZE;
+	ptr = put_u64le(ptr, offset);
+	ptr = put_u32le(ptr, file_id);
+	put_u32le(ptr, needle_id);
+
+	if (++ records->count == VS_RECORDS_BATCH) {
+		return vs_records_flush(records);
+	}
+	return 0;
+}
+
+int vs_records_flush(struct vs_records *records) {
+	const size_t count = records->count;
+	records->count = 0;
+	return count > 0 ? write_all(records->fd, records->buffer, count * VS_RECORD_SIZE) : 0;
+}
+
+void vs_records_destroy(struct vs_records *records) {
+	free(records->buffer);
+	records->buffer = NULL;
+	records->count  = 0;
+}
+
+void vs_print_json_string(const char *str, FILE *stream) {
+	fputc('"', stream);
+	for (; *str; ++ str) {
+		const unsigned char ch = (unsigned char)*str;
+		if (ch == '"' || ch == '\\') {
+			fputc('\\', stream);
+			fputc(ch, stream);
+		}
+		else if (ch < 0x20) {
+			fprintf(stream, "\\u%04x", ch);
+		}
+		else {
+			fputc(ch, stream);
+		}
+	}
+	fputc('"', stream);
+}
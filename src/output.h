@@ -0,0 +1,53 @@
+#ifndef VS_OUTPUT_H
+#define VS_OUTPUT_H
+#pragma once
+
+#include "valuescan.h"
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum vs_output_format {
+	VS_OUTPUT_TEXT,
+	VS_OUTPUT_NDJSON,
+	VS_OUTPUT_BINARY,
+};
+
+// Binary record stream (all integers little endian):
+//
+//   header:  "VSRECS\0\1", u32 file count, u32 needle count, u64 offset of
+//            the first record
+//   files:   u32 name length, name bytes (empty name for stdin)
+//   needles: u32 needle size, u32 label length, label bytes ("format:value")
+//   padding: zero bytes up to the first record (a multiple of 16)
+//   records: u64 offset, u32 file id, u32 needle id
+//
+// Ids are indices into the file and needle tables. Records are written in
+// batches with a single write() each.
+#define VS_RECORDS_MAGIC      "VSRECS\0\1"
+#define VS_RECORDS_MAGIC_SIZE 8
+#define VS_RECORD_SIZE        16
+#define VS_RECORDS_BATCH      4096
+
+struct vs_records {
+	int fd;
+	size_t count;
+	uint8_t *buffer;
+};
+
+int  vs_records_begin(struct vs_records *records, int fd, const char *const filenames[], size_t file_count,
+                      const struct vs_needle needles[], size_t needle_count);
+int  vs_records_push(struct vs_records *records, uint32_t file_id, uint32_t needle_id, uint64_t offset);
+int  vs_records_flush(struct vs_records *records);
+void vs_records_destroy(struct vs_records *records);
+
+void vs_print_json_string(const char *str, FILE *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
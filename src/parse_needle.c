@@ -1,12 +1,16 @@
 #include "parse_needle.h"
 
 #include <string.h>
+#include <strings.h>
+#include <math.h>
 #include <errno.h>
 #include <limits.h>
 #include <ctype.h>
 #include <stdbool.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <assert.h>
@@ -19,6 +23,7 @@ enum vs_needle_type {
 #ifdef __STDC_IEC_559__
 	VS_FLOAT,
 #endif
+	VS_BCD,
 };
 
 enum vs_byte_order {
@@ -36,6 +41,9 @@ struct vs_needle_type_info {
 	enum vs_sign sign;
 	size_t size;
 	enum vs_byte_order byte_order;
+	size_t unit_size;  // text: bytes per code unit (1, 2 or 4)
+	bool ignore_case;  // text: ASCII letters match in any case
+	bool bfloat;       // float: bfloat16 instead of IEEE half precision
 };
 
 static bool startswith_ignorecase(const char *str, const char *prefix) {
@@ -182,16 +190,146 @@ static const char *parse_string(const char *str, char *buf, size_t *sizeptr) {
 	return str;
 }
 
+// text[16le|16be|32le|32be][/i]:
+static const char *parse_text_type(const char *str, struct vs_needle_type_info *info) {
+	info->type        = VS_TEXT;
+	info->unit_size   = 1;
+	info->byte_order  = VS_LITTLE_ENDIAN;
+	info->ignore_case = false;
+
+	if (startswith_ignorecase(str, "16le")) {
+		info->unit_size = 2;
+		str += 4;
+	} else if (startswith_ignorecase(str, "16be")) {
+		info->unit_size  = 2;
+		info->byte_order = VS_BIG_ENDIAN;
+		str += 4;
+	} else if (startswith_ignorecase(str, "32le")) {
+		info->unit_size = 4;
+		str += 4;
+	} else if (startswith_ignorecase(str, "32be")) {
+		info->unit_size  = 4;
+		info->byte_order = VS_BIG_ENDIAN;
+		str += 4;
+	}
+
+	if (startswith_ignorecase(str, "/i")) {
+		info->ignore_case = true;
+		str += 2;
+	}
+
+	if (*str != ':') {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return str + 1;
+}
+
+// Decodes one UTF-8 sequence. Bytes that don't start a valid sequence are
+// taken as Latin-1 so that "\xNN" escapes still mean code point NN.
+static size_t decode_utf8(const uint8_t *str, size_t size, uint32_t *codepoint) {
+	const uint8_t lead = str[0];
+	size_t length = 0;
+	uint32_t value = 0;
+
+	if (lead >= 0xC2 && lead <= 0xDF) {
+		length = 2;
+		value  = lead & 0x1F;
+	} else if (lead >= 0xE0 && lead <= 0xEF) {
+		length = 3;
+		value  = lead & 0x0F;
+	} else if (lead >= 0xF0 && lead <= 0xF4) {
+		length = 4;
+		value  = lead & 0x07;
+	}
+
+	if (length == 0 || length > size) {
+		*codepoint = lead;
+		return 1;
+	}
+
+	for (size_t index = 1; index < length; ++ index) {
+		if ((str[index] & 0xC0) != 0x80) {
+			*codepoint = lead;
+			return 1;
+		}
+		value = (value << 6) | (str[index] & 0x3F);
+	}
+
+	if ((length == 3 && value < 0x800) || (length == 4 && (value < 0x10000 || value > 0x10FFFF)) ||
+	    (value >= 0xD800 && value <= 0xDFFF)) {
+		*codepoint = lead;
+		return 1;
+	}
+
+	*codepoint = value;
+	return length;
+}
+
+static size_t put_code_unit(uint32_t unit, const struct vs_needle_type_info *info, uint8_t buf[], uint8_t fold[], size_t bufsize, size_t size) {
+	const bool is_alpha = unit < 0x80 && isalpha((int)unit);
+	const size_t unit_size = info->unit_size;
+
+	if (is_alpha && info->ignore_case) {
+		unit = (uint32_t)tolower((int)unit);
+	}
+
+	if (bufsize >= size + unit_size) {
+		for (size_t index = 0; index < unit_size; ++ index) {
+			const size_t shift = info->byte_order == VS_LITTLE_ENDIAN ? index : unit_size - 1 - index;
+			buf[size + index] = (uint8_t)(unit >> (8 * shift));
+		}
+		if (fold && is_alpha && info->ignore_case) {
+			// the least significant byte holds the ASCII letter
+			fold[size + (info->byte_order == VS_LITTLE_ENDIAN ? 0 : unit_size - 1)] = 0x20;
+		}
+	}
+
+	return size + unit_size;
+}
+
+static size_t encode_text(const uint8_t *str, size_t str_size, const struct vs_needle_type_info *info, uint8_t buf[], uint8_t fold[], size_t bufsize) {
+	size_t size = 0;
+
+	if (info->unit_size == 1) {
+		for (size_t index = 0; index < str_size; ++ index) {
+			size = put_code_unit(str[index], info, buf, fold, bufsize, size);
+		}
+		return size;
+	}
+
+	for (size_t index = 0; index < str_size;) {
+		uint32_t codepoint = 0;
+		index += decode_utf8(str + index, str_size - index, &codepoint);
+
+		if (info->unit_size == 2 && codepoint >= 0x10000) {
+			codepoint -= 0x10000;
+			size = put_code_unit(0xD800 | (codepoint >> 10),   info, buf, fold, bufsize, size);
+			size = put_code_unit(0xDC00 | (codepoint & 0x3FF), info, buf, fold, bufsize, size);
+		} else {
+			size = put_code_unit(codepoint, info, buf, fold, bufsize, size);
+		}
+	}
+
+	return size;
+}
+
 static const char *parse_needle_type(const char *str, struct vs_needle_type_info *info) {
-	if (startswith_ignorecase(str, "text:")) {
-		info->type = VS_TEXT;
-		return str + 5;
+	info->ignore_case = false;
+	info->bfloat      = false;
+
+	if (startswith_ignorecase(str, "text")) {
+		return parse_text_type(str + 4, info);
 	} else if (startswith_ignorecase(str, "hex:")) {
 		info->type = VS_HEX;
 		return str + 4;
 	} else if (startswith_ignorecase(str, "file:")) {
 		info->type = VS_FILE;
 		return str + 5;
+	} else if (startswith_ignorecase(str, "bcd:")) {
+		info->type = VS_BCD;
+		return str + 4;
 	}
 
 	switch (*str) {
@@ -210,6 +348,18 @@ static const char *parse_needle_type(const char *str, struct vs_needle_type_info
 			info->type = VS_FLOAT;
 			info->sign = VS_SIGNED;
 			break;
+
+		case 'b': case 'B':
+			// bf16, the f is skipped below
+			if (str[1] != 'f' && str[1] != 'F') {
+				errno = EINVAL;
+				return NULL;
+			}
+			info->type   = VS_FLOAT;
+			info->sign   = VS_SIGNED;
+			info->bfloat = true;
+			++ str;
+			break;
 #endif
 
 		default:
@@ -227,7 +377,7 @@ static const char *parse_needle_type(const char *str, struct vs_needle_type_info
 	}
 
 	switch (size) {
-		case 8: case 16:
+		case 8: case 24:
 #ifdef __STDC_IEC_559__
 			if (info->type == VS_FLOAT) {
 				errno = EINVAL;
@@ -237,7 +387,7 @@ static const char *parse_needle_type(const char *str, struct vs_needle_type_info
 			info->size = size / 8;
 			break;
 		
-		case 32: case 64:
+		case 16: case 32: case 64:
 			info->size = size / 8;
 			break;
 
@@ -246,6 +396,13 @@ static const char *parse_needle_type(const char *str, struct vs_needle_type_info
 			return NULL;
 	}
 
+#ifdef __STDC_IEC_559__
+	if (info->bfloat && size != 16) {
+		errno = EINVAL;
+		return NULL;
+	}
+#endif
+
 	str = endptr;
 
 	if (startswith_ignorecase(str, "le")) {
@@ -273,7 +430,7 @@ static const char *parse_needle_type(const char *str, struct vs_needle_type_info
 	return str + 1;
 }
 
-const char *parse_needle_item(const char *str, struct vs_needle_type_info *info, uint8_t buf[], size_t bufsize) {
+const char *parse_needle_item(const char *str, struct vs_needle_type_info *info, uint8_t buf[], uint8_t fold[], size_t bufsize) {
 	str = parse_needle_type(str, info);
 	if (str == NULL) {
 		return NULL;
@@ -313,6 +470,18 @@ const char *parse_needle_item(const char *str, struct vs_needle_type_info *info,
 							}
 							break;
 
+						case 3:
+							if (value < -0x800000 || value > 0x7FFFFF) {
+								errno = ERANGE;
+								return NULL;
+							}
+							if (info->byte_order == VS_LITTLE_ENDIAN) {
+								vs_needle_from_i24le(buf, bufsize, (int32_t)value);
+							} else {
+								vs_needle_from_i24be(buf, bufsize, (int32_t)value);
+							}
+							break;
+
 						case 4:
 							if (value < INT32_MIN || value > INT32_MAX) {
 								errno = ERANGE;
@@ -372,6 +541,18 @@ const char *parse_needle_item(const char *str, struct vs_needle_type_info *info,
 							}
 							break;
 
+						case 3:
+							if (value > 0xFFFFFF) {
+								errno = ERANGE;
+								return NULL;
+							}
+							if (info->byte_order == VS_LITTLE_ENDIAN) {
+								vs_needle_from_u24le(buf, bufsize, (uint32_t)value);
+							} else {
+								vs_needle_from_u24be(buf, bufsize, (uint32_t)value);
+							}
+							break;
+
 						case 4:
 							if (value > UINT32_MAX) {
 								errno = ERANGE;
@@ -411,6 +592,46 @@ const char *parse_needle_item(const char *str, struct vs_needle_type_info *info,
 			errno = 0;
 			switch (info->size)
 			{
+				case 2:
+				{
+					float value = strtof(str, &endptr);
+					if (errno != 0) {
+						return NULL;
+					}
+
+					if (endptr == str) {
+						errno = EINVAL;
+						return NULL;
+					}
+					str = endptr;
+
+					uint8_t half[2];
+					if (info->bfloat) {
+						vs_needle_from_bf16be(half, sizeof(half), value);
+					} else {
+						vs_needle_from_f16be(half, sizeof(half), value);
+					}
+					// finite values that round to infinity
+					const uint16_t bits = (uint16_t)(half[0] << 8 | half[1]);
+					const uint16_t exponent = info->bfloat ? 0x7F80 : 0x7C00;
+					if (isfinite(value) && (bits & exponent) == exponent) {
+						errno = ERANGE;
+						return NULL;
+					}
+					if (info->byte_order == VS_LITTLE_ENDIAN) {
+						if (info->bfloat) {
+							vs_needle_from_bf16le(buf, bufsize, value);
+						} else {
+							vs_needle_from_f16le(buf, bufsize, value);
+						}
+					} else if (info->bfloat) {
+						vs_needle_from_bf16be(buf, bufsize, value);
+					} else {
+						vs_needle_from_f16be(buf, bufsize, value);
+					}
+					break;
+				}
+
 				case 4:
 				{
 					float value = strtof(str, &endptr);
@@ -455,12 +676,21 @@ const char *parse_needle_item(const char *str, struct vs_needle_type_info *info,
 #endif
 		case VS_TEXT:
 		{
-			size_t size = size;
-			str = parse_string(str, (char*)buf, &size);
+			size_t size = 0;
+			if (parse_string(str, NULL, &size) == NULL) {
+				return NULL;
+			}
+			uint8_t *text = malloc(size ? size : 1);
+			if (!text) {
+				return NULL;
+			}
+			str = parse_string(str, (char*)text, &size);
 			if (str == NULL) {
+				free(text);
 				return NULL;
 			}
-			info->size = size;
+			info->size = encode_text(text, size, info, buf, fold, bufsize);
+			free(text);
 			break;
 		}
 		case VS_HEX:
@@ -483,6 +713,29 @@ const char *parse_needle_item(const char *str, struct vs_needle_type_info *info,
 			}
 			break;
 
+		case VS_BCD:
+		{
+			const char *digits = str;
+			while (isdigit(*str))
+				++ str;
+			const size_t count = (size_t)(str - digits);
+			if (count == 0) {
+				errno = EINVAL;
+				return NULL;
+			}
+			// every given digit is encoded, so leading zeros set the width
+			info->size = (count + 1) / 2;
+			if (bufsize >= info->size) {
+				const size_t pad = count & 1;
+				memset(buf, 0, info->size);
+				for (size_t index = 0; index < count; ++ index) {
+					const size_t nibble = index + pad;
+					buf[nibble / 2] |= (uint8_t)((digits[index] - '0') << (nibble & 1 ? 0 : 4));
+				}
+			}
+			break;
+		}
+
 		case VS_FILE:
 		{
 			size_t size = 0;
@@ -504,15 +757,16 @@ const char *parse_needle_item(const char *str, struct vs_needle_type_info *info,
 				return NULL;
 			}
 			info->size = st.st_size;
-			if (info->size <= bufsize) {
+			if (info->size > 0 && info->size <= bufsize) {
 				FILE *fp = fopen(filename, "rb");
 				if (!fp) {
 					perror(filename);
 					free(filename);
 					return NULL;
 				}
-				if (fread(buf, bufsize, 1, fp) != 1) {
+				if (fread(buf, info->size, 1, fp) != 1) {
 					perror(filename);
+					fclose(fp);
 					free(filename);
 					return NULL;
 				}
@@ -529,7 +783,7 @@ const char *parse_needle_item(const char *str, struct vs_needle_type_info *info,
 	return str;
 }
 
-size_t vs_parse_needle_data(const char *str, uint8_t buf[], size_t bufsize) {
+size_t vs_parse_needle_data(const char *str, uint8_t buf[], uint8_t fold[], size_t bufsize) {
 	size_t size = 0;
 	const char *ptr = str;
 	while (isspace(*ptr))
@@ -537,8 +791,8 @@ size_t vs_parse_needle_data(const char *str, uint8_t buf[], size_t bufsize) {
 	while (*ptr) {
 		struct vs_needle_type_info info;
 		ptr = bufsize >= size ?
-			parse_needle_item(ptr, &info, buf + size, bufsize - size) :
-			parse_needle_item(ptr, &info, NULL, 0);
+			parse_needle_item(ptr, &info, buf + size, fold ? fold + size : NULL, bufsize - size) :
+			parse_needle_item(ptr, &info, NULL, NULL, 0);
 		if (ptr == NULL) {
 			return 0;
 		}
@@ -562,20 +816,889 @@ size_t vs_parse_needle_data(const char *str, uint8_t buf[], size_t bufsize) {
 	return size;
 }
 
+int vs_needle_files(const char *str, vs_needle_file_callback callback, void *ctx) {
+	const char *ptr = str;
+	while (isspace(*ptr))
+		++ ptr;
+
+	// delta, varint and group needles are made of numbers only
+	if (startswith_ignorecase(ptr, "delta:") || startswith_ignorecase(ptr, "varint:") ||
+	    startswith_ignorecase(ptr, "uleb128:") || startswith_ignorecase(ptr, "sleb128:") ||
+	    startswith_ignorecase(ptr, "zigzag:") || vs_is_needle_group(ptr)) {
+		return 0;
+	}
+
+	while (*ptr) {
+		struct vs_needle_type_info info;
+		const char *value = parse_needle_type(ptr, &info);
+		if (value == NULL) {
+			return -1;
+		}
+		if (info.type == VS_FILE) {
+			size_t size = 0;
+			if (parse_string(value, NULL, &size) == NULL) {
+				return -1;
+			}
+			char *filename = calloc(1, size + 1);
+			if (!filename) {
+				return -1;
+			}
+			parse_string(value, filename, &size);
+			const int status = callback(filename, ctx);
+			free(filename);
+			if (status != 0) {
+				return status;
+			}
+		}
+
+		ptr = parse_needle_item(ptr, &info, NULL, NULL, 0);
+		if (ptr == NULL) {
+			return -1;
+		}
+		while (isspace(*ptr))
+			++ ptr;
+		if (*ptr != ',')
+			break;
+		++ ptr;
+		while (isspace(*ptr))
+			++ ptr;
+	}
+
+	return 0;
+}
+
+enum vs_group_kind {
+	VS_GROUP_ANY,
+	VS_GROUP_INT,
+	VS_GROUP_FLOAT,
+};
+
+static const char *parse_group_kind(const char *str, enum vs_group_kind *kind) {
+	while (isspace(*str))
+		++ str;
+
+	if (startswith_ignorecase(str, "any:")) {
+		*kind = VS_GROUP_ANY;
+		return str + 4;
+	} else if (startswith_ignorecase(str, "anyint:")) {
+		*kind = VS_GROUP_INT;
+		return str + 7;
+	} else if (startswith_ignorecase(str, "anyfloat:")) {
+		*kind = VS_GROUP_FLOAT;
+		return str + 9;
+	}
+
+	return NULL;
+}
+
+bool vs_is_needle_group(const char *str) {
+	enum vs_group_kind kind;
+	return parse_group_kind(str, &kind) != NULL;
+}
+
+// Adds one needle of a group unless an earlier encoding already produced the
+// same bytes. The label ("format:value") is stored right behind the needle
+// data, so freeing the data frees the label too.
+static int push_group_needle(struct vs_needle needles[], size_t *countptr, const char *format,
+                             const char *value, size_t value_size, const uint8_t data[], size_t size) {
+	for (size_t index = 0; index < *countptr; ++ index) {
+		if (needles[index].size == size && memcmp(needles[index].data, data, size) == 0) {
+			return 0;
+		}
+	}
+
+	assert(*countptr < VS_NEEDLE_GROUP_MAX);
+
+	const size_t label_size = strlen(format) + 1 + value_size + 1;
+	uint8_t *buf = malloc(size + label_size);
+	if (!buf) {
+		return -1;
+	}
+	memcpy(buf, data, size);
+	snprintf((char*)buf + size, label_size, "%s:%.*s", format, (int)value_size, value);
+
+	struct vs_needle *needle = needles + (*countptr) ++;
+	needle->size  = size;
+	needle->data  = buf;
+	needle->fold  = NULL;
+	needle->ctx   = buf + size;
+	needle->flags = 0;
+	needle->unit_size = 0;
+
+	return 0;
+}
+
+int vs_parse_needle_group(const char *str, struct vs_needle needles[], size_t *countptr) {
+	enum vs_group_kind kind;
+	uint8_t buf[8];
+	size_t count = 0;
+
+	const char *value = parse_group_kind(str, &kind);
+	if (value == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	while (isspace(*value))
+		++ value;
+	size_t value_size = strlen(value);
+	while (value_size > 0 && isspace(value[value_size - 1]))
+		-- value_size;
+
+	if (value_size == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	char *endptr = NULL;
+	bool is_int = false;
+	bool is_negative = false;
+	unsigned long long int uvalue = 0;
+	long long int ivalue = 0;
+
+	if (kind != VS_GROUP_FLOAT) {
+		errno = 0;
+		if (*value == '-') {
+			ivalue = strtoll(value, &endptr, 10);
+			is_negative = true;
+		} else {
+			uvalue = strtoull(value, &endptr, 10);
+			ivalue = uvalue > INT64_MAX ? -1 : (long long int)uvalue;
+		}
+		is_int = errno == 0 && endptr == value + value_size;
+	}
+
+#ifdef __STDC_IEC_559__
+	double fvalue = 0;
+	bool is_float = false;
+
+	if (kind != VS_GROUP_INT) {
+		errno = 0;
+		fvalue = strtod(value, &endptr);
+		is_float = errno == 0 && endptr == value + value_size;
+	}
+
+	if (!is_int && !is_float) {
+		errno = EINVAL;
+		return -1;
+	}
+#else
+	if (!is_int) {
+		errno = EINVAL;
+		return -1;
+	}
+#endif
+
+#define PUSH(FORMAT, EXPR) \
+	if (push_group_needle(needles, &count, (FORMAT), value, value_size, buf, (EXPR)) != 0) { \
+		goto error; \
+	}
+
+	if (is_int) {
+		if (!is_negative) {
+			if (uvalue <= UINT8_MAX) {
+				PUSH("u8", vs_needle_from_u8(buf, sizeof(buf), (uint8_t)uvalue));
+			}
+			if (uvalue <= UINT16_MAX) {
+				PUSH("u16le", vs_needle_from_u16le(buf, sizeof(buf), (uint16_t)uvalue));
+				PUSH("u16be", vs_needle_from_u16be(buf, sizeof(buf), (uint16_t)uvalue));
+			}
+			if (uvalue <= UINT32_MAX) {
+				PUSH("u32le", vs_needle_from_u32le(buf, sizeof(buf), (uint32_t)uvalue));
+				PUSH("u32be", vs_needle_from_u32be(buf, sizeof(buf), (uint32_t)uvalue));
+			}
+			PUSH("u64le", vs_needle_from_u64le(buf, sizeof(buf), (uint64_t)uvalue));
+			PUSH("u64be", vs_needle_from_u64be(buf, sizeof(buf), (uint64_t)uvalue));
+		}
+		if (is_negative || uvalue <= INT64_MAX) {
+			if (ivalue >= INT8_MIN && ivalue <= INT8_MAX) {
+				PUSH("i8", vs_needle_from_i8(buf, sizeof(buf), (int8_t)ivalue));
+			}
+			if (ivalue >= INT16_MIN && ivalue <= INT16_MAX) {
+				PUSH("i16le", vs_needle_from_i16le(buf, sizeof(buf), (int16_t)ivalue));
+				PUSH("i16be", vs_needle_from_i16be(buf, sizeof(buf), (int16_t)ivalue));
+			}
+			if (ivalue >= INT32_MIN && ivalue <= INT32_MAX) {
+				PUSH("i32le", vs_needle_from_i32le(buf, sizeof(buf), (int32_t)ivalue));
+				PUSH("i32be", vs_needle_from_i32be(buf, sizeof(buf), (int32_t)ivalue));
+			}
+			PUSH("i64le", vs_needle_from_i64le(buf, sizeof(buf), (int64_t)ivalue));
+			PUSH("i64be", vs_needle_from_i64be(buf, sizeof(buf), (int64_t)ivalue));
+		}
+	}
+
+#ifdef __STDC_IEC_559__
+	if (is_float) {
+		// only if single precision can represent the value exactly
+		const float f32value = (float)fvalue;
+		if ((double)f32value == fvalue || fvalue != fvalue) {
+			PUSH("f32le", vs_needle_from_f32le(buf, sizeof(buf), f32value));
+			PUSH("f32be", vs_needle_from_f32be(buf, sizeof(buf), f32value));
+		}
+		PUSH("f64le", vs_needle_from_f64le(buf, sizeof(buf), fvalue));
+		PUSH("f64be", vs_needle_from_f64be(buf, sizeof(buf), fvalue));
+	}
+#endif
+
+#undef PUSH
+
+	*countptr = count;
+	return 0;
+
+error:
+	for (size_t index = 0; index < count; ++ index) {
+		free((void*)needles[index].data);
+	}
+	return -1;
+}
+
+// A needle that consists of nothing but a single file is mapped instead of
+// copied. Returns 1 if str isn't such a needle.
+static int map_file_needle(const char *str, struct vs_needle *needle) {
+	while (isspace(*str))
+		++ str;
+
+	if (!startswith_ignorecase(str, "file:")) {
+		return 1;
+	}
+	str += 5;
+
+	size_t size = 0;
+	const char *end = parse_string(str, NULL, &size);
+	if (end == NULL) {
+		return -1;
+	}
+	while (isspace(*end))
+		++ end;
+	if (*end) {
+		return 1;
+	}
+
+	char *filename = calloc(1, size + 1);
+	if (!filename) {
+		return -1;
+	}
+	parse_string(str, filename, &size);
+
+	int fd = open(filename, O_RDONLY);
+	free(filename);
+	if (fd == -1) {
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (sizeof(off_t) > sizeof(size_t) && st.st_size > (off_t)SIZE_MAX) {
+		close(fd);
+		errno = ERANGE;
+		return -1;
+	}
+
+	void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return -1;
+	}
+
+	needle->data   = data;
+	needle->size   = (size_t)st.st_size;
+	needle->flags |= VS_NEEDLE_MAPPED;
+	return 0;
+}
+
+// delta:FORMAT:VALUE,VALUE,... e.g. delta:u32le:0,+1,+5 or delta:u16be:0,0x40,0x80
+static int parse_delta_needle(const char *str, struct vs_needle *needle) {
+	struct vs_needle_type_info info;
+	str = parse_needle_type(str, &info);
+	if (str == NULL) {
+		return -1;
+	}
+	if (info.type != VS_INT) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	const uint64_t mask = info.size < 8 ? (UINT64_C(1) << (info.size * 8)) - 1 : UINT64_MAX;
+	size_t count = 1;
+	for (const char *ptr = str; *ptr; ++ ptr) {
+		if (*ptr == ',') {
+			++ count;
+		}
+	}
+	if (count < 2) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	uint8_t *data = malloc(count * info.size);
+	if (!data) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	uint64_t first = 0;
+	for (size_t index = 0; index < count; ++ index) {
+		const bool negative = *str == '-';
+		if (*str == '-' || *str == '+') {
+			++ str;
+		}
+		const int base = str[0] == '0' && (str[1] == 'x' || str[1] == 'X') ? 16 : 10;
+		char *endptr = NULL;
+		errno = 0;
+		const unsigned long long magnitude = strtoull(str, &endptr, base);
+		if (endptr == str || !isxdigit(*str) || (*endptr && *endptr != ',')) {
+			free(data);
+			errno = EINVAL;
+			return -1;
+		}
+		if (errno != 0 || magnitude > mask) {
+			free(data);
+			errno = ERANGE;
+			return -1;
+		}
+		str = *endptr ? endptr + 1 : endptr;
+
+		const uint64_t value = negative ? 0 - (uint64_t)magnitude : (uint64_t)magnitude;
+		if (index == 0) {
+			first = value;
+		}
+
+		// stored relative to the first element
+		const uint64_t delta = (value - first) & mask;
+		uint8_t *ptr = data + index * info.size;
+		for (size_t byte = 0; byte < info.size; ++ byte) {
+			const size_t shift = info.byte_order == VS_BIG_ENDIAN ? (info.size - 1 - byte) * 8 : byte * 8;
+			ptr[byte] = (uint8_t)(delta >> shift);
+		}
+	}
+
+	needle->data      = data;
+	needle->fold      = NULL;
+	needle->size      = count * info.size;
+	needle->unit_size = info.size;
+	needle->flags     = VS_NEEDLE_DELTA | (info.byte_order == VS_BIG_ENDIAN ? VS_NEEDLE_BIG_ENDIAN : 0);
+	return 0;
+}
+
+// varint:VALUE (or uleb128:VALUE), sleb128:VALUE and zigzag:VALUE
+static int parse_varint_needle(const char *str, struct vs_needle *needle) {
+	const bool zigzag    = startswith_ignorecase(str, "zigzag:");
+	const bool is_signed = zigzag || startswith_ignorecase(str, "sleb128:");
+	str = strchr(str, ':') + 1;
+
+	char *endptr = NULL;
+	uint8_t buf[VS_LEB128_MAX_SIZE];
+	size_t size;
+	errno = 0;
+	if (is_signed) {
+		const long long value = strtoll(str, &endptr, 10);
+		size = zigzag ?
+			vs_needle_from_zigzag(buf, sizeof(buf), value) :
+			vs_needle_from_sleb128(buf, sizeof(buf), value);
+	}
+	else {
+		const unsigned long long value = strtoull(str, &endptr, 10);
+		if (*str == '-') {
+			errno = ERANGE;
+		}
+		size = vs_needle_from_uleb128(buf, sizeof(buf), value);
+	}
+	if (endptr == str || *endptr) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (errno != 0) {
+		return -1;
+	}
+
+	uint8_t *data = malloc(size);
+	if (!data) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy(data, buf, size);
+
+	needle->data      = data;
+	needle->fold      = NULL;
+	needle->size      = size;
+	needle->unit_size = 0;
+	// zigzag values are unsigned LEB128
+	needle->flags     = VS_NEEDLE_VARINT | (is_signed && !zigzag ? VS_NEEDLE_SIGNED : 0);
+	return 0;
+}
+
 int vs_parse_needle(const char *str, struct vs_needle *needle) {
-	size_t size = vs_parse_needle_data(str, NULL, 0);
+	if (startswith_ignorecase(str, "delta:")) {
+		return parse_delta_needle(str + 6, needle);
+	}
+
+	if (startswith_ignorecase(str, "varint:") || startswith_ignorecase(str, "uleb128:") ||
+	    startswith_ignorecase(str, "sleb128:") || startswith_ignorecase(str, "zigzag:")) {
+		return parse_varint_needle(str, needle);
+	}
+
+	int status = map_file_needle(str, needle);
+	if (status <= 0) {
+		return status;
+	}
+
+	size_t size = vs_parse_needle_data(str, NULL, NULL, 0);
 	if (size == 0) {
 		return -1;
 	}
-	uint8_t *data = calloc(1, size);
+	// fold mask lives right behind the data
+	uint8_t *data = calloc(2, size);
 	if (!data) {
 		return -1;
 	}
-	if (vs_parse_needle_data(str, data, size) != size) {
+	uint8_t *fold = data + size;
+	if (vs_parse_needle_data(str, data, fold, size) != size) {
 		assert(false);
+		free(data);
 		return -1;
 	}
+	bool folded = false;
+	for (size_t index = 0; index < size; ++ index) {
+		if (fold[index]) {
+			folded = true;
+			break;
+		}
+	}
 	needle->data = data;
+	needle->fold = folded ? fold : NULL;
 	needle->size = size;
 	return 0;
-}
\ No newline at end of file
+}
+
+void vs_free_needle(struct vs_needle *needle) {
+	if (needle->flags & VS_NEEDLE_MAPPED) {
+		munmap((void*)needle->data, needle->size);
+	}
+	else {
+		free((void*)needle->data);
+	}
+	needle->data  = NULL;
+	needle->fold  = NULL;
+	needle->size  = 0;
+	needle->flags = 0;
+	needle->unit_size = 0;
+}
+
+static int parse_array_bound(const char *str, size_t len, const struct vs_array_field *field, union vs_array_bound *bound) {
+	char buf[64];
+	if (len == 0 || len >= sizeof(buf)) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(buf, str, len);
+	buf[len] = '\0';
+
+	char *endptr = NULL;
+	errno = 0;
+	switch (field->value) {
+	case VS_ARRAY_SIGNED:
+	{
+		const long long value = strtoll(buf, &endptr, 0);
+		const long long limit = field->size == 8 ? LLONG_MAX : (1LL << (field->size * 8 - 1)) - 1;
+		if (errno == 0 && (value > limit || value < -limit - 1)) {
+			errno = ERANGE;
+		}
+		bound->i = value;
+		break;
+	}
+	case VS_ARRAY_FLOAT:
+		bound->f = strtod(buf, &endptr);
+		break;
+
+	default:
+	{
+		const unsigned long long value = strtoull(buf, &endptr, 0);
+		if (errno == 0 && (buf[0] == '-' || (field->size < 8 && value >> (field->size * 8) != 0))) {
+			errno = ERANGE;
+		}
+		bound->u = value;
+	}
+	}
+
+	if (*endptr) {
+		errno = EINVAL;
+		return -1;
+	}
+	return errno == 0 ? 0 : -1;
+}
+
+// FORMAT@OFFSET=VALUE, FORMAT@OFFSET=MIN..MAX (either may be left out),
+// FORMAT@OFFSET=inc or FORMAT@OFFSET=dec
+// Sets size, byte order and value type of field from the number format name.
+static int parse_field_format(const char *str, size_t len, struct vs_array_field *field) {
+	static const struct {
+		const char *name;
+		size_t size;
+		bool big_endian;
+		enum vs_array_value value;
+	} formats[] = {
+		{ "u8",    1, false, VS_ARRAY_UNSIGNED },
+		{ "i8",    1, false, VS_ARRAY_SIGNED   },
+		{ "u16le", 2, false, VS_ARRAY_UNSIGNED },
+		{ "i16le", 2, false, VS_ARRAY_SIGNED   },
+		{ "u16be", 2, true,  VS_ARRAY_UNSIGNED },
+		{ "i16be", 2, true,  VS_ARRAY_SIGNED   },
+		{ "u32le", 4, false, VS_ARRAY_UNSIGNED },
+		{ "i32le", 4, false, VS_ARRAY_SIGNED   },
+		{ "u32be", 4, true,  VS_ARRAY_UNSIGNED },
+		{ "i32be", 4, true,  VS_ARRAY_SIGNED   },
+		{ "u64le", 8, false, VS_ARRAY_UNSIGNED },
+		{ "i64le", 8, false, VS_ARRAY_SIGNED   },
+		{ "u64be", 8, true,  VS_ARRAY_UNSIGNED },
+		{ "i64be", 8, true,  VS_ARRAY_SIGNED   },
+#ifdef __STDC_IEC_559__
+		{ "f32le", 4, false, VS_ARRAY_FLOAT    },
+		{ "f32be", 4, true,  VS_ARRAY_FLOAT    },
+		{ "f64le", 8, false, VS_ARRAY_FLOAT    },
+		{ "f64be", 8, true,  VS_ARRAY_FLOAT    },
+#endif
+	};
+
+	size_t index = 0;
+	for (; index < sizeof(formats) / sizeof(formats[0]); ++ index) {
+		if (strlen(formats[index].name) == len && strncasecmp(formats[index].name, str, len) == 0) {
+			break;
+		}
+	}
+	if (index == sizeof(formats) / sizeof(formats[0])) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	field->offset     = 0;
+	field->size       = formats[index].size;
+	field->big_endian = formats[index].big_endian;
+	field->value      = formats[index].value;
+	field->predicate  = VS_ARRAY_RANGE;
+
+	return 0;
+}
+
+static int parse_array_field(const char *str, size_t len, struct vs_array_field *field) {
+	const char *end = str + len;
+	const char *at  = memchr(str, '@', len);
+	const char *eq  = at ? memchr(at, '=', (size_t)(end - at)) : NULL;
+	if (!eq) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (parse_field_format(str, (size_t)(at - str), field) != 0) {
+		return -1;
+	}
+
+	char *endptr = NULL;
+	errno = 0;
+	const unsigned long long offset = strtoull(at + 1, &endptr, 10);
+	if (endptr == at + 1 || endptr != eq || at[1] == '-') {
+		errno = EINVAL;
+		return -1;
+	}
+	if (errno != 0) {
+		return -1;
+	}
+	field->offset = (size_t)offset;
+
+	const char *pred = eq + 1;
+	const size_t pred_len = (size_t)(end - pred);
+	if (pred_len == 3 && strncasecmp(pred, "inc", 3) == 0) {
+		field->predicate = VS_ARRAY_INCREASING;
+		return 0;
+	}
+	if (pred_len == 3 && strncasecmp(pred, "dec", 3) == 0) {
+		field->predicate = VS_ARRAY_DECREASING;
+		return 0;
+	}
+
+	field->predicate = VS_ARRAY_RANGE;
+	switch (field->value) {
+	case VS_ARRAY_SIGNED:
+		field->min.i = field->size == 8 ? LLONG_MIN : -(1LL << (field->size * 8 - 1));
+		field->max.i = field->size == 8 ? LLONG_MAX :  (1LL << (field->size * 8 - 1)) - 1;
+		break;
+
+	case VS_ARRAY_FLOAT:
+		field->min.f = -HUGE_VAL;
+		field->max.f =  HUGE_VAL;
+		break;
+
+	default:
+		field->min.u = 0;
+		field->max.u = field->size == 8 ? UINT64_MAX : (UINT64_C(1) << (field->size * 8)) - 1;
+	}
+
+	const char *dots = NULL;
+	for (const char *ptr = pred; ptr + 1 < end; ++ ptr) {
+		if (ptr[0] == '.' && ptr[1] == '.') {
+			dots = ptr;
+			break;
+		}
+	}
+
+	if (!dots) {
+		if (parse_array_bound(pred, pred_len, field, &field->min) != 0) {
+			return -1;
+		}
+		field->max = field->min;
+		return 0;
+	}
+
+	if (dots == pred && dots + 2 == end) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (dots > pred && parse_array_bound(pred, (size_t)(dots - pred), field, &field->min) != 0) {
+		return -1;
+	}
+	if (dots + 2 < end && parse_array_bound(dots + 2, (size_t)(end - dots - 2), field, &field->max) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+int vs_parse_array_schema(const char *str, struct vs_array_schema *schema) {
+	schema->stride      = 0;
+	schema->min_count   = VS_ARRAY_DEFAULT_MIN_COUNT;
+	schema->fields      = NULL;
+	schema->field_count = 0;
+
+	size_t capacity = 0;
+	while (*str) {
+		const char *comma = strchr(str, ',');
+		const size_t len  = comma ? (size_t)(comma - str) : strlen(str);
+
+		if (startswith_ignorecase(str, "stride:") || startswith_ignorecase(str, "min:")) {
+			const char *value = strchr(str, ':') + 1;
+			char *endptr = NULL;
+			errno = 0;
+			const unsigned long long number = strtoull(value, &endptr, 10);
+			if (endptr == value || endptr != str + len || *value == '-' || number == 0) {
+				errno = EINVAL;
+				goto error;
+			}
+			if (errno != 0 || number > SIZE_MAX) {
+				errno = ERANGE;
+				goto error;
+			}
+			if (tolower(*str) == 's') {
+				schema->stride = (size_t)number;
+			}
+			else {
+				schema->min_count = (size_t)number;
+			}
+		}
+		else {
+			if (schema->field_count == capacity) {
+				capacity = capacity ? capacity * 2 : 8;
+				struct vs_array_field *fields = realloc(schema->fields, sizeof(struct vs_array_field) * capacity);
+				if (!fields) {
+					errno = ENOMEM;
+					goto error;
+				}
+				schema->fields = fields;
+			}
+			if (parse_array_field(str, len, schema->fields + schema->field_count) != 0) {
+				goto error;
+			}
+			++ schema->field_count;
+		}
+
+		str += len;
+		if (*str == ',') {
+			++ str;
+		}
+	}
+
+	if (schema->stride == 0 || schema->field_count == 0) {
+		errno = EINVAL;
+		goto error;
+	}
+
+	for (size_t index = 0; index < schema->field_count; ++ index) {
+		const struct vs_array_field *field = schema->fields + index;
+		if (field->offset + field->size > schema->stride) {
+			errno = ERANGE;
+			goto error;
+		}
+	}
+
+	return 0;
+
+error:
+	{
+		const int errnum = errno;
+		vs_free_array_schema(schema);
+		errno = errnum;
+	}
+	return -1;
+}
+
+void vs_free_array_schema(struct vs_array_schema *schema) {
+	free(schema->fields);
+	schema->fields      = NULL;
+	schema->field_count = 0;
+}
+
+int vs_parse_pointer_format(const char *str, struct vs_pointer_format *format) {
+	static const struct {
+		const char *name;
+		size_t size;
+		bool big_endian;
+	} formats[] = {
+		{ "u16le", 2, false },
+		{ "u16be", 2, true  },
+		{ "u32le", 4, false },
+		{ "u32be", 4, true  },
+		{ "u64le", 8, false },
+		{ "u64be", 8, true  },
+	};
+
+	const char *comma = strchr(str, ',');
+	const size_t name_len = comma ? (size_t)(comma - str) : strlen(str);
+
+	size_t index = 0;
+	for (; index < sizeof(formats) / sizeof(formats[0]); ++ index) {
+		if (strlen(formats[index].name) == name_len && strncasecmp(formats[index].name, str, name_len) == 0) {
+			break;
+		}
+	}
+	if (index == sizeof(formats) / sizeof(formats[0])) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	format->size        = formats[index].size;
+	format->big_endian  = formats[index].big_endian;
+	format->align       = formats[index].size;
+	format->phase       = 0;
+	format->base        = 0;
+	format->min_density = -1;
+
+	str += name_len;
+	while (*str == ',') {
+		++ str;
+		comma = strchr(str, ',');
+		const size_t len = comma ? (size_t)(comma - str) : strlen(str);
+		const char *value = memchr(str, ':', len);
+		char *endptr = NULL;
+		if (!value) {
+			errno = EINVAL;
+			return -1;
+		}
+		++ value;
+		errno = 0;
+
+		if (startswith_ignorecase(str, "density:")) {
+			const double density = strtod(value, &endptr);
+			if (endptr == value || endptr != str + len || !(density >= 0 && density <= 1)) {
+				errno = EINVAL;
+				return -1;
+			}
+			format->min_density = density;
+		}
+		else if (startswith_ignorecase(str, "base:") || startswith_ignorecase(str, "align:")) {
+			const unsigned long long number = strtoull(value, &endptr, 0);
+			if (endptr == value || endptr != str + len || *value == '-') {
+				errno = EINVAL;
+				return -1;
+			}
+			if (errno != 0) {
+				return -1;
+			}
+			if (tolower(*str) == 'b') {
+				format->base = (uint64_t)number;
+			}
+			else if (number == 0 || number > SIZE_MAX) {
+				errno = number == 0 ? EINVAL : ERANGE;
+				return -1;
+			}
+			else {
+				format->align = (size_t)number;
+			}
+		}
+		else {
+			errno = EINVAL;
+			return -1;
+		}
+
+		str += len;
+	}
+
+	if (*str) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int vs_parse_diff(const char *str, struct vs_diff *diff) {
+	static const struct {
+		const char *name;
+		enum vs_diff_kind kind;
+	} kinds[] = {
+		{ "changed:",   VS_DIFF_CHANGED   },
+		{ "increased:", VS_DIFF_INCREASED },
+		{ "decreased:", VS_DIFF_DECREASED },
+	};
+
+	size_t index = 0;
+	for (; index < sizeof(kinds) / sizeof(kinds[0]); ++ index) {
+		if (startswith_ignorecase(str, kinds[index].name)) {
+			break;
+		}
+	}
+	if (index == sizeof(kinds) / sizeof(kinds[0])) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	diff->kind   = kinds[index].kind;
+	diff->before = NULL;
+	diff->after  = NULL;
+
+	str += strlen(kinds[index].name);
+	const char *comma = strchr(str, ',');
+	if (parse_field_format(str, comma ? (size_t)(comma - str) : strlen(str), &diff->field) != 0) {
+		return -1;
+	}
+	diff->align = diff->field.size;
+
+	if (comma) {
+		const char *value = comma + 1;
+		if (!startswith_ignorecase(value, "align:")) {
+			errno = EINVAL;
+			return -1;
+		}
+		value += strlen("align:");
+		char *endptr = NULL;
+		errno = 0;
+		const unsigned long long align = strtoull(value, &endptr, 10);
+		if (endptr == value || *endptr || *value == '-' || align == 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (errno != 0 || align > SIZE_MAX) {
+			errno = ERANGE;
+			return -1;
+		}
+		diff->align = (size_t)align;
+	}
+
+	return 0;
+}
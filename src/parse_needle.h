@@ -4,12 +4,47 @@
 
 #include "valuescan.h"
 
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-size_t vs_parse_needle_data(const char *str, uint8_t buf[], size_t bufsize);
+size_t vs_parse_needle_data(const char *str, uint8_t buf[], uint8_t fold[], size_t bufsize);
 int    vs_parse_needle(const char *str, struct vs_needle *needle);
+void   vs_free_needle(struct vs_needle *needle);
+
+// Calls callback with the name of every file the needle reads data from
+// (file:NAME items). Stops at the first callback that doesn't return 0.
+typedef int (*vs_needle_file_callback)(const char *filename, void *ctx);
+
+int    vs_needle_files(const char *str, vs_needle_file_callback callback, void *ctx);
+
+// any:VALUE, anyint:VALUE and anyfloat:VALUE expand to one needle per distinct
+// encoding of VALUE (every width, sign, byte order and float format it fits).
+// Each needle's ctx is set to the "format:value" string of its encoding.
+#define VS_NEEDLE_GROUP_MAX 32
+
+bool   vs_is_needle_group(const char *str);
+int    vs_parse_needle_group(const char *str, struct vs_needle needles[], size_t *countptr);
+
+// --records=stride:N[,min:N],FORMAT@OFFSET=PREDICATE,... where FORMAT is one
+// of the integer or float formats and PREDICATE is VALUE, MIN..MAX (one side
+// may be left out), inc or dec. Fields must lie within the stride.
+#define VS_ARRAY_DEFAULT_MIN_COUNT 16
+
+int    vs_parse_array_schema(const char *str, struct vs_array_schema *schema);
+void   vs_free_array_schema(struct vs_array_schema *schema);
+
+// --pointers=FORMAT[,base:N][,align:N][,density:R] where FORMAT is one of the
+// integer formats of 16 bits or more. min_density is negative if not given.
+#define VS_POINTER_DEFAULT_DENSITY 0.5
+
+int    vs_parse_pointer_format(const char *str, struct vs_pointer_format *format);
+
+// --diff=KIND:FORMAT[,align:N] where KIND is changed, increased or decreased
+// and FORMAT a number format. align defaults to the size of FORMAT.
+int    vs_parse_diff(const char *str, struct vs_diff *diff);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,915 @@
+#include "valuescan.h"
+#include "hits.h"
+#include "counters.h"
+
+#include <endian.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+
+// Groups are searched chunk by chunk when there is more than one of them, so
+// their hits can be merged in offset order.
+#define VS_PLAN_CHUNK_SIZE (1024 * 1024)
+
+// Many needles of one width are looked up in a hash set instead. Mixed widths
+// stay in one trie: searching several groups means merging their hits, which
+// costs more than it saves.
+#define VS_PLAN_HASH_MIN_NEEDLES 64
+#define VS_PLAN_HASH_MAX_WIDTH   8
+
+// A memchr() stop costs about as much as a few verified candidates.
+#define VS_PLAN_VERIFY_COST 4.0
+
+#define VS_PLAN_NONE UINT32_MAX
+
+// offsets per round of the delta and varint prefilters
+#define DELTA_BLOCK_SIZE  4096
+#define VARINT_BLOCK_SIZE 4096
+
+// Up to this many distinct low parts are compared one by one, more are
+// looked up in a table.
+#define VARINT_MAX_LOWS 4
+
+struct hash_set {
+	size_t    width;
+	unsigned  bits;
+	uint64_t *keys;
+	uint32_t *needles; // index into the group's needles or VS_PLAN_NONE
+	uint64_t  prefix[65536 / 64]; // bitmap of the first (up to) two bytes
+};
+
+// VS_NEEDLE_DELTA needle with its elements decoded
+struct delta_needle {
+	size_t   unit_size;
+	size_t   count;
+	bool     big_endian;
+	uint64_t mask;
+	uint64_t *deltas;
+};
+
+// VS_NEEDLE_VARINT needle with its value decoded
+struct varint_needle {
+	uint64_t value;
+	bool     is_signed;
+	size_t   index; // into the group's needles
+};
+
+struct varint_set {
+	struct varint_needle *needles; // sorted by signedness, value and index
+	bool    any_signed;
+	bool    any_unsigned;
+	uint8_t lows[VARINT_MAX_LOWS]; // distinct low 7 bits of the values
+	size_t  low_count;             // 0 if there are more, then starts is used
+	uint8_t starts[128];           // 1 for the low 7 bits of every value
+};
+
+struct plan_group {
+	struct vs_plan_info info;
+	struct vs_needle *needles; // copies, in original order
+	size_t *indices;           // original index of each copy
+	struct vs_trie  *trie;
+	struct hash_set  hash;
+	struct delta_needle *deltas;
+	struct varint_set varints;
+};
+
+struct vs_plan {
+	const struct vs_needle *needles;
+	size_t needle_count;
+	size_t max_size;
+	struct plan_group *groups;
+	size_t group_count;
+};
+
+const char *vs_plan_engine_name(enum vs_plan_engine engine) {
+	switch (engine) {
+	case VS_ENGINE_ANCHOR: return "anchor";
+	case VS_ENGINE_HASH:   return "hash";
+	case VS_ENGINE_TRIE:   return "trie";
+	case VS_ENGINE_SCAN:   return "scan";
+	case VS_ENGINE_DELTA:  return "delta";
+	case VS_ENGINE_VARINT: return "varint";
+	default:               return "?";
+	}
+}
+
+// Rough byte frequencies of binary files: lots of zero bytes, some 0xFF
+// (padding, -1), text a bit more common than the remaining bytes.
+static double static_frequency(uint8_t byte) {
+	return byte == 0x00 ? 0.25 :
+	       byte == 0xFF ? 0.04 :
+	       byte >= 0x20 && byte < 0x7F ? 0.004 :
+	       0.0025;
+}
+
+struct frequencies {
+	double    bytes[256];
+	uint32_t *pairs; // counts from the sample, NULL without one
+	size_t    sample_size;
+};
+
+static int count_frequencies(struct frequencies *freq, const uint8_t sample[], size_t sample_size) {
+	freq->pairs       = NULL;
+	freq->sample_size = 0;
+
+	if (!sample || sample_size < 2) {
+		for (size_t byte = 0; byte < 256; ++ byte) {
+			freq->bytes[byte] = static_frequency((uint8_t)byte);
+		}
+		return 0;
+	}
+
+	freq->pairs = calloc(256 * 256, sizeof(uint32_t));
+	if (!freq->pairs) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	size_t counts[256] = { 0 };
+	for (size_t index = 0; index < sample_size; ++ index) {
+		++ counts[sample[index]];
+		if (index + 1 < sample_size) {
+			++ freq->pairs[(sample[index] << 8) | sample[index + 1]];
+		}
+	}
+
+	for (size_t byte = 0; byte < 256; ++ byte) {
+		freq->bytes[byte] = (counts[byte] + 1.0) / (sample_size + 256.0);
+	}
+	freq->sample_size = sample_size;
+
+	return 0;
+}
+
+static double pair_frequency(const struct frequencies *freq, uint8_t first, uint8_t second) {
+	const double prior = freq->bytes[first] * freq->bytes[second];
+	if (!freq->pairs) {
+		return prior;
+	}
+	// the independent estimate weighs like 256 sampled pairs
+	return (freq->pairs[(first << 8) | second] + prior * 256.0) / (freq->sample_size - 1 + 256.0);
+}
+
+static void choose_anchor(const struct frequencies *freq, const struct vs_needle *needle, struct vs_plan_info *info) {
+	const uint8_t *data = needle->data;
+
+	if (needle->size == 1) {
+		info->anchor = 0;
+		info->anchor_frequency = freq->bytes[data[0]];
+		return;
+	}
+
+	double best = 0;
+	for (size_t index = 0; index + 1 < needle->size; ++ index) {
+		const double pair  = pair_frequency(freq, data[index], data[index + 1]);
+		const double score = freq->bytes[data[index]] + pair * VS_PLAN_VERIFY_COST;
+		if (index == 0 || score < best) {
+			best = score;
+			info->anchor = index;
+			info->anchor_frequency = pair;
+		}
+	}
+}
+
+static inline uint64_t load_le(const uint8_t *ptr, size_t width) {
+	uint64_t value = 0;
+	for (size_t index = 0; index < width; ++ index) {
+		value |= (uint64_t)ptr[index] << (index * 8);
+	}
+	return value;
+}
+
+static inline size_t prefix_of(const uint8_t *ptr, size_t width) {
+	return width == 1 ? ptr[0] : ((size_t)ptr[0] << 8) | ptr[1];
+}
+
+static inline size_t hash_slot(uint64_t value, unsigned bits) {
+	return (size_t)((value * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - bits));
+}
+
+static int hash_set_create(struct hash_set *set, const struct vs_needle needles[], size_t needle_count) {
+	set->width = needles[0].size;
+	set->bits  = 4;
+	while (((size_t)1 << set->bits) < needle_count * 2) {
+		++ set->bits;
+	}
+
+	const size_t slots = (size_t)1 << set->bits;
+	set->keys    = calloc(slots, sizeof(uint64_t));
+	set->needles = malloc(slots * sizeof(uint32_t));
+	if (!set->keys || !set->needles) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memset(set->needles, 0xFF, slots * sizeof(uint32_t));
+	memset(set->prefix, 0, sizeof(set->prefix));
+
+	for (size_t index = 0; index < needle_count; ++ index) {
+		const uint64_t value = load_le(needles[index].data, set->width);
+		size_t slot = hash_slot(value, set->bits);
+		while (set->needles[slot] != VS_PLAN_NONE && set->keys[slot] != value) {
+			slot = (slot + 1) & (slots - 1);
+		}
+		// duplicates keep the first needle
+		if (set->needles[slot] == VS_PLAN_NONE) {
+			set->keys[slot]    = value;
+			set->needles[slot] = (uint32_t)index;
+		}
+		const size_t prefix = prefix_of(needles[index].data, set->width);
+		set->prefix[prefix / 64] |= UINT64_C(1) << (prefix % 64);
+	}
+
+	return 0;
+}
+
+static void hash_set_destroy(struct hash_set *set) {
+	free(set->keys);
+	free(set->needles);
+}
+
+struct adapter {
+	const struct plan_group *group;
+	const struct vs_needle  *needles;
+	struct vs_hits *hits;  // NULL: report directly
+	size_t base;           // offset of the searched part in the haystack
+	size_t limit;          // only matches starting before this are reported
+	void  *ctx;
+	vs_callback callback;
+};
+
+static int adapter_callback(void *ctx, const struct vs_needle *needle, size_t offset) {
+	const struct adapter *adapter = ctx;
+	const struct vs_needle *original = adapter->needles + adapter->group->indices[needle - adapter->group->needles];
+
+	if (offset >= adapter->limit) {
+		return 0;
+	}
+	if (!adapter->hits) {
+		return adapter->callback(adapter->ctx, original, adapter->base + offset);
+	}
+
+	const struct vs_match match = {
+		.needle        = original,
+		.offset        = adapter->base + offset,
+		.size          = original->size,
+		.needle_offset = 0,
+		.mismatches    = 0,
+		.bit           = 0,
+		.bit_order     = VS_BYTE_ALIGNED,
+	};
+	return vs_hits_push(adapter->hits, &match);
+}
+
+static int search_anchor(const struct plan_group *group, const uint8_t haystack[], size_t haystack_size, void *ctx, vs_callback callback) {
+	const struct vs_needle *needle = group->needles;
+	const size_t anchor = group->info.anchor;
+	const uint8_t *data = needle->data;
+
+	if (needle->size > haystack_size) {
+		return 0;
+	}
+
+	// last position the anchor byte can be at
+	const uint8_t *last = haystack + (haystack_size - needle->size) + anchor;
+	const uint8_t *ptr  = haystack + anchor;
+
+	while (ptr <= last) {
+		const uint8_t *found = memchr(ptr, data[anchor], (size_t)(last - ptr) + 1);
+		if (!found) {
+			break;
+		}
+		VS_COUNT_CANDIDATE();
+
+		const uint8_t *start = found - anchor;
+		if ((needle->size == 1 || found[1] == data[anchor + 1]) && memcmp(start, data, needle->size) == 0) {
+			VS_COUNT_VERIFIED();
+			int status = callback(ctx, needle, (size_t)(start - haystack));
+			if (status != 0) {
+				return status;
+			}
+		}
+		ptr = found + 1;
+	}
+
+	return 0;
+}
+
+static int search_hash(const struct plan_group *group, const uint8_t haystack[], size_t haystack_size, void *ctx, vs_callback callback) {
+	const struct hash_set *set = &group->hash;
+	const size_t width = set->width;
+	const size_t mask  = ((size_t)1 << set->bits) - 1;
+
+	if (width > haystack_size) {
+		return 0;
+	}
+
+	const size_t end = haystack_size - width + 1;
+	for (size_t offset = 0; offset < end; ++ offset) {
+		const uint8_t *ptr = haystack + offset;
+		const size_t prefix = prefix_of(ptr, width);
+		if (!(set->prefix[prefix / 64] & (UINT64_C(1) << (prefix % 64)))) {
+			continue;
+		}
+		VS_COUNT_CANDIDATE();
+
+		uint64_t value;
+		if (haystack_size - offset >= sizeof(value)) {
+			memcpy(&value, ptr, sizeof(value));
+			value = le64toh(value);
+			if (width < sizeof(value)) {
+				value &= (UINT64_C(1) << (width * 8)) - 1;
+			}
+		}
+		else {
+			value = load_le(ptr, width);
+		}
+
+		size_t slot = hash_slot(value, set->bits);
+		while (set->needles[slot] != VS_PLAN_NONE) {
+			if (set->keys[slot] == value) {
+				VS_COUNT_VERIFIED();
+				int status = callback(ctx, group->needles + set->needles[slot], offset);
+				if (status != 0) {
+					return status;
+				}
+				break;
+			}
+			slot = (slot + 1) & mask;
+		}
+	}
+
+	return 0;
+}
+
+static inline uint64_t load_unit(const uint8_t *ptr, size_t unit_size, bool big_endian) {
+	switch (unit_size) {
+	case 1:
+		return ptr[0];
+
+	case 2:
+	{
+		uint16_t value;
+		memcpy(&value, ptr, sizeof(value));
+		return big_endian ? be16toh(value) : le16toh(value);
+	}
+	case 4:
+	{
+		uint32_t value;
+		memcpy(&value, ptr, sizeof(value));
+		return big_endian ? be32toh(value) : le32toh(value);
+	}
+	default:
+	{
+		uint64_t value;
+		memcpy(&value, ptr, sizeof(value));
+		return big_endian ? be64toh(value) : le64toh(value);
+	}
+	}
+}
+
+static int delta_needles_create(struct plan_group *group) {
+	const size_t count = group->info.needle_count;
+	group->deltas = calloc(count, sizeof(struct delta_needle));
+	if (!group->deltas) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (size_t index = 0; index < count; ++ index) {
+		const struct vs_needle *needle = group->needles + index;
+		struct delta_needle *delta = group->deltas + index;
+
+		delta->unit_size  = needle->unit_size;
+		delta->count      = needle->size / needle->unit_size;
+		delta->big_endian = (needle->flags & VS_NEEDLE_BIG_ENDIAN) != 0;
+		delta->mask       = needle->unit_size < 8 ? (UINT64_C(1) << (needle->unit_size * 8)) - 1 : UINT64_MAX;
+		delta->deltas     = malloc(sizeof(uint64_t) * delta->count);
+		if (!delta->deltas) {
+			errno = ENOMEM;
+			return -1;
+		}
+		for (size_t element = 0; element < delta->count; ++ element) {
+			delta->deltas[element] = load_unit(needle->data + element * delta->unit_size, delta->unit_size, delta->big_endian);
+		}
+	}
+
+	return 0;
+}
+
+static void delta_needles_destroy(struct plan_group *group) {
+	if (group->deltas) {
+		for (size_t index = 0; index < group->info.needle_count; ++ index) {
+			free(group->deltas[index].deltas);
+		}
+		free(group->deltas);
+	}
+}
+
+// Marks the offsets where the difference of the first two elements matches,
+// in a loop per width and byte order that the compiler can vectorize.
+#define DELTA_FILTER(TYPE, CONVERT) \
+	for (size_t index = 0; index < count; ++ index) { \
+		TYPE lhs, rhs; \
+		memcpy(&lhs, ptr + index, sizeof(TYPE)); \
+		memcpy(&rhs, ptr + index + sizeof(TYPE), sizeof(TYPE)); \
+		hits[index] = (TYPE)(CONVERT(rhs) - CONVERT(lhs)) == (TYPE)delta1; \
+	}
+
+#define DELTA_NO_CONVERT(VALUE) (VALUE)
+
+static void delta_filter(const struct delta_needle *delta, const uint8_t *ptr, size_t count, uint8_t hits[]) {
+	const uint64_t delta1 = delta->deltas[1];
+	switch (delta->unit_size) {
+	case 1:
+		DELTA_FILTER(uint8_t, DELTA_NO_CONVERT);
+		break;
+
+	case 2:
+		if (delta->big_endian) {
+			DELTA_FILTER(uint16_t, be16toh);
+		}
+		else {
+			DELTA_FILTER(uint16_t, le16toh);
+		}
+		break;
+
+	case 4:
+		if (delta->big_endian) {
+			DELTA_FILTER(uint32_t, be32toh);
+		}
+		else {
+			DELTA_FILTER(uint32_t, le32toh);
+		}
+		break;
+
+	default:
+		if (delta->big_endian) {
+			DELTA_FILTER(uint64_t, be64toh);
+		}
+		else {
+			DELTA_FILTER(uint64_t, le64toh);
+		}
+	}
+}
+
+static int search_delta(const struct plan_group *group, const uint8_t haystack[], size_t haystack_size, void *ctx, vs_callback callback) {
+	const size_t count = group->info.needle_count;
+	// a row of prefilter hits per needle plus one for any needle
+	uint8_t *hits = malloc((count + 1) * DELTA_BLOCK_SIZE);
+	if (!hits) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	int status = 0;
+	for (size_t block = 0; block < haystack_size; block += DELTA_BLOCK_SIZE) {
+		const size_t block_size = haystack_size - block < DELTA_BLOCK_SIZE ? haystack_size - block : DELTA_BLOCK_SIZE;
+
+		for (size_t index = 0; index < count; ++ index) {
+			const size_t size = group->needles[index].size;
+			// offsets where the whole needle fits
+			const size_t fits = haystack_size - block < size ? 0 :
+				haystack_size - block - size + 1 < block_size ? haystack_size - block - size + 1 : block_size;
+			delta_filter(group->deltas + index, haystack + block, fits, hits + index * DELTA_BLOCK_SIZE);
+			memset(hits + index * DELTA_BLOCK_SIZE + fits, 0, block_size - fits);
+		}
+
+		uint8_t *any = hits;
+		if (count > 1) {
+			any = hits + count * DELTA_BLOCK_SIZE;
+			memcpy(any, hits, block_size);
+			for (size_t index = 1; index < count; ++ index) {
+				const uint8_t *row = hits + index * DELTA_BLOCK_SIZE;
+				for (size_t offset = 0; offset < block_size; ++ offset) {
+					any[offset] |= row[offset];
+				}
+			}
+		}
+
+		const uint8_t *next;
+		for (size_t offset = 0; offset < block_size && (next = memchr(any + offset, 1, block_size - offset)); ++ offset) {
+			offset = (size_t)(next - any);
+			const uint8_t *ptr = haystack + block + offset;
+
+			for (size_t index = 0; index < count; ++ index) {
+				if (!hits[index * DELTA_BLOCK_SIZE + offset]) {
+					continue;
+				}
+				VS_COUNT_CANDIDATE();
+
+				const struct delta_needle *delta = group->deltas + index;
+				const size_t   unit_size = delta->unit_size;
+				const uint64_t first     = load_unit(ptr, unit_size, delta->big_endian);
+				size_t element = 2;
+				for (; element < delta->count; ++ element) {
+					const uint64_t value = load_unit(ptr + element * unit_size, unit_size, delta->big_endian);
+					if (((value - first) & delta->mask) != delta->deltas[element]) {
+						break;
+					}
+				}
+
+				if (element == delta->count) {
+					VS_COUNT_VERIFIED();
+					status = callback(ctx, group->needles + index, block + offset);
+					if (status != 0) {
+						goto end;
+					}
+					break;
+				}
+			}
+		}
+	}
+
+end:
+	free(hits);
+	return status;
+}
+
+static int varint_cmp(const void *lhs, const void *rhs) {
+	const struct varint_needle *lvarint = lhs;
+	const struct varint_needle *rvarint = rhs;
+	return lvarint->is_signed != rvarint->is_signed ? (lvarint->is_signed ? 1 : -1) :
+	       lvarint->value < rvarint->value ? -1 : lvarint->value > rvarint->value ? 1 :
+	       lvarint->index < rvarint->index ? -1 : lvarint->index > rvarint->index ? 1 : 0;
+}
+
+static int varint_set_create(struct varint_set *set, const struct vs_needle needles[], size_t count) {
+	set->needles = malloc(sizeof(struct varint_needle) * count);
+	if (!set->needles) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (size_t index = 0; index < count; ++ index) {
+		struct varint_needle *varint = set->needles + index;
+		varint->is_signed = (needles[index].flags & VS_NEEDLE_SIGNED) != 0;
+		varint->index     = index;
+		if (vs_decode_leb128(needles[index].data, needles[index].size, varint->is_signed, &varint->value) != needles[index].size) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		if (varint->is_signed) {
+			set->any_signed = true;
+		}
+		else {
+			set->any_unsigned = true;
+		}
+
+		const uint8_t low = varint->value & 0x7F;
+		if (!set->starts[low]) {
+			set->starts[low] = 1;
+			if (set->low_count < VARINT_MAX_LOWS) {
+				set->lows[set->low_count] = low;
+			}
+			++ set->low_count;
+		}
+	}
+
+	if (set->low_count > VARINT_MAX_LOWS) {
+		set->low_count = 0;
+	}
+
+	qsort(set->needles, count, sizeof(struct varint_needle), varint_cmp);
+
+	return 0;
+}
+
+// Marks the offsets whose byte holds the low 7 bits of a value, whatever its
+// continuation bit says: padded encodings start like the shortest one. One
+// compare per distinct low part is vectorized by the compiler.
+static void varint_filter(const struct varint_set *set, const uint8_t *ptr, size_t count, uint8_t hits[]) {
+	if (set->low_count == 0) {
+		for (size_t index = 0; index < count; ++ index) {
+			hits[index] = set->starts[ptr[index] & 0x7F];
+		}
+		return;
+	}
+
+	const uint8_t first = set->lows[0];
+	for (size_t index = 0; index < count; ++ index) {
+		hits[index] = (ptr[index] & 0x7F) == first;
+	}
+	for (size_t low = 1; low < set->low_count; ++ low) {
+		const uint8_t other = set->lows[low];
+		for (size_t index = 0; index < count; ++ index) {
+			hits[index] |= (ptr[index] & 0x7F) == other;
+		}
+	}
+}
+
+// Index of the first needle with the given signedness and value, or count.
+static size_t varint_find(const struct varint_set *set, size_t count, bool is_signed, uint64_t value) {
+	size_t lo = 0;
+	size_t hi = count;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		const struct varint_needle *varint = set->needles + mid;
+		if (varint->is_signed < is_signed || (varint->is_signed == is_signed && varint->value < value)) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo < count && set->needles[lo].is_signed == is_signed && set->needles[lo].value == value ? lo : count;
+}
+
+static int search_varint(const struct plan_group *group, const uint8_t haystack[], size_t haystack_size, void *ctx, vs_callback callback) {
+	const struct varint_set *set = &group->varints;
+	const size_t count = group->info.needle_count;
+	uint8_t *hits = malloc(VARINT_BLOCK_SIZE);
+	if (!hits) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	int status = 0;
+	for (size_t block = 0; block < haystack_size; block += VARINT_BLOCK_SIZE) {
+		const size_t block_size = haystack_size - block < VARINT_BLOCK_SIZE ? haystack_size - block : VARINT_BLOCK_SIZE;
+		varint_filter(set, haystack + block, block_size, hits);
+
+		const uint8_t *next;
+		for (size_t offset = 0; offset < block_size && (next = memchr(hits + offset, 1, block_size - offset)); ++ offset) {
+			offset = (size_t)(next - hits);
+			VS_COUNT_CANDIDATE();
+
+			// the value is decoded once per signedness, of several needles
+			// with that value the first one is reported
+			const uint8_t *ptr  = haystack + block + offset;
+			const size_t   rest = haystack_size - block - offset;
+			size_t found = count;
+			uint64_t value;
+			if (set->any_unsigned && vs_decode_leb128(ptr, rest, false, &value) > 0) {
+				found = varint_find(set, count, false, value);
+			}
+			if (set->any_signed && vs_decode_leb128(ptr, rest, true, &value) > 0) {
+				const size_t pos = varint_find(set, count, true, value);
+				if (pos < count && (found == count || set->needles[pos].index < set->needles[found].index)) {
+					found = pos;
+				}
+			}
+
+			if (found < count) {
+				VS_COUNT_VERIFIED();
+				status = callback(ctx, group->needles + set->needles[found].index, block + offset);
+				if (status != 0) {
+					goto end;
+				}
+			}
+		}
+	}
+
+end:
+	free(hits);
+	return status;
+}
+
+static int search_group(const struct plan_group *group, const uint8_t haystack[], size_t haystack_size, struct adapter *adapter) {
+	switch (group->info.engine) {
+	case VS_ENGINE_ANCHOR:
+		return search_anchor(group, haystack, haystack_size, adapter, &adapter_callback);
+
+	case VS_ENGINE_HASH:
+		return search_hash(group, haystack, haystack_size, adapter, &adapter_callback);
+
+	case VS_ENGINE_TRIE:
+		return vs_trie_search(group->trie, haystack, haystack_size, adapter, &adapter_callback);
+
+	case VS_ENGINE_DELTA:
+		return search_delta(group, haystack, haystack_size, adapter, &adapter_callback);
+
+	case VS_ENGINE_VARINT:
+		return search_varint(group, haystack, haystack_size, adapter, &adapter_callback);
+
+	default:
+		return vs_search(haystack, haystack_size, group->needles, group->info.needle_count, adapter, &adapter_callback);
+	}
+}
+
+static int add_group(struct vs_plan *plan, enum vs_plan_engine engine, const size_t indices[], size_t count,
+                     const struct frequencies *freq) {
+	struct plan_group *group = plan->groups + plan->group_count;
+	memset(group, 0, sizeof(*group));
+
+	group->needles = malloc(sizeof(struct vs_needle) * count);
+	group->indices = malloc(sizeof(size_t) * count);
+	if (!group->needles || !group->indices) {
+		free(group->needles);
+		free(group->indices);
+		errno = ENOMEM;
+		return -1;
+	}
+	++ plan->group_count;
+
+	bool first_bytes[256] = { false };
+	group->info.engine       = engine;
+	group->info.needle_count = count;
+	group->info.min_size     = SIZE_MAX;
+	for (size_t index = 0; index < count; ++ index) {
+		const struct vs_needle *needle = plan->needles + indices[index];
+		group->needles[index] = *needle;
+		group->indices[index] = indices[index];
+		if (needle->size < group->info.min_size) {
+			group->info.min_size = needle->size;
+		}
+		if (needle->size > group->info.max_size) {
+			group->info.max_size = needle->size;
+		}
+		if (needle->size > 0 && !first_bytes[needle->data[0]]) {
+			first_bytes[needle->data[0]] = true;
+			++ group->info.first_bytes;
+		}
+	}
+
+	switch (engine) {
+	case VS_ENGINE_ANCHOR:
+		choose_anchor(freq, group->needles, &group->info);
+		return 0;
+
+	case VS_ENGINE_HASH:
+		return hash_set_create(&group->hash, group->needles, count);
+
+	case VS_ENGINE_TRIE:
+		group->trie = vs_trie_create(group->needles, count);
+		return group->trie ? 0 : -1;
+
+	case VS_ENGINE_DELTA:
+		return delta_needles_create(group);
+
+	case VS_ENGINE_VARINT:
+		return varint_set_create(&group->varints, group->needles, count);
+
+	default:
+		return 0;
+	}
+}
+
+struct vs_plan *vs_plan_create(const struct vs_needle needles[], size_t needle_count, const uint8_t sample[], size_t sample_size) {
+	struct frequencies freq;
+	struct vs_plan *plan = calloc(1, sizeof(struct vs_plan));
+	size_t *scan   = malloc(sizeof(size_t) * (needle_count ? needle_count : 1));
+	size_t *plain  = malloc(sizeof(size_t) * (needle_count ? needle_count : 1));
+	size_t *delta  = malloc(sizeof(size_t) * (needle_count ? needle_count : 1));
+	size_t *varint = malloc(sizeof(size_t) * (needle_count ? needle_count : 1));
+
+	if (!plan || !scan || !plain || !delta || !varint || count_frequencies(&freq, sample, sample_size) != 0) {
+		free(plan);
+		free(scan);
+		free(plain);
+		free(delta);
+		free(varint);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	plan->needles      = needles;
+	plan->needle_count = needle_count;
+	plan->groups       = calloc(4, sizeof(struct plan_group));
+	if (!plan->groups) {
+		errno = ENOMEM;
+		goto error;
+	}
+
+	size_t scan_count  = 0;
+	size_t plain_count = 0;
+	size_t delta_count = 0;
+	size_t varint_count = 0;
+	for (size_t index = 0; index < needle_count; ++ index) {
+		const struct vs_needle *needle = needles + index;
+		// padded varints are longer than the needle
+		const size_t max_size = needle->flags & VS_NEEDLE_VARINT ? VS_LEB128_MAX_SIZE : needle->size;
+		if (max_size > plan->max_size) {
+			plan->max_size = max_size;
+		}
+		if (needle->flags & VS_NEEDLE_DELTA) {
+			delta[delta_count ++] = index;
+		}
+		else if (needle->flags & VS_NEEDLE_VARINT) {
+			varint[varint_count ++] = index;
+		}
+		else if (needle->fold || needle->size == 0 || needle->size > VS_TRIE_MAX_NEEDLE_SIZE) {
+			scan[scan_count ++] = index;
+		}
+		else {
+			plain[plain_count ++] = index;
+		}
+	}
+
+	if (plain_count > 0) {
+		bool same_width = true;
+		for (size_t index = 0; index < plain_count; ++ index) {
+			same_width = same_width && needles[plain[index]].size == needles[plain[0]].size;
+		}
+
+		const enum vs_plan_engine engine =
+			plain_count == 1 ? VS_ENGINE_ANCHOR :
+			same_width && needles[plain[0]].size <= VS_PLAN_HASH_MAX_WIDTH &&
+			plain_count >= VS_PLAN_HASH_MIN_NEEDLES ? VS_ENGINE_HASH :
+			VS_ENGINE_TRIE;
+
+		if (add_group(plan, engine, plain, plain_count, &freq) != 0) {
+			goto error;
+		}
+	}
+
+	if (scan_count > 0 && add_group(plan, VS_ENGINE_SCAN, scan, scan_count, &freq) != 0) {
+		goto error;
+	}
+
+	if (delta_count > 0 && add_group(plan, VS_ENGINE_DELTA, delta, delta_count, &freq) != 0) {
+		goto error;
+	}
+
+	if (varint_count > 0 && add_group(plan, VS_ENGINE_VARINT, varint, varint_count, &freq) != 0) {
+		goto error;
+	}
+
+	free(freq.pairs);
+	free(scan);
+	free(plain);
+	free(delta);
+	free(varint);
+	return plan;
+
+error:
+	{
+		const int errnum = errno;
+		free(freq.pairs);
+		free(scan);
+		free(plain);
+		free(delta);
+		free(varint);
+		vs_plan_free(plan);
+		errno = errnum;
+	}
+	return NULL;
+}
+
+void vs_plan_free(struct vs_plan *plan) {
+	if (plan) {
+		for (size_t index = 0; index < plan->group_count; ++ index) {
+			struct plan_group *group = plan->groups + index;
+			vs_trie_free(group->trie);
+			hash_set_destroy(&group->hash);
+			delta_needles_destroy(group);
+			free(group->varints.needles);
+			free(group->needles);
+			free(group->indices);
+		}
+		free(plan->groups);
+		free(plan);
+	}
+}
+
+size_t vs_plan_group_count(const struct vs_plan *plan) {
+	return plan->group_count;
+}
+
+void vs_plan_group_info(const struct vs_plan *plan, size_t group, struct vs_plan_info *info) {
+	*info = plan->groups[group].info;
+}
+
+static int flush_callback(void *ctx, const struct vs_match *match) {
+	const struct adapter *adapter = ctx;
+	return adapter->callback(adapter->ctx, match->needle, match->offset);
+}
+
+int vs_plan_search(const struct vs_plan *plan, const uint8_t haystack[], size_t haystack_size, void *ctx, vs_callback callback) {
+	if (plan->group_count == 0) {
+		return 0;
+	}
+
+	if (plan->group_count == 1) {
+		struct adapter adapter = { plan->groups, plan->needles, NULL, 0, SIZE_MAX, ctx, callback };
+		return search_group(plan->groups, haystack, haystack_size, &adapter);
+	}
+
+	struct vs_hits hits = { NULL, 0, 0 };
+	int status = 0;
+
+	for (size_t start = 0; start < haystack_size; start += VS_PLAN_CHUNK_SIZE) {
+		const size_t rem   = haystack_size - start;
+		const size_t limit = rem > VS_PLAN_CHUNK_SIZE ? VS_PLAN_CHUNK_SIZE : rem;
+		// matches starting in this chunk may end in the next one
+		const size_t size  = rem - limit > plan->max_size ? limit + plan->max_size : rem;
+
+		for (size_t index = 0; index < plan->group_count; ++ index) {
+			struct adapter adapter = { plan->groups + index, plan->needles, &hits, start, limit, ctx, callback };
+			status = search_group(plan->groups + index, haystack + start, size, &adapter);
+			if (status != 0) {
+				goto end;
+			}
+		}
+
+		struct adapter adapter = { NULL, plan->needles, NULL, 0, SIZE_MAX, ctx, callback };
+		status = vs_hits_flush(&hits, &adapter, &flush_callback);
+		if (status != 0) {
+			goto end;
+		}
+	}
+
+end:
+	vs_hits_destroy(&hits);
+	return status;
+}
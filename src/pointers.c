@@ -0,0 +1,240 @@
+#include "valuescan.h"
+
+#include <endian.h>
+#include <string.h>
+#include <errno.h>
+
+// values per batch of lookups
+#define POINTER_BATCH 4096
+
+// Batches are looked up with this many values of the neighbouring batches on
+// either side, so that every window around a value of the batch is seen.
+#define POINTER_OVERLAP (VS_POINTER_WINDOW - 1)
+
+// Bits of the target prefilter: one bit per 2^shift offsets, so a 1 MiB
+// bitmap covers the targets of a 32 MiB file at byte granularity.
+#define TARGET_BITMAP_BITS (UINT64_C(1) << 23)
+
+struct candidate {
+	uint64_t target;
+	size_t   slot;
+};
+
+#define LOAD_VALUES(TYPE, CONVERT) \
+	for (size_t slot = 0; slot < count; ++ slot) { \
+		TYPE value; \
+		memcpy(&value, ptr + slot * align, sizeof(TYPE)); \
+		values[slot] = CONVERT(value); \
+	}
+
+#define NO_CONVERT(VALUE) (VALUE)
+
+static void load_values(size_t size, bool big_endian, size_t align, const uint8_t *ptr, size_t count, uint64_t values[]) {
+	switch (size) {
+	case 1:
+		LOAD_VALUES(uint8_t, NO_CONVERT);
+		break;
+
+	case 2:
+		if (big_endian) {
+			LOAD_VALUES(uint16_t, be16toh);
+		}
+		else {
+			LOAD_VALUES(uint16_t, le16toh);
+		}
+		break;
+
+	case 4:
+		if (big_endian) {
+			LOAD_VALUES(uint32_t, be32toh);
+		}
+		else {
+			LOAD_VALUES(uint32_t, le32toh);
+		}
+		break;
+
+	default:
+		if (big_endian) {
+			LOAD_VALUES(uint64_t, be64toh);
+		}
+		else {
+			LOAD_VALUES(uint64_t, le64toh);
+		}
+	}
+}
+
+static int candidate_cmp(const void *lhs, const void *rhs) {
+	const struct candidate *lcand = lhs;
+	const struct candidate *rcand = rhs;
+	return lcand->target < rcand->target ? -1 : lcand->target > rcand->target ? 1 :
+	       lcand->slot   < rcand->slot   ? -1 : lcand->slot   > rcand->slot   ? 1 : 0;
+}
+
+// Index of the first target from index from on that is not less than value.
+// Gallops, since the values looked up are ascending.
+static size_t lower_bound(const size_t targets[], size_t from, size_t target_count, uint64_t value) {
+	size_t lo = from;
+	size_t hi = from;
+	size_t step = 1;
+	while (hi < target_count && targets[hi] < value) {
+		lo = hi + 1;
+		hi += step;
+		step *= 2;
+	}
+	if (hi > target_count) {
+		hi = target_count;
+	}
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (targets[mid] < value) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+int vs_search_pointers(const uint8_t haystack[], size_t haystack_size, const struct vs_pointer_format *format,
+                       const size_t targets[], size_t target_count, void *ctx, vs_pointer_callback callback) {
+	const size_t size  = format->size;
+	const size_t align = format->align ? format->align : size;
+	const size_t phase = format->phase;
+
+	if ((size != 1 && size != 2 && size != 4 && size != 8) || phase >= align) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (haystack_size < phase || haystack_size - phase < size || (targets && target_count == 0)) {
+		return 0;
+	}
+
+	const size_t slot_count = (haystack_size - phase - size) / align + 1;
+	const uint64_t lowest  = targets ? targets[0] : 0;
+	const uint64_t highest = targets ? targets[target_count - 1] : haystack_size - 1;
+
+	unsigned int shift = 0;
+	while ((highest - lowest) >> shift >= TARGET_BITMAP_BITS) {
+		++ shift;
+	}
+
+	const size_t window_size = slot_count < VS_POINTER_WINDOW ? slot_count : VS_POINTER_WINDOW;
+	const size_t capacity    = POINTER_BATCH + 2 * POINTER_OVERLAP;
+
+	uint64_t *values = malloc(sizeof(uint64_t) * capacity);
+	size_t *hits = malloc(sizeof(size_t) * capacity);
+	struct candidate *candidates = malloc(sizeof(struct candidate) * capacity);
+	uint64_t *bitmap = targets ? calloc((((highest - lowest) >> shift) >> 6) + 1, sizeof(uint64_t)) : NULL;
+	if (!values || !hits || !candidates || (targets && !bitmap)) {
+		free(values);
+		free(hits);
+		free(candidates);
+		free(bitmap);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (size_t index = 0; index < target_count; ++ index) {
+		const uint64_t bit = (targets[index] - lowest) >> shift;
+		bitmap[bit >> 6] |= UINT64_C(1) << (bit & 63);
+	}
+
+	int status = 0;
+	for (size_t batch = 0; batch < slot_count; batch += POINTER_BATCH) {
+		const size_t batch_size = slot_count - batch < POINTER_BATCH ? slot_count - batch : POINTER_BATCH;
+		const size_t before     = batch < POINTER_OVERLAP ? batch : POINTER_OVERLAP;
+		const size_t rest       = slot_count - batch - batch_size;
+		const size_t after      = rest < POINTER_OVERLAP ? rest : POINTER_OVERLAP;
+		const size_t first      = batch - before; // slot of values[0]
+		const size_t count      = before + batch_size + after;
+		load_values(size, format->big_endian, align, haystack + phase + first * align, count, values);
+
+		// values that point into the range of the targets and pass the bitmap
+		size_t candidate_count = 0;
+		for (size_t slot = 0; slot < count; ++ slot) {
+			const uint64_t value  = values[slot];
+			const uint64_t target = value - format->base;
+			values[slot] = target;
+			hits[slot] = SIZE_MAX;
+			if (value != 0 && target >= lowest && target <= highest) {
+				if (bitmap) {
+					const uint64_t bit = (target - lowest) >> shift;
+					if (!(bitmap[bit >> 6] & (UINT64_C(1) << (bit & 63)))) {
+						continue;
+					}
+				}
+				candidates[candidate_count].target = target;
+				candidates[candidate_count].slot   = slot;
+				++ candidate_count;
+			}
+		}
+
+		// merge the sorted candidates with the targets
+		if (targets) {
+			if (candidate_count > 1) {
+				qsort(candidates, candidate_count, sizeof(struct candidate), candidate_cmp);
+			}
+			size_t pos = 0;
+			for (size_t index = 0; index < candidate_count; ++ index) {
+				pos = lower_bound(targets, pos, target_count, candidates[index].target);
+				if (pos == target_count) {
+					break;
+				}
+				if (targets[pos] == candidates[index].target) {
+					hits[candidates[index].slot] = pos;
+				}
+			}
+		}
+		else {
+			for (size_t index = 0; index < candidate_count; ++ index) {
+				hits[candidates[index].slot] = 0;
+			}
+		}
+
+		// A pointer is reported if any window of window_size values around it
+		// is dense enough. The windows slide, so that a table is reported
+		// whole wherever it starts. dense_end is the end of the last dense
+		// window seen.
+		const size_t last_window = count - window_size;
+		size_t hit_count = 0;
+		size_t dense_end = 0;
+		for (size_t slot = 0; slot < window_size; ++ slot) {
+			hit_count += hits[slot] != SIZE_MAX;
+		}
+		for (size_t slot = 0; slot < before + batch_size; ++ slot) {
+			if (slot <= last_window) {
+				if (slot > 0) {
+					hit_count -= hits[slot - 1] != SIZE_MAX;
+					hit_count += hits[slot + window_size - 1] != SIZE_MAX;
+				}
+				if (hit_count > 0 && (double)hit_count >= format->min_density * (double)window_size) {
+					dense_end = slot + window_size;
+				}
+			}
+
+			if (slot < before || hits[slot] == SIZE_MAX || dense_end <= slot) {
+				continue;
+			}
+
+			const struct vs_pointer pointer = {
+				.offset       = phase + (first + slot) * align,
+				.target       = (size_t)values[slot],
+				.target_index = targets ? hits[slot] : SIZE_MAX,
+			};
+			status = callback(ctx, &pointer);
+			if (status != 0) {
+				goto end;
+			}
+		}
+	}
+
+end:
+	free(bitmap);
+	free(candidates);
+	free(hits);
+	free(values);
+
+	return status;
+}
@@ -0,0 +1,102 @@
+#include "prefetch.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static size_t page_floor(size_t offset) {
+	const long pagesize = sysconf(_SC_PAGE_SIZE);
+	return pagesize > 0 ? offset - offset % (size_t)pagesize : offset;
+}
+
+static void *prefetch_thread(void *arg) {
+	struct vs_prefetcher *prefetcher = arg;
+
+	pthread_mutex_lock(&prefetcher->mutex);
+	for (;;) {
+		const size_t cursor = prefetcher->cursor;
+		const size_t ahead  = prefetcher->size - cursor > prefetcher->distance ?
+			cursor + prefetcher->distance : prefetcher->size;
+
+		if (prefetcher->done) {
+			break;
+		}
+
+		if (prefetcher->advised >= ahead && prefetcher->dropped >= page_floor(cursor)) {
+			pthread_cond_wait(&prefetcher->cond, &prefetcher->mutex);
+			continue;
+		}
+
+		const size_t advise_from = prefetcher->advised > cursor ? prefetcher->advised : page_floor(cursor);
+		const size_t drop_from   = prefetcher->dropped;
+		const size_t drop_to     = page_floor(cursor);
+		prefetcher->advised = ahead;
+		prefetcher->dropped = drop_to > drop_from ? drop_to : drop_from;
+		pthread_mutex_unlock(&prefetcher->mutex);
+
+		// madvise() can block on I/O submission, which is why this isn't done
+		// by the scanning thread
+		if (ahead > advise_from) {
+			madvise(prefetcher->data + advise_from, ahead - advise_from, MADV_WILLNEED);
+		}
+		if (drop_to > drop_from) {
+			madvise(prefetcher->data + drop_from, drop_to - drop_from, MADV_DONTNEED);
+		}
+
+		pthread_mutex_lock(&prefetcher->mutex);
+	}
+	pthread_mutex_unlock(&prefetcher->mutex);
+
+	return NULL;
+}
+
+int vs_prefetch_start(struct vs_prefetcher *prefetcher, void *data, size_t size, size_t distance) {
+	prefetcher->data     = data;
+	prefetcher->size     = size;
+	prefetcher->distance = distance;
+	prefetcher->cursor   = 0;
+	prefetcher->advised  = 0;
+	prefetcher->dropped  = 0;
+	prefetcher->done     = false;
+
+	int errnum = pthread_mutex_init(&prefetcher->mutex, NULL);
+	if (errnum != 0) {
+		errno = errnum;
+		return -1;
+	}
+
+	errnum = pthread_cond_init(&prefetcher->cond, NULL);
+	if (errnum != 0) {
+		pthread_mutex_destroy(&prefetcher->mutex);
+		errno = errnum;
+		return -1;
+	}
+
+	errnum = pthread_create(&prefetcher->thread, NULL, prefetch_thread, prefetcher);
+	if (errnum != 0) {
+		pthread_cond_destroy(&prefetcher->cond);
+		pthread_mutex_destroy(&prefetcher->mutex);
+		errno = errnum;
+		return -1;
+	}
+
+	return 0;
+}
+
+void vs_prefetch_advance(struct vs_prefetcher *prefetcher, size_t cursor) {
+	pthread_mutex_lock(&prefetcher->mutex);
+	prefetcher->cursor = cursor;
+	pthread_cond_signal(&prefetcher->cond);
+	pthread_mutex_unlock(&prefetcher->mutex);
+}
+
+void vs_prefetch_stop(struct vs_prefetcher *prefetcher) {
+	pthread_mutex_lock(&prefetcher->mutex);
+	prefetcher->done = true;
+	pthread_cond_signal(&prefetcher->cond);
+	pthread_mutex_unlock(&prefetcher->mutex);
+
+	pthread_join(prefetcher->thread, NULL);
+	pthread_cond_destroy(&prefetcher->cond);
+	pthread_mutex_destroy(&prefetcher->mutex);
+}
@@ -0,0 +1,45 @@
+#ifndef VS_PREFETCH_H
+#define VS_PREFETCH_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VS_PREFETCH_DEFAULT_DISTANCE (64 * 1024 * 1024)
+
+// Bytes searched between two moves of the cursor.
+#define VS_PREFETCH_CHUNK (4 * 1024 * 1024)
+
+// --prefetch[=DISTANCE]: a helper thread asks the kernel to read the mapping
+// DISTANCE bytes ahead of the scan cursor (MADV_WILLNEED) and drops what is
+// behind it from the mapping (MADV_DONTNEED), so the scan doesn't stall on
+// page faults of cold storage and the resident set stays small. Dropped
+// pages of a read-only mapping are just faulted in again if touched.
+struct vs_prefetcher {
+	uint8_t *data;     // page aligned start of the mapping
+	size_t   size;
+	size_t   distance;
+	size_t   cursor;   // everything before it was searched
+	size_t   advised;  // end of the range given to MADV_WILLNEED
+	size_t   dropped;  // end of the range given to MADV_DONTNEED
+	bool     done;
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;
+	pthread_t thread;
+};
+
+int  vs_prefetch_start(struct vs_prefetcher *prefetcher, void *data, size_t size, size_t distance);
+void vs_prefetch_advance(struct vs_prefetcher *prefetcher, size_t cursor);
+void vs_prefetch_stop(struct vs_prefetcher *prefetcher);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,427 @@
+#include "serve.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SERVE_MAX_ARGS 4096
+#define SERVE_MAX_CLIENTS 64
+#define SERVE_MAX_LINE (16 * 1024 * 1024)
+#define SERVE_READ_SIZE 4096
+#define SERVE_SEND_TIMEOUT 30 // seconds
+
+void vs_map_cache_init(struct vs_map_cache *cache, size_t capacity) {
+	cache->mappings = NULL;
+	cache->count    = 0;
+	cache->capacity = capacity > 0 ? capacity : 1;
+	cache->clock    = 0;
+}
+
+static void unmap(struct vs_mapping *mapping) {
+	if (mapping->data) {
+		munmap(mapping->data, (size_t)mapping->size);
+	}
+	free(mapping->path);
+}
+
+static int map(struct vs_mapping *mapping, const char *path, int fd, const struct stat *st) {
+	if (sizeof(off_t) > sizeof(size_t) && st->st_size > (off_t)SIZE_MAX) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	uint8_t *data = NULL;
+	if (st->st_size > 0) {
+		data = mmap(NULL, (size_t)st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			return -1;
+		}
+	}
+
+	char *copy = strdup(path);
+	if (!copy) {
+		if (data) {
+			munmap(data, (size_t)st->st_size);
+		}
+		errno = ENOMEM;
+		return -1;
+	}
+
+	mapping->path  = copy;
+	mapping->dev   = st->st_dev;
+	mapping->ino   = st->st_ino;
+	mapping->size  = st->st_size;
+	mapping->mtime = st->st_mtim;
+	mapping->data  = data;
+	return 0;
+}
+
+const struct vs_mapping *vs_map_cache_get(struct vs_map_cache *cache, const char *path) {
+	struct stat st;
+	struct vs_mapping *found = NULL;
+
+	for (size_t index = 0; index < cache->count; ++ index) {
+		if (strcmp(cache->mappings[index].path, path) == 0) {
+			found = cache->mappings + index;
+			break;
+		}
+	}
+
+	if (found && stat(path, &st) == 0 &&
+	    st.st_dev == found->dev && st.st_ino == found->ino && st.st_size == found->size &&
+	    st.st_mtim.tv_sec == found->mtime.tv_sec && st.st_mtim.tv_nsec == found->mtime.tv_nsec) {
+		found->last_used = ++ cache->clock;
+		return found;
+	}
+
+	const int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+
+	if (fstat(fd, &st) != 0) {
+		goto error;
+	}
+
+	if (!S_ISREG(st.st_mode)) {
+		errno = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+		goto error;
+	}
+
+	if (found) {
+		// changed since it was mapped
+		unmap(found);
+		*found = cache->mappings[-- cache->count];
+	}
+
+	if (cache->count == cache->capacity) {
+		struct vs_mapping *oldest = cache->mappings;
+		for (size_t index = 1; index < cache->count; ++ index) {
+			if (cache->mappings[index].last_used < oldest->last_used) {
+				oldest = cache->mappings + index;
+			}
+		}
+		unmap(oldest);
+		*oldest = cache->mappings[-- cache->count];
+	}
+
+	if (!cache->mappings) {
+		cache->mappings = calloc(cache->capacity, sizeof(struct vs_mapping));
+		if (!cache->mappings) {
+			errno = ENOMEM;
+			goto error;
+		}
+	}
+
+	struct vs_mapping *mapping = cache->mappings + cache->count;
+	if (map(mapping, path, fd, &st) != 0) {
+		goto error;
+	}
+	++ cache->count;
+	mapping->last_used = ++ cache->clock;
+
+	close(fd);
+	return mapping;
+
+error:
+	{
+		const int errnum = errno;
+		close(fd);
+		errno = errnum;
+	}
+	return NULL;
+}
+
+void vs_map_cache_destroy(struct vs_map_cache *cache) {
+	for (size_t index = 0; index < cache->count; ++ index) {
+		unmap(cache->mappings + index);
+	}
+	free(cache->mappings);
+	cache->mappings = NULL;
+	cache->count    = 0;
+}
+
+static volatile sig_atomic_t serve_stop = 0;
+
+static void handle_stop(int signum) {
+	(void)signum;
+	serve_stop = 1;
+}
+
+static int listen_unix(const char *socket_path) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock == -1) {
+		return -1;
+	}
+
+	// replace a stale socket, but not one that still has a server
+	struct stat st;
+	if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		if (connect(sock, (const struct sockaddr*)&addr, sizeof(addr)) == 0) {
+			close(sock);
+			errno = EADDRINUSE;
+			return -1;
+		}
+		unlink(socket_path);
+	}
+
+	// only the owner may connect
+	const mode_t mask = umask(0077);
+	const int status = bind(sock, (const struct sockaddr*)&addr, sizeof(addr));
+	umask(mask);
+
+	if (status != 0 || listen(sock, 64) != 0) {
+		const int errnum = errno;
+		close(sock);
+		errno = errnum;
+		return -1;
+	}
+
+	return sock;
+}
+
+// Splits line at tabs (in place). Returns the number of fields.
+static int split_request(char *line, char *argv[], int max_args) {
+	int argc = 0;
+	char *field = line;
+	while (argc < max_args) {
+		argv[argc ++] = field;
+		char *tab = strchr(field, '\t');
+		if (!tab) {
+			break;
+		}
+		*tab = '\0';
+		field = tab + 1;
+	}
+	return argc;
+}
+
+struct client {
+	int     fd;
+	FILE   *out;
+	char   *line;      // bytes received that don't form a whole line yet
+	size_t  line_size;
+	size_t  line_capacity;
+	uint64_t last_active;
+};
+
+static void close_client(struct client *client) {
+	fclose(client->out);
+	close(client->fd);
+	free(client->line);
+}
+
+static int open_client(struct client *client, int conn, uint64_t now) {
+	// a client that doesn't read its responses can't stall the others forever
+	const struct timeval timeout = { SERVE_SEND_TIMEOUT, 0 };
+	setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	const int out_fd = dup(conn);
+	FILE *out = out_fd == -1 ? NULL : fdopen(out_fd, "w");
+	if (!out) {
+		if (out_fd != -1) {
+			close(out_fd);
+		}
+		return -1;
+	}
+	setvbuf(out, NULL, _IOFBF, 64 * 1024);
+
+	client->fd            = conn;
+	client->out           = out;
+	client->line          = NULL;
+	client->line_size     = 0;
+	client->line_capacity = 0;
+	client->last_active   = now;
+	return 0;
+}
+
+// Handles the complete request lines received so far. Returns -1 if the
+// client has to be disconnected.
+static int handle_requests(struct client *client, void *ctx, vs_request_handler handler, char *argv[]) {
+	char  *line = client->line;
+	size_t rest = client->line_size;
+	char  *newline;
+	while (!serve_stop && (newline = memchr(line, '\n', rest))) {
+		size_t len = (size_t)(newline - line);
+		const size_t consumed = len + 1;
+		*newline = '\0';
+		if (len > 0 && line[len - 1] == '\r') {
+			line[-- len] = '\0';
+		}
+
+		if (len > 0) {
+			const int argc = split_request(line, argv, SERVE_MAX_ARGS);
+			handler(ctx, argc, argv, client->out);
+			fputc('\n', client->out);
+			if (fflush(client->out) != 0) {
+				// client went away
+				return -1;
+			}
+		}
+
+		line += consumed;
+		rest -= consumed;
+	}
+
+	memmove(client->line, line, rest);
+	client->line_size = rest;
+
+	return 0;
+}
+
+// Reads what the client sent. Returns -1 if the client has to be
+// disconnected.
+static int receive(struct client *client, void *ctx, vs_request_handler handler, char *argv[]) {
+	if (client->line_capacity - client->line_size < SERVE_READ_SIZE + 1) {
+		const size_t capacity = client->line_size + SERVE_READ_SIZE + 1;
+		if (capacity > SERVE_MAX_LINE) {
+			return -1;
+		}
+		char *line = realloc(client->line, capacity);
+		if (!line) {
+			return -1;
+		}
+		client->line          = line;
+		client->line_capacity = capacity;
+	}
+
+	const ssize_t count = read(client->fd, client->line + client->line_size, SERVE_READ_SIZE);
+	if (count < 0) {
+		return errno == EINTR || errno == EAGAIN ? 0 : -1;
+	}
+	if (count == 0) {
+		// a last request without a newline is still handled
+		if (client->line_size > 0) {
+			client->line[client->line_size ++] = '\n';
+			handle_requests(client, ctx, handler, argv);
+		}
+		return -1;
+	}
+	client->line_size += (size_t)count;
+
+	return handle_requests(client, ctx, handler, argv);
+}
+
+int vs_serve(const char *socket_path, void *ctx, vs_request_handler handler) {
+	char **argv = malloc(sizeof(char*) * SERVE_MAX_ARGS);
+	if (!argv) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	const int sock = listen_unix(socket_path);
+	if (sock == -1) {
+		const int errnum = errno;
+		free(argv);
+		errno = errnum;
+		return -1;
+	}
+
+	// no SA_RESTART, so poll() returns on these
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_stop;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT,  &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	// writes to clients that disconnected fail with EPIPE instead
+	signal(SIGPIPE, SIG_IGN);
+
+	// pollfds[0] is the listening socket, pollfds[index + 1] belongs to clients[index]
+	struct client clients[SERVE_MAX_CLIENTS];
+	struct pollfd pollfds[SERVE_MAX_CLIENTS + 1];
+	size_t client_count = 0;
+	uint64_t clock = 0;
+
+	int status = 0;
+	while (!serve_stop) {
+		pollfds[0] = (struct pollfd){ sock, POLLIN, 0 };
+		for (size_t index = 0; index < client_count; ++ index) {
+			pollfds[index + 1] = (struct pollfd){ clients[index].fd, POLLIN, 0 };
+		}
+
+		if (poll(pollfds, client_count + 1, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			status = -1;
+			break;
+		}
+
+		// clients first, so that the indices in pollfds stay valid
+		for (size_t index = client_count; index > 0 && !serve_stop; -- index) {
+			struct client *client = clients + index - 1;
+			if (!pollfds[index].revents) {
+				continue;
+			}
+			client->last_active = ++ clock;
+			if (receive(client, ctx, handler, argv) != 0) {
+				close_client(client);
+				*client = clients[-- client_count];
+			}
+		}
+
+		if (pollfds[0].revents & POLLIN) {
+			const int conn = accept(sock, NULL, NULL);
+			if (conn == -1) {
+				if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN) {
+					continue;
+				}
+				status = -1;
+				break;
+			}
+
+			if (client_count == SERVE_MAX_CLIENTS) {
+				// make room by dropping the client that was idle the longest
+				size_t idlest = 0;
+				for (size_t index = 1; index < client_count; ++ index) {
+					if (clients[index].last_active < clients[idlest].last_active) {
+						idlest = index;
+					}
+				}
+				close_client(clients + idlest);
+				clients[idlest] = clients[-- client_count];
+			}
+
+			if (open_client(clients + client_count, conn, ++ clock) == 0) {
+				++ client_count;
+			}
+			else {
+				close(conn);
+			}
+		}
+	}
+
+	for (size_t index = 0; index < client_count; ++ index) {
+		close_client(clients + index);
+	}
+
+	const int errnum = errno;
+	close(sock);
+	unlink(socket_path);
+	free(argv);
+	errno = errnum;
+
+	return status;
+}
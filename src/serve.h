@@ -0,0 +1,56 @@
+#ifndef VS_SERVE_H
+#define VS_SERVE_H
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A whole file mapped read-only. data is NULL for empty files.
+struct vs_mapping {
+	char    *path;
+	dev_t    dev;
+	ino_t    ino;
+	off_t    size;
+	struct timespec mtime;
+	uint8_t *data;
+	uint64_t last_used;
+};
+
+// Keeps up to capacity files mapped. A mapping is reused as long as the
+// file's device, inode, size and mtime didn't change, otherwise it is
+// remapped. The least recently used mapping is dropped when the cache is full.
+struct vs_map_cache {
+	struct vs_mapping *mappings;
+	size_t   count;
+	size_t   capacity;
+	uint64_t clock;
+};
+
+void vs_map_cache_init(struct vs_map_cache *cache, size_t capacity);
+// The returned mapping stays valid until the next call. Returns NULL and
+// sets errno on error.
+const struct vs_mapping *vs_map_cache_get(struct vs_map_cache *cache, const char *path);
+void vs_map_cache_destroy(struct vs_map_cache *cache);
+
+// argv holds the tab separated fields of one request line. Everything the
+// handler writes to out is sent to the client, followed by an empty line.
+typedef int (*vs_request_handler)(void *ctx, int argc, char *argv[], FILE *out);
+
+// Listens on a Unix socket at socket_path. Any number of clients may be
+// connected at once, each of which may send any number of requests. Requests
+// are handled one at a time in the order they arrive. Returns once SIGINT or
+// SIGTERM was received (0) or on error (-1 with errno set).
+int vs_serve(const char *socket_path, void *ctx, vs_request_handler handler);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
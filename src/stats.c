@@ -0,0 +1,209 @@
+#include "stats.h"
+#include "output.h"
+
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#ifdef __linux__
+#	include <linux/perf_event.h>
+#	include <sys/ioctl.h>
+#	include <sys/syscall.h>
+#endif
+
+#ifdef _MSC_VER
+#	define PRIuSZ "Iu"
+#else
+#	define PRIuSZ "zu"
+#endif
+
+#define VS_PERF_CYCLES     0
+#define VS_PERF_LLC_MISSES 1
+
+static const char *phase_names[VS_PHASE_COUNT] = { "parse", "map", "search", "output" };
+
+static uint64_t elapsed_ns(const struct timespec *start, const struct timespec *end) {
+	return (uint64_t)(end->tv_sec - start->tv_sec) * UINT64_C(1000000000) +
+	       (uint64_t)end->tv_nsec - (uint64_t)start->tv_nsec;
+}
+
+#ifdef __linux__
+static int open_perf_counter(uint64_t config) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size           = sizeof(attr);
+	attr.type           = PERF_TYPE_HARDWARE;
+	attr.config         = config;
+	attr.disabled       = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv     = 1;
+
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+void vs_stats_init(struct vs_stats *stats) {
+	memset(stats, 0, sizeof(*stats));
+	stats->perf_fds[VS_PERF_CYCLES]     = -1;
+	stats->perf_fds[VS_PERF_LLC_MISSES] = -1;
+	vs_stats_begin(stats, VS_PHASE_PARSE);
+}
+
+int vs_stats_start(struct vs_stats *stats, const struct vs_needle needles[], size_t needle_count) {
+	struct rusage usage;
+
+	stats->needles      = needles;
+	stats->needle_count = needle_count;
+	stats->needle_hits  = calloc(needle_count ? needle_count : 1, sizeof(uint64_t));
+	if (!stats->needle_hits) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+		stats->minor_faults = -usage.ru_minflt;
+		stats->major_faults = -usage.ru_majflt;
+	}
+
+#ifdef __linux__
+	// hardware counters are often unavailable (containers, VMs,
+	// perf_event_paranoid), in which case they are just left out
+	stats->perf_fds[VS_PERF_CYCLES]     = open_perf_counter(PERF_COUNT_HW_CPU_CYCLES);
+	stats->perf_fds[VS_PERF_LLC_MISSES] = open_perf_counter(PERF_COUNT_HW_CACHE_MISSES);
+	for (size_t index = 0; index < 2; ++ index) {
+		if (stats->perf_fds[index] != -1) {
+			ioctl(stats->perf_fds[index], PERF_EVENT_IOC_RESET, 0);
+			ioctl(stats->perf_fds[index], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#endif
+
+	vs_reset_counters();
+	return 0;
+}
+
+void vs_stats_begin(struct vs_stats *stats, enum vs_phase phase) {
+	struct vs_phase_time *time = stats->phases + phase;
+	clock_gettime(CLOCK_MONOTONIC, &time->wall_start);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time->cpu_start);
+}
+
+void vs_stats_end(struct vs_stats *stats, enum vs_phase phase) {
+	struct vs_phase_time *time = stats->phases + phase;
+	struct timespec wall, cpu;
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+	time->wall_ns += elapsed_ns(&time->wall_start, &wall);
+	time->cpu_ns  += elapsed_ns(&time->cpu_start, &cpu);
+}
+
+void vs_stats_hit(struct vs_stats *stats, const struct vs_needle *needle) {
+	++ stats->hits;
+	if (needle >= stats->needles && needle < stats->needles + stats->needle_count) {
+		++ stats->needle_hits[needle - stats->needles];
+	}
+}
+
+static int64_t read_perf_counter(int fd) {
+	uint64_t value = 0;
+	if (fd == -1) {
+		return -1;
+	}
+#ifdef __linux__
+	ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+	if (read(fd, &value, sizeof(value)) != (ssize_t)sizeof(value)) {
+		return -1;
+	}
+	return (int64_t)value;
+}
+
+void vs_stats_print(struct vs_stats *stats, FILE *stream) {
+	struct vs_counters counters;
+	struct rusage usage;
+	int64_t perf[2];
+
+	vs_get_counters(&counters);
+
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+		stats->minor_faults += usage.ru_minflt;
+		stats->major_faults += usage.ru_majflt;
+		stats->max_rss       = usage.ru_maxrss;
+	}
+
+	for (size_t index = 0; index < 2; ++ index) {
+		perf[index] = read_perf_counter(stats->perf_fds[index]);
+	}
+
+	// output happens from within the search callback
+	struct vs_phase_time *search = stats->phases + VS_PHASE_SEARCH;
+	const struct vs_phase_time *output = stats->phases + VS_PHASE_OUTPUT;
+	search->wall_ns = search->wall_ns > output->wall_ns ? search->wall_ns - output->wall_ns : 0;
+	search->cpu_ns  = search->cpu_ns  > output->cpu_ns  ? search->cpu_ns  - output->cpu_ns  : 0;
+
+	const double throughput = search->wall_ns > 0 ?
+		(double)stats->bytes / ((double)search->wall_ns / 1e9) / (1024.0 * 1024.0) : 0.0;
+
+	if (stats->json) {
+		fprintf(stream, "{\"files\":%" PRIuSZ ",\"bytes\":%" PRIu64 ",\"skipped_bytes\":%" PRIu64
+			",\"throughput_mib_s\":%.3f,\"throttled_ns\":%" PRIu64 ",\"phases\":{",
+			stats->files, stats->bytes, stats->skipped_bytes, throughput, stats->throttled_ns);
+		for (size_t index = 0; index < VS_PHASE_COUNT; ++ index) {
+			fprintf(stream, "%s\"%s\":{\"wall_ns\":%" PRIu64 ",\"cpu_ns\":%" PRIu64 "}",
+				index > 0 ? "," : "", phase_names[index],
+				stats->phases[index].wall_ns, stats->phases[index].cpu_ns);
+		}
+		fprintf(stream, "},\"minor_faults\":%ld,\"major_faults\":%ld,\"max_rss_kib\":%ld,\"candidates\":%" PRIu64
+			",\"verified\":%" PRIu64 ",\"hits\":%" PRIu64,
+			stats->minor_faults, stats->major_faults, stats->max_rss, counters.candidates, counters.verified, stats->hits);
+		fputs(",\"cycles\":", stream);
+		if (perf[VS_PERF_CYCLES] < 0) fputs("null", stream);
+		else fprintf(stream, "%" PRId64, perf[VS_PERF_CYCLES]);
+		fputs(",\"llc_misses\":", stream);
+		if (perf[VS_PERF_LLC_MISSES] < 0) fputs("null", stream);
+		else fprintf(stream, "%" PRId64, perf[VS_PERF_LLC_MISSES]);
+		fputs(",\"needles\":[", stream);
+		for (size_t index = 0; index < stats->needle_count; ++ index) {
+			fputs(index > 0 ? ",{\"needle\":" : "{\"needle\":", stream);
+			vs_print_json_string((const char*)stats->needles[index].ctx, stream);
+			fprintf(stream, ",\"hits\":%" PRIu64 "}", stats->needle_hits[index]);
+		}
+		fputs("]}\n", stream);
+	}
+	else {
+		fprintf(stream, "files:        %" PRIuSZ "\n", stats->files);
+		fprintf(stream, "bytes:        %" PRIu64 "\n", stats->bytes);
+		fprintf(stream, "skipped:      %" PRIu64 " bytes\n", stats->skipped_bytes);
+		fprintf(stream, "throughput:   %.1f MiB/s\n", throughput);
+		fprintf(stream, "throttled:    %.3f ms\n", (double)stats->throttled_ns / 1e6);
+		for (size_t index = 0; index < VS_PHASE_COUNT; ++ index) {
+			fprintf(stream, "%-7s wall: %10.3f ms, cpu: %10.3f ms\n", phase_names[index],
+				(double)stats->phases[index].wall_ns / 1e6, (double)stats->phases[index].cpu_ns / 1e6);
+		}
+		fprintf(stream, "page faults:  %ld minor, %ld major\n", stats->minor_faults, stats->major_faults);
+		fprintf(stream, "max RSS:      %ld KiB\n", stats->max_rss);
+		fprintf(stream, "candidates:   %" PRIu64 " (%" PRIu64 " verified)\n", counters.candidates, counters.verified);
+		if (perf[VS_PERF_CYCLES] < 0) fputs("cycles:       unavailable\n", stream);
+		else fprintf(stream, "cycles:       %" PRId64 "\n", perf[VS_PERF_CYCLES]);
+		if (perf[VS_PERF_LLC_MISSES] < 0) fputs("LLC misses:   unavailable\n", stream);
+		else fprintf(stream, "LLC misses:   %" PRId64 "\n", perf[VS_PERF_LLC_MISSES]);
+		fprintf(stream, "hits:         %" PRIu64 "\n", stats->hits);
+		for (size_t index = 0; index < stats->needle_count; ++ index) {
+			fprintf(stream, "  %10" PRIu64 "  %s\n", stats->needle_hits[index], (const char*)stats->needles[index].ctx);
+		}
+	}
+}
+
+void vs_stats_destroy(struct vs_stats *stats) {
+	for (size_t index = 0; index < 2; ++ index) {
+		if (stats->perf_fds[index] != -1) {
+			close(stats->perf_fds[index]);
+			stats->perf_fds[index] = -1;
+		}
+	}
+	free(stats->needle_hits);
+	stats->needle_hits = NULL;
+}
@@ -0,0 +1,61 @@
+#ifndef VS_STATS_H
+#define VS_STATS_H
+#pragma once
+
+#include "valuescan.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum vs_phase {
+	VS_PHASE_PARSE,
+	VS_PHASE_MAP,
+	VS_PHASE_SEARCH,
+	VS_PHASE_OUTPUT,
+	VS_PHASE_COUNT,
+};
+
+struct vs_phase_time {
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+	struct timespec wall_start;
+	struct timespec cpu_start;
+};
+
+// Run statistics printed by --stats. Output is timed while the search is
+// running, so the reported search time has the output time subtracted.
+struct vs_stats {
+	bool json;
+	struct vs_phase_time phases[VS_PHASE_COUNT];
+	uint64_t bytes;
+	uint64_t skipped_bytes; // --skip-entropy
+	uint64_t throttled_ns;  // --max-read-rate, --max-cpu
+	size_t   files;
+	uint64_t hits;
+	long     minor_faults;
+	long     major_faults;
+	long     max_rss; // KiB
+	const struct vs_needle *needles;
+	size_t    needle_count;
+	uint64_t *needle_hits;
+	int       perf_fds[2];
+};
+
+void vs_stats_init(struct vs_stats *stats);
+int  vs_stats_start(struct vs_stats *stats, const struct vs_needle needles[], size_t needle_count);
+void vs_stats_begin(struct vs_stats *stats, enum vs_phase phase);
+void vs_stats_end(struct vs_stats *stats, enum vs_phase phase);
+void vs_stats_hit(struct vs_stats *stats, const struct vs_needle *needle);
+void vs_stats_print(struct vs_stats *stats, FILE *stream);
+void vs_stats_destroy(struct vs_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,235 @@
+#include "throttle.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#	include <sys/syscall.h>
+#endif
+
+// the bucket holds at most this many seconds worth of reading, so a scan that
+// was waiting on output doesn't read at full speed afterwards
+#define VS_THROTTLE_BURST 0.25
+
+static double seconds_between(const struct timespec *start, const struct timespec *end) {
+	return (double)(end->tv_sec - start->tv_sec) + (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int parse_positive(const char *str, double max, double *valueptr) {
+	char *endptr = NULL;
+	errno = 0;
+	const double value = strtod(str, &endptr);
+	if (endptr == str || *endptr) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (errno != 0 || !(value > 0 && value <= max)) {
+		errno = ERANGE;
+		return -1;
+	}
+	*valueptr = value;
+	return 0;
+}
+
+int vs_parse_read_rate(const char *str, struct vs_throttle *throttle) {
+	double rate = 0;
+	if (parse_positive(str, 1e9, &rate) != 0) {
+		return -1;
+	}
+	throttle->read_rate = rate * 1024 * 1024;
+	return 0;
+}
+
+int vs_parse_cpu_share(const char *str, struct vs_throttle *throttle) {
+	double percent = 0;
+	if (parse_positive(str, 100, &percent) != 0) {
+		return -1;
+	}
+	throttle->cpu_share = percent / 100;
+	return 0;
+}
+
+int vs_throttle_wait(struct vs_throttle *throttle, size_t size) {
+	struct timespec wall, cpu;
+	if (clock_gettime(CLOCK_MONOTONIC, &wall) != 0 || clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu) != 0) {
+		return -1;
+	}
+
+	if (!throttle->started) {
+		throttle->started   = true;
+		throttle->tokens    = throttle->read_rate * VS_THROTTLE_BURST;
+		throttle->refilled  = wall;
+		throttle->wall_mark = wall;
+		throttle->cpu_mark  = cpu;
+	}
+
+	double delay = 0;
+	if (throttle->cpu_share > 0) {
+		// sleep until the CPU time used since the last wait is cpu_share of
+		// the time passed since then
+		const double busy    = seconds_between(&throttle->cpu_mark,  &cpu);
+		const double elapsed = seconds_between(&throttle->wall_mark, &wall);
+		delay = busy / throttle->cpu_share - elapsed;
+	}
+
+	if (throttle->read_rate > 0) {
+		const double burst = throttle->read_rate * VS_THROTTLE_BURST;
+		throttle->tokens += seconds_between(&throttle->refilled, &wall) * throttle->read_rate;
+		if (throttle->tokens > burst) {
+			throttle->tokens = burst;
+		}
+		throttle->refilled = wall;
+
+		// the debt is paid by the time slept, which refills the bucket
+		throttle->tokens -= (double)size;
+		if (throttle->tokens < 0 && -throttle->tokens / throttle->read_rate > delay) {
+			delay = -throttle->tokens / throttle->read_rate;
+		}
+	}
+
+	if (delay > 0) {
+		struct timespec remaining = {
+			.tv_sec  = (time_t)delay,
+			.tv_nsec = (long)((delay - floor(delay)) * 1e9),
+		};
+		while (nanosleep(&remaining, &remaining) != 0) {
+			if (errno != EINTR) {
+				return -1;
+			}
+		}
+		throttle->waited_ns += (uint64_t)(delay * 1e9);
+
+		if (clock_gettime(CLOCK_MONOTONIC, &wall) != 0) {
+			return -1;
+		}
+	}
+
+	throttle->wall_mark = wall;
+	throttle->cpu_mark  = cpu;
+
+	return 0;
+}
+
+int vs_nice_io(void) {
+#if defined(__linux__) && defined(SYS_ioprio_set)
+	// from linux/ioprio.h, which isn't installed everywhere
+	const int who_process = 1;
+	const int class_idle  = 3;
+	const int class_shift = 13;
+	return syscall(SYS_ioprio_set, who_process, 0, class_idle << class_shift) == 0 ? 0 : -1;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+// Samples which pages of the chunk are cached and then reads it ahead.
+static int sample_chunk(struct vs_page_dropper *dropper, size_t chunk) {
+	const size_t start = chunk * dropper->chunk_size;
+	if (start >= dropper->size) {
+		return 0;
+	}
+	const size_t end = dropper->size - start > dropper->chunk_size ? start + dropper->chunk_size : dropper->size;
+
+	if (mincore(dropper->data + start, end - start, dropper->resident[chunk % 2]) != 0) {
+		return -1;
+	}
+	madvise(dropper->data + start, end - start, MADV_WILLNEED);
+
+	return 0;
+}
+
+static void drop_chunk(struct vs_page_dropper *dropper, size_t chunk) {
+	const size_t start = chunk * dropper->chunk_size;
+	if (start >= dropper->size) {
+		return;
+	}
+	const size_t end   = dropper->size - start > dropper->chunk_size ? start + dropper->chunk_size : dropper->size;
+	const size_t pages = (end - start + dropper->pagesize - 1) / dropper->pagesize;
+	const unsigned char *resident = dropper->resident[chunk % 2];
+
+	size_t page = 0;
+	while (page < pages) {
+		if (resident[page] & 1) {
+			++ page;
+			continue;
+		}
+
+		const size_t first = page;
+		while (page < pages && !(resident[page] & 1)) {
+			++ page;
+		}
+
+		// the pages have to be unmapped before the kernel drops them from the page cache
+		const size_t from = start + first * dropper->pagesize;
+		const size_t to   = end - start > page * dropper->pagesize ? start + page * dropper->pagesize : end;
+		madvise(dropper->data + from, to - from, MADV_DONTNEED);
+		posix_fadvise(dropper->fd, dropper->offset + (off_t)from, (off_t)(to - from), POSIX_FADV_DONTNEED);
+	}
+}
+
+int vs_page_dropper_start(struct vs_page_dropper *dropper, int fd, void *data, off_t offset, size_t size, size_t chunk_size) {
+	const long pagesize = sysconf(_SC_PAGE_SIZE);
+	if (pagesize <= 0) {
+		return -1;
+	}
+	if (chunk_size == 0 || chunk_size % (size_t)pagesize != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	dropper->fd         = fd;
+	dropper->data       = data;
+	dropper->offset     = offset;
+	dropper->size       = size;
+	dropper->chunk_size = chunk_size;
+	dropper->pagesize   = (size_t)pagesize;
+	dropper->chunk      = 0;
+
+	const size_t pages = chunk_size / (size_t)pagesize;
+	dropper->resident[0] = malloc(pages);
+	dropper->resident[1] = malloc(pages);
+	if (!dropper->resident[0] || !dropper->resident[1]) {
+		free(dropper->resident[0]);
+		free(dropper->resident[1]);
+		return -1;
+	}
+
+	// Page faults would read ahead into chunks that weren't sampled yet, so
+	// only sample_chunk() reads ahead. NOREUSE is only a hint, ignored by
+	// older kernels.
+	madvise(data, size, MADV_RANDOM);
+	posix_fadvise(fd, offset, (off_t)size, POSIX_FADV_NOREUSE);
+
+	return 0;
+}
+
+int vs_page_dropper_next(struct vs_page_dropper *dropper) {
+	if (dropper->chunk == 0) {
+		if (sample_chunk(dropper, 0) != 0) {
+			return -1;
+		}
+	}
+	else {
+		drop_chunk(dropper, dropper->chunk - 1);
+	}
+
+	++ dropper->chunk;
+
+	return sample_chunk(dropper, dropper->chunk);
+}
+
+void vs_page_dropper_stop(struct vs_page_dropper *dropper) {
+	if (dropper->chunk > 0) {
+		drop_chunk(dropper, dropper->chunk - 1);
+	}
+
+	free(dropper->resident[0]);
+	free(dropper->resident[1]);
+	dropper->resident[0] = NULL;
+	dropper->resident[1] = NULL;
+}
@@ -0,0 +1,68 @@
+#ifndef VS_THROTTLE_H
+#define VS_THROTTLE_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// --max-read-rate and --max-cpu: the search waits between chunks until the
+// bytes it read fit into a token bucket that is refilled at read_rate bytes
+// per second, and until it used no more than cpu_share of the wall clock
+// time since the last chunk.
+struct vs_throttle {
+	double   read_rate; // bytes per second, 0 if unlimited
+	double   cpu_share; // 0 < cpu_share <= 1, 0 if unlimited
+	double   tokens;    // bytes that can be read without waiting, negative if in debt
+	bool     started;
+	struct timespec refilled;  // when tokens were last refilled
+	struct timespec wall_mark; // times at the end of the last wait
+	struct timespec cpu_mark;
+	uint64_t waited_ns;
+};
+
+// --nice-io: pages of the file that weren't in the page cache before they were
+// searched are dropped from it after the search, so that a scan doesn't evict
+// what other processes are using. The residency of each chunk is sampled before
+// the previous chunk is searched and the chunk is read ahead right after that,
+// instead of by the kernel's read ahead on page faults.
+struct vs_page_dropper {
+	int      fd;
+	uint8_t *data;       // page aligned start of the mapping
+	off_t    offset;     // file offset of the mapping
+	size_t   size;
+	size_t   chunk_size; // multiple of the page size
+	size_t   pagesize;
+	size_t   chunk;      // index of the chunk that is searched next
+	unsigned char *resident[2]; // residency of pages of even and odd chunks
+};
+
+// read_rate in MiB/s
+int vs_parse_read_rate(const char *str, struct vs_throttle *throttle);
+
+// cpu share in percent (1 to 100)
+int vs_parse_cpu_share(const char *str, struct vs_throttle *throttle);
+
+// Call before reading size bytes. Sleeps as long as needed.
+int vs_throttle_wait(struct vs_throttle *throttle, size_t size);
+
+// Gives disk I/O of the calling process the idle priority (Linux only).
+int vs_nice_io(void);
+
+int  vs_page_dropper_start(struct vs_page_dropper *dropper, int fd, void *data, off_t offset, size_t size, size_t chunk_size);
+// Call before each chunk is searched. Drops the previously searched chunk.
+int  vs_page_dropper_next(struct vs_page_dropper *dropper);
+// Drops the last searched chunk and frees the dropper.
+void vs_page_dropper_stop(struct vs_page_dropper *dropper);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
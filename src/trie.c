@@ -0,0 +1,281 @@
+#include "valuescan.h"
+#include "counters.h"
+
+#include <string.h>
+#include <errno.h>
+
+#define VS_TRIE_NONE UINT32_MAX
+
+// Needles that share a prefix share the trie nodes of that prefix, so a whole
+// group of needles (e.g. all encodings of one value) is tested with a single
+// walk per haystack offset. The root is a dense table, deeper nodes keep
+// their edges sorted by byte.
+struct trie_node {
+	uint32_t first_edge;
+	uint32_t edge_count;
+	uint32_t needle; // smallest index of a needle ending here or VS_TRIE_NONE
+};
+
+struct vs_trie {
+	const struct vs_needle *needles;
+	uint32_t root[256];
+	struct trie_node *nodes;
+	uint8_t  *edge_bytes;
+	uint32_t *edge_targets;
+	size_t node_count;
+};
+
+// build time node: edges are kept in a sorted growable array
+struct build_node {
+	uint8_t  *bytes;
+	uint32_t *targets;
+	uint32_t count;
+	uint32_t capacity;
+	uint32_t needle;
+};
+
+struct trie_builder {
+	struct build_node *nodes;
+	size_t count;
+	size_t capacity;
+};
+
+static uint32_t builder_add_node(struct trie_builder *builder) {
+	if (builder->count == builder->capacity) {
+		size_t capacity = builder->capacity ? builder->capacity * 2 : 256;
+		struct build_node *nodes = realloc(builder->nodes, sizeof(struct build_node) * capacity);
+		if (!nodes) {
+			errno = ENOMEM;
+			return VS_TRIE_NONE;
+		}
+		builder->nodes    = nodes;
+		builder->capacity = capacity;
+	}
+	if (builder->count >= VS_TRIE_NONE) {
+		errno = ERANGE;
+		return VS_TRIE_NONE;
+	}
+	struct build_node *node = builder->nodes + builder->count;
+	memset(node, 0, sizeof(*node));
+	node->needle = VS_TRIE_NONE;
+	return (uint32_t)builder->count ++;
+}
+
+static uint32_t builder_child(struct trie_builder *builder, uint32_t parent, uint8_t byte) {
+	struct build_node *node = builder->nodes + parent;
+	uint32_t lo = 0;
+	uint32_t hi = node->count;
+
+	while (lo < hi) {
+		const uint32_t mid = lo + (hi - lo) / 2;
+		if (node->bytes[mid] < byte) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	if (lo < node->count && node->bytes[lo] == byte) {
+		return node->targets[lo];
+	}
+
+	const uint32_t child = builder_add_node(builder);
+	if (child == VS_TRIE_NONE) {
+		return VS_TRIE_NONE;
+	}
+	node = builder->nodes + parent; // nodes might have moved
+
+	if (node->count == node->capacity) {
+		uint32_t capacity = node->capacity ? node->capacity * 2 : 2;
+		uint8_t  *bytes   = realloc(node->bytes, capacity);
+		if (!bytes) {
+			errno = ENOMEM;
+			return VS_TRIE_NONE;
+		}
+		node->bytes = bytes;
+		uint32_t *targets = realloc(node->targets, sizeof(uint32_t) * capacity);
+		if (!targets) {
+			errno = ENOMEM;
+			return VS_TRIE_NONE;
+		}
+		node->targets  = targets;
+		node->capacity = capacity;
+	}
+
+	memmove(node->bytes   + lo + 1, node->bytes   + lo, node->count - lo);
+	memmove(node->targets + lo + 1, node->targets + lo, sizeof(uint32_t) * (node->count - lo));
+	node->bytes[lo]   = byte;
+	node->targets[lo] = child;
+	++ node->count;
+
+	return child;
+}
+
+static void builder_destroy(struct trie_builder *builder) {
+	for (size_t index = 0; index < builder->count; ++ index) {
+		free(builder->nodes[index].bytes);
+		free(builder->nodes[index].targets);
+	}
+	free(builder->nodes);
+}
+
+struct vs_trie *vs_trie_create(const struct vs_needle needles[], size_t needle_count) {
+	struct trie_builder builder = { NULL, 0, 0 };
+	struct vs_trie *trie = NULL;
+
+	if (needle_count >= VS_TRIE_NONE) {
+		errno = ERANGE;
+		return NULL;
+	}
+
+	// node 0 is the (sparse) root, only used while building
+	if (builder_add_node(&builder) == VS_TRIE_NONE) {
+		goto error;
+	}
+
+	for (size_t index = 0; index < needle_count; ++ index) {
+		const struct vs_needle *needle = needles + index;
+		uint32_t node = 0;
+
+		if (needle->size == 0) {
+			continue;
+		}
+
+		for (size_t depth = 0; depth < needle->size; ++ depth) {
+			node = builder_child(&builder, node, needle->data[depth]);
+			if (node == VS_TRIE_NONE) {
+				goto error;
+			}
+		}
+
+		if (builder.nodes[node].needle == VS_TRIE_NONE) {
+			builder.nodes[node].needle = (uint32_t)index;
+		}
+	}
+
+	trie = calloc(1, sizeof(struct vs_trie));
+	if (!trie) {
+		errno = ENOMEM;
+		goto error;
+	}
+
+	size_t edge_count = 0;
+	for (size_t index = 0; index < builder.count; ++ index) {
+		edge_count += builder.nodes[index].count;
+	}
+
+	trie->needles      = needles;
+	trie->node_count   = builder.count;
+	trie->nodes        = calloc(builder.count, sizeof(struct trie_node));
+	trie->edge_bytes   = calloc(edge_count ? edge_count : 1, 1);
+	trie->edge_targets = calloc(edge_count ? edge_count : 1, sizeof(uint32_t));
+
+	if (!trie->nodes || !trie->edge_bytes || !trie->edge_targets) {
+		errno = ENOMEM;
+		goto error;
+	}
+
+	for (size_t byte = 0; byte < 256; ++ byte) {
+		trie->root[byte] = VS_TRIE_NONE;
+	}
+
+	const struct build_node *root = builder.nodes;
+	for (uint32_t edge = 0; edge < root->count; ++ edge) {
+		trie->root[root->bytes[edge]] = root->targets[edge];
+	}
+
+	uint32_t edge_index = 0;
+	for (size_t index = 0; index < builder.count; ++ index) {
+		const struct build_node *src = builder.nodes + index;
+		struct trie_node *dest = trie->nodes + index;
+
+		dest->first_edge = edge_index;
+		dest->edge_count = src->count;
+		dest->needle     = src->needle;
+
+		memcpy(trie->edge_bytes   + edge_index, src->bytes,   src->count);
+		memcpy(trie->edge_targets + edge_index, src->targets, sizeof(uint32_t) * src->count);
+		edge_index += src->count;
+	}
+
+	builder_destroy(&builder);
+	return trie;
+
+error:
+	builder_destroy(&builder);
+	vs_trie_free(trie);
+	return NULL;
+}
+
+void vs_trie_free(struct vs_trie *trie) {
+	if (trie) {
+		free(trie->nodes);
+		free(trie->edge_bytes);
+		free(trie->edge_targets);
+		free(trie);
+	}
+}
+
+static inline uint32_t find_edge(const struct vs_trie *trie, const struct trie_node *node, uint8_t byte) {
+	const uint8_t *bytes = trie->edge_bytes + node->first_edge;
+	uint32_t lo = 0;
+	uint32_t hi = node->edge_count;
+
+	if (hi <= 8) {
+		for (; lo < hi; ++ lo) {
+			if (bytes[lo] == byte) {
+				return trie->edge_targets[node->first_edge + lo];
+			}
+		}
+		return VS_TRIE_NONE;
+	}
+
+	while (lo < hi) {
+		const uint32_t mid = lo + (hi - lo) / 2;
+		if (bytes[mid] < byte) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	return lo < node->edge_count && bytes[lo] == byte ?
+		trie->edge_targets[node->first_edge + lo] : VS_TRIE_NONE;
+}
+
+int vs_trie_search(const struct vs_trie *trie, const uint8_t haystack[], size_t haystack_size, void *ctx, vs_callback callback) {
+	for (size_t offset = 0; offset < haystack_size; ++ offset) {
+		const uint8_t *ptr = haystack + offset;
+		const size_t   rem = haystack_size - offset;
+		uint32_t node = trie->root[ptr[0]];
+		uint32_t best = VS_TRIE_NONE;
+
+		if (node == VS_TRIE_NONE) {
+			continue;
+		}
+		VS_COUNT_CANDIDATE();
+
+		for (size_t depth = 1; node != VS_TRIE_NONE; ++ depth) {
+			const struct trie_node *current = trie->nodes + node;
+			if (current->needle < best) {
+				best = current->needle;
+			}
+			if (depth == rem) {
+				break;
+			}
+			node = find_edge(trie, current, ptr[depth]);
+		}
+
+		if (best != VS_TRIE_NONE) {
+			VS_COUNT_VERIFIED();
+			int status = callback(ctx, trie->needles + best, offset);
+			if (status != 0) {
+				return status;
+			}
+		}
+	}
+
+	return 0;
+}
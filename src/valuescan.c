@@ -1,10 +1,25 @@
 #include "valuescan.h"
+#include "hash.h"
+#include "counters.h"
 
 #include <endian.h>
 #include <string.h>
+#include <errno.h>
+#include <stdbool.h>
 
 void *memmem(const void *l, size_t l_len, const void *s, size_t s_len);
 
+_Thread_local struct vs_counters vs_thread_counters = { 0, 0 };
+
+void vs_get_counters(struct vs_counters *counters) {
+	*counters = vs_thread_counters;
+}
+
+void vs_reset_counters(void) {
+	vs_thread_counters.candidates = 0;
+	vs_thread_counters.verified   = 0;
+}
+
 size_t vs_needle_from_i8(uint8_t needle[], size_t needle_size, int8_t value) {
 	return vs_needle_from_u8(needle, needle_size, (uint8_t)value);
 }
@@ -104,6 +119,125 @@ size_t vs_needle_from_u64be(uint8_t needle[], size_t needle_size, uint64_t value
 	return sizeof(value);
 }
 
+size_t vs_needle_from_i24le(uint8_t needle[], size_t needle_size, int32_t value) {
+	return vs_needle_from_u24le(needle, needle_size, (uint32_t)value);
+}
+
+size_t vs_needle_from_u24le(uint8_t needle[], size_t needle_size, uint32_t value) {
+	if (needle_size >= 3) {
+		needle[0] =  value        & 0xFF;
+		needle[1] = (value >>  8) & 0xFF;
+		needle[2] = (value >> 16) & 0xFF;
+	}
+	return 3;
+}
+
+size_t vs_needle_from_i24be(uint8_t needle[], size_t needle_size, int32_t value) {
+	return vs_needle_from_u24be(needle, needle_size, (uint32_t)value);
+}
+
+size_t vs_needle_from_u24be(uint8_t needle[], size_t needle_size, uint32_t value) {
+	if (needle_size >= 3) {
+		needle[0] = (value >> 16) & 0xFF;
+		needle[1] = (value >>  8) & 0xFF;
+		needle[2] =  value        & 0xFF;
+	}
+	return 3;
+}
+
+size_t vs_needle_from_uleb128(uint8_t needle[], size_t needle_size, uint64_t value) {
+	uint8_t buf[VS_LEB128_MAX_SIZE];
+	size_t size = 0;
+	do {
+		uint8_t byte = value & 0x7F;
+		value >>= 7;
+		if (value != 0) {
+			byte |= 0x80;
+		}
+		buf[size ++] = byte;
+	} while (value != 0);
+
+	if (needle_size >= size) {
+		memcpy(needle, buf, size);
+	}
+	return size;
+}
+
+size_t vs_needle_from_sleb128(uint8_t needle[], size_t needle_size, int64_t value) {
+	uint8_t buf[VS_LEB128_MAX_SIZE];
+	size_t size = 0;
+	for (;;) {
+		uint8_t byte = value & 0x7F;
+		value >>= 7;
+		// done when the remaining bits are the sign extension of bit 6
+		if ((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40))) {
+			buf[size ++] = byte;
+			break;
+		}
+		buf[size ++] = byte | 0x80;
+	}
+
+	if (needle_size >= size) {
+		memcpy(needle, buf, size);
+	}
+	return size;
+}
+
+size_t vs_needle_from_zigzag(uint8_t needle[], size_t needle_size, int64_t value) {
+	return vs_needle_from_uleb128(needle, needle_size, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+size_t vs_decode_leb128(const uint8_t data[], size_t size, bool is_signed, uint64_t *valueptr) {
+	const size_t max_size = size < VS_LEB128_MAX_SIZE ? size : VS_LEB128_MAX_SIZE;
+	uint64_t value = 0;
+	for (size_t index = 0; index < max_size; ++ index) {
+		const uint8_t byte = data[index];
+		const unsigned int shift = (unsigned int)(index * 7);
+
+		if (index == VS_LEB128_MAX_SIZE - 1) {
+			// only bit 63 is left, the other bits must be zero (or its sign extension)
+			const uint8_t payload = byte & 0x7F;
+			if ((byte & 0x80) || (is_signed ? payload != 0 && payload != 0x7F : payload > 1)) {
+				return 0;
+			}
+			*valueptr = value | (uint64_t)(payload & 1) << 63;
+			return index + 1;
+		}
+
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			if (is_signed && (byte & 0x40)) {
+				value |= UINT64_MAX << (shift + 7);
+			}
+			*valueptr = value;
+			return index + 1;
+		}
+	}
+	return 0;
+}
+
+size_t vs_needle_from_bcd(uint8_t needle[], size_t needle_size, uint64_t value, size_t digits) {
+	size_t count = 0;
+	for (uint64_t rest = value; rest != 0 || count == 0; rest /= 10) {
+		++ count;
+	}
+	if (digits < count) {
+		digits = count;
+	}
+
+	const size_t size = (digits + 1) / 2;
+	if (needle_size >= size) {
+		// least significant digit into the low nibble of the last byte
+		for (size_t index = size; index > 0; -- index) {
+			needle[index - 1] = (uint8_t)(value % 10);
+			value /= 10;
+			needle[index - 1] |= (uint8_t)((value % 10) << 4);
+			value /= 10;
+		}
+	}
+	return size;
+}
+
 #ifdef __STDC_IEC_559__
 #	if (BYTE_ORDER != BIG_ENDIAN) && (BYTE_ORDER != LITTLE_ENDIAN)
 #		error unsupported host byte order
@@ -176,16 +310,221 @@ size_t vs_needle_from_f64be(uint8_t needle[], size_t needle_size, double value)
 	}
 	return sizeof(value);
 }
+
+static uint16_t float_to_f16(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	const uint16_t sign = (bits >> 16) & 0x8000;
+	const int exponent  = (int)((bits >> 23) & 0xFF);
+	uint32_t mantissa   = bits & 0x7FFFFF;
+
+	if (exponent == 0xFF) {
+		// infinity, or a quiet NaN
+		return sign | 0x7C00 | (mantissa ? 0x200 | (uint16_t)(mantissa >> 13) : 0);
+	}
+
+	const int half_exponent = exponent - 127 + 15;
+	if (half_exponent >= 31) {
+		return sign | 0x7C00;
+	}
+
+	uint32_t half;
+	unsigned int shift;
+	if (half_exponent <= 0) {
+		// subnormal, or too small even for that
+		if (half_exponent < -10) {
+			return sign;
+		}
+		mantissa |= 0x800000;
+		shift = (unsigned int)(14 - half_exponent);
+		half  = mantissa >> shift;
+	}
+	else {
+		shift = 13;
+		half  = (uint32_t)half_exponent << 10 | mantissa >> shift;
+	}
+
+	// round to nearest even, a carry may overflow into the exponent (or infinity)
+	const uint32_t rest    = mantissa & ((UINT32_C(1) << shift) - 1);
+	const uint32_t halfway = UINT32_C(1) << (shift - 1);
+	if (rest > halfway || (rest == halfway && (half & 1))) {
+		++ half;
+	}
+
+	return sign | (uint16_t)half;
+}
+
+static uint16_t float_to_bf16(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	if ((bits & 0x7FFFFFFF) > 0x7F800000) {
+		// quiet NaN
+		return (uint16_t)(bits >> 16) | 0x40;
+	}
+	return (uint16_t)((bits + 0x7FFF + ((bits >> 16) & 1)) >> 16);
+}
+
+size_t vs_needle_from_f16le(uint8_t needle[], size_t needle_size, float value) {
+	return vs_needle_from_u16le(needle, needle_size, float_to_f16(value));
+}
+
+size_t vs_needle_from_f16be(uint8_t needle[], size_t needle_size, float value) {
+	return vs_needle_from_u16be(needle, needle_size, float_to_f16(value));
+}
+
+size_t vs_needle_from_bf16le(uint8_t needle[], size_t needle_size, float value) {
+	return vs_needle_from_u16le(needle, needle_size, float_to_bf16(value));
+}
+
+size_t vs_needle_from_bf16be(uint8_t needle[], size_t needle_size, float value) {
+	return vs_needle_from_u16be(needle, needle_size, float_to_bf16(value));
+}
+#endif
+
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif
+
+// Case folding compare: OR the fold mask into the haystack bytes before
+// comparing them with the (already folded) needle, 16 bytes at a time.
+static bool folded_equals(const uint8_t *ptr, const uint8_t *data, const uint8_t *fold, size_t size) {
+	if ((ptr[0] | fold[0]) != data[0]) {
+		return false;
+	}
+
+	size_t index = 0;
+#ifdef __SSE2__
+	for (; index + 16 <= size; index += 16) {
+		const __m128i bytes  = _mm_loadu_si128((const __m128i*)(ptr  + index));
+		const __m128i mask   = _mm_loadu_si128((const __m128i*)(fold + index));
+		const __m128i needle = _mm_loadu_si128((const __m128i*)(data + index));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(bytes, mask), needle)) != 0xFFFF) {
+			return false;
+		}
+	}
 #endif
+	for (; index < size; ++ index) {
+		if ((ptr[index] | fold[index]) != data[index]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static inline bool needle_equals(const struct vs_needle *needle, const uint8_t *ptr) {
+	return needle->fold ?
+		folded_equals(ptr, needle->data, needle->fold, needle->size) :
+		memcmp(needle->data, ptr, needle->size) == 0;
+}
+
+// Needles at least this long are first compared by a rolling hash of the
+// haystack window so that the search stays linear in the haystack size.
+#define VS_ROLLING_HASH_MIN_SIZE 256
+
+struct rolling_hash {
+	size_t   size;
+	uint64_t pow;  // VS_HASH_BASE^(size-1)
+	uint64_t hash;
+};
+
+static int search_rolling_hash(const uint8_t haystack[], size_t haystack_size, const struct vs_needle needles[], size_t needle_count, void *ctx, vs_callback callback) {
+	// one rolling hash per distinct long needle size
+	struct rolling_hash *windows = calloc(needle_count, sizeof(struct rolling_hash));
+	size_t   *window_index  = calloc(needle_count, sizeof(size_t));
+	uint64_t *needle_hashes = calloc(needle_count, sizeof(uint64_t));
+	size_t window_count = 0;
+	int status = 0;
+
+	if (!windows || !window_index || !needle_hashes) {
+		errno = ENOMEM;
+		status = -1;
+		goto end;
+	}
+
+	for (size_t i = 0; i < needle_count; ++ i) {
+		const struct vs_needle *needle = needles + i;
+		window_index[i] = SIZE_MAX;
+
+		if (needle->size < VS_ROLLING_HASH_MIN_SIZE || needle->size > haystack_size || needle->fold) {
+			continue;
+		}
+
+		size_t index = 0;
+		while (index < window_count && windows[index].size != needle->size) {
+			++ index;
+		}
+
+		if (index == window_count) {
+			windows[index].size = needle->size;
+			windows[index].pow  = vs_hash_pow(needle->size - 1);
+			windows[index].hash = vs_hash(haystack, needle->size);
+			++ window_count;
+		}
+
+		window_index[i]  = index;
+		needle_hashes[i] = vs_hash(needle->data, needle->size);
+	}
+
+	for (size_t offset = 0; offset < haystack_size; ++ offset) {
+		const uint8_t *ptr = haystack + offset;
+		const size_t   rem = haystack_size - offset;
+
+		for (size_t i = 0; i < needle_count; ++ i) {
+			const struct vs_needle *needle = needles + i;
+			if (needle->size > rem) {
+				continue;
+			}
+			if (window_index[i] != SIZE_MAX) {
+				if (windows[window_index[i]].hash != needle_hashes[i]) {
+					continue;
+				}
+				VS_COUNT_CANDIDATE();
+			}
+			if (needle_equals(needle, ptr)) {
+				if (window_index[i] != SIZE_MAX) {
+					VS_COUNT_VERIFIED();
+				}
+				status = callback(ctx, needle, offset);
+				if (status != 0) {
+					goto end;
+				}
+				break;
+			}
+		}
+
+		for (size_t index = 0; index < window_count; ++ index) {
+			struct rolling_hash *window = windows + index;
+			if (window->size < rem) {
+				window->hash = vs_hash_roll(window->hash, window->pow, ptr[0], ptr[window->size]);
+			}
+		}
+	}
+
+end:
+	free(needle_hashes);
+	free(window_index);
+	free(windows);
+
+	return status;
+}
 
 int vs_search(const uint8_t haystack[], size_t haystack_size, const struct vs_needle needles[], size_t needle_count, void *ctx, vs_callback callback) {
+	for (size_t i = 0; i < needle_count; ++ i) {
+		if (needles[i].size >= VS_ROLLING_HASH_MIN_SIZE && needles[i].size <= haystack_size) {
+			return search_rolling_hash(haystack, haystack_size, needles, needle_count, ctx, callback);
+		}
+	}
+
 	const uint8_t *end = haystack + haystack_size;
 
 	for (const uint8_t *ptr = haystack; ptr < end; ++ ptr) {
 		const size_t rem = (size_t)(end - ptr);
 		for (size_t i = 0; i < needle_count; ++ i) {
 			const struct vs_needle *needle = needles + i;
-			if (needle->size <= rem && memcmp(needle->data, ptr, needle->size) == 0) {
+			if (needle->size <= rem && needle_equals(needle, ptr)) {
 				int status = callback(ctx, needle, (size_t)(ptr - haystack));
 				if (status != 0) {
 					return status;
@@ -4,18 +4,72 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+enum vs_needle_flags {
+	VS_NEEDLE_MAPPED     = 1, // data is a read-only file mapping, not heap memory
+	VS_NEEDLE_DELTA      = 2, // data holds differences, see below
+	VS_NEEDLE_BIG_ENDIAN = 4, // VS_NEEDLE_DELTA: elements are big endian
+	VS_NEEDLE_VARINT     = 8, // data is a LEB128 varint, see below
+	VS_NEEDLE_SIGNED     = 16, // VS_NEEDLE_VARINT: signed LEB128
+};
+
+// If fold is not NULL the haystack byte h at needle position i matches when
+// (h | fold[i]) == data[i]. With 0x20 at ASCII letters (and data in lower
+// case) this matches case-insensitively. Only vs_search() supports it.
+//
+// A VS_NEEDLE_DELTA needle is a sequence of unit_size byte integers that
+// matches wherever each element minus the first one (modulo 2^bits) equals
+// the corresponding element of data, whatever the first element is. Only the
+// planner (vs_plan_search()) supports it.
+//
+// A VS_NEEDLE_VARINT needle holds the shortest LEB128 encoding of a value and
+// also matches longer (padded) encodings of the same value of up to
+// VS_LEB128_MAX_SIZE bytes. Only the planner supports it.
 struct vs_needle {
 	size_t size;
 	const uint8_t *data;
+	const uint8_t *fold;
 	void *ctx;
+	unsigned int flags;
+	size_t unit_size;
+};
+
+enum vs_bit_order {
+	VS_BYTE_ALIGNED = 0,
+	VS_MSB_FIRST    = 1,
+	VS_LSB_FIRST    = 2,
+};
+
+struct vs_match {
+	const struct vs_needle *needle;
+	size_t offset;
+	size_t size;          // matched bytes, needle->size unless only a part matched
+	size_t needle_offset; // offset of the matched part within the needle
+	size_t mismatches;
+	unsigned int bit;     // bit within the byte at offset where the match starts
+	enum vs_bit_order bit_order;
+	size_t target;        // pointers: offset the value at offset points at
+	size_t hits;          // histograms: hits of the needle in the bucket at offset
+};
+
+// Prefilter statistics of the calling thread: positions that passed a cheap
+// prefilter (hash, first byte, SIMD compare, trie root) and how many of them
+// turned out to be real matches.
+struct vs_counters {
+	uint64_t candidates;
+	uint64_t verified;
 };
 
+void vs_get_counters(struct vs_counters *counters);
+void vs_reset_counters(void);
+
 typedef int (*vs_callback)(void *ctx, const struct vs_needle *needle, size_t offset);
+typedef int (*vs_match_callback)(void *ctx, const struct vs_match *match);
 
 size_t vs_needle_from_i8(uint8_t needle[], size_t needle_size, int8_t  value);
 size_t vs_needle_from_u8(uint8_t needle[], size_t needle_size, uint8_t value);
@@ -34,16 +88,216 @@ size_t vs_needle_from_u32be(uint8_t needle[], size_t needle_size, uint32_t value
 size_t vs_needle_from_i64be(uint8_t needle[], size_t needle_size, int64_t  value);
 size_t vs_needle_from_u64be(uint8_t needle[], size_t needle_size, uint64_t value);
 
+size_t vs_needle_from_i24le(uint8_t needle[], size_t needle_size, int32_t  value);
+size_t vs_needle_from_u24le(uint8_t needle[], size_t needle_size, uint32_t value);
+size_t vs_needle_from_i24be(uint8_t needle[], size_t needle_size, int32_t  value);
+size_t vs_needle_from_u24be(uint8_t needle[], size_t needle_size, uint32_t value);
+
 #ifdef __STDC_IEC_559__
 size_t vs_needle_from_f32le( uint8_t needle[], size_t needle_size, float   value);
 size_t vs_needle_from_f64le( uint8_t needle[], size_t needle_size, double  value);
 
 size_t vs_needle_from_f32be( uint8_t needle[], size_t needle_size, float   value);
 size_t vs_needle_from_f64be( uint8_t needle[], size_t needle_size, double  value);
+
+// IEEE half precision and bfloat16, rounded to nearest even
+size_t vs_needle_from_f16le( uint8_t needle[], size_t needle_size, float   value);
+size_t vs_needle_from_f16be( uint8_t needle[], size_t needle_size, float   value);
+size_t vs_needle_from_bf16le(uint8_t needle[], size_t needle_size, float   value);
+size_t vs_needle_from_bf16be(uint8_t needle[], size_t needle_size, float   value);
 #endif
 
+// Shortest LEB128 encodings. zigzag is protobuf's sint64: the unsigned LEB128
+// encoding of (value << 1) ^ (value >> 63).
+#define VS_LEB128_MAX_SIZE 10
+
+size_t vs_needle_from_uleb128(uint8_t needle[], size_t needle_size, uint64_t value);
+size_t vs_needle_from_sleb128(uint8_t needle[], size_t needle_size, int64_t  value);
+size_t vs_needle_from_zigzag( uint8_t needle[], size_t needle_size, int64_t  value);
+
+// Decodes a LEB128 value of up to VS_LEB128_MAX_SIZE bytes (sign extended if
+// is_signed). Returns its size, or 0 if it doesn't end within size bytes or
+// doesn't fit into 64 bits.
+size_t vs_decode_leb128(const uint8_t data[], size_t size, bool is_signed, uint64_t *valueptr);
+
+// Packed BCD, two digits per byte, most significant first. At least digits
+// digits are encoded (zero padded), an odd count gets a leading zero nibble.
+size_t vs_needle_from_bcd(uint8_t needle[], size_t needle_size, uint64_t value, size_t digits);
+
+// Needles of 256 bytes or more are compared by rolling hash first, so huge
+// needles don't make the search O(n*m).
 int vs_search(const uint8_t haystack[], size_t haystack_size, const struct vs_needle needles[], size_t needle_count, void *ctx, vs_callback callback);
 
+// A set of needles compiled into a shared-prefix automaton (trie). Matches
+// are reported like vs_search() does. The needles array must outlive the
+// trie. Meant for many short needles, every needle byte is a trie node.
+struct vs_trie;
+
+#define VS_TRIE_MAX_NEEDLE_SIZE 256
+
+struct vs_trie *vs_trie_create(const struct vs_needle needles[], size_t needle_count);
+void vs_trie_free(struct vs_trie *trie);
+int  vs_trie_search(const struct vs_trie *trie, const uint8_t haystack[], size_t haystack_size, void *ctx, vs_callback callback);
+
+// Query planner for exact searches: splits the needles into groups and picks
+// a matcher per group from the needle count, sizes, shared prefixes and the
+// estimated byte frequencies (a static table for typical binary data, or
+// counted from a sample of the haystack). Matches are reported like
+// vs_search() does, also across groups.
+enum vs_plan_engine {
+	VS_ENGINE_ANCHOR, // memchr() for the rarest byte pair of a single needle
+	VS_ENGINE_HASH,   // hash set of many needles of the same width (<= 8 bytes)
+	VS_ENGINE_TRIE,   // shared-prefix automaton (vs_trie_search())
+	VS_ENGINE_SCAN,   // vs_search(): case folding and very long needles
+	VS_ENGINE_DELTA,  // differences of consecutive integers (VS_NEEDLE_DELTA)
+	VS_ENGINE_VARINT, // LEB128 values decoded at candidate offsets (VS_NEEDLE_VARINT)
+};
+
+struct vs_plan;
+
+struct vs_plan_info {
+	enum vs_plan_engine engine;
+	size_t needle_count;
+	size_t min_size;
+	size_t max_size;
+	size_t first_bytes;      // distinct first bytes of the group's needles
+	size_t anchor;           // ANCHOR: offset of the rarest byte pair
+	double anchor_frequency; // ANCHOR: estimated matches of that pair per byte
+};
+
+// sample may be NULL. The needles array must outlive the plan.
+struct vs_plan *vs_plan_create(const struct vs_needle needles[], size_t needle_count, const uint8_t sample[], size_t sample_size);
+void   vs_plan_free(struct vs_plan *plan);
+int    vs_plan_search(const struct vs_plan *plan, const uint8_t haystack[], size_t haystack_size, void *ctx, vs_callback callback);
+size_t vs_plan_group_count(const struct vs_plan *plan);
+void   vs_plan_group_info(const struct vs_plan *plan, size_t group, struct vs_plan_info *info);
+const char *vs_plan_engine_name(enum vs_plan_engine engine);
+
+// Find needles with at most max_mismatches differing bytes (Hamming distance).
+// Needles of up to 64 bytes use a bit-parallel Shift-Or kernel, longer needles
+// are found via exact seeds (pigeonhole principle) that are then verified.
+int vs_search_approx(const uint8_t haystack[], size_t haystack_size, const struct vs_needle needles[], size_t needle_count,
+                     size_t max_mismatches, void *ctx, vs_match_callback callback);
+
+// Find partial or shifted copies of needles: every block_size aligned block of
+// a needle is hashed, a rolling hash over the haystack looks these blocks up
+// and each hit is extended in both directions to the longest common run.
+int vs_search_blocks(const uint8_t haystack[], size_t haystack_size, const struct vs_needle needles[], size_t needle_count,
+                     size_t block_size, void *ctx, vs_match_callback callback);
+
+// Find needles at every bit offset of a bit stream. bit_orders is a bit set of
+// VS_MSB_FIRST and VS_LSB_FIRST. Byte aligned matches are reported once with
+// VS_BYTE_ALIGNED, all others with the bit order and bit (1-7, counted from
+// the most/least significant bit) where they start.
+int vs_search_bits(const uint8_t haystack[], size_t haystack_size, const struct vs_needle needles[], size_t needle_count,
+                   unsigned int bit_orders, void *ctx, vs_match_callback callback);
+
+// Record arrays: runs of at least min_count consecutive records of stride
+// bytes where every field satisfies its predicate.
+enum vs_array_value {
+	VS_ARRAY_UNSIGNED,
+	VS_ARRAY_SIGNED,
+	VS_ARRAY_FLOAT,
+};
+
+enum vs_array_predicate {
+	VS_ARRAY_RANGE,      // min <= value <= max (exact values have min == max)
+	VS_ARRAY_INCREASING, // bigger than in the previous record
+	VS_ARRAY_DECREASING, // smaller than in the previous record
+};
+
+union vs_array_bound {
+	uint64_t u;
+	int64_t  i;
+	double   f;
+};
+
+struct vs_array_field {
+	size_t offset; // within the record
+	size_t size;   // 1, 2, 4 or 8 (4 or 8 for floats)
+	bool   big_endian;
+	enum vs_array_value     value;
+	enum vs_array_predicate predicate;
+	union vs_array_bound min;
+	union vs_array_bound max;
+};
+
+struct vs_array_schema {
+	size_t stride;
+	size_t min_count;
+	struct vs_array_field *fields;
+	size_t field_count;
+};
+
+struct vs_array {
+	size_t offset;
+	size_t count;
+	size_t stride;
+};
+
+typedef int (*vs_array_callback)(void *ctx, const struct vs_array *array);
+
+// Tracks one run per stride phase in a single pass. Arrays are reported in
+// offset order. Of arrays that overlap (at different phases) only the longest
+// is reported.
+int vs_search_arrays(const uint8_t haystack[], size_t haystack_size, const struct vs_array_schema *schema,
+                     void *ctx, vs_array_callback callback);
+
+// Pointers: aligned integers that, minus base, are the offset of a target
+// within the haystack.
+#define VS_POINTER_WINDOW 64
+
+struct vs_pointer_format {
+	size_t   size;        // 1, 2, 4 or 8
+	bool     big_endian;
+	size_t   align;       // distance between the values read (0: size)
+	size_t   phase;       // offset of the first value read (< align)
+	uint64_t base;        // a value v points at offset v - base
+	double   min_density; // fraction of values in a window that must be pointers
+};
+
+struct vs_pointer {
+	size_t offset;       // of the value
+	size_t target;       // offset the value points at
+	size_t target_index; // index into targets, SIZE_MAX if there are none
+};
+
+typedef int (*vs_pointer_callback)(void *ctx, const struct vs_pointer *pointer);
+
+// targets must be sorted and free of duplicates. If targets is NULL every
+// offset within the haystack is a target. Zero values (null pointers) never
+// count. Values are looked up in batches: the values of a batch that pass a
+// bitmap of the targets are sorted and merged with the targets.
+// Pointers are only reported if at least min_density of the values are
+// pointers in some window of VS_POINTER_WINDOW consecutive values around
+// them. Pointers are reported in offset order.
+int vs_search_pointers(const uint8_t haystack[], size_t haystack_size, const struct vs_pointer_format *format,
+                       const size_t targets[], size_t target_count, void *ctx, vs_pointer_callback callback);
+
+// Differences between two snapshots of the same data.
+enum vs_diff_kind {
+	VS_DIFF_NEEDLES,   // before holds one needle and after the other
+	VS_DIFF_CHANGED,   // the value of field changed
+	VS_DIFF_INCREASED, // the value of field is bigger in after
+	VS_DIFF_DECREASED, // the value of field is smaller in after
+};
+
+struct vs_diff {
+	enum vs_diff_kind kind;
+	const struct vs_needle *before; // VS_DIFF_NEEDLES
+	const struct vs_needle *after;
+	struct vs_array_field field;    // the other kinds, offset and predicate are ignored
+	size_t align;                   // only offsets that are a multiple of align are tested
+};
+
+typedef int (*vs_diff_callback)(void *ctx, size_t offset, size_t size);
+
+// Walks both haystacks in lockstep, skipping blocks of equal bytes, and only
+// tests the offsets whose value covers a differing byte. Offsets are reported
+// in order.
+int vs_search_diff(const uint8_t before[], const uint8_t after[], size_t size, const struct vs_diff *diff,
+                   void *ctx, vs_diff_callback callback);
+
 #ifdef __cplusplus
 }
 #endif
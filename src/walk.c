@@ -0,0 +1,470 @@
+#include "walk.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#	include <sys/syscall.h>
+#endif
+
+#define VS_WALK_MAX_THREADS 8
+#define VS_WALK_QUEUE_SIZE  256
+#define VS_WALK_BUFFER_SIZE (32 * 1024)
+
+#ifndef O_CLOEXEC
+#	define O_CLOEXEC 0
+#endif
+
+// An opened directory whose subdirectories are still to be read. They are
+// opened relative to it, so paths of any depth work and a subdirectory that
+// was replaced by a symbolic link isn't followed out of the tree.
+struct walk_parent {
+	int    fd;
+	size_t refs; // the reading thread and every queued subdirectory
+};
+
+struct walk_dir {
+	char  *path;     // for messages and globs
+	const char *name; // within path, opened relative to parent
+	struct walk_parent *parent; // NULL for roots
+	size_t root_len; // length of the root prefix, for globs with slashes
+	dev_t  dev;      // device of the root, for --one-file-system
+};
+
+struct vs_walker {
+	const struct vs_walk_options *options;
+	pthread_mutex_t lock;
+	pthread_cond_t  dirs_cond;
+	pthread_cond_t  files_cond;
+
+	// directories still to be read (used as a stack)
+	struct walk_dir *dirs;
+	size_t dir_count;
+	size_t dir_capacity;
+	size_t pending; // queued or being read
+
+	// files named as roots, opened by vs_walk_next() in the given order
+	char **root_files;
+	size_t root_file_count;
+	size_t root_file_next;
+
+	// ring of opened files for the caller
+	struct vs_walk_file files[VS_WALK_QUEUE_SIZE];
+	size_t file_head;
+	size_t file_count;
+	size_t active_threads;
+
+	bool failed;
+
+	pthread_t threads[VS_WALK_MAX_THREADS];
+	size_t thread_count;
+};
+
+static void walk_error(struct vs_walker *walker, const char *path) {
+	perror(path);
+	pthread_mutex_lock(&walker->lock);
+	walker->failed = true;
+	pthread_mutex_unlock(&walker->lock);
+}
+
+static char *join_path(const char *dir, const char *name) {
+	const size_t dir_len  = strlen(dir);
+	const size_t name_len = strlen(name);
+	const bool   slash    = dir_len > 0 && dir[dir_len - 1] != '/';
+	char *path = malloc(dir_len + slash + name_len + 1);
+	if (path) {
+		memcpy(path, dir, dir_len);
+		if (slash) {
+			path[dir_len] = '/';
+		}
+		memcpy(path + dir_len + slash, name, name_len + 1);
+	}
+	return path;
+}
+
+static bool glob_match(const char *const globs[], size_t count, const char *name, const char *relpath) {
+	for (size_t index = 0; index < count; ++ index) {
+		const char *glob = globs[index];
+		if (fnmatch(glob, strchr(glob, '/') ? relpath : name, 0) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void release_parent(struct vs_walker *walker, struct walk_parent *parent) {
+	if (!parent) {
+		return;
+	}
+	pthread_mutex_lock(&walker->lock);
+	const bool last = -- parent->refs == 0;
+	pthread_mutex_unlock(&walker->lock);
+	if (last) {
+		close(parent->fd);
+		free(parent);
+	}
+}
+
+static int push_dir(struct vs_walker *walker, char *path, const char *name, struct walk_parent *parent,
+                    size_t root_len, dev_t dev) {
+	pthread_mutex_lock(&walker->lock);
+	if (walker->dir_count == walker->dir_capacity) {
+		size_t capacity = walker->dir_capacity ? walker->dir_capacity * 2 : 64;
+		struct walk_dir *dirs = realloc(walker->dirs, sizeof(struct walk_dir) * capacity);
+		if (!dirs) {
+			pthread_mutex_unlock(&walker->lock);
+			errno = ENOMEM;
+			return -1;
+		}
+		walker->dirs = dirs;
+		walker->dir_capacity = capacity;
+	}
+	walker->dirs[walker->dir_count ++] = (struct walk_dir){ path, name, parent, root_len, dev };
+	if (parent) {
+		++ parent->refs;
+	}
+	++ walker->pending;
+	pthread_cond_signal(&walker->dirs_cond);
+	pthread_mutex_unlock(&walker->lock);
+	return 0;
+}
+
+static void push_file(struct vs_walker *walker, char *path, int fd) {
+	pthread_mutex_lock(&walker->lock);
+	while (walker->file_count == VS_WALK_QUEUE_SIZE) {
+		pthread_cond_wait(&walker->files_cond, &walker->lock);
+	}
+	walker->files[(walker->file_head + walker->file_count) % VS_WALK_QUEUE_SIZE] = (struct vs_walk_file){ path, fd };
+	++ walker->file_count;
+	pthread_cond_broadcast(&walker->files_cond);
+	pthread_mutex_unlock(&walker->lock);
+}
+
+static void visit_entry(struct vs_walker *walker, struct walk_parent *self, const struct walk_dir *dir,
+                        const char *name, unsigned char type) {
+	const int dirfd = self->fd;
+	const struct vs_walk_options *options = walker->options;
+	struct stat st;
+
+	if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+		return;
+	}
+
+	char *path = join_path(dir->path, name);
+	if (!path) {
+		walk_error(walker, dir->path);
+		return;
+	}
+	const char *relpath = path + dir->root_len;
+	if (*relpath == '/') {
+		++ relpath;
+	}
+
+	if (options->exclude_count > 0 && glob_match(options->exclude, options->exclude_count, name, relpath)) {
+		goto skip;
+	}
+
+	const bool need_stat = type == DT_UNKNOWN || (type == DT_REG && (options->min_size || options->max_size));
+	if (need_stat) {
+		if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+			walk_error(walker, path);
+			goto skip;
+		}
+		type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+	}
+
+	if (type == DT_DIR) {
+		if (push_dir(walker, path, path + strlen(path) - strlen(name), self, dir->root_len, dir->dev) != 0) {
+			walk_error(walker, path);
+			goto skip;
+		}
+		return;
+	}
+
+	// symbolic links, devices, fifos and sockets are not followed or read
+	if (type != DT_REG) {
+		goto skip;
+	}
+
+	if (options->include_count > 0 && !glob_match(options->include, options->include_count, name, relpath)) {
+		goto skip;
+	}
+
+	if (need_stat && ((uint64_t)st.st_size < options->min_size ||
+	                  (options->max_size && (uint64_t)st.st_size > options->max_size))) {
+		goto skip;
+	}
+
+	int fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1) {
+		walk_error(walker, path);
+		goto skip;
+	}
+
+	push_file(walker, path, fd);
+	return;
+
+skip:
+	free(path);
+}
+
+static void read_dir(struct vs_walker *walker, const struct walk_dir *dir, uint8_t *buffer) {
+	const int dirfd = dir->parent ?
+		openat(dir->parent->fd, dir->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) :
+		open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	release_parent(walker, dir->parent);
+	if (dirfd == -1) {
+		walk_error(walker, dir->path);
+		return;
+	}
+
+	if (walker->options->one_file_system) {
+		struct stat st;
+		if (fstat(dirfd, &st) != 0) {
+			walk_error(walker, dir->path);
+			close(dirfd);
+			return;
+		}
+		if (st.st_dev != dir->dev) {
+			close(dirfd);
+			return;
+		}
+	}
+
+	struct walk_parent *self = malloc(sizeof(struct walk_parent));
+	if (!self) {
+		walk_error(walker, dir->path);
+		close(dirfd);
+		return;
+	}
+	*self = (struct walk_parent){ dirfd, 1 };
+
+#ifdef __linux__
+	for (;;) {
+		long count = syscall(SYS_getdents64, dirfd, buffer, VS_WALK_BUFFER_SIZE);
+		if (count < 0) {
+			walk_error(walker, dir->path);
+			break;
+		}
+		if (count == 0) {
+			break;
+		}
+		for (long pos = 0; pos < count;) {
+			// struct linux_dirent64: u64 ino, s64 off, u16 reclen, u8 type, name
+			uint16_t reclen;
+			memcpy(&reclen, buffer + pos + 16, sizeof(reclen));
+			visit_entry(walker, self, dir, (const char*)buffer + pos + 19, buffer[pos + 18]);
+			pos += reclen;
+		}
+	}
+#else
+	(void)buffer;
+	int dupfd = dup(dirfd);
+	DIR *handle = dupfd == -1 ? NULL : fdopendir(dupfd);
+	if (!handle) {
+		walk_error(walker, dir->path);
+	}
+	else {
+		struct dirent *entry;
+		while ((entry = readdir(handle))) {
+			visit_entry(walker, self, dir, entry->d_name, DT_UNKNOWN);
+		}
+		closedir(handle);
+	}
+#endif
+
+	release_parent(walker, self);
+}
+
+static void *walk_thread(void *arg) {
+	struct vs_walker *walker = arg;
+	uint8_t *buffer = malloc(VS_WALK_BUFFER_SIZE);
+
+	if (!buffer) {
+		walk_error(walker, "allocating directory buffer");
+	}
+
+	pthread_mutex_lock(&walker->lock);
+	for (;;) {
+		while (walker->dir_count == 0 && walker->pending > 0) {
+			pthread_cond_wait(&walker->dirs_cond, &walker->lock);
+		}
+		if (walker->dir_count == 0) {
+			break;
+		}
+		struct walk_dir dir = walker->dirs[-- walker->dir_count];
+		pthread_mutex_unlock(&walker->lock);
+
+		if (buffer) {
+			read_dir(walker, &dir, buffer);
+		}
+		free(dir.path);
+
+		pthread_mutex_lock(&walker->lock);
+		if (-- walker->pending == 0) {
+			pthread_cond_broadcast(&walker->dirs_cond);
+		}
+	}
+
+	if (-- walker->active_threads == 0) {
+		pthread_cond_broadcast(&walker->files_cond);
+	}
+	pthread_mutex_unlock(&walker->lock);
+
+	free(buffer);
+	return NULL;
+}
+
+struct vs_walker *vs_walk_start(const char *const roots[], size_t root_count, const struct vs_walk_options *options) {
+	struct vs_walker *walker = calloc(1, sizeof(struct vs_walker));
+	if (!walker) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	walker->options = options;
+	pthread_mutex_init(&walker->lock, NULL);
+	pthread_cond_init(&walker->dirs_cond, NULL);
+	pthread_cond_init(&walker->files_cond, NULL);
+
+	walker->root_files = malloc(sizeof(char*) * (root_count ? root_count : 1));
+	if (!walker->root_files) {
+		vs_walk_finish(walker);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	for (size_t index = 0; index < root_count; ++ index) {
+		const char *root = roots[index];
+		struct stat st;
+
+		if (stat(root, &st) != 0) {
+			walker->failed = true;
+			perror(root);
+			continue;
+		}
+
+		char *path = strdup(root);
+		if (!path) {
+			walker->failed = true;
+			perror(root);
+			continue;
+		}
+
+		if (S_ISDIR(st.st_mode)) {
+			if (push_dir(walker, path, path, NULL, strlen(path), st.st_dev) != 0) {
+				walker->failed = true;
+				perror(root);
+				free(path);
+			}
+		}
+		else {
+			// explicitly named files are scanned regardless of the filters
+			walker->root_files[walker->root_file_count ++] = path;
+		}
+	}
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t thread_count = cpus > 0 ? (size_t)cpus : 1;
+	if (thread_count > VS_WALK_MAX_THREADS) {
+		thread_count = VS_WALK_MAX_THREADS;
+	}
+
+	pthread_mutex_lock(&walker->lock);
+	for (; walker->thread_count < thread_count; ++ walker->thread_count) {
+		if (pthread_create(walker->threads + walker->thread_count, NULL, walk_thread, walker) != 0) {
+			break;
+		}
+		++ walker->active_threads;
+	}
+	pthread_mutex_unlock(&walker->lock);
+
+	if (walker->thread_count == 0) {
+		vs_walk_finish(walker);
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	return walker;
+}
+
+int vs_walk_next(struct vs_walker *walker, struct vs_walk_file *file) {
+	// named files come first and are only opened when they are due, so any
+	// number of them can be given without running out of file descriptors
+	while (walker->root_file_next < walker->root_file_count) {
+		char *path = walker->root_files[walker->root_file_next ++];
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd == -1) {
+			walk_error(walker, path);
+			free(path);
+			continue;
+		}
+		*file = (struct vs_walk_file){ path, fd };
+		return 1;
+	}
+
+	int found = 0;
+
+	pthread_mutex_lock(&walker->lock);
+	while (walker->file_count == 0 && walker->active_threads > 0) {
+		pthread_cond_wait(&walker->files_cond, &walker->lock);
+	}
+	if (walker->file_count > 0) {
+		*file = walker->files[walker->file_head];
+		walker->file_head = (walker->file_head + 1) % VS_WALK_QUEUE_SIZE;
+		-- walker->file_count;
+		pthread_cond_broadcast(&walker->files_cond);
+		found = 1;
+	}
+	pthread_mutex_unlock(&walker->lock);
+
+	return found;
+}
+
+int vs_walk_finish(struct vs_walker *walker) {
+	for (; walker->root_file_next < walker->root_file_count; ++ walker->root_file_next) {
+		free(walker->root_files[walker->root_file_next]);
+	}
+
+	// drain the queue so no walker thread stays blocked
+	struct vs_walk_file file;
+	while (walker->thread_count > 0 && vs_walk_next(walker, &file)) {
+		close(file.fd);
+		free(file.path);
+	}
+
+	for (size_t index = 0; index < walker->thread_count; ++ index) {
+		pthread_join(walker->threads[index], NULL);
+	}
+
+	for (size_t index = 0; index < walker->file_count; ++ index) {
+		struct vs_walk_file *queued = walker->files + (walker->file_head + index) % VS_WALK_QUEUE_SIZE;
+		close(queued->fd);
+		free(queued->path);
+	}
+
+	for (size_t index = 0; index < walker->dir_count; ++ index) {
+		release_parent(walker, walker->dirs[index].parent);
+		free(walker->dirs[index].path);
+	}
+
+	const bool failed = walker->failed;
+
+	pthread_cond_destroy(&walker->files_cond);
+	pthread_cond_destroy(&walker->dirs_cond);
+	pthread_mutex_destroy(&walker->lock);
+	free(walker->dirs);
+	free(walker->root_files);
+	free(walker);
+
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,47 @@
+#ifndef VS_WALK_H
+#define VS_WALK_H
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Globs are matched against the file name (or against the path relative to
+// the walked root if they contain a slash). Excluded directories are not
+// descended into. A max_size of 0 means no limit.
+struct vs_walk_options {
+	const char *const *include;
+	size_t include_count;
+	const char *const *exclude;
+	size_t exclude_count;
+	uint64_t min_size;
+	uint64_t max_size;
+	bool one_file_system;
+};
+
+struct vs_walk_file {
+	char *path;
+	int   fd;
+};
+
+// Directories are read by a few threads in parallel (getdents64() and
+// openat() relative to the directory) which hand opened regular files to
+// the caller through a bounded queue. Errors are printed to stderr.
+struct vs_walker;
+
+struct vs_walker *vs_walk_start(const char *const roots[], size_t root_count, const struct vs_walk_options *options);
+// Returns 1 and fills file (path must be freed, fd closed by the caller)
+// or 0 once everything was walked.
+int  vs_walk_next(struct vs_walker *walker, struct vs_walk_file *file);
+// Returns -1 if any error occurred while walking.
+int  vs_walk_finish(struct vs_walker *walker);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif